@@ -0,0 +1,80 @@
+/******************************************************************************
+MIT License
+
+Copyright (c) 2016 Antti-Pekka Hynninen
+Copyright (c) 2016 Oak Ridge National Laboratory (UT-Batelle)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+#ifndef LIBRETTFASTDIV_H
+#define LIBRETTFASTDIV_H
+
+#include "Types.h"
+#include "uniapi.h"
+
+//
+// Division by a divisor that is only known when the plan is set up.
+// For 0 <= n < 2^31 and 1 <= d <= 2^31, n/d is computed with a multiply-high,
+// an add and a shift:
+// q = (umulhi(n, mul) + n) >> shift
+// where shift = ceil(log2(d)) and mul = floor(2^32*(2^shift - d)/d) + 1
+//
+#if LIBRETT_USES_SYCL
+  #define __fastdiv_inline__ inline
+#else
+  #define __fastdiv_inline__ __host__ __device__ __forceinline__
+#endif
+
+// Returns fast divisor for d >= 1, called on the host at plan setup time
+static inline FastDiv makeFastDiv(const int d) {
+  FastDiv fd;
+  unsigned int shift = 0;
+  while ((1ull << shift) < (unsigned long long int)d) shift++;
+  fd.mul = (unsigned int)((((1ull << 32)*((1ull << shift) - d))/d) + 1);
+  fd.shift = shift;
+  return fd;
+}
+
+// Sets fast divisors of c and d
+template <typename IndexT>
+void setFastDiv(TensorConvInOutT<IndexT>& conv) {
+  conv.c_in_div  = makeFastDiv(conv.c_in);
+  conv.d_in_div  = makeFastDiv(conv.d_in);
+  conv.c_out_div = makeFastDiv(conv.c_out);
+  conv.d_out_div = makeFastDiv(conv.d_out);
+}
+
+// Returns n/d for 0 <= n < 2^31
+__fastdiv_inline__ int fastDivide(const int n, const FastDiv& fd) {
+  const unsigned int un = (unsigned int)n;
+#if defined(__CUDA_ARCH__) || defined(__HIP_DEVICE_COMPILE__)
+  const unsigned int hi = __umulhi(un, fd.mul);
+#else
+  const unsigned int hi = (unsigned int)(((unsigned long long int)un*fd.mul) >> 32);
+#endif
+  return (int)((hi + un) >> fd.shift);
+}
+
+// Returns (n/c) % d for 0 <= n < 2^31
+__fastdiv_inline__ int fastDivMod(const int n, const FastDiv& cdiv, const FastDiv& ddiv, const int d) {
+  const int q = fastDivide(n, cdiv);
+  return q - fastDivide(q, ddiv)*d;
+}
+
+#endif // LIBRETTFASTDIV_H
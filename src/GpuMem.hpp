@@ -25,6 +25,10 @@ SOFTWARE.
 #ifndef LIBRETTMEM_HPP
 #define LIBRETTMEM_HPP
 
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 #include "GpuUtils.h"
 
 #ifdef LIBRETT_HAS_UMPIRE
@@ -44,7 +48,7 @@ template <class T>
 void allocate_device(T **pp, const size_t len, gpuStream_t gpuStream) {
 
 #ifdef LIBRETT_HAS_UMPIRE
-  *pp = librett_umpire_allocator.allocate(sizeof(T)*len);
+  *pp = (T *)librett_umpire_allocator.allocate(sizeof(T)*len);
 #else  // LIBRETT_HAS_UMPIRE
   #if LIBRETT_USES_SYCL
   *((void **)pp) = (void *)sycl::malloc_device( sizeof(T)*len, *gpuStream);
@@ -83,4 +87,387 @@ void deallocate_device(T **pp, gpuStream_t gpuStream) {
 }
 
 
+//----------------------------------------------------------------------------------------
+//
+// Arena for the small device buffers of plans (Mbar, Mmk, Msh, Group)
+//
+// Buffers of up to 64 KB are carved out of 1 MB blocks of each device and rounded up
+// to a power of two size class. A released buffer is reused once the work that was
+// queued on the releasing stream before the release is done, so that plans can be
+// created and destroyed without cudaMalloc/cudaFree, which synchronize the device.
+// Larger buffers use cudaMallocAsync/hipMallocAsync and the matching stream-ordered
+// free when the device supports memory pools. Otherwise they are deallocated by a
+// later call once the work queued before the release is done.
+// With Umpire, blocks and large buffers come from the Umpire allocator.
+//
+class DescriptorArena {
+public:
+
+  static DescriptorArena& instance() {
+    static DescriptorArena arena;
+    return arena;
+  }
+
+  void* allocate(const size_t size, gpuStream_t stream) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Device& dev = findDevice(stream);
+    reclaim(dev);
+    const int sizeClass = getSizeClass(size);
+    void* ptr;
+    if (sizeClass < 0) {
+      ptr = allocateLarge(dev, size, stream);
+    } else {
+      std::vector<char*>& freeSlots = dev.freeSlots[sizeClass];
+      if (!freeSlots.empty()) {
+        ptr = freeSlots.back();
+        freeSlots.pop_back();
+      } else {
+        const size_t slotSize = MIN_SLOT_SIZE << sizeClass;
+        if (dev.bumpLeft < slotSize) {
+          dev.bump = (char*)allocateRaw(BLOCK_SIZE, stream);
+          dev.blocks.push_back(dev.bump);
+          dev.bumpLeft = BLOCK_SIZE;
+        }
+        ptr = dev.bump;
+        dev.bump += slotSize;
+        dev.bumpLeft -= slotSize;
+      }
+    }
+    slots[ptr] = {&dev, sizeClass};
+    return ptr;
+  }
+
+  //
+  // Releases buffer ptr. If streamOrdered = true, the buffer is reused after the work
+  // that is currently queued on stream. Otherwise the buffer may also be in use on other
+  // streams and the device is synchronized, as cudaFree would do. With SYCL the caller
+  // must have waited for the queues in that case
+  //
+  void deallocate(void* ptr, gpuStream_t stream, const bool streamOrdered) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = slots.find(ptr);
+    if (it == slots.end()) return;
+    Device& dev = *it->second.dev;
+    const int sizeClass = it->second.sizeClass;
+    slots.erase(it);
+    reclaim(dev);
+    if (!streamOrdered) {
+      synchronize(dev);
+      if (sizeClass < 0) {
+        freeRaw(dev, ptr);
+      } else {
+        dev.freeSlots[sizeClass].push_back((char*)ptr);
+      }
+      return;
+    }
+#if !defined(LIBRETT_HAS_UMPIRE) && LIBRETT_USES_HIP && defined(HIP_VERSION) && HIP_VERSION >= 50300000
+    if (sizeClass < 0 && dev.memPools) {
+      hipCheck(hipFreeAsync(ptr, stream));
+      return;
+    }
+#elif !defined(LIBRETT_HAS_UMPIRE) && LIBRETT_USES_CUDA && CUDART_VERSION >= 11020
+    if (sizeClass < 0 && dev.memPools) {
+      cudaCheck(cudaFreeAsync(ptr, stream));
+      return;
+    }
+#endif
+    addPending(dev, (char*)ptr, sizeClass, stream);
+  }
+
+  //
+  // Deallocates buffer ptr from allocate_device() after the work that is currently
+  // queued on stream. stream must be on the current device
+  //
+  void deallocateOrdered(void* ptr, gpuStream_t stream) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Device& dev = findDevice(stream);
+    reclaim(dev);
+    addPending(dev, (char*)ptr, -1, stream);
+  }
+
+  //
+  // Deallocates the blocks if no buffer is in use
+  //
+  void release() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!slots.empty()) return;
+#if LIBRETT_USES_HIP
+    int curDevice;
+    hipCheck(hipGetDevice(&curDevice));
+#elif LIBRETT_USES_CUDA
+    int curDevice;
+    cudaCheck(cudaGetDevice(&curDevice));
+#endif
+    for (auto& dev : devices) {
+#if LIBRETT_USES_SYCL
+      for (auto& pending : dev->pending) {
+        pending.event.wait();
+        if (pending.sizeClass < 0) freeRaw(*dev, pending.ptr);
+      }
+#elif LIBRETT_USES_HIP
+      hipCheck(hipSetDevice(dev->deviceID));
+      for (auto& pending : dev->pending) {
+        hipCheck(hipEventSynchronize(pending.event));
+        hipCheck(hipEventDestroy(pending.event));
+        if (pending.sizeClass < 0) freeRaw(*dev, pending.ptr);
+      }
+      for (auto event : dev->spareEvents) hipCheck(hipEventDestroy(event));
+#elif LIBRETT_USES_CUDA
+      cudaCheck(cudaSetDevice(dev->deviceID));
+      for (auto& pending : dev->pending) {
+        cudaCheck(cudaEventSynchronize(pending.event));
+        cudaCheck(cudaEventDestroy(pending.event));
+        if (pending.sizeClass < 0) freeRaw(*dev, pending.ptr);
+      }
+      for (auto event : dev->spareEvents) cudaCheck(cudaEventDestroy(event));
+#endif
+      for (auto block : dev->blocks) freeRaw(*dev, block);
+    }
+#if LIBRETT_USES_HIP
+    hipCheck(hipSetDevice(curDevice));
+#elif LIBRETT_USES_CUDA
+    cudaCheck(cudaSetDevice(curDevice));
+#endif
+    devices.clear();
+  }
+
+private:
+
+  static const size_t BLOCK_SIZE = 1 << 20;
+  static const size_t MIN_SLOT_SIZE = 256;
+  // Size classes 256 B, 512 B, ..., 64 KB
+  static const int NUM_SIZE_CLASS = 9;
+
+  struct Pending {
+    char* ptr;
+    // -1 for buffers that are deallocated, not reused
+    int sizeClass;
+    gpuEvent_t event;
+  };
+
+  struct Device {
+#if LIBRETT_USES_SYCL
+    sycl::context context;
+    sycl::device device;
+    Device(const sycl::context& context, const sycl::device& device) : context(context), device(device) {}
+#else
+    int deviceID;
+    // Device supports cudaMallocAsync/hipMallocAsync
+    bool memPools;
+#endif
+    std::vector<char*> blocks;
+    char* bump = nullptr;
+    size_t bumpLeft = 0;
+    std::vector<char*> freeSlots[NUM_SIZE_CLASS];
+    std::vector<Pending> pending;
+    std::vector<gpuEvent_t> spareEvents;
+  };
+
+  struct Slot {
+    Device* dev;
+    // -1 for buffers that are larger than the largest size class
+    int sizeClass;
+  };
+
+  std::mutex mutex;
+  std::vector<std::unique_ptr<Device>> devices;
+  std::unordered_map<void*, Slot> slots;
+
+  static int getSizeClass(const size_t size) {
+    int sizeClass = 0;
+    while ((MIN_SLOT_SIZE << sizeClass) < size) sizeClass++;
+    return (sizeClass < NUM_SIZE_CLASS) ? sizeClass : -1;
+  }
+
+  // Returns the arena of the device of stream, the current device with CUDA and HIP
+  Device& findDevice(gpuStream_t stream) {
+#if LIBRETT_USES_SYCL
+    for (auto& dev : devices) {
+      if (dev->context == stream->get_context() && dev->device == stream->get_device()) return *dev;
+    }
+    devices.emplace_back(new Device(stream->get_context(), stream->get_device()));
+#else
+    int deviceID;
+  #if LIBRETT_USES_HIP
+    hipCheck(hipGetDevice(&deviceID));
+  #elif LIBRETT_USES_CUDA
+    cudaCheck(cudaGetDevice(&deviceID));
+  #endif
+    for (auto& dev : devices) {
+      if (dev->deviceID == deviceID) return *dev;
+    }
+    devices.emplace_back(new Device());
+    devices.back()->deviceID = deviceID;
+    int memPools = 0;
+  #if !defined(LIBRETT_HAS_UMPIRE) && LIBRETT_USES_HIP && defined(HIP_VERSION) && HIP_VERSION >= 50300000
+    hipCheck(hipDeviceGetAttribute(&memPools, hipDeviceAttributeMemoryPoolsSupported, deviceID));
+  #elif !defined(LIBRETT_HAS_UMPIRE) && LIBRETT_USES_CUDA && CUDART_VERSION >= 11020
+    cudaCheck(cudaDeviceGetAttribute(&memPools, cudaDevAttrMemoryPoolsSupported, deviceID));
+  #endif
+    devices.back()->memPools = (memPools != 0);
+#endif
+    return *devices.back();
+  }
+
+  // Queues release of ptr after the work that is currently queued on stream
+  void addPending(Device& dev, char* ptr, const int sizeClass, gpuStream_t stream) {
+    Pending pending;
+    pending.ptr = ptr;
+    pending.sizeClass = sizeClass;
+#if LIBRETT_USES_SYCL
+    pending.event = stream->ext_oneapi_submit_barrier();
+#else
+    // Event must be on the device of the stream
+    int curDevice;
+  #if LIBRETT_USES_HIP
+    hipCheck(hipGetDevice(&curDevice));
+    if (curDevice != dev.deviceID) hipCheck(hipSetDevice(dev.deviceID));
+    if (dev.spareEvents.empty()) {
+      hipEvent_t event;
+      hipCheck(hipEventCreateWithFlags(&event, hipEventDisableTiming));
+      dev.spareEvents.push_back(event);
+    }
+    pending.event = dev.spareEvents.back();
+    dev.spareEvents.pop_back();
+    hipCheck(hipEventRecord(pending.event, stream));
+    if (curDevice != dev.deviceID) hipCheck(hipSetDevice(curDevice));
+  #elif LIBRETT_USES_CUDA
+    cudaCheck(cudaGetDevice(&curDevice));
+    if (curDevice != dev.deviceID) cudaCheck(cudaSetDevice(dev.deviceID));
+    if (dev.spareEvents.empty()) {
+      cudaEvent_t event;
+      cudaCheck(cudaEventCreateWithFlags(&event, cudaEventDisableTiming));
+      dev.spareEvents.push_back(event);
+    }
+    pending.event = dev.spareEvents.back();
+    dev.spareEvents.pop_back();
+    cudaCheck(cudaEventRecord(pending.event, stream));
+    if (curDevice != dev.deviceID) cudaCheck(cudaSetDevice(curDevice));
+  #endif
+#endif
+    dev.pending.push_back(pending);
+  }
+
+  // Finishes the releases that have passed on the device
+  void reclaim(Device& dev) {
+    size_t j = 0;
+    for (size_t i=0;i < dev.pending.size();i++) {
+      Pending& pending = dev.pending[i];
+#if LIBRETT_USES_SYCL
+      const bool done = (pending.event.get_info<sycl::info::event::command_execution_status>() ==
+        sycl::info::event_command_status::complete);
+#elif LIBRETT_USES_HIP
+      const bool done = (hipEventQuery(pending.event) == hipSuccess);
+#elif LIBRETT_USES_CUDA
+      const bool done = (cudaEventQuery(pending.event) == cudaSuccess);
+#endif
+      if (done) {
+        if (pending.sizeClass < 0) {
+          freeRaw(dev, pending.ptr);
+        } else {
+          dev.freeSlots[pending.sizeClass].push_back(pending.ptr);
+        }
+#if !LIBRETT_USES_SYCL
+        dev.spareEvents.push_back(pending.event);
+#endif
+      } else {
+        dev.pending[j++] = pending;
+      }
+    }
+    dev.pending.resize(j);
+  }
+
+  static void synchronize(Device& dev) {
+#if LIBRETT_USES_HIP
+    int curDevice;
+    hipCheck(hipGetDevice(&curDevice));
+    if (curDevice != dev.deviceID) hipCheck(hipSetDevice(dev.deviceID));
+    hipCheck(hipDeviceSynchronize());
+    if (curDevice != dev.deviceID) hipCheck(hipSetDevice(curDevice));
+#elif LIBRETT_USES_CUDA
+    int curDevice;
+    cudaCheck(cudaGetDevice(&curDevice));
+    if (curDevice != dev.deviceID) cudaCheck(cudaSetDevice(dev.deviceID));
+    cudaCheck(cudaDeviceSynchronize());
+    if (curDevice != dev.deviceID) cudaCheck(cudaSetDevice(curDevice));
+#endif
+  }
+
+  static void* allocateRaw(const size_t size, gpuStream_t stream) {
+    void* ptr;
+    allocate_device<char>((char**)&ptr, size, stream);
+    return ptr;
+  }
+
+  // Deallocates buffer from allocate_device()
+  static void freeRaw(Device& dev, void* ptr) {
+#ifdef LIBRETT_HAS_UMPIRE
+    librett_umpire_allocator.deallocate(ptr);
+#elif LIBRETT_USES_SYCL
+    sycl::free(ptr, dev.context);
+#elif LIBRETT_USES_HIP
+    hipCheck(hipFree(ptr));
+#elif LIBRETT_USES_CUDA
+    cudaCheck(cudaFree(ptr));
+#endif
+  }
+
+  static void* allocateLarge(Device& dev, const size_t size, gpuStream_t stream) {
+#if !defined(LIBRETT_HAS_UMPIRE) && LIBRETT_USES_HIP && defined(HIP_VERSION) && HIP_VERSION >= 50300000
+    if (dev.memPools) {
+      void* ptr;
+      hipCheck(hipMallocAsync(&ptr, size, stream));
+      return ptr;
+    }
+#elif !defined(LIBRETT_HAS_UMPIRE) && LIBRETT_USES_CUDA && CUDART_VERSION >= 11020
+    if (dev.memPools) {
+      void* ptr;
+      cudaCheck(cudaMallocAsync(&ptr, size, stream));
+      return ptr;
+    }
+#endif
+    return allocateRaw(size, stream);
+  }
+
+};
+
+//----------------------------------------------------------------------------------------
+//
+// Allocate plan descriptor buffer from DescriptorArena
+// pp = memory pointer
+// len = length of the array
+//
+template <class T>
+void allocate_descriptor(T **pp, const size_t len, gpuStream_t gpuStream) {
+  *pp = (T *)DescriptorArena::instance().allocate(sizeof(T)*len, gpuStream);
+}
+
+//----------------------------------------------------------------------------------------
+//
+// Deallocate plan descriptor buffer after the work queued on gpuStream,
+// see DescriptorArena::deallocate()
+// pp = memory pointer
+//
+template <class T>
+void deallocate_descriptor(T **pp, gpuStream_t gpuStream, const bool streamOrdered=true) {
+  if (*pp != NULL) {
+    DescriptorArena::instance().deallocate((void *)(*pp), gpuStream, streamOrdered);
+    *pp = NULL;
+  }
+}
+
+//----------------------------------------------------------------------------------------
+//
+// Deallocate gpu memory from allocate_device() after the work queued on gpuStream,
+// gpuStream must be on the current device
+// pp = memory pointer
+//
+template <class T>
+void deallocate_device_ordered(T **pp, gpuStream_t gpuStream) {
+  if (*pp != NULL) {
+    DescriptorArena::instance().deallocateOrdered((void *)(*pp), gpuStream);
+    *pp = NULL;
+  }
+}
+
 #endif //LIBRETTMEM_HPP
@@ -27,9 +27,15 @@ SOFTWARE.
 #include <algorithm>
 #include <random>
 #include <cstring> // memcpy
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
 #include "GpuModel.h"
+#include "FastDiv.h"
 #include "GpuModelKernel.h"
 #include "GpuUtils.h"
+#include "PlanDatabase.h" // librettDeviceName
 
 // #define CALC_L1_CACHELINES
 
@@ -215,8 +221,8 @@ void computePos(const int vol0, const int vol1,
     int posOutVal = 0;
     int j = i + vol0;
     for (int k=0;k < numConv;k++) {
-      posInVal  += ((j / conv[k].c_in) % conv[k].d_in) * conv[k].ct_in;
-      posOutVal += ((j / conv[k].c_out) % conv[k].d_out) * conv[k].ct_out;
+      posInVal  += fastDivMod(j, conv[k].c_in_div, conv[k].d_in_div, conv[k].d_in) * conv[k].ct_in;
+      posOutVal += fastDivMod(j, conv[k].c_out_div, conv[k].d_out_div, conv[k].d_out) * conv[k].ct_out;
     }
     posIn[i] = posInVal;
     posOut[i] = posOutVal;
@@ -558,14 +564,19 @@ void countPackedShTransactionsRef(const int warpSize, const int bankWidth, const
 
 //
 // Count number of global memory transactions for Tiled method
+// With vector accesses the tiles are TILEDIM*vecWidth wide, each row of
+// a tile is still read (and for the copy, written) with one request
 //
 void countTiledGlTransactions(const bool isCopy,
   const int numPosMbarSample, const int volMm, const int volMk, const int volMbar,
-  const int cIn, const int cOut, const int accWidth, const int cacheWidth,
+  const int cIn, const int cOut, const int accWidth, const int cacheWidth, const int vecWidth,
   std::vector<TensorConvInOut>& hostMbar, const int sizeMbar,
   int& num_iter, float& mlp, int& gld_tran, int& gst_tran, int& gld_req, int& gst_req, int& cl_full, int& cl_part) {
 
-  int ntile = ((volMm - 1)/TILEDIM + 1)*((volMk - 1)/TILEDIM + 1);
+  // Tile width
+  const int tileX = TILEDIM*vecWidth;
+
+  int ntile = ((volMm - 1)/tileX + 1)*((volMk - 1)/TILEDIM + 1);
   num_iter = volMbar*ntile;
 
   gld_tran = 0;
@@ -580,16 +591,16 @@ void countTiledGlTransactions(const bool isCopy,
   std::uniform_int_distribution<int> distribution(0, volMbar - 1);
 
   // Number of elements inside the horizontally clipped tiles
-  int h = volMm % TILEDIM;
+  int h = volMm % tileX;
   // Number of elements inside the vertically clipped tiles
   int v = volMk % TILEDIM;
 
   // Number of full tiles
-  int ntile_full = (volMm/TILEDIM)*(volMk/TILEDIM);
+  int ntile_full = (volMm/tileX)*(volMk/TILEDIM);
   // Number of tiles that are clipped in horizontal direction
   int ntile_horz = (h > 0)*(volMk/TILEDIM);
   // Number of tiles that are clipped in vertical direction
-  int ntile_vert = (v > 0)*(volMm/TILEDIM);
+  int ntile_vert = (v > 0)*(volMm/tileX);
   // Number of corner tiles (0 or 1)
   int ntile_corn = (h > 0)*(v > 0);
 
@@ -600,7 +611,7 @@ void countTiledGlTransactions(const bool isCopy,
     mlp = (float)mlp_tot/(float)ntile;
   } else {
     // Total number of memory level parallelism
-    int mlp_tot = (TILEDIM/TILEROWS)*(2*ntile_full + ntile_horz + ntile_vert) +
+    int mlp_tot = (TILEDIM/TILEROWS)*(ntile_full + ntile_horz) + (tileX/TILEROWS)*(ntile_full + ntile_vert) +
     ((v - 1)/TILEROWS + 1)*(ntile_vert + ntile_corn) + ((h - 1)/TILEROWS + 1)*(ntile_horz + ntile_corn);
     // Average memory level parallelism per tile
     mlp = (float)mlp_tot/(float)(2*ntile);
@@ -624,15 +635,30 @@ void countTiledGlTransactions(const bool isCopy,
       int gst_tran_tmp = 0;
       int cl_full_tmp = 0;
       int cl_part_tmp = 0;
-      for (int i=0;i < TILEDIM;i++) {
-        int posIn  = posMbarIn + i*cIn;
-        int posOut = posMbarOut + i*cOut;
-        gld_tran_tmp += glTransactions(posIn, TILEDIM, accWidth);
-        gst_tran_tmp += glTransactions(posOut, TILEDIM, accWidth);
-        int cl_full_tmp2, cl_part_tmp2;
-        countCacheLines(posOut, TILEDIM, cacheWidth, cl_full_tmp2, cl_part_tmp2);
-        cl_full_tmp += cl_full_tmp2;
-        cl_part_tmp += cl_part_tmp2;
+      if (isCopy) {
+        for (int i=0;i < TILEDIM;i++) {
+          int posIn  = posMbarIn + i*cIn;
+          int posOut = posMbarOut + i*cOut;
+          gld_tran_tmp += glTransactions(posIn, tileX, accWidth);
+          gst_tran_tmp += glTransactions(posOut, tileX, accWidth);
+          int cl_full_tmp2, cl_part_tmp2;
+          countCacheLines(posOut, tileX, cacheWidth, cl_full_tmp2, cl_part_tmp2);
+          cl_full_tmp += cl_full_tmp2;
+          cl_part_tmp += cl_part_tmp2;
+        }
+      } else {
+        for (int i=0;i < TILEDIM;i++) {
+          int posIn  = posMbarIn + i*cIn;
+          gld_tran_tmp += glTransactions(posIn, tileX, accWidth);
+        }
+        for (int i=0;i < tileX;i++) {
+          int posOut = posMbarOut + i*cOut;
+          gst_tran_tmp += glTransactions(posOut, TILEDIM, accWidth);
+          int cl_full_tmp2, cl_part_tmp2;
+          countCacheLines(posOut, TILEDIM, cacheWidth, cl_full_tmp2, cl_part_tmp2);
+          cl_full_tmp += cl_full_tmp2;
+          cl_part_tmp += cl_part_tmp2;
+        }
       }
       gld_tran += gld_tran_tmp*ntile_full;
       gst_tran += gst_tran_tmp*ntile_full;
@@ -685,19 +711,19 @@ void countTiledGlTransactions(const bool isCopy,
         for (int i=0;i < v;i++) {
           int posIn  = posMbarIn + i*cIn;
           int posOut = posMbarOut + i*cOut;
-          gld_tran_tmp += glTransactions(posIn, TILEDIM, accWidth);
-          gst_tran_tmp += glTransactions(posOut, TILEDIM, accWidth);
+          gld_tran_tmp += glTransactions(posIn, tileX, accWidth);
+          gst_tran_tmp += glTransactions(posOut, tileX, accWidth);
           int cl_full_tmp2, cl_part_tmp2;
-          countCacheLines(posOut, TILEDIM, cacheWidth, cl_full_tmp2, cl_part_tmp2);
+          countCacheLines(posOut, tileX, cacheWidth, cl_full_tmp2, cl_part_tmp2);
           cl_full_tmp += cl_full_tmp2;
           cl_part_tmp += cl_part_tmp2;
         }
       } else {
         for (int i=0;i < v;i++) {
           int posIn  = posMbarIn + i*cIn;
-          gld_tran_tmp += glTransactions(posIn, TILEDIM, accWidth);
+          gld_tran_tmp += glTransactions(posIn, tileX, accWidth);
         }
-        for (int i=0;i < TILEDIM;i++) {
+        for (int i=0;i < tileX;i++) {
           int posOut = posMbarOut + i*cOut;
           gst_tran_tmp += glTransactions(posOut, v, accWidth);
           int cl_full_tmp2, cl_part_tmp2;
@@ -755,47 +781,97 @@ void countTiledGlTransactions(const bool isCopy,
     gst_req = gld_req;
   } else {
     gld_req = num_iposMbar*( TILEDIM*ntile_full + TILEDIM*ntile_horz + v*ntile_vert + v*ntile_corn );
-    gst_req = num_iposMbar*( TILEDIM*ntile_full + TILEDIM*ntile_vert + h*ntile_horz + h*ntile_corn );
+    gst_req = num_iposMbar*( tileX*ntile_full + tileX*ntile_vert + h*ntile_horz + h*ntile_corn );
   }
 }
 
-struct GpuModelProp {
-  double base_dep_delay;
-  double base_mem_latency;
-  double sh_mem_latency;
-  double iter_cycles;
-  double fac;
-
-  GpuModelProp(int major) {
-    #if LIBRETT_USES_CUDA
-    if (major <= 3) {
-      // Kepler
-      base_dep_delay = 14.0;
-      base_mem_latency = 358.0;
-      sh_mem_latency = 11.0;
-      iter_cycles = 50.0;
-      fac = 2.0;
-    } else if (major <= 5) {
-      // Maxwell
-      base_dep_delay = 2.5;
-      base_mem_latency = 385.0;
-      sh_mem_latency = 1.0;
-      iter_cycles = 220.0;
-      fac = 2.0;
-    } else {
-      // Pascal and above
-      base_dep_delay = 2.8;
-      base_mem_latency = 485.0;
-      sh_mem_latency = 1.0;
-      iter_cycles = 260.0;
-      fac = 2.0;
+// Calibrated model parameters, key is librettDeviceName()
+static std::unordered_map<std::string, GpuModelProp> gpuModelPropTable;
+static std::mutex gpuModelPropMutex;
+
+GpuModelProp::GpuModelProp() {
+  base_dep_delay = 0.0;
+  base_mem_latency = 0.0;
+  sh_mem_latency = 0.0;
+  iter_cycles = 0.0;
+  fac = 0.0;
+  hitrate = 0.0;
+}
+
+GpuModelProp::GpuModelProp(const gpuDeviceProp_t &prop) {
+  setDefault(prop);
+  std::lock_guard<std::mutex> lock(gpuModelPropMutex);
+  if (gpuModelPropTable.empty()) return;
+  auto it = gpuModelPropTable.find(librettDeviceName(prop));
+  if (it != gpuModelPropTable.end()) *this = it->second;
+}
+
+void GpuModelProp::setDefault(const gpuDeviceProp_t &prop) {
+  hitrate = 0.2;
+  #if LIBRETT_USES_CUDA
+  int major = gpuMajor;
+  if (major <= 3) {
+    // Kepler
+    base_dep_delay = 14.0;
+    base_mem_latency = 358.0;
+    sh_mem_latency = 11.0;
+    iter_cycles = 50.0;
+    fac = 2.0;
+  } else if (major <= 5) {
+    // Maxwell
+    base_dep_delay = 2.5;
+    base_mem_latency = 385.0;
+    sh_mem_latency = 1.0;
+    iter_cycles = 220.0;
+    fac = 2.0;
+  } else {
+    // Pascal and above
+    base_dep_delay = 2.8;
+    base_mem_latency = 485.0;
+    sh_mem_latency = 1.0;
+    iter_cycles = 260.0;
+    fac = 2.0;
+  }
+  #elif LIBRETT_USES_HIP
+  if (strncmp(prop.gcnArchName, "gfx9", 4) == 0) {
+    // CDNA (and GCN): a 64-wide wavefront issues memory instructions in
+    // four 16-lane passes and LDS serves 32 banks per clock
+    base_dep_delay = 4.0;
+    base_mem_latency = 650.0;
+    sh_mem_latency = 2.0;
+    iter_cycles = 300.0;
+    fac = 2.0;
+    // MI300 (gfx94x) sits behind a 256 MB Infinity Cache
+    if (strncmp(prop.gcnArchName, "gfx94", 5) == 0) {
+      base_mem_latency = 750.0;
+      hitrate = 0.35;
     }
-    #endif
+  } else {
+    // RDNA: wave32, Infinity Cache from RDNA2 on
+    base_dep_delay = 2.8;
+    base_mem_latency = 550.0;
+    sh_mem_latency = 1.0;
+    iter_cycles = 260.0;
+    fac = 2.0;
+    hitrate = 0.3;
   }
+  #elif LIBRETT_USES_SYCL
+  // Intel Xe: the model counts 32-wide warps, with SIMD16 sub-groups
+  // each warp is sent as two messages
+  #if LIBRETT_SUBGROUP_SIZE16
+  base_dep_delay = 4.0;
+  #else
+  base_dep_delay = 2.8;
+  #endif
+  base_mem_latency = 600.0;
+  sh_mem_latency = 2.0;
+  iter_cycles = 260.0;
+  fac = 2.0;
+  hitrate = 0.3;
+  #endif
+}
 
-};
-
-void prepmodel5(const gpuDeviceProp_t &prop, GpuModelProp &gpuModelProp,
+void prepmodel5(const gpuDeviceProp_t &prop, const GpuModelProp &gpuModelProp,
   int nthread, int numActiveBlock, float mlp,
   int gld_req, int gst_req, int gld_tran, int gst_tran,
   int sld_req, int sst_req, int sld_tran, int sst_tran,
@@ -807,17 +883,14 @@ void prepmodel5(const gpuDeviceProp_t &prop, GpuModelProp &gpuModelProp,
   double freq = (double)gpuClockRate/1.0e3;
   int warpSize = gpuWarpSize;
 
-#if LIBRETT_USES_SYCL
-  // Memory bandwidth in GB/s
-  //double mem_BW = (double)(prop.memoryClockRate*2*(prop.memoryBusWidth/8))/1.0e6;
-  //if (prop.ECCEnabled) mem_BW *= (1.0 - 0.125);
-  double mem_BW = 0.0;
-#else // CUDA or SYCL
   // Memory bandwidth in GB/s
+#if LIBRETT_USES_SYCL
+  double mem_BW = prop.get_mem_bandwidth();
+#else // CUDA or HIP
   double mem_BW = (double)(prop.memoryClockRate*2*(prop.memoryBusWidth/8))/1.0e6;
+  #if LIBRETT_USES_CUDA
+  // ECC costs bandwidth on GDDR, on HBM (all CDNA parts) it comes for free
   if (prop.ECCEnabled) mem_BW *= (1.0 - 0.125);
-  #if LIBRETT_USES_HIP
-    return;  // Dmitry Lyakh
   #endif
 #endif
 
@@ -832,7 +905,7 @@ void prepmodel5(const gpuDeviceProp_t &prop, GpuModelProp &gpuModelProp,
 
   double mem_l = gpuModelProp.base_mem_latency + (num_trans_per_request - 1.0) * gpuModelProp.base_dep_delay;
 
-  const double hitrate = 0.2;
+  const double hitrate = gpuModelProp.hitrate;
 
   // Avg. number of memory cycles per warp per iteration
   mem_cycles = gpuModelProp.fac * mem_l * mlp;
@@ -852,15 +925,13 @@ void prepmodel5(const gpuDeviceProp_t &prop, GpuModelProp &gpuModelProp,
 }
 
 double cyclesPacked(const bool isSplit, const size_t sizeofType, const gpuDeviceProp_t &prop,
-  int nthread, int numActiveBlock, float mlp,
+  const GpuModelProp &gpuModelProp, int nthread, int numActiveBlock, float mlp,
   int gld_req, int gst_req, int gld_tran, int gst_tran,
   int sld_req, int sst_req, int sld_tran, int sst_tran, int num_iter, int cl_full, int cl_part) {
 
   int warpSize = gpuWarpSize;           // AMD change
   int warps_per_block = nthread/warpSize; // AMD change
 
-  GpuModelProp gpuModelProp(gpuMajor);
-
   double delta_ll, mem_cycles, sh_mem_cycles, MWP;
   prepmodel5(prop, gpuModelProp, nthread, numActiveBlock, mlp,
     gld_req, gst_req, gld_tran, gst_tran,
@@ -874,15 +945,13 @@ double cyclesPacked(const bool isSplit, const size_t sizeofType, const gpuDevice
 }
 
 double cyclesTiled(const bool isCopy, const size_t sizeofType, const gpuDeviceProp_t &prop,
-  int nthread, int numActiveBlock, float mlp,
+  const GpuModelProp &gpuModelProp, int nthread, int numActiveBlock, float mlp,
   int gld_req, int gst_req, int gld_tran, int gst_tran,
   int sld_req, int sst_req, int sld_tran, int sst_tran, int num_iter, int cl_full, int cl_part) {
 
   int warpSize = gpuWarpSize;           // AMD change
   int warps_per_block = nthread/warpSize; // AMD change
 
-  GpuModelProp gpuModelProp(gpuMajor);
-
   double delta_ll, mem_cycles, sh_mem_cycles, MWP;
   prepmodel5(prop, gpuModelProp, nthread, numActiveBlock, mlp,
     gld_req, gst_req, gld_tran, gst_tran,
@@ -899,6 +968,82 @@ double cyclesTiled(const bool isCopy, const size_t sizeofType, const gpuDevicePr
   return cycles;
 }
 
+void librettSetGpuModelProp(const std::string& device, const GpuModelProp& modelProp) {
+  std::lock_guard<std::mutex> lock(gpuModelPropMutex);
+  gpuModelPropTable.insert_or_assign(device, modelProp);
+}
+
+std::vector< std::pair<std::string, GpuModelProp> > librettGetGpuModelProps() {
+  std::lock_guard<std::mutex> lock(gpuModelPropMutex);
+  return std::vector< std::pair<std::string, GpuModelProp> >(gpuModelPropTable.begin(), gpuModelPropTable.end());
+}
+
+//
+// Fits the model by coordinate descent in log-space:
+// each parameter is scaled up and down by "step" and changes that reduce
+// the squared log-error between predicted and measured cycles are kept.
+// The step is reduced when no parameter improves the fit
+//
+bool fitGpuModelProp(const gpuDeviceProp_t &prop, std::list<librettPlan_t>& plans,
+  std::vector<double>& times, GpuModelProp& modelProp) {
+
+  // Conversion factor from wallclock time to total number of cycles = (GPU clock in Hz) x #SM
+  double freq_SM = (double)(gpuClockRate*1.0e6)*(double)gpuMultiProcessorCount;
+
+  std::vector<const librettPlan_t*> fitPlans;
+  std::vector<double> logCycles;
+  int i = 0;
+  for (auto it=plans.begin();it != plans.end() && i < (int)times.size();it++,i++) {
+    int method = it->tensorSplit.method;
+    if (times[i] > 0.0 && (method == Packed || method == PackedSplit ||
+      method == Tiled || method == TiledCopy)) {
+      fitPlans.push_back(&(*it));
+      logCycles.push_back(std::log(times[i]*freq_SM));
+    }
+  }
+
+  const int numParam = 6;
+  double GpuModelProp::* param[numParam] = {&GpuModelProp::base_dep_delay, &GpuModelProp::base_mem_latency,
+    &GpuModelProp::sh_mem_latency, &GpuModelProp::iter_cycles, &GpuModelProp::fac, &GpuModelProp::hitrate};
+  if ((int)fitPlans.size() < 2*numParam) return false;
+
+  auto error = [&](const GpuModelProp& p) {
+    double err = 0.0;
+    for (size_t j=0;j < fitPlans.size();j++) {
+      double cycles = fitPlans[j]->modelCycles(prop, p);
+      if (!(cycles > 0.0) || !std::isfinite(cycles)) return std::numeric_limits<double>::infinity();
+      double d = std::log(cycles) - logCycles[j];
+      err += d*d;
+    }
+    return err;
+  };
+
+  double bestErr = error(modelProp);
+  if (!std::isfinite(bestErr)) return false;
+
+  double step = 2.0;
+  for (int iter=0;iter < 200 && step > 1.01;iter++) {
+    bool improved = false;
+    for (int k=0;k < numParam;k++) {
+      for (double f : {step, 1.0/step}) {
+        GpuModelProp trial = modelProp;
+        trial.*param[k] *= f;
+        // Hit rate is a fraction
+        if (trial.hitrate > 0.95) trial.hitrate = 0.95;
+        double err = error(trial);
+        if (err < bestErr) {
+          bestErr = err;
+          modelProp = trial;
+          improved = true;
+        }
+      }
+    }
+    if (!improved) step = std::sqrt(step);
+  }
+
+  return true;
+}
+
 bool check_results(const int tran, const int cl_full, const int cl_part, const int* results) {
   if (tran != results[0] || cl_full != results[1] || cl_part != results[2] ) return false;
   return true;
@@ -25,7 +25,9 @@ SOFTWARE.
 #ifndef LIBRETTGPUMODEL_H
 #define LIBRETTGPUMODEL_H
 
+#include <string>
 #include <vector>
+#include <list>
 #include "Types.h"
 #include "plan.h"
 #include "int_vector.h"
@@ -70,17 +72,48 @@ void countPackedShTransactionsRef(const int warpSize, const int bankWidth, const
 
 void countTiledGlTransactions(const bool leadVolSame,
   const int numPosMbarSample, const int volMm, const int volMk, const int volMbar,
-  const int cIn, const int cOut, const int accWidth, const int cacheWidth,
+  const int cIn, const int cOut, const int accWidth, const int cacheWidth, const int vecWidth,
   std::vector<TensorConvInOut>& hostMbar, const int sizeMbar,
   int& num_iter, float& mlp, int& gld_tran, int& gst_tran, int& gld_req, int& gst_req, int& cl_full, int& cl_part);
 
+//
+// Parameters of the performance model
+//
+struct GpuModelProp {
+  double base_dep_delay;
+  double base_mem_latency;
+  double sh_mem_latency;
+  double iter_cycles;
+  double fac;
+  // Fraction of global memory requests served by the last level cache
+  double hitrate;
+
+  GpuModelProp();
+  // Calibrated parameters of the device if there are any, architecture defaults otherwise
+  GpuModelProp(const gpuDeviceProp_t &prop);
+  // Sets architecture defaults
+  void setDefault(const gpuDeviceProp_t &prop);
+};
+
+// Stores calibrated model parameters for device (see librettDeviceName())
+void librettSetGpuModelProp(const std::string& device, const GpuModelProp& modelProp);
+
+// Returns all calibrated model parameters
+std::vector< std::pair<std::string, GpuModelProp> > librettGetGpuModelProps();
+
+// Fits model parameters to measured plan execution times (in seconds).
+// modelProp is used as the starting point.
+// Returns false if there are not enough plans to fit to
+bool fitGpuModelProp(const gpuDeviceProp_t &prop, std::list<librettPlan_t>& plans,
+  std::vector<double>& times, GpuModelProp& modelProp);
+
 double cyclesPacked(const bool isSplit, const size_t sizeofType, const gpuDeviceProp_t &prop,
-  int nthread, int numActiveBlock, float mlp,
+  const GpuModelProp &gpuModelProp, int nthread, int numActiveBlock, float mlp,
   int gld_req, int gst_req, int gld_tran, int gst_tran,
   int sld_req, int sst_req, int sld_tran, int sst_tran, int num_iter, int cl_full, int cl_part);
 
 double cyclesTiled(const bool isCopy, const size_t sizeofType, const gpuDeviceProp_t &prop,
-  int nthread, int numActiveBlock, float mlp,
+  const GpuModelProp &gpuModelProp, int nthread, int numActiveBlock, float mlp,
   int gld_req, int gst_req, int gld_tran, int gst_tran,
   int sld_req, int sst_req, int sld_tran, int sst_tran, int num_iter, int cl_full, int cl_part);
 
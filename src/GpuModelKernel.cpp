@@ -28,6 +28,7 @@ All rights reserved.
 #include "GpuUtils.h"
 #include "GpuMem.hpp"
 #include "GpuModelKernel.h"
+#include "FastDiv.h"
 #include <iostream>
 #include "uniapi.h"
 
@@ -71,15 +72,15 @@ struct MemStat {
 //
 __gpu_inline__
 #if LIBRETT_USES_SYCL
-int tensorPos(const int p, const int rank, const int c, const int d, const int ct, sycl::nd_item<3>& item)
+int tensorPos(const int p, const int rank, const FastDiv& cdiv, const FastDiv& ddiv, const int d, const int ct, sycl::nd_item<3>& item)
 #else // CUDA or HIP
-int tensorPos(const int p, const int rank, const int c, const int d, const int ct, const int numLane=warpSize)
+int tensorPos(const int p, const int rank, const FastDiv& cdiv, const FastDiv& ddiv, const int d, const int ct, const int numLane=warpSize)
 #endif
 {
 #if LIBRETT_USES_SYCL
   const int numLane = item.get_sub_group().get_local_range().get(0);
 #endif
-  int r = ((p / c) % d) * ct;
+  int r = fastDivMod(p, cdiv, ddiv, d) * ct;
 #pragma unroll
   for (int i=numLane/2; i >= 1; i/=2) {
     r += gpu_shfl_xor(r,i);
@@ -399,8 +400,8 @@ countTiled(const int numMm, const int volMbar, const int sizeMbar,
   for (int posMbar=blockIdx_z; posMbar < volMbar; posMbar += gridDim_z)
   {
     // Compute global memory positions
-    int posMajorIn = ((posMbar/Mbar.c_in) % Mbar.d_in)*Mbar.ct_in;
-    int posMajorOut = ((posMbar/Mbar.c_out) % Mbar.d_out)*Mbar.ct_out;
+    int posMajorIn = fastDivMod(posMbar, Mbar.c_in_div, Mbar.d_in_div, Mbar.d_in)*Mbar.ct_in;
+    int posMajorOut = fastDivMod(posMbar, Mbar.c_out_div, Mbar.d_out_div, Mbar.d_out)*Mbar.ct_out;
 #if LIBRETT_USES_SYCL
     posMajorIn = sycl::reduce_over_group(sg, posMajorIn, sycl::plus<int>());
     posMajorOut = sycl::reduce_over_group(sg, posMajorOut, sycl::plus<int>());
@@ -542,8 +543,8 @@ countPacked(const int volMmk, const int volMbar,
   for (int posMbar=blockIdx_x; posMbar < volMbar; posMbar += gridDim_x)
   {
 
-    int posMbarOut = ((posMbar/Mbar.c_out) % Mbar.d_out)*Mbar.ct_out;
-    int posMbarIn = ((posMbar/Mbar.c_in) % Mbar.d_in)*Mbar.ct_in;
+    int posMbarOut = fastDivMod(posMbar, Mbar.c_out_div, Mbar.d_out_div, Mbar.d_out)*Mbar.ct_out;
+    int posMbarIn = fastDivMod(posMbar, Mbar.c_in_div, Mbar.d_in_div, Mbar.d_in)*Mbar.ct_in;
 #if LIBRETT_USES_SYCL
     posMbarOut = sycl::reduce_over_group(sg, posMbarOut, sycl::plus<int>());
     posMbarIn = sycl::reduce_over_group(sg, posMbarIn, sycl::plus<int>());
@@ -732,8 +733,8 @@ countPackedSplit( const int splitDim, const int volMmkUnsplit, const int volMbar
   for (int posMbar=blockIdx_y; posMbar < volMbar; posMbar+=gridDim_y)
   {
 
-    int posMbarOut = ((posMbar/Mbar.c_out) % Mbar.d_out)*Mbar.ct_out;
-    int posMbarIn = ((posMbar/Mbar.c_in) % Mbar.d_in)*Mbar.ct_in;
+    int posMbarOut = fastDivMod(posMbar, Mbar.c_out_div, Mbar.d_out_div, Mbar.d_out)*Mbar.ct_out;
+    int posMbarIn = fastDivMod(posMbar, Mbar.c_in_div, Mbar.d_in_div, Mbar.d_in)*Mbar.ct_in;
     #if LIBRETT_USES_SYCL
     posMbarOut = sycl::reduce_over_group(sg, posMbarOut, sycl::plus<int>());
     posMbarIn = sycl::reduce_over_group(sg, posMbarIn, sycl::plus<int>());
@@ -878,9 +879,9 @@ countTiledCopy(const int numMm, const int volMbar, const int sizeMbar,
     // Read global memory
     {
       #if LIBRETT_USES_SYCL
-        int pos0 = tensorPos(posMbar, sizeMbar, Mbar.c_in, Mbar.d_in, Mbar.ct_in, item);
+        int pos0 = tensorPos(posMbar, sizeMbar, Mbar.c_in_div, Mbar.d_in_div, Mbar.d_in, Mbar.ct_in, item);
       #else // CUDA or HIP
-        int pos0 = tensorPos(posMbar, sizeMbar, Mbar.c_in, Mbar.d_in, Mbar.ct_in);
+        int pos0 = tensorPos(posMbar, sizeMbar, Mbar.c_in_div, Mbar.d_in_div, Mbar.d_in, Mbar.ct_in);
       #endif
       pos0 += x + y*cuDimMk;
 
@@ -906,9 +907,9 @@ countTiledCopy(const int numMm, const int volMbar, const int sizeMbar,
     // Write global memory
     {
       #if LIBRETT_USES_SYCL
-        int pos0 = tensorPos(posMbar, sizeMbar, Mbar.c_out, Mbar.d_out, Mbar.ct_out, item);
+        int pos0 = tensorPos(posMbar, sizeMbar, Mbar.c_out_div, Mbar.d_out_div, Mbar.d_out, Mbar.ct_out, item);
       #else // CUDA or HIP
-	int pos0 = tensorPos(posMbar, sizeMbar, Mbar.c_out, Mbar.d_out, Mbar.ct_out);
+	int pos0 = tensorPos(posMbar, sizeMbar, Mbar.c_out_div, Mbar.d_out_div, Mbar.d_out, Mbar.ct_out);
       #endif
       pos0 += x + y*cuDimMm;
 
@@ -1009,20 +1010,21 @@ void runCounters(const int warpSize, const int *hostPosData, const int numPosDat
   deallocate_device<int>(&devPosData, gpustream);
 }
 
-bool librettGpuModelKernel(librettPlan_t &plan, const int accWidth, const int cacheWidth,
-  int &gld_tran, int &gst_tran, int &gld_req, int &gst_req,
-  int &cl_full_l2, int &cl_part_l2, int &cl_full_l1, int &cl_part_l1)
+//
+// Launches the counter kernel of plan on plan.stream, counts are accumulated into devMemStat
+//
+static bool launchGpuModelKernel(librettPlan_t &plan, const int accWidth, const int cacheWidth,
+  MemStat* devMemStat)
 {
 
+  // Counters only support 32-bit positions and scalar accesses of the Tiled methods
+  if (plan.index64 || plan.launchConfig.vecWidth != 1) return false;
+
   LaunchConfig& lc = plan.launchConfig;
   TensorSplit& ts = plan.tensorSplit;
 
-  MemStat* devMemStat;
-  allocate_device<MemStat>(&devMemStat, 1, plan.stream);
-  set_device_array<MemStat>(devMemStat, 0, 1, plan.stream);
-
   switch(ts.method) {
-    case Trivial:
+    default:
     {
       return false;
     }
@@ -1198,6 +1200,23 @@ bool librettGpuModelKernel(librettPlan_t &plan, const int accWidth, const int ca
   cudaCheck(cudaGetLastError());
 #endif
 
+  return true;
+}
+
+bool librettGpuModelKernel(librettPlan_t &plan, const int accWidth, const int cacheWidth,
+  int &gld_tran, int &gst_tran, int &gld_req, int &gst_req,
+  int &cl_full_l2, int &cl_part_l2, int &cl_full_l1, int &cl_part_l1)
+{
+
+  MemStat* devMemStat;
+  allocate_device<MemStat>(&devMemStat, 1, plan.stream);
+  set_device_array<MemStat>(devMemStat, 0, 1, plan.stream);
+
+  if (!launchGpuModelKernel(plan, accWidth, cacheWidth, devMemStat)) {
+    deallocate_device<MemStat>(&devMemStat, plan.stream);
+    return false;
+  }
+
   MemStat hostMemStat;
   copy_DtoH<MemStat>(devMemStat, &hostMemStat, 1, plan.stream);
 #if LIBRETT_USES_SYCL
@@ -1221,3 +1240,61 @@ bool librettGpuModelKernel(librettPlan_t &plan, const int accWidth, const int ca
 
   return true;
 }
+
+bool librettGpuModelKernelSupported(const librettPlan_t& plan) {
+  const int method = plan.tensorSplit.method;
+  return (!plan.index64 && plan.launchConfig.vecWidth == 1 &&
+    (method == Packed || method == PackedSplit || method == Tiled || method == TiledCopy));
+}
+
+bool librettGpuModelKernelAll(std::list<librettPlan_t>& plans, const int accWidth, const int cacheWidth,
+  gpuStream_t& stream)
+{
+
+  std::vector<librettPlan_t*> countPlans;
+  for (auto it=plans.begin();it != plans.end();it++) {
+    if (librettGpuModelKernelSupported(*it)) {
+      it->setStream(stream);
+      it->activate();
+      countPlans.push_back(&(*it));
+    }
+  }
+  const int numPlan = countPlans.size();
+  if (numPlan == 0) return true;
+
+  MemStat* devMemStat;
+  allocate_device<MemStat>(&devMemStat, numPlan, stream);
+  set_device_array<MemStat>(devMemStat, 0, numPlan, stream);
+
+  // Launches go back to back, there is a single synchronization at the end
+  bool ok = true;
+  for (int i=0;i < numPlan && ok;i++) {
+    ok = launchGpuModelKernel(*countPlans[i], accWidth, cacheWidth, devMemStat + i);
+  }
+
+  std::vector<MemStat> hostMemStat(numPlan);
+  copy_DtoH<MemStat>(devMemStat, hostMemStat.data(), numPlan, stream);
+#if LIBRETT_USES_SYCL
+  stream->wait_and_throw();
+#elif LIBRETT_USES_HIP
+  hipCheck(hipStreamSynchronize(stream));
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaStreamSynchronize(stream));
+#endif
+  deallocate_device<MemStat>(&devMemStat, stream);
+  if (!ok) return false;
+
+  for (int i=0;i < numPlan;i++) {
+    librettPlan_t& plan = *countPlans[i];
+    plan.gld_tran   = hostMemStat[i].gld_tran;
+    plan.gst_tran   = hostMemStat[i].gst_tran;
+    plan.gld_req    = hostMemStat[i].gld_req;
+    plan.gst_req    = hostMemStat[i].gst_req;
+    plan.cl_full_l2 = hostMemStat[i].cl_full_l2;
+    plan.cl_part_l2 = hostMemStat[i].cl_part_l2;
+    plan.cl_full_l1 = hostMemStat[i].cl_full_l1;
+    plan.cl_part_l1 = hostMemStat[i].cl_part_l1;
+  }
+
+  return true;
+}
@@ -33,4 +33,14 @@ bool librettGpuModelKernel(librettPlan_t& plan, const int accWidth, const int ca
   int& gld_tran, int& gst_tran, int& gld_req, int& gst_req,
   int& cl_full_l2, int& cl_part_l2, int& cl_full_l1, int& cl_part_l1);
 
+// Returns true if the device counters support plan: Packed, PackedSplit, Tiled and TiledCopy
+// plans without vector accesses and 64-bit positions
+bool librettGpuModelKernelSupported(const librettPlan_t& plan);
+
+// Counts global memory transactions of all plans on the device, covering all of Mbar.
+// Plans are activated on stream, the counters of the plans are overwritten.
+// Plans that the counters do not support are left as they are
+bool librettGpuModelKernelAll(std::list<librettPlan_t>& plans, const int accWidth, const int cacheWidth,
+  gpuStream_t& stream);
+
 #endif // LIBRETTGPUMODELKERNEL_H
@@ -24,13 +24,18 @@ SOFTWARE.
 *******************************************************************************/
 
 #include <stdio.h>
+#include <atomic>
+
+#include "GpuUtils.h"
 
 #ifdef ENABLE_NVTOOLS
-  #include <nvToolsExtCuda.h>
+  #if LIBRETT_USES_HIP
+    #include <roctracer/roctx.h>
+  #elif LIBRETT_USES_CUDA
+    #include <nvToolsExtCuda.h>
+  #endif
 #endif
 
-#include "GpuUtils.h"
-
 //----------------------------------------------------------------------------------------
 
 void set_device_array_async_T(void *data, int value, const size_t ndata,
@@ -113,10 +118,58 @@ void copy_DtoH_sync_T(const void *d_array, void *h_array, const size_t array_len
   #endif
 }
 
+// Larger pitches are not accepted by the 2D copies
+const size_t MAX_COPY_PITCH = 2147483647;
+
+//----------------------------------------------------------------------------------------
+//
+// Copies height rows of width bytes between any memories (host, device, peer device)
+//
+void copy_2D_async(void* dst, const size_t dpitch, const void* src, const size_t spitch,
+  const size_t width, const size_t height, gpuStream_t& stream) {
+  if ((spitch == width && dpitch == width) || height == 1) {
+#if LIBRETT_USES_SYCL
+    stream->memcpy(dst, src, width*height);
+#elif LIBRETT_USES_HIP
+    hipCheck(hipMemcpyAsync(dst, src, width*height, hipMemcpyDefault, stream));
+#elif LIBRETT_USES_CUDA
+    cudaCheck(cudaMemcpyAsync(dst, src, width*height, cudaMemcpyDefault, stream));
+#endif
+    return;
+  }
+#if LIBRETT_USES_SYCL
+  for (size_t i=0;i < height;i++) stream->memcpy((char*)dst + i*dpitch, (const char*)src + i*spitch, width);
+#else
+  if (spitch > MAX_COPY_PITCH || dpitch > MAX_COPY_PITCH) {
+    for (size_t i=0;i < height;i++) {
+  #if LIBRETT_USES_HIP
+      hipCheck(hipMemcpyAsync((char*)dst + i*dpitch, (const char*)src + i*spitch, width, hipMemcpyDefault, stream));
+  #elif LIBRETT_USES_CUDA
+      cudaCheck(cudaMemcpyAsync((char*)dst + i*dpitch, (const char*)src + i*spitch, width, cudaMemcpyDefault, stream));
+  #endif
+    }
+    return;
+  }
+  #if LIBRETT_USES_HIP
+  hipCheck(hipMemcpy2DAsync(dst, dpitch, src, spitch, width, height, hipMemcpyDefault, stream));
+  #elif LIBRETT_USES_CUDA
+  cudaCheck(cudaMemcpy2DAsync(dst, dpitch, src, spitch, width, height, cudaMemcpyDefault, stream));
+  #endif
+#endif
+}
+
 //----------------------------------------------------------------------------------------
 #ifdef ENABLE_NVTOOLS
+//
+// Profiler ranges: NVTX on CUDA, ROCTX on HIP, no ranges on SYCL
+//
 void gpuRangeStart(const char *range_name) {
-  static int color_id=0;
+#if LIBRETT_USES_HIP
+  roctxRangePush(range_name);
+#elif LIBRETT_USES_CUDA
+  // Ranges are started from several threads by librettExecute
+  static std::atomic<int> next_color_id(0);
+  const int color_id = (next_color_id++) & 3;
   nvtxEventAttributes_t att;
   att.version = NVTX_VERSION;
   att.size = NVTX_EVENT_ATTRIB_STRUCT_SIZE;
@@ -130,15 +183,18 @@ void gpuRangeStart(const char *range_name) {
   } else if (color_id == 3) {
     att.color = 0xFFFF00FF;
   }
-  color_id++;
-  if (color_id > 3) color_id = 0;
   att.messageType = NVTX_MESSAGE_TYPE_ASCII;
   att.message.ascii = range_name;
   nvtxRangePushEx(&att);
+#endif
 }
 
 void gpuRangeStop() {
+#if LIBRETT_USES_HIP
+  roctxRangePop();
+#elif LIBRETT_USES_CUDA
   nvtxRangePop();
+#endif
 }
 #endif
 
@@ -85,6 +85,9 @@ void copy_DtoH_async_T(const void *d_array, void *h_array, const size_t array_le
            const size_t sizeofT);
 void copy_HtoD_sync_T(const void *h_array, void *d_array, size_t array_len, gpuStream_t& stream, const size_t sizeofT);
 void copy_DtoH_sync_T(const void *d_array, void *h_array, const size_t array_len, gpuStream_t& stream, const size_t sizeofT);
+// Copies height rows of width bytes from src (row pitch spitch) to dst (row pitch dpitch)
+void copy_2D_async(void *dst, const size_t dpitch, const void *src, const size_t spitch,
+           const size_t width, const size_t height, gpuStream_t& stream);
 
 //----------------------------------------------------------------------------------------
 //
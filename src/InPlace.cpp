@@ -0,0 +1,240 @@
+/******************************************************************************
+MIT License
+
+Copyright (c) 2016 Antti-Pekka Hynninen
+Copyright (c) 2016 Oak Ridge National Laboratory (UT-Batelle)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+#include <algorithm>
+#include <numeric>
+#include "InPlace.h"
+#include "GpuUtils.h"
+#include "GpuMem.hpp"
+#include "kernel.h"
+
+// defined in plan.cpp
+void reduceRanks(const int rank, const int* dim, const int* permutation,
+  std::vector<int>& redDim, std::vector<int>& redPermutation);
+
+// Default scratch buffer is this fraction of the tensor
+const size_t INPLACE_SCRATCH_FRACTION = 8;
+
+//
+// Device helpers. With SYCL the queue knows its device
+//
+static int getDevice() {
+  int device = 0;
+#if LIBRETT_USES_HIP
+  hipCheck(hipGetDevice(&device));
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaGetDevice(&device));
+#endif
+  return device;
+}
+
+static void setDevice(const int device) {
+#if LIBRETT_USES_HIP
+  hipCheck(hipSetDevice(device));
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaSetDevice(device));
+#endif
+}
+
+static void copyDtoD(char* dst, const char* src, const size_t bytes, gpuStream_t stream) {
+#if LIBRETT_USES_SYCL
+  stream->memcpy(dst, src, bytes);
+#elif LIBRETT_USES_HIP
+  hipCheck(hipMemcpyAsync(dst, src, bytes, hipMemcpyDefault, stream));
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaMemcpyAsync(dst, src, bytes, cudaMemcpyDefault, stream));
+#endif
+}
+
+// Orders the following work after the already submitted work,
+// out-of-order SYCL queues need a barrier
+static void orderStream(gpuStream_t stream) {
+#if LIBRETT_USES_SYCL
+  if (!stream->is_in_order()) stream->ext_oneapi_submit_barrier();
+#endif
+}
+
+librettInPlacePlan_t::librettInPlacePlan_t() : sizeofType(0), stream(nullptr), deviceID(0),
+  scratch(nullptr), scratchBytes(0) {}
+
+librettInPlacePlan_t::~librettInPlacePlan_t() {
+  const int curDevice = getDevice();
+  if (curDevice != deviceID) setDevice(deviceID);
+  for (auto& step : steps) {
+    if (!step.shuffle) librettDestroy(step.plan);
+  }
+  deallocate_device_ordered<char>(&scratch, stream);
+  if (curDevice != deviceID) setDevice(curDevice);
+}
+
+librettResult librettInPlacePlan_t::createSteps(const std::vector<int>& dim_in, const std::vector<int>& permutation_in,
+  const std::vector<size_t>& repeatCount, const std::vector<size_t>& repeatStride) {
+
+  std::vector<int> dim;
+  std::vector<int> permutation;
+  reduceRanks(dim_in.size(), dim_in.data(), permutation_in.data(), dim, permutation);
+  const int rank = dim.size();
+  if (rank == 1) return LIBRETT_SUCCESS;
+
+  const int a = rank - 1;
+  const int q = std::find(permutation.begin(), permutation.end(), a) - permutation.begin();
+  size_t volSlab = 1;
+  for (int i=0;i < a;i++) volSlab *= dim[i];
+
+  // (1) Transpose the other ranks within the slabs of a
+  std::vector<int> slabPermutation;
+  for (int i=0;i < rank;i++) {
+    if (permutation[i] != a) slabPermutation.push_back(permutation[i]);
+  }
+  bool slabIdentity = true;
+  for (int i=0;i < a;i++) slabIdentity = slabIdentity && (slabPermutation[i] == i);
+  if (!slabIdentity) {
+    const size_t numSlabFit = scratchBytes/(volSlab*sizeofType);
+    if (numSlabFit > 0) {
+      const int numSlab = (int)std::min<size_t>(dim[a], numSlabFit);
+      std::vector<int> batchDim(dim.begin(), dim.end() - 1);
+      std::vector<int> batchPermutation(slabPermutation);
+      batchDim.push_back(numSlab);
+      batchPermutation.push_back(a);
+      // Full batches and the remainder
+      for (int k=0;k < 2;k++) {
+        const int numBatch = (k == 0) ? dim[a]/numSlab : 1;
+        const int numSlabBatch = (k == 0) ? numSlab : dim[a] % numSlab;
+        if (numBatch == 0 || numSlabBatch == 0) continue;
+        batchDim[a] = numSlabBatch;
+        Step step;
+        step.repeatCount = repeatCount;
+        step.repeatStride = repeatStride;
+        step.shuffle = false;
+        librettResult result = librettPlan(&step.plan, rank, batchDim.data(), batchPermutation.data(), sizeofType, stream);
+        if (result != LIBRETT_SUCCESS) return result;
+        step.start = (k == 0) ? 0 : (size_t)(dim[a]/numSlab)*numSlab*volSlab;
+        step.batchVol = (size_t)numSlabBatch*volSlab;
+        step.numBatch = numBatch;
+        steps.push_back(step);
+      }
+    } else {
+      std::vector<int> slabDim(dim.begin(), dim.end() - 1);
+      std::vector<size_t> slabRepeatCount(repeatCount);
+      std::vector<size_t> slabRepeatStride(repeatStride);
+      slabRepeatCount.push_back(dim[a]);
+      slabRepeatStride.push_back(volSlab);
+      librettResult result = createSteps(slabDim, slabPermutation, slabRepeatCount, slabRepeatStride);
+      if (result != LIBRETT_SUCCESS) return result;
+    }
+  }
+
+  // (2) Move rank a from the slowest output position to q
+  if (q != a) {
+    Step step;
+    step.repeatCount = repeatCount;
+    step.repeatStride = repeatStride;
+    step.shuffle = true;
+    step.m = dim[a];
+    step.n = 1;
+    step.L = 1;
+    for (int i=0;i < q;i++) step.L *= dim[permutation[i]];
+    for (int i=q+1;i < rank;i++) step.n *= dim[permutation[i]];
+    steps.push_back(step);
+  }
+
+  return LIBRETT_SUCCESS;
+}
+
+librettResult librettInPlacePlan_t::setup(const int rank, const int* dim, const int* permutation,
+  const size_t sizeofType_in, gpuStream_t stream_in, const size_t scratchSize) {
+
+  sizeofType = sizeofType_in;
+  stream = stream_in;
+  deviceID = getDevice();
+
+  size_t vol = 1;
+  for (int i=0;i < rank;i++) vol *= dim[i];
+  scratchBytes = (scratchSize > 0) ? scratchSize : vol*sizeofType/INPLACE_SCRATCH_FRACTION;
+
+  librettResult result = createSteps(std::vector<int>(dim, dim + rank), std::vector<int>(permutation, permutation + rank),
+    std::vector<size_t>(), std::vector<size_t>());
+  if (result != LIBRETT_SUCCESS) return result;
+
+  // Shuffles need one row and one column of blocks
+  size_t minBytes = 0;
+  for (auto& step : steps) {
+    if (step.shuffle) minBytes = std::max(minBytes, (size_t)std::max(step.m, step.n)*step.L*sizeofType);
+  }
+  scratchBytes = std::max(scratchBytes, minBytes);
+  if (!steps.empty()) allocate_device<char>(&scratch, scratchBytes, stream);
+
+  return LIBRETT_SUCCESS;
+}
+
+void librettInPlacePlan_t::executeShuffle(const Step& step, char* data) {
+  const size_t blockBytes = step.L*sizeofType;
+  // Rotation is the identity when m and n are coprime
+  const int firstPass = (std::gcd(step.m, step.n) > 1) ? 0 : 1;
+  for (int pass=firstPass;pass < 3;pass++) {
+    // Row pass goes through the rows, column passes through the columns
+    const long long numLine = (pass == 1) ? step.m : step.n;
+    const long long lineLen = (pass == 1) ? step.n : step.m;
+    const long long numLineBatch = std::max<long long>(1, scratchBytes/(lineLen*blockBytes));
+    for (long long first=0;first < numLine;first += numLineBatch) {
+      librettInPlacePass(pass, step.m, step.n, first, std::min(numLineBatch, numLine - first),
+        blockBytes, data, scratch, stream);
+      orderStream(stream);
+    }
+  }
+}
+
+librettResult librettInPlacePlan_t::execute(void* data) {
+  std::lock_guard<std::mutex> lock(executeMutex);
+
+  char* base = (char*)data;
+  for (auto& step : steps) {
+    // Go through the offsets of the step
+    std::vector<size_t> k(step.repeatCount.size(), 0);
+    while (true) {
+      size_t offset = 0;
+      for (size_t i=0;i < k.size();i++) offset += k[i]*step.repeatStride[i];
+      if (!step.shuffle) {
+        for (int b=0;b < step.numBatch;b++) {
+          char* batch = base + (offset + step.start + (size_t)b*step.batchVol)*sizeofType;
+          librettResult result = librettExecute(step.plan, batch, scratch);
+          if (result != LIBRETT_SUCCESS) return result;
+          orderStream(stream);
+          copyDtoD(batch, scratch, step.batchVol*sizeofType, stream);
+          orderStream(stream);
+        }
+      } else {
+        executeShuffle(step, base + offset*sizeofType);
+      }
+      size_t i = 0;
+      for (;i < k.size();i++) {
+        if (++k[i] < step.repeatCount[i]) break;
+        k[i] = 0;
+      }
+      if (i == k.size()) break;
+    }
+  }
+
+  return LIBRETT_SUCCESS;
+}
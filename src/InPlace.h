@@ -0,0 +1,101 @@
+/******************************************************************************
+MIT License
+
+Copyright (c) 2016 Antti-Pekka Hynninen
+Copyright (c) 2016 Oak Ridge National Laboratory (UT-Batelle)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+#ifndef LIBRETTINPLACE_H
+#define LIBRETTINPLACE_H
+
+#include <vector>
+#include <mutex>
+#include "librett.h"
+#include "uniapi.h"
+
+//
+// In-place transpose with a bounded scratch buffer
+//
+// After rank reduction, let a be the slowest input rank and q its position in the output.
+// (1) The other ranks are transposed within each slab of a. Batches of slabs that fit
+//     into the scratch buffer are transposed into it with an ordinary plan and copied back.
+//     Slabs that do not fit are transposed in place recursively.
+// (2) Rank a is moved from the slowest position to q. With L = volume of the output ranks
+//     before q and M = volume of the ones after it, this is the transpose of a row-major
+//     dim[a] x M matrix of blocks of L elements, done in place with the decomposition into
+//     row and column permutations of B. Catanzaro, M. Garland and K. Keutzer,
+//     "A decomposition for in-place matrix transposition", PPoPP 2014.
+//     Each pass permutes rows or columns independently, through the scratch buffer.
+//
+// The scratch buffer must hold one row and one column of the block matrix of (2).
+//
+class librettInPlacePlan_t {
+public:
+
+  librettInPlacePlan_t();
+  ~librettInPlacePlan_t();
+
+  librettResult setup(const int rank, const int* dim, const int* permutation, const size_t sizeofType_in,
+    gpuStream_t stream_in, const size_t scratchSize);
+
+  librettResult execute(void* data);
+
+  // Size of the scratch buffer in bytes
+  size_t getScratchSize() const {return scratchBytes;}
+
+private:
+
+  struct Step {
+    // Step is applied at element offsets sum_i k_i*repeatStride[i], 0 <= k_i < repeatCount[i]
+    std::vector<size_t> repeatCount;
+    std::vector<size_t> repeatStride;
+    // Shuffle step (2), otherwise slab step (1)
+    bool shuffle;
+    // Slab step: plan transposes numBatch batches of batchVol elements
+    // that start at element offset start
+    librettHandle plan;
+    size_t start;
+    size_t batchVol;
+    int numBatch;
+    // Shuffle step (2): m x n matrix of blocks of L elements
+    long long m;
+    long long n;
+    size_t L;
+  };
+
+  size_t sizeofType;
+  gpuStream_t stream;
+  int deviceID;
+
+  std::vector<Step> steps;
+
+  char* scratch;
+  size_t scratchBytes;
+
+  // Execution reuses the scratch buffer
+  std::mutex executeMutex;
+
+  librettResult createSteps(const std::vector<int>& dim, const std::vector<int>& permutation,
+    const std::vector<size_t>& repeatCount, const std::vector<size_t>& repeatStride);
+
+  void executeShuffle(const Step& step, char* data);
+};
+
+#endif // LIBRETTINPLACE_H
@@ -0,0 +1,362 @@
+/******************************************************************************
+MIT License
+
+Copyright (c) 2016 Antti-Pekka Hynninen
+Copyright (c) 2016 Oak Ridge National Laboratory (UT-Batelle)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+#include <algorithm>
+#include "MultiGpu.h"
+#include "GpuUtils.h"
+#include "GpuMem.hpp"
+
+// Maximum number of chunks of step 1, the copies of a chunk overlap with the transpose of the next one
+const int MULTIGPU_NUM_CHUNK = 4;
+
+//
+// Device and event helpers. With SYCL the queue knows its device and
+// events are barriers submitted to the queue
+//
+static int getDevice() {
+  int device = 0;
+#if LIBRETT_USES_HIP
+  hipCheck(hipGetDevice(&device));
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaGetDevice(&device));
+#endif
+  return device;
+}
+
+static void setDevice(const int device) {
+#if LIBRETT_USES_HIP
+  hipCheck(hipSetDevice(device));
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaSetDevice(device));
+#endif
+}
+
+static void createEvent(gpuEvent_t& event) {
+#if LIBRETT_USES_HIP
+  hipCheck(hipEventCreateWithFlags(&event, hipEventDisableTiming));
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaEventCreateWithFlags(&event, cudaEventDisableTiming));
+#endif
+}
+
+static void destroyEvent(gpuEvent_t& event) {
+#if LIBRETT_USES_HIP
+  if (event != nullptr) hipCheck(hipEventDestroy(event));
+  event = nullptr;
+#elif LIBRETT_USES_CUDA
+  if (event != nullptr) cudaCheck(cudaEventDestroy(event));
+  event = nullptr;
+#endif
+}
+
+static void recordEvent(gpuEvent_t& event, gpuStream_t stream) {
+#if LIBRETT_USES_SYCL
+  event = stream->ext_oneapi_submit_barrier();
+#elif LIBRETT_USES_HIP
+  hipCheck(hipEventRecord(event, stream));
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaEventRecord(event, stream));
+#endif
+}
+
+static void streamWaitEvent(gpuStream_t stream, gpuEvent_t& event) {
+#if LIBRETT_USES_SYCL
+  stream->ext_oneapi_submit_barrier({event});
+#elif LIBRETT_USES_HIP
+  hipCheck(hipStreamWaitEvent(stream, event, 0));
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaStreamWaitEvent(stream, event, 0));
+#endif
+}
+
+//
+// Lets device access the memory of peer. Without peer access the
+// runtime stages the copies through the host
+//
+static void enablePeerAccess(const int device, const int peer) {
+#if LIBRETT_USES_HIP
+  int canAccess;
+  hipCheck(hipDeviceCanAccessPeer(&canAccess, device, peer));
+  if (canAccess) {
+    hipError_t err = hipDeviceEnablePeerAccess(peer, 0);
+    if (err == hipErrorPeerAccessAlreadyEnabled) {
+      (void)hipGetLastError();
+    } else {
+      hipCheck(err);
+    }
+  }
+#elif LIBRETT_USES_CUDA
+  int canAccess;
+  cudaCheck(cudaDeviceCanAccessPeer(&canAccess, device, peer));
+  if (canAccess) {
+    cudaError_t err = cudaDeviceEnablePeerAccess(peer, 0);
+    if (err == cudaErrorPeerAccessAlreadyEnabled) {
+      (void)cudaGetLastError();
+    } else {
+      cudaCheck(err);
+    }
+  }
+#endif
+}
+
+int librettMultiGpuPlan_t::shardStart(const int d, const int numDevice, const int i) {
+  return i*(d/numDevice) + std::min(i, d % numDevice);
+}
+
+int librettMultiGpuPlan_t::shardSize(const int d, const int numDevice, const int i) {
+  return d/numDevice + (i < d % numDevice);
+}
+
+librettMultiGpuPlan_t::librettMultiGpuPlan_t() : rank(0), sizeofType(0), shardIn(0), shardOut(0),
+  exchange(false), sendIsCopy(false), recvIsCopy(false), volOther(1) {}
+
+librettMultiGpuPlan_t::~librettMultiGpuPlan_t() {
+  const int curDevice = getDevice();
+  for (auto& d : dev) {
+    setDevice(d.device);
+    for (auto handle : d.sendPlan) librettDestroy(handle);
+    for (auto handle : d.recvPlan) librettDestroy(handle);
+    // Stream waits for the copies of the last execute, see execute()
+    deallocate_device_ordered<char>(&d.sendBuf, d.stream);
+    deallocate_device_ordered<char>(&d.recvBuf, d.stream);
+    destroyEvent(d.startEvent);
+    destroyEvent(d.copyEvent);
+    for (auto& event : d.chunkEvent) destroyEvent(event);
+    if (d.copyStream != nullptr) {
+#if LIBRETT_USES_SYCL
+      delete d.copyStream;
+#elif LIBRETT_USES_HIP
+      hipCheck(hipStreamDestroy(d.copyStream));
+#elif LIBRETT_USES_CUDA
+      cudaCheck(cudaStreamDestroy(d.copyStream));
+#endif
+    }
+  }
+  setDevice(curDevice);
+}
+
+librettResult librettMultiGpuPlan_t::createLocalPlan(DeviceData& d, std::vector<int> localDim,
+  std::vector<int> localPermutation, std::vector<librettHandle>& handles) {
+  librettHandle handle;
+  librettResult result = librettPlan(&handle, rank, localDim.data(), localPermutation.data(), sizeofType, d.stream);
+  if (result == LIBRETT_SUCCESS) handles.push_back(handle);
+  return result;
+}
+
+librettResult librettMultiGpuPlan_t::setup(const int rank_in, const int* dim_in, const int* permutation_in,
+  const size_t sizeofType_in, const int shardIn_in, const int shardOut_in, const int numDevice,
+  const int* devices, gpuStream_t* streams) {
+
+  rank = rank_in;
+  dim.assign(dim_in, dim_in + rank);
+  permutation.assign(permutation_in, permutation_in + rank);
+  sizeofType = sizeofType_in;
+  shardIn = shardIn_in;
+  shardOut = shardOut_in;
+  exchange = (shardIn != shardOut && numDevice > 1);
+
+  dev.resize(numDevice);
+  for (int i=0;i < numDevice;i++) {
+    DeviceData& d = dev[i];
+    d.device = (devices != nullptr) ? devices[i] : 0;
+    d.stream = streams[i];
+    d.copyStream = nullptr;
+    d.inStart = shardStart(dim[shardIn], numDevice, i);
+    d.inSize = shardSize(dim[shardIn], numDevice, i);
+    d.outStart = shardStart(dim[shardOut], numDevice, i);
+    d.outSize = shardSize(dim[shardOut], numDevice, i);
+    d.sendBuf = nullptr;
+    d.recvBuf = nullptr;
+#if !LIBRETT_USES_SYCL
+    d.startEvent = nullptr;
+    d.copyEvent = nullptr;
+#endif
+  }
+
+#if LIBRETT_USES_SYCL
+  // Device buffers are copied between the queues
+  for (int i=1;i < numDevice;i++) {
+    if (streams[i]->get_context() != streams[0]->get_context()) return LIBRETT_INVALID_DEVICE;
+  }
+#endif
+
+  const int curDevice = getDevice();
+  librettResult result = LIBRETT_SUCCESS;
+
+  if (!exchange) {
+    // Every device transposes its own shard
+    for (auto& d : dev) {
+      setDevice(d.device);
+      std::vector<int> localDim(dim);
+      localDim[shardIn] = d.inSize;
+      result = createLocalPlan(d, localDim, permutation, d.recvPlan);
+      if (result != LIBRETT_SUCCESS) break;
+    }
+    setDevice(curDevice);
+    return result;
+  }
+
+  // Layout after step 1: other ranks in input order, shardOut, shardIn
+  std::vector<int> sendOrder;
+  volOther = 1;
+  for (int i=0;i < rank;i++) {
+    if (i != shardIn && i != shardOut) {
+      sendOrder.push_back(i);
+      volOther *= dim[i];
+    }
+  }
+  sendOrder.push_back(shardOut);
+  sendOrder.push_back(shardIn);
+
+  // Step 3 permutes the ranks of the receive buffer (in sendOrder) into the output order
+  std::vector<int> sendPos(rank);
+  for (int i=0;i < rank;i++) sendPos[sendOrder[i]] = i;
+  std::vector<int> recvPermutation(rank);
+  for (int i=0;i < rank;i++) recvPermutation[i] = sendPos[permutation[i]];
+
+  sendIsCopy = true;
+  recvIsCopy = true;
+  for (int i=0;i < rank;i++) {
+    if (sendOrder[i] != i) sendIsCopy = false;
+    if (recvPermutation[i] != i) recvIsCopy = false;
+  }
+
+  for (int i=0;i < numDevice && result == LIBRETT_SUCCESS;i++) {
+    DeviceData& d = dev[i];
+    setDevice(d.device);
+    for (int j=0;j < numDevice;j++) {
+      if (dev[j].device != d.device) enablePeerAccess(d.device, dev[j].device);
+    }
+#if LIBRETT_USES_SYCL
+    d.copyStream = new sycl::queue(d.stream->get_context(), d.stream->get_device(),
+      sycl::property_list{sycl::property::queue::in_order{}});
+#elif LIBRETT_USES_HIP
+    hipCheck(hipStreamCreateWithFlags(&d.copyStream, hipStreamNonBlocking));
+#elif LIBRETT_USES_CUDA
+    cudaCheck(cudaStreamCreateWithFlags(&d.copyStream, cudaStreamNonBlocking));
+#endif
+    createEvent(d.startEvent);
+    createEvent(d.copyEvent);
+
+    // Chunks along shardIn are contiguous in the input only when it is the slowest rank
+    const int numChunk = (!sendIsCopy && shardIn == rank - 1) ? std::min(MULTIGPU_NUM_CHUNK, d.inSize) : 1;
+    for (int c=0;c < numChunk;c++) {
+      d.chunkStart.push_back(shardStart(d.inSize, numChunk, c));
+      d.chunkSize.push_back(shardSize(d.inSize, numChunk, c));
+    }
+
+    if (!sendIsCopy) {
+      d.chunkEvent.resize(numChunk);
+      for (int c=0;c < numChunk && result == LIBRETT_SUCCESS;c++) {
+        createEvent(d.chunkEvent[c]);
+        std::vector<int> localDim(dim);
+        localDim[shardIn] = d.chunkSize[c];
+        result = createLocalPlan(d, localDim, sendOrder, d.sendPlan);
+      }
+      allocate_device<char>(&d.sendBuf, (size_t)d.inSize*dim[shardOut]*volOther*sizeofType, d.stream);
+    }
+
+    if (!recvIsCopy && result == LIBRETT_SUCCESS) {
+      std::vector<int> recvDim(rank);
+      for (int j=0;j < rank;j++) recvDim[j] = dim[sendOrder[j]];
+      recvDim[rank - 2] = d.outSize;
+      result = createLocalPlan(d, recvDim, recvPermutation, d.recvPlan);
+      allocate_device<char>(&d.recvBuf, (size_t)d.outSize*dim[shardIn]*volOther*sizeofType, d.stream);
+    }
+  }
+
+  setDevice(curDevice);
+  return result;
+}
+
+void librettMultiGpuPlan_t::copyToDevice(DeviceData& src, DeviceData& dst, const char* srcBuf, char* dstBuf,
+  const int aStart, const int aSize) {
+  // Source rows (one per index of shardIn) hold all of shardOut, the destination rows
+  // hold the range of dst. Destination rows are in the order of the global shardIn index
+  const size_t volBytes = volOther*sizeofType;
+  const size_t width = dst.outSize*volBytes;
+  const size_t spitch = dim[shardOut]*volBytes;
+  const char* srcPtr = srcBuf + ((size_t)aStart*dim[shardOut] + dst.outStart)*volBytes;
+  char* dstPtr = dstBuf + (size_t)(src.inStart + aStart)*width;
+  copy_2D_async(dstPtr, width, srcPtr, spitch, width, aSize, src.copyStream);
+}
+
+librettResult librettMultiGpuPlan_t::execute(void** idata, void** odata) {
+  std::lock_guard<std::mutex> lock(executeMutex);
+
+  const int numDevice = dev.size();
+  const int curDevice = getDevice();
+  librettResult result = LIBRETT_SUCCESS;
+
+  if (!exchange) {
+    for (int i=0;i < numDevice && result == LIBRETT_SUCCESS;i++) {
+      setDevice(dev[i].device);
+      result = librettExecute(dev[i].recvPlan[0], idata[i], odata[i]);
+    }
+    setDevice(curDevice);
+    return result;
+  }
+
+  // Copies start once the input is ready and the receive buffers are no longer read
+  for (auto& d : dev) {
+    setDevice(d.device);
+    recordEvent(d.startEvent, d.stream);
+  }
+
+  for (int p=0;p < numDevice && result == LIBRETT_SUCCESS;p++) {
+    DeviceData& d = dev[p];
+    setDevice(d.device);
+    for (auto& dq : dev) streamWaitEvent(d.copyStream, dq.startEvent);
+    const char* in = (const char*)idata[p];
+    for (size_t c=0;c < d.chunkStart.size() && result == LIBRETT_SUCCESS;c++) {
+      const char* srcBuf = in;
+      if (!sendIsCopy) {
+        const size_t offset = (size_t)d.chunkStart[c]*dim[shardOut]*volOther*sizeofType;
+        result = librettExecute(d.sendPlan[c], (void*)(in + offset), d.sendBuf + offset);
+        recordEvent(d.chunkEvent[c], d.stream);
+        streamWaitEvent(d.copyStream, d.chunkEvent[c]);
+        srcBuf = d.sendBuf;
+      }
+      // Peers first, each device starts from the next one to spread the links
+      for (int k=1;k <= numDevice;k++) {
+        DeviceData& dq = dev[(p + k) % numDevice];
+        char* dstBuf = recvIsCopy ? (char*)odata[(p + k) % numDevice] : dq.recvBuf;
+        copyToDevice(d, dq, srcBuf, dstBuf, d.chunkStart[c], d.chunkSize[c]);
+      }
+    }
+    recordEvent(d.copyEvent, d.copyStream);
+  }
+
+  // Output streams wait for all copies, which also keeps the input and
+  // send buffers of every device in use until the copies are done
+  for (int q=0;q < numDevice;q++) {
+    DeviceData& d = dev[q];
+    setDevice(d.device);
+    for (auto& dp : dev) streamWaitEvent(d.stream, dp.copyEvent);
+    if (!recvIsCopy && result == LIBRETT_SUCCESS) result = librettExecute(d.recvPlan[0], d.recvBuf, odata[q]);
+  }
+
+  setDevice(curDevice);
+  return result;
+}
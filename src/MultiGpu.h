@@ -0,0 +1,117 @@
+/******************************************************************************
+MIT License
+
+Copyright (c) 2016 Antti-Pekka Hynninen
+Copyright (c) 2016 Oak Ridge National Laboratory (UT-Batelle)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+#ifndef LIBRETTMULTIGPU_H
+#define LIBRETTMULTIGPU_H
+
+#include <vector>
+#include <mutex>
+#include "librett.h"
+#include "uniapi.h"
+
+//
+// Transpose of a tensor that is sharded over several devices
+//
+// Device i holds the input elements whose index of rank shardIn is in
+// [shardStart(dim[shardIn], numDevice, i), ... + shardSize(dim[shardIn], numDevice, i))
+// as a tensor of its own, and receives the output elements whose index of rank shardOut
+// is in the corresponding range of dim[shardOut].
+//
+// When shardIn = shardOut every device transposes its own shard. Otherwise
+// (1) device p transposes its shard so that shardIn is the slowest rank and shardOut
+//     the one before it, in chunks along shardIn when shardIn is the slowest input rank,
+// (2) the part that belongs to device q is copied (2D, peer to peer) into a receive
+//     buffer of q on a copy stream of p, as soon as its chunk is done,
+// (3) device q transposes the receive buffer into its output shard.
+// Steps (1) and (3) are skipped when they would be plain copies.
+//
+class librettMultiGpuPlan_t {
+public:
+
+  librettMultiGpuPlan_t();
+  ~librettMultiGpuPlan_t();
+
+  librettResult setup(const int rank_in, const int* dim_in, const int* permutation_in, const size_t sizeofType_in,
+    const int shardIn_in, const int shardOut_in, const int numDevice, const int* devices, gpuStream_t* streams);
+
+  librettResult execute(void** idata, void** odata);
+
+  // First index and number of indices of dimension d that go to device i
+  static int shardStart(const int d, const int numDevice, const int i);
+  static int shardSize(const int d, const int numDevice, const int i);
+
+private:
+
+  struct DeviceData {
+    int device;
+    gpuStream_t stream;
+    // Stream for the copies out of this device
+    gpuStream_t copyStream;
+    // Range of shardIn and shardOut on this device
+    int inStart, inSize;
+    int outStart, outSize;
+    // Chunks of the local input along shardIn and their plans (step 1),
+    // sendPlan is empty when step 1 is skipped
+    std::vector<int> chunkStart;
+    std::vector<int> chunkSize;
+    std::vector<librettHandle> sendPlan;
+    // Plan of step 3 or the local plan when there is no exchange,
+    // empty when step 3 is skipped
+    std::vector<librettHandle> recvPlan;
+    char* sendBuf;
+    char* recvBuf;
+    gpuEvent_t startEvent;
+    gpuEvent_t copyEvent;
+    std::vector<gpuEvent_t> chunkEvent;
+  };
+
+  int rank;
+  std::vector<int> dim;
+  std::vector<int> permutation;
+  size_t sizeofType;
+  int shardIn;
+  int shardOut;
+
+  // Devices exchange data (shardIn != shardOut and more than one device)
+  bool exchange;
+  // Steps 1 and 3 are plain copies and are skipped
+  bool sendIsCopy;
+  bool recvIsCopy;
+  // Volume of the ranks other than shardIn and shardOut
+  size_t volOther;
+
+  std::vector<DeviceData> dev;
+
+  // Execution reuses the buffers and events of the plan
+  std::mutex executeMutex;
+
+  librettResult createLocalPlan(DeviceData& d, std::vector<int> localDim,
+    std::vector<int> localPermutation, std::vector<librettHandle>& handles);
+
+  // Copies chunk [aStart, aStart + aSize) of shardIn from srcBuf of src to dstBuf of dst
+  void copyToDevice(DeviceData& src, DeviceData& dst, const char* srcBuf, char* dstBuf,
+    const int aStart, const int aSize);
+};
+
+#endif // LIBRETTMULTIGPU_H
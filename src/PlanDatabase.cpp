@@ -0,0 +1,271 @@
+/******************************************************************************
+MIT License
+
+Copyright (c) 2016 Antti-Pekka Hynninen
+Copyright (c) 2016 Oak Ridge National Laboratory (UT-Batelle)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <mutex>
+#include "PlanDatabase.h"
+#include "GpuModel.h"
+#include "kernel.h"
+
+// Version tag written on the first line of the database file, files with another tag are ignored
+static const char* PLAN_DATABASE_VERSION = "#librett-plan-database-3";
+
+// Hash table to store the records, key is built by databaseKey()
+static std::unordered_map<std::string, PlanRecord> planDatabase;
+static std::mutex planDatabaseMutex;
+
+// True after librettPlanDatabaseLoad() has been called
+static bool planDatabaseEnabled = false;
+
+PlanRecord::PlanRecord() {
+  measured = false;
+  method = Unknown;
+  sizeMm = 0;
+  sizeMk = 0;
+  numSplit = 1;
+  splitRank = -1;
+}
+
+std::string librettDeviceName(const gpuDeviceProp_t &prop) {
+  std::string name;
+#if LIBRETT_USES_SYCL
+  name = prop.get_name();
+#elif LIBRETT_USES_HIP
+  name = std::string(prop.name) + "_" + std::string(prop.gcnArchName);
+#elif LIBRETT_USES_CUDA
+  name = std::string(prop.name) + "_sm" + std::to_string(prop.major) + std::to_string(prop.minor);
+#endif
+  // Records are white space separated
+  for (auto& c : name) {
+    if (c == ' ' || c == '\t' || c == '\n') c = '_';
+  }
+  return name;
+}
+
+//
+// Builds hash table key from device, reduced dim, reduced permutation and sizeofType
+//
+static std::string databaseKey(const std::string& device, const int redRank, const int* redDim,
+  const int* redPermutation, const size_t sizeofType) {
+  std::ostringstream key;
+  key << device << " " << sizeofType << " " << redRank;
+  for (int i=0;i < redRank;i++) key << " " << redDim[i];
+  for (int i=0;i < redRank;i++) key << " " << redPermutation[i];
+  return key.str();
+}
+
+bool librettPlanDatabaseLoad(const char* filename) {
+  std::lock_guard<std::mutex> lock(planDatabaseMutex);
+  planDatabaseEnabled = true;
+
+  std::ifstream file(filename);
+  if (!file.is_open()) return false;
+
+  std::string line;
+  if (!std::getline(file, line) || line != PLAN_DATABASE_VERSION) {
+    printf("librettPlanDatabaseLoad: ignoring %s, unknown file format\n", filename);
+    return false;
+  }
+
+  while (std::getline(file, line)) {
+    std::istringstream rec_in(line);
+    std::string device;
+    // Calibrated model parameters
+    if (line.compare(0, 6, "model ") == 0) {
+      std::string tag;
+      double param[6];
+      rec_in >> tag >> device;
+      for (int i=0;i < 6;i++) rec_in >> param[i];
+      if (rec_in.fail()) continue;
+      GpuModelProp modelProp;
+      modelProp.base_dep_delay = param[0];
+      modelProp.base_mem_latency = param[1];
+      modelProp.sh_mem_latency = param[2];
+      modelProp.iter_cycles = param[3];
+      modelProp.fac = param[4];
+      modelProp.hitrate = param[5];
+      librettSetGpuModelProp(device, modelProp);
+      continue;
+    }
+    size_t sizeofType;
+    int measured, redRank;
+    if (!(rec_in >> device >> sizeofType >> measured >> redRank) || redRank < 1) continue;
+    std::vector<int> redDim(redRank);
+    std::vector<int> redPermutation(redRank);
+    for (int i=0;i < redRank;i++) rec_in >> redDim[i];
+    for (int i=0;i < redRank;i++) rec_in >> redPermutation[i];
+    PlanRecord rec;
+    rec.measured = (measured != 0);
+    int rank = 0;
+    if (!(rec_in >> rank) || rank < 1) continue;
+    rec.dim.resize(rank);
+    rec.permutation.resize(rank);
+    for (int i=0;i < rank;i++) rec_in >> rec.dim[i];
+    for (int i=0;i < rank;i++) rec_in >> rec.permutation[i];
+    rec_in >> rec.method >> rec.sizeMm >> rec.sizeMk >> rec.numSplit >> rec.splitRank;
+    if (rec_in.fail()) continue;
+    if (rec.method <= Unknown || rec.method >= NumTransposeMethods || rec.method == Grouped) continue;
+    if (rec.sizeMm < 1 || rec.sizeMm > rank || rec.sizeMk < 1 || rec.sizeMk > rank) continue;
+    if (rec.splitRank < -1 || rec.splitRank >= rank) continue;
+    if (rec.method == PackedSplit ? (rec.splitRank < 0 || rec.numSplit < 1) : (rec.numSplit != 1)) continue;
+    planDatabase[databaseKey(device, redRank, redDim.data(), redPermutation.data(), sizeofType)] = rec;
+  }
+
+  return true;
+}
+
+bool librettPlanDatabaseSave(const char* filename) {
+  std::lock_guard<std::mutex> lock(planDatabaseMutex);
+
+  std::ofstream file(filename);
+  if (!file.is_open()) return false;
+
+  file << PLAN_DATABASE_VERSION << "\n";
+  for (auto it=planDatabase.begin();it != planDatabase.end();it++) {
+    // Key starts with: device sizeofType redRank
+    std::istringstream key_in(it->first);
+    std::string device;
+    size_t sizeofType;
+    key_in >> device >> sizeofType;
+    const PlanRecord& rec = it->second;
+    file << device << " " << sizeofType << " " << (rec.measured ? 1 : 0);
+    // Rest of the key: redRank redDim[] redPerm[]
+    std::string keyRest;
+    std::getline(key_in, keyRest);
+    file << keyRest;
+    file << " " << rec.dim.size();
+    for (size_t i=0;i < rec.dim.size();i++) file << " " << rec.dim[i];
+    for (size_t i=0;i < rec.permutation.size();i++) file << " " << rec.permutation[i];
+    file << " " << rec.method << " " << rec.sizeMm << " " << rec.sizeMk << " " << rec.numSplit << " " << rec.splitRank << "\n";
+  }
+
+  auto modelProps = librettGetGpuModelProps();
+  for (auto it=modelProps.begin();it != modelProps.end();it++) {
+    const GpuModelProp& p = it->second;
+    file << "model " << it->first << " " << p.base_dep_delay << " " << p.base_mem_latency << " "
+      << p.sh_mem_latency << " " << p.iter_cycles << " " << p.fac << " " << p.hitrate << "\n";
+  }
+
+  return file.good();
+}
+
+void librettPlanDatabaseClearHeuristic(const std::string& device) {
+  std::lock_guard<std::mutex> lock(planDatabaseMutex);
+  // Key starts with the device name
+  const std::string prefix = device + " ";
+  for (auto it=planDatabase.begin();it != planDatabase.end();) {
+    if (!it->second.measured && it->first.compare(0, prefix.size(), prefix) == 0) {
+      it = planDatabase.erase(it);
+    } else {
+      it++;
+    }
+  }
+}
+
+bool librettPlanDatabaseEnabled() {
+  std::lock_guard<std::mutex> lock(planDatabaseMutex);
+  return planDatabaseEnabled;
+}
+
+bool librettPlanDatabaseFind(const std::string& device, const int rank, const int* dim, const int* permutation,
+  const int redRank, const int* redDim, const int* redPermutation, const size_t sizeofType,
+  const bool measured, const int deviceID, const gpuDeviceProp_t& prop, librettPlan_t& plan) {
+
+  PlanRecord rec;
+  {
+    std::lock_guard<std::mutex> lock(planDatabaseMutex);
+    if (!planDatabaseEnabled) return false;
+    auto it = planDatabase.find(databaseKey(device, redRank, redDim, redPermutation, sizeofType));
+    if (it == planDatabase.end()) return false;
+    rec = it->second;
+  }
+  if (measured && !rec.measured) return false;
+
+  // Plans that were setup with non-reduced ranks are only valid for the exact same shape
+  const int recRank = rec.dim.size();
+  const int* recDim;
+  const int* recPermutation;
+  if (recRank == redRank) {
+    for (int i=0;i < redRank;i++) {
+      if (rec.dim[i] != redDim[i] || rec.permutation[i] != redPermutation[i]) return false;
+    }
+    recDim = redDim;
+    recPermutation = redPermutation;
+  } else if (recRank == rank) {
+    for (int i=0;i < rank;i++) {
+      if (rec.dim[i] != dim[i] || rec.permutation[i] != permutation[i]) return false;
+    }
+    recDim = dim;
+    recPermutation = permutation;
+  } else {
+    return false;
+  }
+
+  // splitRank < recRank was checked on load
+  if (rec.method == PackedSplit && rec.numSplit > recDim[rec.splitRank]) return false;
+  TensorSplit ts;
+  ts.method = rec.method;
+  ts.numSplit = rec.numSplit;
+  ts.splitRank = rec.splitRank;
+  if (!ts.update(rec.sizeMm, rec.sizeMk, recRank, recDim, recPermutation)) return false;
+
+  // Same launch configuration as createPlans() chooses for the split
+  LaunchConfig lc;
+  const int numActiveBlock = librettKernelLaunchConfiguration(sizeofType, ts, deviceID, prop, lc);
+  if (numActiveBlock == 0) return false;
+
+  return plan.setup(recRank, recDim, recPermutation, sizeofType, ts, lc, numActiveBlock);
+}
+
+void librettPlanDatabaseInsert(const std::string& device, const int rank, const int* dim, const int* permutation,
+  const int redRank, const int* redDim, const int* redPermutation, const size_t sizeofType,
+  const bool measured, const librettPlan_t& plan) {
+
+  const TensorSplit& ts = plan.tensorSplit;
+
+  PlanRecord rec;
+  rec.measured = measured;
+  // plan.rank tells which set of ranks were used to setup the plan
+  if (plan.rank == redRank) {
+    rec.dim.assign(redDim, redDim + redRank);
+    rec.permutation.assign(redPermutation, redPermutation + redRank);
+  } else {
+    rec.dim.assign(dim, dim + rank);
+    rec.permutation.assign(permutation, permutation + rank);
+  }
+  rec.method = ts.method;
+  rec.sizeMm = ts.sizeMm;
+  rec.sizeMk = ts.sizeMk;
+  rec.numSplit = ts.numSplit;
+  rec.splitRank = ts.splitRank;
+
+  std::lock_guard<std::mutex> lock(planDatabaseMutex);
+  if (!planDatabaseEnabled) return;
+  std::string key = databaseKey(device, redRank, redDim, redPermutation, sizeofType);
+  auto it = planDatabase.find(key);
+  if (it != planDatabase.end() && it->second.measured && !measured) return;
+  planDatabase[key] = rec;
+}
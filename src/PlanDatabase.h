@@ -0,0 +1,100 @@
+/******************************************************************************
+MIT License
+
+Copyright (c) 2016 Antti-Pekka Hynninen
+Copyright (c) 2016 Oak Ridge National Laboratory (UT-Batelle)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+#ifndef LIBRETTPLANDATABASE_H
+#define LIBRETTPLANDATABASE_H
+
+#include <string>
+#include <vector>
+#include "plan.h"
+
+//
+// Persistent plan database
+//
+// Stores the plan that was chosen for a
+// (device, reduced dim, reduced permutation, sizeofType) key so that
+// createPlans() and countCycles() can be skipped when the same shape
+// is planned again, possibly in a later run.
+//
+// File format is plain text, one record per line:
+// device sizeofType measured redRank redDim[] redPerm[] rank dim[] perm[]
+// method sizeMm sizeMk numSplit splitRank
+//
+// Only the split is stored, the launch configuration is recomputed for the device
+// when the plan is looked up.
+//
+// Calibrated performance model parameters (see GpuModelProp) are stored as
+// model device base_dep_delay base_mem_latency sh_mem_latency iter_cycles fac hitrate
+//
+class PlanRecord {
+public:
+  // Plan was chosen by librettPlanMeasure()
+  bool measured;
+
+  // Dimensions and permutation that were used to setup the plan
+  // (either the reduced or the original ones)
+  std::vector<int> dim;
+  std::vector<int> permutation;
+
+  // Parameters that fully define the split
+  int method;
+  int sizeMm;
+  int sizeMk;
+  int numSplit;
+  int splitRank;
+
+  PlanRecord();
+};
+
+// Returns string that identifies the device in the database
+std::string librettDeviceName(const gpuDeviceProp_t &prop);
+
+// Loads database from file, returns false if the file can not be read
+bool librettPlanDatabaseLoad(const char* filename);
+
+// Saves database into file, returns false if the file can not be written
+bool librettPlanDatabaseSave(const char* filename);
+
+// Removes heuristic (not measured) plans of device,
+// used when the performance model of the device changes
+void librettPlanDatabaseClearHeuristic(const std::string& device);
+
+// Returns true if the database has been loaded
+bool librettPlanDatabaseEnabled();
+
+// Looks up the plan from database and sets it up with the launch configuration
+// for device deviceID with properties prop.
+// If measured = true, only plans chosen by librettPlanMeasure() are accepted
+// Returns true on hit
+bool librettPlanDatabaseFind(const std::string& device, const int rank, const int* dim, const int* permutation,
+  const int redRank, const int* redDim, const int* redPermutation, const size_t sizeofType,
+  const bool measured, const int deviceID, const gpuDeviceProp_t& prop, librettPlan_t& plan);
+
+// Inserts plan into database.
+// Heuristic plans never replace measured ones
+void librettPlanDatabaseInsert(const std::string& device, const int rank, const int* dim, const int* permutation,
+  const int redRank, const int* redDim, const int* redPermutation, const size_t sizeofType,
+  const bool measured, const librettPlan_t& plan);
+
+#endif // LIBRETTPLANDATABASE_H
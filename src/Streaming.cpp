@@ -0,0 +1,200 @@
+/******************************************************************************
+MIT License
+
+Copyright (c) 2016 Antti-Pekka Hynninen
+Copyright (c) 2016 Oak Ridge National Laboratory (UT-Batelle)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+#include <algorithm>
+#include "Streaming.h"
+#include "GpuUtils.h"
+#include "GpuMem.hpp"
+
+// defined in plan.cpp
+void reduceRanks(const int rank, const int* dim, const int* permutation,
+  std::vector<int>& redDim, std::vector<int>& redPermutation);
+
+//
+// Device helpers. With SYCL the queue knows its device
+//
+static int getDevice() {
+  int device = 0;
+#if LIBRETT_USES_HIP
+  hipCheck(hipGetDevice(&device));
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaGetDevice(&device));
+#endif
+  return device;
+}
+
+static void setDevice(const int device) {
+#if LIBRETT_USES_HIP
+  hipCheck(hipSetDevice(device));
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaSetDevice(device));
+#endif
+}
+
+// Returns half of the free device memory
+static size_t defaultDeviceBytes(gpuStream_t stream) {
+#if LIBRETT_USES_SYCL
+  return stream->get_device().get_info<sycl::info::device::global_mem_size>()/2;
+#else
+  size_t freeBytes, totalBytes;
+  #if LIBRETT_USES_HIP
+  hipCheck(hipMemGetInfo(&freeBytes, &totalBytes));
+  #elif LIBRETT_USES_CUDA
+  cudaCheck(cudaMemGetInfo(&freeBytes, &totalBytes));
+  #endif
+  return freeBytes/2;
+#endif
+}
+
+// Orders the following work after the already submitted work,
+// out-of-order SYCL queues need a barrier
+static void orderStream(gpuStream_t stream) {
+#if LIBRETT_USES_SYCL
+  if (!stream->is_in_order()) stream->ext_oneapi_submit_barrier();
+#endif
+}
+
+librettStreamingPlan_t::librettStreamingPlan_t() : sizeofType(0), deviceID(0), chunkDimFull(0),
+  dimChunked(0), numChunk(0), volInBefore(1), volInAfter(1), volOutBefore(1), volOutAfter(1) {}
+
+librettStreamingPlan_t::~librettStreamingPlan_t() {
+  const int curDevice = getDevice();
+  if (curDevice != deviceID) setDevice(deviceID);
+  for (auto& sd : streamData) {
+    librettDestroy(sd.plan);
+    if (sd.hasLastPlan) librettDestroy(sd.lastPlan);
+    deallocate_device_ordered<char>(&sd.inBuf, sd.stream);
+    deallocate_device_ordered<char>(&sd.outBuf, sd.stream);
+  }
+  if (curDevice != deviceID) setDevice(curDevice);
+}
+
+librettResult librettStreamingPlan_t::setup(const int rank_in, const int* dim_in, const int* permutation_in,
+  const size_t sizeofType_in, const int numStream, gpuStream_t* streams, const size_t maxDeviceBytes) {
+
+  sizeofType = sizeofType_in;
+  deviceID = getDevice();
+
+  std::vector<int> dim;
+  std::vector<int> permutation;
+  reduceRanks(rank_in, dim_in, permutation_in, dim, permutation);
+  const int rank = dim.size();
+  size_t vol = 1;
+  for (int i=0;i < rank;i++) vol *= dim[i];
+
+  // Volume of the ranks before c in the input and in the output
+  auto volBeforeIn = [&](const int c) {
+    size_t v = 1;
+    for (int i=0;i < c;i++) v *= dim[i];
+    return v;
+  };
+  auto volBeforeOut = [&](const int c) {
+    size_t v = 1;
+    for (int i=0;permutation[i] != c;i++) v *= dim[permutation[i]];
+    return v;
+  };
+
+  // Slowest input rank gives contiguous input chunks, slowest output rank contiguous output chunks
+  const int slowestIn = rank - 1;
+  const int slowestOut = permutation[rank - 1];
+  const int c = (volBeforeOut(slowestIn) >= volBeforeIn(slowestOut)) ? slowestIn : slowestOut;
+
+  dimChunked = dim[c];
+  volInBefore = volBeforeIn(c);
+  volInAfter = vol/(volInBefore*dimChunked);
+  volOutBefore = volBeforeOut(c);
+  volOutAfter = vol/(volOutBefore*dimChunked);
+
+  // Input and output buffer on each stream
+  const size_t deviceBytes = (maxDeviceBytes > 0) ? maxDeviceBytes : defaultDeviceBytes(streams[0]);
+  const size_t sliceBytes = vol/dimChunked*sizeofType;
+  chunkDimFull = (int)std::max<size_t>(1, std::min<size_t>(dimChunked, deviceBytes/(2*numStream*sliceBytes)));
+  numChunk = (dimChunked - 1)/chunkDimFull + 1;
+  const int lastChunkDim = dimChunked - (numChunk - 1)*chunkDimFull;
+
+  const int numStreamUsed = std::min(numStream, numChunk);
+  streamData.resize(numStreamUsed);
+  for (int i=0;i < numStreamUsed;i++) {
+    StreamData& sd = streamData[i];
+    sd.stream = streams[i];
+    sd.hasLastPlan = false;
+    sd.inBuf = nullptr;
+    sd.outBuf = nullptr;
+  }
+  for (int i=0;i < numStreamUsed;i++) {
+    StreamData& sd = streamData[i];
+    std::vector<int> chunkDim(dim);
+    chunkDim[c] = chunkDimFull;
+    librettResult result = librettPlan(&sd.plan, rank, chunkDim.data(), permutation.data(), sizeofType, sd.stream);
+    if (result != LIBRETT_SUCCESS) {
+      streamData.resize(i);
+      return result;
+    }
+    if (lastChunkDim != chunkDimFull) {
+      chunkDim[c] = lastChunkDim;
+      result = librettPlan(&sd.lastPlan, rank, chunkDim.data(), permutation.data(), sizeofType, sd.stream);
+      if (result != LIBRETT_SUCCESS) {
+        librettDestroy(sd.plan);
+        streamData.resize(i);
+        return result;
+      }
+      sd.hasLastPlan = true;
+    }
+    allocate_device<char>(&sd.inBuf, chunkDimFull*sliceBytes, sd.stream);
+    allocate_device<char>(&sd.outBuf, chunkDimFull*sliceBytes, sd.stream);
+  }
+
+  return LIBRETT_SUCCESS;
+}
+
+librettResult librettStreamingPlan_t::execute(const void* idata, void* odata) {
+  std::lock_guard<std::mutex> lock(executeMutex);
+
+  const int curDevice = getDevice();
+  if (curDevice != deviceID) setDevice(deviceID);
+
+  const char* in = (const char*)idata;
+  char* out = (char*)odata;
+  librettResult result = LIBRETT_SUCCESS;
+  for (int j=0;j < numChunk && result == LIBRETT_SUCCESS;j++) {
+    StreamData& sd = streamData[j % streamData.size()];
+    const size_t start = (size_t)j*chunkDimFull;
+    const size_t chunkDim = std::min<size_t>(chunkDimFull, dimChunked - start);
+    const size_t inRowBytes = volInBefore*chunkDim*sizeofType;
+    const size_t outRowBytes = volOutBefore*chunkDim*sizeofType;
+
+    copy_2D_async(sd.inBuf, inRowBytes, in + start*volInBefore*sizeofType, volInBefore*dimChunked*sizeofType,
+      inRowBytes, volInAfter, sd.stream);
+    orderStream(sd.stream);
+    result = librettExecute((chunkDim == chunkDimFull) ? sd.plan : sd.lastPlan, sd.inBuf, sd.outBuf);
+    orderStream(sd.stream);
+    copy_2D_async(out + start*volOutBefore*sizeofType, volOutBefore*dimChunked*sizeofType, sd.outBuf, outRowBytes,
+      outRowBytes, volOutAfter, sd.stream);
+    // Buffers are reused by the next chunk of the stream
+    orderStream(sd.stream);
+  }
+
+  if (curDevice != deviceID) setDevice(curDevice);
+  return result;
+}
@@ -0,0 +1,87 @@
+/******************************************************************************
+MIT License
+
+Copyright (c) 2016 Antti-Pekka Hynninen
+Copyright (c) 2016 Oak Ridge National Laboratory (UT-Batelle)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+#ifndef LIBRETTSTREAMING_H
+#define LIBRETTSTREAMING_H
+
+#include <vector>
+#include <mutex>
+#include "librett.h"
+#include "uniapi.h"
+
+//
+// Transpose of a tensor in host memory that does not fit into device memory
+//
+// The tensor is cut into chunks along rank c, the slowest input or output rank.
+// Chunk j holds indices [j*chunkDim, (j+1)*chunkDim) of c and is handled on stream j % numStream:
+// 2D copy of the chunk into the input buffer of the stream, transpose into the output buffer,
+// 2D copy into the host output. Chunks on different streams overlap, so with three streams
+// the host to device copy, the transpose and the device to host copy of consecutive chunks
+// run at the same time.
+//
+// Rank c is the one whose copies move the longest contiguous rows: with
+// L = volume of the ranks before c (in the input or output order), a chunk is copied as
+// volume/(L*dim[c]) rows of L*chunkDim elements on one side and in one piece on the other.
+//
+class librettStreamingPlan_t {
+public:
+
+  librettStreamingPlan_t();
+  ~librettStreamingPlan_t();
+
+  librettResult setup(const int rank, const int* dim, const int* permutation, const size_t sizeofType_in,
+    const int numStream, gpuStream_t* streams_in, const size_t maxDeviceBytes);
+
+  librettResult execute(const void* idata, void* odata);
+
+private:
+
+  struct StreamData {
+    gpuStream_t stream;
+    // Plans for full chunks and for the last, partial one
+    librettHandle plan;
+    librettHandle lastPlan;
+    bool hasLastPlan;
+    char* inBuf;
+    char* outBuf;
+  };
+
+  size_t sizeofType;
+  int deviceID;
+
+  // Chunked rank c and chunk size
+  int chunkDimFull;
+  int dimChunked;
+  int numChunk;
+  // Volumes of the ranks before and after c, in the input and in the output
+  size_t volInBefore, volInAfter;
+  size_t volOutBefore, volOutAfter;
+
+  std::vector<StreamData> streamData;
+
+  // Execution reuses the buffers of the plan
+  std::mutex executeMutex;
+};
+
+#endif // LIBRETTSTREAMING_H
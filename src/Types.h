@@ -27,19 +27,70 @@ SOFTWARE.
 
 #define MAX_REG_STORAGE 8
 
+// Tiled and TiledCopy kernels are specialized for Mbar of up to this many ranks
+#define MAX_MBAR_SPECIALIZED 4
+
+// Divisor of fastDivide(), see FastDiv.h. The default divides by 1
+struct FastDiv {
+  unsigned int mul = 0;
+  unsigned int shift = 0;
+};
+
 struct TensorConv {
   int c;
   int d;
   int ct;
 };
 
-struct TensorConvInOut {
+// Strides (ct) are positions in the full tensor and use the index type IndexT,
+// c and d are bounded by the volume of the sub-tensor and always fit into an int.
+// *_div are the fast divisors of c and d, set with setFastDiv()
+template <typename IndexT>
+struct TensorConvInOutT {
   int c_in;
   int d_in;
-  int ct_in;
+  IndexT ct_in;
   int c_out;
   int d_out;
-  int ct_out;
+  IndexT ct_out;
+  FastDiv c_in_div;
+  FastDiv d_in_div;
+  FastDiv c_out_div;
+  FastDiv d_out_div;
+};
+
+typedef TensorConvInOutT<int> TensorConvInOut;
+// For tensors with more than 2^31 elements
+typedef TensorConvInOutT<long long int> TensorConvInOut64;
+
+// Mbar of at most MAX_MBAR_SPECIALIZED ranks, passed to the specialized kernels by value
+template <typename IndexT>
+struct MbarParamT {
+  TensorConvInOutT<IndexT> m[MAX_MBAR_SPECIALIZED];
+};
+
+// One problem of a grouped transpose. Problems are laid out one after another
+// along the grid, each thread block transposes one tile of one problem
+struct TensorGroup {
+  // First thread block of the problem
+  int blockStart;
+  // Number of tiles along the fastest input rank and in total
+  int numMm;
+  int numTile;
+  // Remaining volume, decomposed by sizeMbar entries starting at Mbar[mbarOffset]
+  int volMbar;
+  int sizeMbar;
+  int mbarOffset;
+  // Volume of the tile ranks and their strides
+  int tiledVolX;
+  int tiledVolY;
+  int cuDimMk;
+  int cuDimMm;
+  // Fastest rank is the same in input and output
+  int copy;
+  // Element offsets of the problem in dataIn and dataOut
+  long long int inOffset;
+  long long int outOffset;
 };
 
 #endif // LIBRETTTYPES_H
@@ -0,0 +1,89 @@
+/******************************************************************************
+MIT License
+
+Copyright (c) 2016 Antti-Pekka Hynninen
+Copyright (c) 2016 Oak Ridge National Laboratory (UT-Batelle)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+#include <cstdio>
+#include <atomic>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include "WorkloadTrace.h"
+
+struct TraceEntry {
+  long long int numPlan;
+  long long int numExecute;
+};
+
+// Counts by trace line, std::map keeps the file sorted
+static std::map<std::string, TraceEntry> traceEntries;
+// Trace line of the traced handles
+static std::unordered_map<librettHandle, std::string> traceHandles;
+static std::mutex traceMutex;
+
+static std::atomic<bool> traceEnabled(false);
+
+void librettTraceEnable(const bool enable) {
+  traceEnabled = enable;
+}
+
+bool librettTraceEnabled() {
+  return traceEnabled;
+}
+
+void librettTracePlan(const librettHandle handle, const std::string& device, const int rank, const int* dim,
+  const int* permutation, const size_t sizeofType) {
+  std::string line;
+  for (int i=0;i < rank;i++) line += std::to_string(dim[i]) + " ";
+  line += ":";
+  for (int i=0;i < rank;i++) line += " " + std::to_string(permutation[i]);
+  line += " : " + std::to_string(sizeofType) + " # " + device;
+
+  std::lock_guard<std::mutex> lock(traceMutex);
+  // New entries are zero initialized
+  traceEntries[line].numPlan++;
+  traceHandles[handle] = line;
+}
+
+void librettTraceExecute(const librettHandle handle) {
+  std::lock_guard<std::mutex> lock(traceMutex);
+  auto it = traceHandles.find(handle);
+  if (it != traceHandles.end()) traceEntries[it->second].numExecute++;
+}
+
+void librettTraceDestroy(const librettHandle handle) {
+  std::lock_guard<std::mutex> lock(traceMutex);
+  traceHandles.erase(handle);
+}
+
+bool librettTraceSave(const char* filename) {
+  std::lock_guard<std::mutex> lock(traceMutex);
+  if (traceEntries.empty()) return true;
+  FILE* fp = fopen(filename, "a");
+  if (fp == NULL) return false;
+  for (auto it=traceEntries.begin();it != traceEntries.end();it++) {
+    fprintf(fp, "%s plans %lld executes %lld\n", it->first.c_str(), it->second.numPlan, it->second.numExecute);
+  }
+  bool ok = (fclose(fp) == 0);
+  traceEntries.clear();
+  return ok;
+}
@@ -0,0 +1,60 @@
+/******************************************************************************
+MIT License
+
+Copyright (c) 2016 Antti-Pekka Hynninen
+Copyright (c) 2016 Oak Ridge National Laboratory (UT-Batelle)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+#ifndef LIBRETTWORKLOADTRACE_H
+#define LIBRETTWORKLOADTRACE_H
+
+#include <string>
+#include "librett.h"
+
+//
+// Workload trace
+//
+// Counts plan creations and executions per (device, dim, permutation, sizeofType)
+// so that the shapes of an application can be tuned offline (librett_bench -tune).
+//
+// File format is plain text that librett_bench -shapes reads, one shape per line:
+// dim[] : perm[] : sizeofType # device plans numPlan executes numExecute
+//
+
+// Enables or disables tracing of calls made after this call
+void librettTraceEnable(const bool enable);
+
+// Returns true if tracing is enabled
+bool librettTraceEnabled();
+
+// Records creation of plan handle
+void librettTracePlan(const librettHandle handle, const std::string& device, const int rank, const int* dim,
+  const int* permutation, const size_t sizeofType);
+
+// Records execution of plan handle, ignored for handles that were not traced
+void librettTraceExecute(const librettHandle handle);
+
+// Forgets plan handle, its counts are kept
+void librettTraceDestroy(const librettHandle handle);
+
+// Appends the trace into file and clears it, returns false if the file can not be written
+bool librettTraceSave(const char* filename);
+
+#endif // LIBRETTWORKLOADTRACE_H
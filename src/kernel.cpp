@@ -29,7 +29,14 @@ All rights reserved.
 #include "GpuUtils.h"
 #include "LRUCache.h"
 #include "kernel.h"
+#include "FastDiv.h"
 #include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <type_traits>
+#include <mutex>
 #include "unistd.h"
 
 #define RESTRICT __restrict__
@@ -39,16 +46,232 @@ All rights reserved.
 #  pragma clang diagnostic ignored "-Wpass-failed"
 #endif
 
+//
+// How the kernels store to dataOut:
+// StoreCopy       : dataOut = dataIn
+// StoreScale      : dataOut = alpha*dataIn
+// StoreAccumulate : dataOut = alpha*dataIn + beta*dataOut
+//
+enum StoreMode {StoreCopy, StoreScale, StoreAccumulate};
+
+__gpu_inline__ float scalarMul(const float a, const float b) {return a*b;}
+__gpu_inline__ double scalarMul(const double a, const double b) {return a*b;}
+__gpu_inline__ librett_complex_float scalarMul(const librett_complex_float a, const librett_complex_float b) {
+#if LIBRETT_USES_SYCL
+  return a*b;
+#elif LIBRETT_USES_HIP
+  return hipCmulf(a, b);
+#elif LIBRETT_USES_CUDA
+  return cuCmulf(a, b);
+#endif
+}
+__gpu_inline__ librett_complex scalarMul(const librett_complex a, const librett_complex b) {
+#if LIBRETT_USES_SYCL
+  return a*b;
+#elif LIBRETT_USES_HIP
+  return hipCmul(a, b);
+#elif LIBRETT_USES_CUDA
+  return cuCmul(a, b);
+#endif
+}
+
+__gpu_inline__ float scalarAdd(const float a, const float b) {return a+b;}
+__gpu_inline__ double scalarAdd(const double a, const double b) {return a+b;}
+__gpu_inline__ librett_complex_float scalarAdd(const librett_complex_float a, const librett_complex_float b) {
+#if LIBRETT_USES_SYCL
+  return a+b;
+#elif LIBRETT_USES_HIP
+  return hipCaddf(a, b);
+#elif LIBRETT_USES_CUDA
+  return cuCaddf(a, b);
+#endif
+}
+__gpu_inline__ librett_complex scalarAdd(const librett_complex a, const librett_complex b) {
+#if LIBRETT_USES_SYCL
+  return a+b;
+#elif LIBRETT_USES_HIP
+  return hipCadd(a, b);
+#elif LIBRETT_USES_CUDA
+  return cuCadd(a, b);
+#endif
+}
+
+//
+// Converts element of input type T to the output type TOut of the plan.
+// Real values become complex values with zero imaginary part, half precision goes through float
+//
+template <typename TOut, typename T>
+__gpu_inline__ TOut convertElement(const T val) {
+  if constexpr (std::is_same<T, TOut>::value) {
+    return val;
+  } else if constexpr (std::is_same<TOut, librett_complex>::value) {
+#if LIBRETT_USES_SYCL
+    return librett_complex((double)val, 0.0);
+#elif LIBRETT_USES_HIP
+    return make_hipDoubleComplex((double)val, 0.0);
+#elif LIBRETT_USES_CUDA
+    return make_cuDoubleComplex((double)val, 0.0);
+#endif
+  } else if constexpr (std::is_same<T, librett_half>::value) {
+    return (TOut)((float)val);
+  } else if constexpr (std::is_same<TOut, librett_half>::value) {
+    return librett_half((float)val);
+  } else {
+    return (TOut)val;
+  }
+}
+
+template <int storeMode, typename T, typename TOut, typename IndexT>
+__gpu_inline__ void storeElement(TOut* RESTRICT dataOut, const IndexT pos, const T val, const T alpha, const T beta) {
+  // 1 and 2 byte types and type conversions are never scaled (librettKernel() refuses alpha and beta for them),
+  // the check only keeps their scaled instantiations compiling
+  if constexpr (!std::is_same<T, TOut>::value) {
+    dataOut[pos] = convertElement<TOut>(val);
+  } else if constexpr (storeMode == StoreCopy || sizeof(T) < 4) {
+    dataOut[pos] = val;
+  } else if constexpr (storeMode == StoreScale) {
+    dataOut[pos] = scalarMul(alpha, val);
+  } else {
+    dataOut[pos] = scalarAdd(scalarMul(alpha, val), scalarMul(beta, dataOut[pos]));
+  }
+}
+
+//
+// Vector of V consecutive elements that is loaded and stored with a single access
+//
+template <typename T, int V>
+struct alignas(sizeof(T)*V) VecType {
+  T v[V];
+};
+
+template <int storeMode, typename T, typename TOut, int V, typename IndexT>
+__gpu_inline__ void storeVector(TOut* RESTRICT dataOut, const IndexT pos, const VecType<T, V>& val,
+  const T alpha, const T beta) {
+  if constexpr (!std::is_same<T, TOut>::value) {
+    // Converted in registers, still stored with a single access
+    VecType<TOut, V> valOut;
+#pragma unroll
+    for (int k=0;k < V;k++) valOut.v[k] = convertElement<TOut>(val.v[k]);
+    *reinterpret_cast<VecType<TOut, V>*>(dataOut + pos) = valOut;
+  } else if constexpr (storeMode == StoreCopy) {
+    *reinterpret_cast<VecType<T, V>*>(dataOut + pos) = val;
+  } else {
+#pragma unroll
+    for (int k=0;k < V;k++) storeElement<storeMode>(dataOut, pos + k, val.v[k], alpha, beta);
+  }
+}
+
+//
+// Positions of posMbar in dataIn and dataOut when Mbar has numMbar ranks, known at compile time.
+// The ranks are kernel parameters, no warp reduction is needed
+//
+template <int numMbar, typename IndexT>
+__gpu_inline__ void mbarPosition(const int posMbar, const MbarParamT<IndexT>& mbarParam,
+  IndexT& posIn, IndexT& posOut) {
+  posIn = 0;
+  posOut = 0;
+#pragma unroll
+  for (int i=0;i < numMbar;i++) {
+    posIn  += fastDivMod(posMbar, mbarParam.m[i].c_in_div, mbarParam.m[i].d_in_div, mbarParam.m[i].d_in) *mbarParam.m[i].ct_in;
+    posOut += fastDivMod(posMbar, mbarParam.m[i].c_out_div, mbarParam.m[i].d_out_div, mbarParam.m[i].d_out)*mbarParam.m[i].ct_out;
+  }
+}
+
+//
+// Scaled copy, used by the Trivial method when dataOut is not a plain copy of dataIn
+// (scaled, accumulated or of different type TOut)
+//
+template <typename T, int storeMode, typename IndexT, typename TOut = T>
+__global__ void scaleCopy(const IndexT volume, const T* RESTRICT dataIn, TOut* RESTRICT dataOut,
+  const T alpha, const T beta
+#if LIBRETT_USES_SYCL
+  , sycl::nd_item<3>& item
+#endif
+  )
+{
+  for (IndexT pos=(IndexT)blockIdx_x*blockDim_x + threadIdx_x; pos < volume; pos += (IndexT)blockDim_x*gridDim_x) {
+    storeElement<storeMode>(dataOut, pos, dataIn[pos], alpha, beta);
+  }
+}
+
+//
+// Passes of the in-place transpose of a row-major m x n matrix of blocks, see InPlace.h.
+// Blocks are numWord words. c = gcd(m, n), a = m/c, b = n/c
+//
+// pass 0: column j is rotated,        A'[i][j] = A[(i + j/b) % m][j]
+// pass 1: row i is scattered,         A'[i][((i + j/b) % m + j*m) % n] = A[i][j]
+// pass 2: column j is gathered,       A'[i][j] = A[(j + i*n - i/a) % m][j]
+//
+// inPlaceGather writes the permuted rows (pass 1) or columns (passes 0 and 2)
+// first ... first+count-1 into scratch, inPlaceStoreColumns copies columns back
+//
+template <typename T>
+__global__ void inPlaceGather(const int pass, const long long m, const long long n,
+  const long long a, const long long b, const long long first, const long long count,
+  const long long numWord, const T* RESTRICT data, T* RESTRICT scratch
+#if LIBRETT_USES_SYCL
+  , sycl::nd_item<3>& item
+#endif
+  )
+{
+  const long long volume = ((pass == 1) ? count*n : m*count)*numWord;
+  for (long long t=(long long)blockIdx_x*blockDim_x + threadIdx_x; t < volume; t += (long long)blockDim_x*gridDim_x) {
+    const long long blk = t/numWord;
+    const long long e = t - blk*numWord;
+    long long src, dst;
+    if (pass == 1) {
+      const long long ii = blk/n;
+      const long long j = blk - ii*n;
+      const long long i = first + ii;
+      src = i*n + j;
+      dst = ii*n + ((i + j/b) % m + j*m) % n;
+    } else {
+      const long long i = blk/count;
+      const long long jj = blk - i*count;
+      const long long j = first + jj;
+      const long long row = (pass == 0) ? (i + j/b) % m : (j + i*n - i/a) % m;
+      src = row*n + j;
+      dst = blk;
+    }
+    scratch[dst*numWord + e] = data[src*numWord + e];
+  }
+}
+
+template <typename T>
+__global__ void inPlaceStoreColumns(const long long m, const long long n, const long long first,
+  const long long count, const long long numWord, const T* RESTRICT scratch, T* RESTRICT data
+#if LIBRETT_USES_SYCL
+  , sycl::nd_item<3>& item
+#endif
+  )
+{
+  const long long volume = m*count*numWord;
+  for (long long t=(long long)blockIdx_x*blockDim_x + threadIdx_x; t < volume; t += (long long)blockDim_x*gridDim_x) {
+    const long long blk = t/numWord;
+    const long long e = t - blk*numWord;
+    const long long i = blk/count;
+    const long long jj = blk - i*count;
+    data[(i*n + first + jj)*numWord + e] = scratch[t];
+  }
+}
+
 //
 // Transpose when Mm and Mk don't overlap and contain only single rank
+// Each thread reads vecWidth consecutive elements of Mm with one access,
+// the tile is TILEDIM*vecWidth elements wide. Element k of thread x is stored in
+// tile column k*TILEDIM + x so that the shared memory stores are conflict free.
+// numMbar >= 0: Mbar has numMbar ranks given in mbarParam, otherwise sizeMbar ranks in glMbar
 //
 //  dim3 numthread(TILEDIM, TILEROWS, 1);
-//  dim3 numblock( ((plan.volMm-1)/TILEDIM+1)*((plan.volMk-1)/TILEDIM+1), 1, plan.volMbar);
+//  dim3 numblock( ((plan.volMm-1)/(TILEDIM*vecWidth)+1)*((plan.volMk-1)/TILEDIM+1), 1, plan.volMbar);
 //
-template <typename T>
+template <typename T, int storeMode = StoreCopy, typename IndexT = int, int vecWidth = 1, int numMbar = -1,
+  typename TOut = T>
 __global__ void transposeTiled(const int numMm, const int volMbar, const int sizeMbar,
-  const int2_t tiledVol, const int cuDimMk, const int cuDimMm,
-  const TensorConvInOut* RESTRICT glMbar, const T* RESTRICT dataIn, T* RESTRICT dataOut
+  const int2_t tiledVol, const IndexT cuDimMk, const IndexT cuDimMm,
+  const TensorConvInOutT<IndexT>* RESTRICT glMbar, const MbarParamT<IndexT> mbarParam,
+  const T* RESTRICT dataIn, TOut* RESTRICT dataOut,
+  const T alpha, const T beta
 #if LIBRETT_USES_SYCL
   , sycl::nd_item<3>& item
 #endif
@@ -58,82 +281,96 @@ __global__ void transposeTiled(const int numMm, const int volMbar, const int siz
 #if LIBRETT_USES_SYCL
   sycl::group wrk_grp = item.get_group();
   sycl::sub_group sg = item.get_sub_group();
-  #ifdef LIBRETT_SUBGROUP_SIZE64
-  using tile_t = T[TILEDIM][TILEDIM];
-  #else
-  using tile_t = T[TILEDIM][TILEDIM+1];
-  #endif
+  using tile_t = T[TILEDIM][TILEDIM*vecWidth + tilePad(sizeof(T))];
   tile_t& shTile = *sycl::ext::oneapi::group_local_memory_for_overwrite<tile_t>(wrk_grp);
   const int warpSize = sg.get_local_range().get(0);
-#elif LIBRETT_USES_HIP
-  __shared__ T shTile[TILEDIM][TILEDIM];
-#elif LIBRETT_USES_CUDA
-  __shared__ T shTile[TILEDIM][TILEDIM+1];
+#else
+  __shared__ T shTile[TILEDIM][TILEDIM*vecWidth + tilePad(sizeof(T))];
 #endif
+  using vec_t = VecType<T, vecWidth>;
 
   const int warpLane = threadIdx_x & (warpSize - 1);
 
-  TensorConvInOut Mbar;
+  TensorConvInOutT<IndexT> Mbar;
   Mbar.c_in = 1;
   Mbar.d_in = 1;
   Mbar.c_out = 1;
   Mbar.d_out = 1;
-  if (warpLane < sizeMbar) {
+  if (numMbar < 0 && warpLane < sizeMbar) {
     Mbar = glMbar[warpLane];
   }
 
-  const int bx = (blockIdx_x % numMm)*TILEDIM;
+  const int bx = (blockIdx_x % numMm)*TILEDIM*vecWidth;
   const int by = (blockIdx_x / numMm)*TILEDIM;
 
-  const int xin = bx + threadIdx_x;
+  const int xin = bx + threadIdx_x*vecWidth;
   const int yin = by + threadIdx_y;
 
   const int xout = bx + threadIdx_y;
   const int yout = by + threadIdx_x;
 
+  // Tile is written in vecWidth parts of TILEDIM columns, maskOutx[k] is the mask of part k
 #if LIBRETT_USES_SYCL
   const unsigned long long int maskIny = ballot(sg, (yin + warpLane < tiledVol.y())).s0() * (xin < tiledVol.x());
-  const unsigned long long int maskOutx = ballot(sg, (xout + warpLane < tiledVol.x())).s0() * (yout < tiledVol.y());
+  unsigned long long int maskOutx[vecWidth];
+#pragma unroll
+  for (int k=0;k < vecWidth;k++) {
+    maskOutx[k] = ballot(sg, (xout + k*TILEDIM + warpLane < tiledVol.x())).s0() * (yout < tiledVol.y());
+  }
   const unsigned long long int one = 1;
 #elif LIBRETT_USES_HIP
   // AMD change
   const unsigned long long int maskIny = __ballot((yin + warpLane < tiledVol.y))*(xin < tiledVol.x);
-  const unsigned long long int maskOutx = __ballot((xout + warpLane < tiledVol.x))*(yout < tiledVol.y);
+  unsigned long long int maskOutx[vecWidth];
+#pragma unroll
+  for (int k=0;k < vecWidth;k++) {
+    maskOutx[k] = __ballot((xout + k*TILEDIM + warpLane < tiledVol.x))*(yout < tiledVol.y);
+  }
   const unsigned long long int one = 1;
 #elif LIBRETT_USES_CUDA
   const unsigned int maskIny = __ballot_sync(0xffffffff,(yin + warpLane < tiledVol.y))*(xin < tiledVol.x);
-  const unsigned int maskOutx = __ballot_sync(0xffffffff,(xout + warpLane < tiledVol.x))*(yout < tiledVol.y);
+  unsigned int maskOutx[vecWidth];
+#pragma unroll
+  for (int k=0;k < vecWidth;k++) {
+    maskOutx[k] = __ballot_sync(0xffffffff,(xout + k*TILEDIM + warpLane < tiledVol.x))*(yout < tiledVol.y);
+  }
   const unsigned int one = 1;
 #endif
 
-  const int posMinorIn = xin + yin*cuDimMk;
-  const int posMinorOut = yout + xout*cuDimMm;
-  const int posInAdd = TILEROWS*cuDimMk;
-  const int posOutAdd = TILEROWS*cuDimMm;
+  const IndexT posMinorIn = xin + yin*cuDimMk;
+  const IndexT posMinorOut = yout + xout*cuDimMm;
+  const IndexT posInAdd = TILEROWS*cuDimMk;
+  const IndexT posOutAdd = TILEROWS*cuDimMm;
 
   for (int posMbar=blockIdx_z; posMbar < volMbar; posMbar += gridDim_z)
   {
     // Compute global memory positions
-    int posMajorIn = ((posMbar/Mbar.c_in) % Mbar.d_in)*Mbar.ct_in;
-    int posMajorOut = ((posMbar/Mbar.c_out) % Mbar.d_out)*Mbar.ct_out;
+    IndexT posMajorIn;
+    IndexT posMajorOut;
+    if constexpr (numMbar >= 0) {
+      mbarPosition<numMbar>(posMbar, mbarParam, posMajorIn, posMajorOut);
+    } else {
+      posMajorIn = fastDivMod(posMbar, Mbar.c_in_div, Mbar.d_in_div, Mbar.d_in)*Mbar.ct_in;
+      posMajorOut = fastDivMod(posMbar, Mbar.c_out_div, Mbar.d_out_div, Mbar.d_out)*Mbar.ct_out;
 #if LIBRETT_USES_SYCL
-    posMajorIn  = sycl::reduce_over_group(sg, posMajorIn,  sycl::plus<int>());
-    posMajorOut = sycl::reduce_over_group(sg, posMajorOut, sycl::plus<int>());
+      posMajorIn  = sycl::reduce_over_group(sg, posMajorIn,  sycl::plus<IndexT>());
+      posMajorOut = sycl::reduce_over_group(sg, posMajorOut, sycl::plus<IndexT>());
 #else // FOR CUDA, HIP only
-    #pragma unroll
-    for (int i=warpSize/2; i >= 1; i/=2) {  // AMD change
-      #if LIBRETT_USES_HIP
-        posMajorIn += __shfl_xor(posMajorIn,i);
-        posMajorOut += __shfl_xor(posMajorOut,i);
-      #elif LIBRETT_USES_CUDA
-        posMajorIn += __shfl_xor_sync(0xffffffff,posMajorIn,i);
-        posMajorOut += __shfl_xor_sync(0xffffffff,posMajorOut,i);
-      #endif
-    }
+      #pragma unroll
+      for (int i=warpSize/2; i >= 1; i/=2) {  // AMD change
+        #if LIBRETT_USES_HIP
+          posMajorIn += __shfl_xor(posMajorIn,i);
+          posMajorOut += __shfl_xor(posMajorOut,i);
+        #elif LIBRETT_USES_CUDA
+          posMajorIn += __shfl_xor_sync(0xffffffff,posMajorIn,i);
+          posMajorOut += __shfl_xor_sync(0xffffffff,posMajorOut,i);
+        #endif
+      }
 #endif // SYCL
+    }
 
-    int posIn = posMajorIn + posMinorIn;
-    int posOut = posMajorOut + posMinorOut;
+    IndexT posIn = posMajorIn + posMinorIn;
+    IndexT posOut = posMajorOut + posMinorOut;
 
     // Read from global memory
     #if LIBRETT_USES_SYCL
@@ -148,7 +385,9 @@ __global__ void transposeTiled(const int numMm, const int volMbar, const int siz
       // int pos = posIn + j*cuDimMk;
       // if (xin < readVol.x && yin + j < readVol.y) {
       if ((maskIny & (one << j)) != 0) {   // AMD change
-        shTile[threadIdx_y + j][threadIdx_x] = dataIn[posIn];
+        const vec_t val = *reinterpret_cast<const vec_t*>(dataIn + posIn);
+#pragma unroll
+        for (int k=0;k < vecWidth;k++) shTile[threadIdx_y + j][k*TILEDIM + threadIdx_x] = val.v[k];
       }
       posIn += posInAdd;
     }
@@ -161,11 +400,14 @@ __global__ void transposeTiled(const int numMm, const int volMbar, const int siz
     #endif
 
 #pragma unroll
-    for (int j=0; j < TILEDIM; j += TILEROWS) {
+    for (int j=0; j < TILEDIM*vecWidth; j += TILEROWS) {
       // int pos = posOut + j*cuDimMm;
       // if (xout + j < readVol.x && yout < readVol.y) {
-      if ((maskOutx & (one << j)) != 0 ) {   // AMD change
-        dataOut[posOut] = shTile[threadIdx_x][threadIdx_y + j];
+      if ((maskOutx[j/TILEDIM] & (one << (j % TILEDIM))) != 0 ) {   // AMD change
+        // Column x of the input tile is stored in tile column (x % vecWidth)*TILEDIM + x/vecWidth
+        const int x = threadIdx_y + j;
+        storeElement<storeMode>(dataOut, posOut, shTile[threadIdx_x][(x % vecWidth)*TILEDIM + x/vecWidth],
+          alpha, beta);
       }
       posOut += posOutAdd;
     }
@@ -174,17 +416,116 @@ __global__ void transposeTiled(const int numMm, const int volMbar, const int siz
 
 }
 
+//
+// Grouped transpose of tensors with different shapes, see librettPlan_t::setupGrouped()
+// Each thread block transposes one tile of one problem
+//
+//  dim3 numthread(TILEDIM, TILEROWS, 1);
+//  dim3 numblock(sum of numTile*volMbar over problems, 1, 1);
+//
+template <typename T, int storeMode = StoreCopy>
+__global__ void transposeGrouped(const int numGroup, const TensorGroup* RESTRICT glGroup,
+  const TensorConvInOut* RESTRICT glMbar, const T* RESTRICT dataIn, T* RESTRICT dataOut,
+  const T alpha, const T beta
+#if LIBRETT_USES_SYCL
+  , sycl::nd_item<3>& item
+#endif
+  )
+{
+  // Shared memory
+#if LIBRETT_USES_SYCL
+  sycl::group wrk_grp = item.get_group();
+  using tile_t = T[TILEDIM][TILEDIM + tilePad(sizeof(T))];
+  tile_t& shTile = *sycl::ext::oneapi::group_local_memory_for_overwrite<tile_t>(wrk_grp);
+#else
+  __shared__ T shTile[TILEDIM][TILEDIM + tilePad(sizeof(T))];
+#endif
+
+  // Find the problem of this block, problems are sorted by blockStart
+  int lo = 0;
+  int hi = numGroup - 1;
+  while (lo < hi) {
+    const int mid = (lo + hi + 1)/2;
+    if (glGroup[mid].blockStart <= (int)blockIdx_x) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  const TensorGroup grp = glGroup[lo];
+
+  const int block = blockIdx_x - grp.blockStart;
+  const int posMbar = block / grp.numTile;
+  const int tile = block % grp.numTile;
+
+  // Compute global memory positions
+  int posMajorIn = 0;
+  int posMajorOut = 0;
+  for (int i=0;i < grp.sizeMbar;i++) {
+    const TensorConvInOut Mbar = glMbar[grp.mbarOffset + i];
+    posMajorIn  += fastDivMod(posMbar, Mbar.c_in_div, Mbar.d_in_div, Mbar.d_in)*Mbar.ct_in;
+    posMajorOut += fastDivMod(posMbar, Mbar.c_out_div, Mbar.d_out_div, Mbar.d_out)*Mbar.ct_out;
+  }
+  const T* RESTRICT in = dataIn + grp.inOffset + posMajorIn;
+  T* RESTRICT out = dataOut + grp.outOffset + posMajorOut;
+
+  const int bx = (tile % grp.numMm)*TILEDIM;
+  const int by = (tile / grp.numMm)*TILEDIM;
+
+  const int xin = bx + threadIdx_x;
+  const int yin = by + threadIdx_y;
+
+  if (grp.copy) {
+    // Fastest rank is the same in input and output, copy without shared memory
+#pragma unroll
+    for (int j=0; j < TILEDIM; j += TILEROWS) {
+      if (xin < grp.tiledVolX && yin + j < grp.tiledVolY) {
+        storeElement<storeMode>(out, xin + (yin + j)*grp.cuDimMm, in[xin + (yin + j)*grp.cuDimMk], alpha, beta);
+      }
+    }
+    return;
+  }
+
+  // Read data into shared memory tile
+#pragma unroll
+  for (int j=0; j < TILEDIM; j += TILEROWS) {
+    if (xin < grp.tiledVolX && yin + j < grp.tiledVolY) {
+      shTile[threadIdx_y + j][threadIdx_x] = in[xin + (yin + j)*grp.cuDimMk];
+    }
+  }
+
+  // grp.copy is the same for the whole thread block
+  #if LIBRETT_USES_SYCL
+  sycl::group_barrier( wrk_grp );
+  #else
+  syncthreads();
+  #endif
+
+  const int xout = bx + threadIdx_y;
+  const int yout = by + threadIdx_x;
+
+  // Write to global memory
+#pragma unroll
+  for (int j=0; j < TILEDIM; j += TILEROWS) {
+    if (xout + j < grp.tiledVolX && yout < grp.tiledVolY) {
+      storeElement<storeMode>(out, yout + (xout + j)*grp.cuDimMm, shTile[threadIdx_x][threadIdx_y + j], alpha, beta);
+    }
+  }
+
+}
+
 //
 // Packed transpose. Thread block loads plan.volMmk number of elements
 //
-template <typename T, int numRegStorage>
+template <typename T, int numRegStorage, int storeMode = StoreCopy, typename IndexT = int, typename TOut = T>
 __global__ void transposePacked(
   const int volMmk, const int volMbar,
   const int sizeMmk, const int sizeMbar,
-  const TensorConvInOut* RESTRICT gl_Mmk,
-  const TensorConvInOut* RESTRICT gl_Mbar,
+  const TensorConvInOutT<IndexT>* RESTRICT gl_Mmk,
+  const TensorConvInOutT<IndexT>* RESTRICT gl_Mbar,
   const TensorConv* RESTRICT gl_Msh,
-  const T* RESTRICT dataIn, T* RESTRICT dataOut
+  const T* RESTRICT dataIn, TOut* RESTRICT dataOut,
+  const T alpha, const T beta
   #if LIBRETT_USES_SYCL
   , sycl::nd_item<3> item, uint8_t *dpct_local
   #endif
@@ -205,7 +546,7 @@ __global__ void transposePacked(
 
   const int warpLane = threadIdx_x & (warpSize - 1);
 
-  TensorConvInOut Mmk;
+  TensorConvInOutT<IndexT> Mmk;
   Mmk.c_in = 1;
   Mmk.d_in = 1;
   Mmk.c_out = 1;
@@ -222,8 +563,8 @@ __global__ void transposePacked(
 
   // Pre-compute tensor positions in Mmk
   // 3*numRegStorage registers
-  int posMmkIn[numRegStorage];
-  int posMmkOut[numRegStorage];
+  IndexT posMmkIn[numRegStorage];
+  IndexT posMmkOut[numRegStorage];
   int posSh[numRegStorage];
 #pragma unroll
   for (int j=0; j < numRegStorage; j++) {
@@ -255,7 +596,7 @@ __global__ void transposePacked(
   }
 
   // 6 registers
-  TensorConvInOut Mbar;
+  TensorConvInOutT<IndexT> Mbar;
   Mbar.c_in = 1;
   Mbar.d_in = 1;
   Mbar.c_out = 1;
@@ -267,11 +608,11 @@ __global__ void transposePacked(
   for (int posMbar=blockIdx_x; posMbar < volMbar; posMbar += gridDim_x)
   {
 
-    int posMbarOut = ((posMbar/Mbar.c_out) % Mbar.d_out)*Mbar.ct_out;
-    int posMbarIn  = ((posMbar/Mbar.c_in)  % Mbar.d_in) *Mbar.ct_in;
+    IndexT posMbarOut = fastDivMod(posMbar, Mbar.c_out_div, Mbar.d_out_div, Mbar.d_out)*Mbar.ct_out;
+    IndexT posMbarIn  = fastDivMod(posMbar, Mbar.c_in_div, Mbar.d_in_div, Mbar.d_in) *Mbar.ct_in;
 #if LIBRETT_USES_SYCL
-    posMbarOut = sycl::reduce_over_group(sg, posMbarOut, sycl::plus<int>());
-    posMbarIn  = sycl::reduce_over_group(sg, posMbarIn,  sycl::plus<int>());
+    posMbarOut = sycl::reduce_over_group(sg, posMbarOut, sycl::plus<IndexT>());
+    posMbarIn  = sycl::reduce_over_group(sg, posMbarIn,  sycl::plus<IndexT>());
 #else // for CUDA, HIP only
     #pragma unroll
     for (int i=warpSize/2; i >= 1; i/=2) {   // AMD change
@@ -295,7 +636,7 @@ __global__ void transposePacked(
 #pragma unroll
     for (int j=0; j < numRegStorage; j++) {
       int posMmk = threadIdx_x + j*blockDim_x;
-      int posIn = posMbarIn + posMmkIn[j];
+      IndexT posIn = posMbarIn + posMmkIn[j];
       if (posMmk < volMmk) shBuffer[posMmk] = dataIn[posIn];
     }
 
@@ -309,8 +650,8 @@ __global__ void transposePacked(
 #pragma unroll
     for (int j=0; j < numRegStorage; j++) {
       int posMmk = threadIdx_x + j*blockDim_x;
-      int posOut = posMbarOut + posMmkOut[j];
-      if (posMmk < volMmk) dataOut[posOut] = shBuffer[posSh[j]];
+      IndexT posOut = posMbarOut + posMmkOut[j];
+      if (posMmk < volMmk) storeElement<storeMode>(dataOut, posOut, shBuffer[posSh[j]], alpha, beta);
     }
 
   }
@@ -323,15 +664,16 @@ __global__ void transposePacked(
 // dim nthread(((volMmkWithSplit - 1)/(gpuWarpSize*lc.numRegStorage) + 1)*gpuWarpSize, 1, 1)
 // dim nblock(ts.numSplit, min(256, max(1, ts.volMbar)), 1)
 //
-template <typename T, int numRegStorage>
+template <typename T, int numRegStorage, int storeMode = StoreCopy, typename IndexT = int, typename TOut = T>
 __global__ void transposePackedSplit(
   const int splitDim, const int volMmkUnsplit, const int volMbar,
   const int sizeMmk, const int sizeMbar,
-  const int cMmSplit, const int cMkSplit,
-  const TensorConvInOut* RESTRICT glMmk,
-  const TensorConvInOut* RESTRICT glMbar,
+  const IndexT cMmSplit, const IndexT cMkSplit,
+  const TensorConvInOutT<IndexT>* RESTRICT glMmk,
+  const TensorConvInOutT<IndexT>* RESTRICT glMbar,
   const TensorConv* RESTRICT glMsh,
-  const T* RESTRICT dataIn, T* RESTRICT dataOut
+  const T* RESTRICT dataIn, TOut* RESTRICT dataOut,
+  const T alpha, const T beta
   #if LIBRETT_USES_SYCL
   , sycl::nd_item<3>& item, uint8_t *dpct_local
   #endif
@@ -357,7 +699,7 @@ __global__ void transposePackedSplit(
   const int volSplit = (blockIdx_x + 1)*splitDim/gridDim_x - p0;
   const int plusone = volSplit - splitDim/gridDim_x;
 
-  TensorConvInOut Mmk;
+  TensorConvInOutT<IndexT> Mmk;
   Mmk.c_in = 1;
   Mmk.d_in = 1;
   Mmk.c_out = 1;
@@ -378,15 +720,15 @@ __global__ void transposePackedSplit(
   // const int volSplit = (splitDim/gridDim.x) + plusone;
   // Start position in this split
   // const int p0 = (splitDim/gridDim.x)*blockIdx.x + min(blockIdx.x, (splitDim % gridDim.x));
-  const int posMmkIn0  = p0*cMmSplit;
-  const int posMmkOut0 = p0*cMkSplit;
+  const IndexT posMmkIn0  = p0*cMmSplit;
+  const IndexT posMmkOut0 = p0*cMkSplit;
   // Volume of split Mmk
   const int volMmkSplit = volSplit*volMmkUnsplit;
 
   // Pre-compute tensor positions in Mmk
   // 3*numRegStorage registers
-  int posMmkIn[numRegStorage];
-  int posMmkOut[numRegStorage];
+  IndexT posMmkIn[numRegStorage];
+  IndexT posMmkOut[numRegStorage];
   int posSh[numRegStorage];
 #pragma unroll
   for (int j=0; j < numRegStorage; j++) {
@@ -417,7 +759,7 @@ __global__ void transposePackedSplit(
     }
   }
 
-  TensorConvInOut Mbar;
+  TensorConvInOutT<IndexT> Mbar;
   Mbar.c_in = 1;
   Mbar.d_in = 1;
   Mbar.c_out = 1;
@@ -432,11 +774,11 @@ __global__ void transposePackedSplit(
   // for (int posMbar=blockIdx.y;posMbar < volMbar;posMbar+=gridDim.y)
   {
 
-    int posMbarOut = ((posMbar/Mbar.c_out) % Mbar.d_out)*Mbar.ct_out;
-    int posMbarIn = ((posMbar/Mbar.c_in) % Mbar.d_in)*Mbar.ct_in;
+    IndexT posMbarOut = fastDivMod(posMbar, Mbar.c_out_div, Mbar.d_out_div, Mbar.d_out)*Mbar.ct_out;
+    IndexT posMbarIn = fastDivMod(posMbar, Mbar.c_in_div, Mbar.d_in_div, Mbar.d_in)*Mbar.ct_in;
 #if LIBRETT_USES_SYCL
-    posMbarOut = sycl::reduce_over_group(sg, posMbarOut, sycl::plus<int>());
-    posMbarIn  = sycl::reduce_over_group(sg, posMbarIn,  sycl::plus<int>());
+    posMbarOut = sycl::reduce_over_group(sg, posMbarOut, sycl::plus<IndexT>());
+    posMbarIn  = sycl::reduce_over_group(sg, posMbarIn,  sycl::plus<IndexT>());
 #else // HIP, CUDA only
     #pragma unroll
     for (int i=warpSize/2; i >= 1; i/=2) {   // AMD change
@@ -460,7 +802,7 @@ __global__ void transposePackedSplit(
 #pragma unroll
     for (int j=0; j < numRegStorage; j++) {
       int posMmk = threadIdx_x + j*blockDim_x;
-      int posIn = posMbarIn + posMmkIn[j];
+      IndexT posIn = posMbarIn + posMmkIn[j];
       if (posMmk < volMmkSplit) shBuffer[posMmk] = dataIn[posIn];
     }
 
@@ -474,8 +816,8 @@ __global__ void transposePackedSplit(
 #pragma unroll
     for (int j=0; j < numRegStorage; j++) {
       int posMmk = threadIdx_x + j*blockDim_x;
-      int posOut = posMbarOut + posMmkOut[j];
-      if (posMmk < volMmkSplit) dataOut[posOut] = shBuffer[posSh[j]];
+      IndexT posOut = posMbarOut + posMmkOut[j];
+      if (posMmk < volMmkSplit) storeElement<storeMode>(dataOut, posOut, shBuffer[posSh[j]], alpha, beta);
     }
 
   }
@@ -485,17 +827,21 @@ __global__ void transposePackedSplit(
 #if 1
 //
 // Transpose when the lead dimension is the same, e.g. (1, 2, 3) -> (1, 3, 2)
+// Each thread copies vecWidth consecutive elements of Mm with one access,
+// numMbar as in transposeTiled
 //
 //  dim3 numthread(TILEDIM, TILEROWS, 1);
-//  dim3 numblock( ((plan.volMm-1)/TILEDIM+1)*((plan.volMkBar-1)/TILEDIM+1), 1, plan.volMbar);
+//  dim3 numblock( ((plan.volMm-1)/(TILEDIM*vecWidth)+1)*((plan.volMkBar-1)/TILEDIM+1), 1, plan.volMbar);
 //
-template <typename T>
+template <typename T, int storeMode = StoreCopy, typename IndexT = int, int vecWidth = 1, int numMbar = -1,
+  typename TOut = T>
 __global__ void transposeTiledCopy(
   const int numMm, const int volMbar, const int sizeMbar,
-  const int cuDimMk, const int cuDimMm,
+  const IndexT cuDimMk, const IndexT cuDimMm,
   const int2_t tiledVol,
-  const TensorConvInOut* RESTRICT gl_Mbar,
-  const T* RESTRICT dataIn, T* RESTRICT dataOut
+  const TensorConvInOutT<IndexT>* RESTRICT gl_Mbar, const MbarParamT<IndexT> mbarParam,
+  const T* RESTRICT dataIn, TOut* RESTRICT dataOut,
+  const T alpha, const T beta
   #if LIBRETT_USES_SYCL
   , sycl::nd_item<3>& item
   #endif
@@ -506,19 +852,19 @@ __global__ void transposeTiledCopy(
   const int warpSize = sg.get_local_range().get(0);
 #endif
   const int warpLane = threadIdx_x & (warpSize - 1);
-  TensorConvInOut Mbar;
+  TensorConvInOutT<IndexT> Mbar;
   Mbar.c_in = 1;
   Mbar.d_in = 1;
   Mbar.c_out = 1;
   Mbar.d_out = 1;
-  if (warpLane < sizeMbar) {
+  if (numMbar < 0 && warpLane < sizeMbar) {
     Mbar = gl_Mbar[warpLane];
   }
 
-  const int bx = (blockIdx_x % numMm)*TILEDIM;
+  const int bx = (blockIdx_x % numMm)*TILEDIM*vecWidth;
   const int by = (blockIdx_x / numMm)*TILEDIM;
 
-  const int x = bx + threadIdx_x;
+  const int x = bx + threadIdx_x*vecWidth;
   const int y = by + threadIdx_y;
 
 #if LIBRETT_USES_SYCL
@@ -532,44 +878,50 @@ __global__ void transposeTiledCopy(
   const unsigned int one = 1;
 #endif
 
-  const int posMinorIn = x + y*cuDimMk;
-  const int posMinorOut = x + y*cuDimMm;
-  const int posInAdd = TILEROWS*cuDimMk;
-  const int posOutAdd = TILEROWS*cuDimMm;
+  const IndexT posMinorIn = x + y*cuDimMk;
+  const IndexT posMinorOut = x + y*cuDimMm;
+  const IndexT posInAdd = TILEROWS*cuDimMk;
+  const IndexT posOutAdd = TILEROWS*cuDimMm;
 
   for (int posMbar=blockIdx_z; posMbar < volMbar; posMbar += gridDim_z)
   {
 
     // Compute global memory positions
-    int posMajorIn = ((posMbar/Mbar.c_in) % Mbar.d_in)*Mbar.ct_in;
-    int posMajorOut = ((posMbar/Mbar.c_out) % Mbar.d_out)*Mbar.ct_out;
+    IndexT posMajorIn;
+    IndexT posMajorOut;
+    if constexpr (numMbar >= 0) {
+      mbarPosition<numMbar>(posMbar, mbarParam, posMajorIn, posMajorOut);
+    } else {
+      posMajorIn = fastDivMod(posMbar, Mbar.c_in_div, Mbar.d_in_div, Mbar.d_in)*Mbar.ct_in;
+      posMajorOut = fastDivMod(posMbar, Mbar.c_out_div, Mbar.d_out_div, Mbar.d_out)*Mbar.ct_out;
 #if LIBRETT_USES_SYCL
-    posMajorIn  = sycl::reduce_over_group(sg, posMajorIn,  sycl::plus<int>());
-    posMajorOut = sycl::reduce_over_group(sg, posMajorOut, sycl::plus<int>());
+      posMajorIn  = sycl::reduce_over_group(sg, posMajorIn,  sycl::plus<IndexT>());
+      posMajorOut = sycl::reduce_over_group(sg, posMajorOut, sycl::plus<IndexT>());
 #else // for CUDA, HIP only
-    #pragma unroll
-    for (int i=warpSize/2; i >= 1; i/=2) {   // AMD change
-      #if LIBRETT_USES_HIP
-        posMajorIn += __shfl_xor(posMajorIn,i);
-        posMajorOut += __shfl_xor(posMajorOut,i);
-      #elif LIBRETT_USES_CUDA
-        posMajorIn  += __shfl_xor_sync(0xffffffff,posMajorIn,i);
-        posMajorOut += __shfl_xor_sync(0xffffffff,posMajorOut,i);
-      #endif
-    }
+      #pragma unroll
+      for (int i=warpSize/2; i >= 1; i/=2) {   // AMD change
+        #if LIBRETT_USES_HIP
+          posMajorIn += __shfl_xor(posMajorIn,i);
+          posMajorOut += __shfl_xor(posMajorOut,i);
+        #elif LIBRETT_USES_CUDA
+          posMajorIn  += __shfl_xor_sync(0xffffffff,posMajorIn,i);
+          posMajorOut += __shfl_xor_sync(0xffffffff,posMajorOut,i);
+        #endif
+      }
 #endif // SYCL
-    int posIn = posMajorIn + posMinorIn;
-    int posOut = posMajorOut + posMinorOut;
+    }
+    IndexT posIn = posMajorIn + posMinorIn;
+    IndexT posOut = posMajorOut + posMinorOut;
 
     // Variables where values are stored
-    T val[TILEDIM/TILEROWS];
+    VecType<T, vecWidth> val[TILEDIM/TILEROWS];
 
     // Read global memory
 #pragma unroll
     for (int j=0; j < TILEDIM; j += TILEROWS) {
       // if ((x < tiledVol.x) && (y + j < tiledVol.y)) {
       if ((mask & (one << j)) != 0) {   // AMD change
-        val[j/TILEROWS] = dataIn[posIn];
+        val[j/TILEROWS] = *reinterpret_cast<const VecType<T, vecWidth>*>(dataIn + posIn);
       }
       posIn += posInAdd;
     }
@@ -579,7 +931,7 @@ __global__ void transposeTiledCopy(
     for (int j=0; j < TILEDIM; j += TILEROWS) {
       // if ((x < tiledVol.x) && (y + j < tiledVol.y)) {
       if ((mask & (one << j)) != 0) {   // AMD change
-        dataOut[posOut] = val[j/TILEROWS];
+        storeVector<storeMode>(dataOut, posOut, val[j/TILEROWS], alpha, beta);
       }
       posOut += posOutAdd;
     }
@@ -713,7 +1065,7 @@ void librettKernelSetSharedMemConfig() {
 }
 
 // Caches for PackedSplit kernels. One cache for all devices
-// NOTE: Not thread safe
+// NOTE: LRUCache locks internally, so concurrent plan creation is safe
 const int CACHE_SIZE = 100000;
 #if LIBRETT_USES_HIP
   const int MAX_NUMWARP = (1024/64);  // AMD change
@@ -730,10 +1082,59 @@ const int CACHE_SIZE = 100000;
 #elif LIBRETT_USES_CUDA
   const int MAX_NUMWARP = (1024/32);
 #endif
-const int MAX_NUMTYPE = 2;
+const int MAX_NUMTYPE = 5;
 static int numDevices = -1;
+static std::once_flag numDevicesFlag;
 LRUCache<unsigned long long int, int> nabCache(CACHE_SIZE, -1);
 
+//
+// Returns true if the kernel of method from type T to TOut can use vector accesses of vecWidth elements.
+// Only TiledCopy stores vectors of TOut
+//
+template <typename T, typename TOut, int method>
+constexpr bool vecWidthFitsTypes(const int vecWidth) {
+  return vecWidthFits(method, sizeof(T), vecWidth) &&
+    (method != TiledCopy || vecWidthFits(method, sizeof(TOut), vecWidth));
+}
+
+//
+// Calls func with std::integral_constant<int, vecWidth> for the Tiled or TiledCopy kernel from type T to TOut.
+// Only the vector widths that fit T and TOut are instantiated, others fall back to 1
+//
+template <typename T, typename TOut, int method, typename Func>
+static void dispatchVecWidth(const int vecWidth, Func&& func) {
+  if constexpr (vecWidthFitsTypes<T, TOut, method>(4)) {
+    if (vecWidth == 4) return func(std::integral_constant<int, 4>());
+  }
+  if constexpr (vecWidthFitsTypes<T, TOut, method>(2)) {
+    if (vecWidth == 2) return func(std::integral_constant<int, 2>());
+  }
+  func(std::integral_constant<int, 1>());
+}
+
+//
+// Calls func with std::integral_constant<int, numMbar>, numMbar = sizeMbar if sizeMbar <= N, otherwise -1
+//
+template <int N, typename Func>
+static void dispatchNumMbarN(const int sizeMbar, Func&& func) {
+  if (sizeMbar == N) return func(std::integral_constant<int, N>());
+  if constexpr (N > 0) return dispatchNumMbarN<N - 1>(sizeMbar, func);
+  func(std::integral_constant<int, -1>());
+}
+
+//
+// Calls func with std::integral_constant<int, numMbar> for the Tiled and TiledCopy kernels.
+// The kernels are specialized on sizeMbar for plain copies of the same type with 32-bit indices,
+// numMbar = -1 selects the general kernel
+//
+template <int storeMode, typename IndexT, bool sameType, typename Func>
+static void dispatchNumMbar(const int sizeMbar, Func&& func) {
+  if constexpr (storeMode == StoreCopy && sameType && std::is_same<IndexT, int>::value) {
+    return dispatchNumMbarN<MAX_MBAR_SPECIALIZED>(sizeMbar, func);
+  }
+  func(std::integral_constant<int, -1>());
+}
+
 //
 // Returns the maximum number of active blocks per SM
 //
@@ -760,7 +1161,9 @@ int getNumActiveBlock(const int method, const int sizeofType, const LaunchConfig
       switch(lc.numRegStorage) {
         #define CALL(ICASE) case ICASE: if (sizeofType == 4) CALL0(float,  ICASE); \
 	                                if (sizeofType == 8) CALL0(double, ICASE); \
-                                        if (sizeofType == 16) CALL0(librett_complex, ICASE); break;
+                                        if (sizeofType == 16) CALL0(librett_complex, ICASE); \
+                                        if (sizeofType == 2) CALL0(uint16_t, ICASE); \
+                                        if (sizeofType == 1) CALL0(uint8_t, ICASE); break;
         #include "calls.h"
       }
       #undef CALL
@@ -772,7 +1175,7 @@ int getNumActiveBlock(const int method, const int sizeofType, const LaunchConfig
     case PackedSplit:
     {
       // Allocate cache structure if needed
-      if (numDevices == -1) {
+      std::call_once(numDevicesFlag, []() {
         #if LIBRETT_USES_SYCL
           Librett::syclGetDeviceCount(&numDevices);
         #elif LIBRETT_USES_HIP
@@ -780,7 +1183,7 @@ int getNumActiveBlock(const int method, const int sizeofType, const LaunchConfig
         #elif LIBRETT_USES_CUDA
           cudaCheck(cudaGetDeviceCount(&numDevices));
         #endif
-      }
+      });
       // Build unique key for cache
       int key_warp = (numthread/gpuWarpSize - 1);
       if (key_warp >= MAX_NUMWARP) {
@@ -788,7 +1191,9 @@ int getNumActiveBlock(const int method, const int sizeofType, const LaunchConfig
         exit(1);
       }
       int key_reg = (lc.numRegStorage - 1);
-      int key_type = (sizeofType == 4);
+      // sizeofType 1, 2, 4, 8, 16 -> 0, 1, 2, 3, 4
+      int key_type = 0;
+      while ((size_t(1) << key_type) < sizeofType) key_type++;
       unsigned long long int key =
       (unsigned long long int)(lc.shmemsize/sizeofType)*MAX_NUMWARP*MAX_REG_STORAGE*MAX_NUMTYPE*numDevices +
       (unsigned long long int)deviceID*MAX_NUMWARP*MAX_REG_STORAGE*MAX_NUMTYPE +
@@ -806,7 +1211,9 @@ int getNumActiveBlock(const int method, const int sizeofType, const LaunchConfig
           switch(lc.numRegStorage) {
             #define CALL(ICASE) case ICASE: if (sizeofType == 4) CALL0(float,  ICASE); \
 		                            if (sizeofType == 8) CALL0(double, ICASE); \
-                                            if (sizeofType == 16) CALL0(librett_complex,ICASE); break;
+                                            if (sizeofType == 16) CALL0(librett_complex,ICASE); \
+                                        if (sizeofType == 2) CALL0(uint16_t, ICASE); \
+                                        if (sizeofType == 1) CALL0(uint8_t, ICASE); break;
             #include "calls.h"
           }
           #undef CALL
@@ -820,17 +1227,16 @@ int getNumActiveBlock(const int method, const int sizeofType, const LaunchConfig
     case Tiled:
     {
     #ifndef LIBRETT_USES_SYCL
-      if (sizeofType == 4) {
-        gpuOccupancyMaxActiveBlocksPerMultiprocessor(&numActiveBlock,
-          transposeTiled<float>, numthread, lc.shmemsize);
-      } else if (sizeofType == 8) {
-        gpuOccupancyMaxActiveBlocksPerMultiprocessor(&numActiveBlock,
-          transposeTiled<double>, numthread, lc.shmemsize);
-      }
-      else if (sizeofType == 16) {
-        gpuOccupancyMaxActiveBlocksPerMultiprocessor(&numActiveBlock,
-          transposeTiled<librett_complex>, numthread, lc.shmemsize);
-      }
+      #define CALL(TYPE) \
+        dispatchVecWidth<TYPE, TYPE, Tiled>(lc.vecWidth, [&](auto vec) { \
+          gpuOccupancyMaxActiveBlocksPerMultiprocessor(&numActiveBlock, \
+            transposeTiled<TYPE, StoreCopy, int, decltype(vec)::value>, numthread, lc.shmemsize); })
+      if (sizeofType == 4) CALL(float);
+      if (sizeofType == 8) CALL(double);
+      if (sizeofType == 16) CALL(librett_complex);
+      if (sizeofType == 2) CALL(uint16_t);
+      if (sizeofType == 1) CALL(uint8_t);
+      #undef CALL
     #endif // CUDA or HIP
     }
     break;
@@ -838,16 +1244,16 @@ int getNumActiveBlock(const int method, const int sizeofType, const LaunchConfig
     case TiledCopy:
     {
     #ifndef LIBRETT_USES_SYCL
-      if (sizeofType == 4) {
-        gpuOccupancyMaxActiveBlocksPerMultiprocessor(&numActiveBlock,
-          transposeTiledCopy<float>, numthread, lc.shmemsize);
-      } else if (sizeofType == 8) {
-        gpuOccupancyMaxActiveBlocksPerMultiprocessor(&numActiveBlock,
-          transposeTiledCopy<double>, numthread, lc.shmemsize);
-      } else if (sizeofType == 16) {
-        gpuOccupancyMaxActiveBlocksPerMultiprocessor(&numActiveBlock,
-          transposeTiledCopy<librett_complex>, numthread, lc.shmemsize);
-      }
+      #define CALL(TYPE) \
+        dispatchVecWidth<TYPE, TYPE, TiledCopy>(lc.vecWidth, [&](auto vec) { \
+          gpuOccupancyMaxActiveBlocksPerMultiprocessor(&numActiveBlock, \
+            transposeTiledCopy<TYPE, StoreCopy, int, decltype(vec)::value>, numthread, lc.shmemsize); })
+      if (sizeofType == 4) CALL(float);
+      if (sizeofType == 8) CALL(double);
+      if (sizeofType == 16) CALL(librett_complex);
+      if (sizeofType == 2) CALL(uint16_t);
+      if (sizeofType == 1) CALL(uint8_t);
+      #undef CALL
     #endif // CUDA or HIP
     }
     break;
@@ -856,6 +1262,26 @@ int getNumActiveBlock(const int method, const int sizeofType, const LaunchConfig
   return numActiveBlock;
 }
 
+//
+// Returns the number of tiles in the Mm direction for the Tiled and TiledCopy methods
+//
+static int tiledNumMm(const TensorSplit &ts, const int vecWidth) {
+  return (ts.volMm - 1)/(TILEDIM*vecWidth) + 1;
+}
+
+//
+// Returns the widest vector access for the Tiled and TiledCopy methods.
+// Mm must be a multiple of the width, then all strides of the vector accesses
+// are multiples too, and at least as wide as the tile
+//
+static int tiledVecWidth(const int method, const int sizeofType, const TensorSplit &ts) {
+  for (int vecWidth=MAX_VEC_WIDTH;vecWidth > 1;vecWidth /= 2) {
+    if (vecWidthFits(method, sizeofType, vecWidth) && ts.volMm % vecWidth == 0 &&
+      ts.volMm >= TILEDIM*vecWidth) return vecWidth;
+  }
+  return 1;
+}
+
 //
 // Sets up kernel launch configuration
 //
@@ -867,6 +1293,7 @@ int getNumActiveBlock(const int method, const int sizeofType, const LaunchConfig
 // lc.numblock
 // lc.shmemsize
 // lc.numRegStorage  (for Packed method)
+// lc.vecWidth       (for Tiled and TiledCopy methods)
 //
 int librettKernelLaunchConfiguration(const int sizeofType, const TensorSplit &ts,
   const int deviceID, const gpuDeviceProp_t &prop, LaunchConfig &lc) {
@@ -915,6 +1342,9 @@ int librettKernelLaunchConfiguration(const int sizeofType, const TensorSplit &ts
       int maxNumRegStorage = (ts.volMmk - 1)/minNumthread + 1;
       // printf("minNumRegStorage %d maxNumRegStorage %d\n", minNumRegStorage, maxNumRegStorage);
 
+      // Register storage that is too small is rejected below, skip the occupancy queries
+      if (maxNumRegStorage < 9) return 0;
+
       int bestVal = 0;
       int bestNumRegStorage = 0;
       int bestNumActiveBlock = 0;
@@ -1008,10 +1438,11 @@ int librettKernelLaunchConfiguration(const int sizeofType, const TensorSplit &ts
 
     case Tiled:
     {
+      lc.vecWidth = tiledVecWidth(Tiled, sizeofType, ts);
       lc.numthread_x = TILEDIM;
       lc.numthread_y = TILEROWS;
       lc.numthread_z = 1;
-      lc.numblock_x = ((ts.volMm - 1)/TILEDIM + 1)*((ts.volMk - 1)/TILEDIM + 1);
+      lc.numblock_x = tiledNumMm(ts, lc.vecWidth)*((ts.volMk - 1)/TILEDIM + 1);
       lc.numblock_y = 1;
       lc.numblock_z = std::max<unsigned int>(1, std::min<unsigned int>((gpuMultiProcessorCount*8) /
 			                    (lc.numblock_x*lc.numblock_y), ts.volMbar));
@@ -1022,10 +1453,11 @@ int librettKernelLaunchConfiguration(const int sizeofType, const TensorSplit &ts
 
     case TiledCopy:
     {
+      lc.vecWidth = tiledVecWidth(TiledCopy, sizeofType, ts);
       lc.numthread_x = TILEDIM;
       lc.numthread_y = TILEROWS;
       lc.numthread_z = 1;
-      lc.numblock_x = ((ts.volMm - 1)/TILEDIM + 1)*((ts.volMkBar - 1)/TILEDIM + 1);
+      lc.numblock_x = tiledNumMm(ts, lc.vecWidth)*((ts.volMkBar - 1)/TILEDIM + 1);
       lc.numblock_y = 1;
       lc.numblock_z = ts.volMbar;
       lc.numblock_z = min((gpuMultiProcessorCount*8)/(lc.numblock_x*lc.numblock_y), lc.numblock_z);
@@ -1049,23 +1481,158 @@ int librettKernelLaunchConfiguration(const int sizeofType, const TensorSplit &ts
   return numActiveBlockReturn;
 }
 
-bool librettKernel(librettPlan_t &plan, void *dataIn, void *dataOut)
+//
+// Returns true if ptr is aligned to alignment bytes
+//
+static bool isAligned(const void* ptr, const size_t alignment) {
+  return ((uintptr_t)ptr % alignment) == 0;
+}
+
+//
+// Returns scalar of type T stored in host memory at ptr, zero if ptr = nullptr
+//
+template <typename T>
+static T hostScalar(const void* ptr) {
+  T val{};
+  if (ptr != nullptr) memcpy(&val, ptr, sizeof(T));
+  return val;
+}
+
+size_t librettScalarSize(const librettScalarType type) {
+  switch(type) {
+    case LIBRETT_FLOAT: return 4;
+    case LIBRETT_DOUBLE: return 8;
+    case LIBRETT_COMPLEX_FLOAT: return 8;
+    case LIBRETT_COMPLEX_DOUBLE: return 16;
+    default: return 0;
+  }
+}
+
+//
+// Returns true if scalar of type at ptr equals re
+//
+static bool scalarEquals(const void* ptr, const librettScalarType type, const double re) {
+  if (type == LIBRETT_FLOAT) return (hostScalar<float>(ptr) == re);
+  if (type == LIBRETT_DOUBLE) return (hostScalar<double>(ptr) == re);
+  if (type == LIBRETT_COMPLEX_FLOAT) {
+    float val[2] = {0.0f, 0.0f};
+    if (ptr != nullptr) memcpy(val, ptr, sizeof(val));
+    return (val[0] == re && val[1] == 0.0f);
+  }
+  double val[2] = {0.0, 0.0};
+  if (ptr != nullptr) memcpy(val, ptr, sizeof(val));
+  return (val[0] == re && val[1] == 0.0);
+}
+
+//
+// Calls CALLT(TYPE, TYPEOUT, ARG) for the input and output element types of plan.
+// Type conversions are plain copies, their scaled kernels are never instantiated.
+// 8 byte elements are copied as double, float complex kernels are only instantiated for scaling
+//
+#define CALL_TYPES(CALLT, ARG)                                                                            \
+  if (plan.sizeofTypeOut == plan.sizeofType) {                                                            \
+    if (plan.sizeofType == 4) CALLT(float, float, ARG);                                                   \
+    if (plan.sizeofType == 8 && !complexFloat) CALLT(double, double, ARG);                                \
+    if constexpr (storeMode != StoreCopy) {                                                               \
+      if (plan.sizeofType == 8 && complexFloat) CALLT(librett_complex_float, librett_complex_float, ARG); \
+    }                                                                                                     \
+    if (plan.sizeofType == 16) CALLT(librett_complex, librett_complex, ARG);                              \
+    if (plan.sizeofType == 2) CALLT(uint16_t, uint16_t, ARG);                                             \
+    if (plan.sizeofType == 1) CALLT(uint8_t, uint8_t, ARG);                                               \
+  } else if constexpr (storeMode == StoreCopy) {                                                          \
+    if (plan.sizeofType == 8 && plan.sizeofTypeOut == 4) CALLT(double, float, ARG);                       \
+    if (plan.sizeofType == 4 && plan.sizeofTypeOut == 8) CALLT(float, double, ARG);                       \
+    if (plan.sizeofType == 4 && plan.sizeofTypeOut == 2) CALLT(float, librett_half, ARG);                 \
+    if (plan.sizeofType == 2 && plan.sizeofTypeOut == 4) CALLT(librett_half, float, ARG);                 \
+    if (plan.sizeofType == 4 && plan.sizeofTypeOut == 16) CALLT(float, librett_complex, ARG);             \
+    if (plan.sizeofType == 8 && plan.sizeofTypeOut == 16) CALLT(double, librett_complex, ARG);            \
+  }
+
+template <int storeMode, typename IndexT>
+static bool librettKernelStore(librettPlan_t &plan, void *dataIn, void *dataOut, gpuStream_t stream,
+  const void* alpha, const void* beta, const librettScalarType scalarType
+#if LIBRETT_USES_SYCL
+  , const std::vector<sycl::event>& depEvents, sycl::event* event
+#endif
+  )
 {
   LaunchConfig& lc = plan.launchConfig;
   TensorSplit& ts = plan.tensorSplit;
+  // Selects the float complex kernels in CALL_TYPES
+  const bool complexFloat = (storeMode != StoreCopy && scalarType == LIBRETT_COMPLEX_FLOAT);
+#if LIBRETT_USES_SYCL
+  // Launches are not waited for, the last one is returned in event
+  sycl::event kernelEvent;
+#endif
+
+  // Device buffers and strides for the index type
+  const TensorConvInOutT<IndexT>* planMbar;
+  const TensorConvInOutT<IndexT>* planMmk;
+  if constexpr (std::is_same<IndexT, int>::value) {
+    planMbar = plan.Mbar;
+    planMmk = plan.Mmk;
+  } else {
+    planMbar = plan.Mbar64;
+    planMmk = plan.Mmk64;
+  }
+  const IndexT planCuDimMk = (IndexT)plan.cuDimMk;
+  const IndexT planCuDimMm = (IndexT)plan.cuDimMm;
+
+  // Mbar for the kernels specialized on sizeMbar
+  MbarParamT<IndexT> mbarParam{};
+  if (ts.method == Tiled || ts.method == TiledCopy) {
+    for (int i=0;i < std::min(ts.sizeMbar, MAX_MBAR_SPECIALIZED);i++) {
+      if constexpr (std::is_same<IndexT, int>::value) {
+        mbarParam.m[i] = plan.hostMbar[i];
+      } else {
+        mbarParam.m[i] = plan.hostMbar64[i];
+      }
+    }
+  }
 
   switch(ts.method) {
     case Trivial:
     {
+      if (storeMode == StoreCopy && plan.sizeofTypeOut == plan.sizeofType) {
 #if LIBRETT_USES_SYCL
-      plan.stream->memcpy(dataOut, dataIn, ts.volMmk * ts.volMbar * plan.sizeofType);
+        kernelEvent = stream->memcpy(dataOut, dataIn, (size_t)ts.volMmk * ts.volMbar * plan.sizeofType, depEvents);
 #elif LIBRETT_USES_HIP
-      hipCheck(hipMemcpyAsync(dataOut, dataIn, ts.volMmk*ts.volMbar*plan.sizeofType,
-        hipMemcpyDefault, plan.stream));
+        hipCheck(hipMemcpyAsync(dataOut, dataIn, (size_t)ts.volMmk*ts.volMbar*plan.sizeofType,
+          hipMemcpyDefault, stream));
 #elif LIBRETT_USES_CUDA
-      cudaCheck(cudaMemcpyAsync(dataOut, dataIn, ts.volMmk*ts.volMbar*plan.sizeofType,
-        cudaMemcpyDefault, plan.stream));
+        cudaCheck(cudaMemcpyAsync(dataOut, dataIn, (size_t)ts.volMmk*ts.volMbar*plan.sizeofType,
+          cudaMemcpyDefault, stream));
 #endif
+      } else {
+        const IndexT volume = (IndexT)ts.volMmk*ts.volMbar;
+        const int numthread = 256;
+        const int numblock = std::max<IndexT>(1, std::min<IndexT>((volume - 1)/numthread + 1, 65535));
+        #if LIBRETT_USES_SYCL
+          #define CALL(TYPE, TYPEOUT, UNUSED)                                       \
+          kernelEvent = stream->submit([&](sycl::handler &cgh) {                    \
+            cgh.depends_on(depEvents);                                              \
+            auto volume_ct0 = volume;                                               \
+            auto dataIn_ct1 = (TYPE *)dataIn;                                       \
+            auto dataOut_ct2 = (TYPEOUT *)dataOut;                                  \
+            auto alpha_ct3 = hostScalar<TYPE>(alpha);                               \
+            auto beta_ct4 = hostScalar<TYPE>(beta);                                 \
+                                                                                    \
+            cgh.parallel_for(                                                       \
+                sycl::nd_range<3>(sycl::range<3>(1, 1, numblock*numthread),         \
+                                  sycl::range<3>(1, 1, numthread)),                 \
+                [=](sycl::nd_item<3> item) {                                        \
+                  scaleCopy<TYPE, storeMode, IndexT, TYPEOUT>(volume_ct0, dataIn_ct1, dataOut_ct2, \
+                      alpha_ct3, beta_ct4, item);                                   \
+                });                                                                 \
+          });
+        #else // CUDA or HIP
+          #define CALL(TYPE, TYPEOUT, UNUSED)                                       \
+          scaleCopy<TYPE, storeMode, IndexT, TYPEOUT> <<< numblock, numthread, 0, stream >>> \
+              (volume, (TYPE *)dataIn, (TYPEOUT *)dataOut, hostScalar<TYPE>(alpha), hostScalar<TYPE>(beta))
+        #endif
+        CALL_TYPES(CALL, 0);
+        #undef CALL
+      }
     }
     break;
 
@@ -1073,8 +1640,9 @@ bool librettKernel(librettPlan_t &plan, void *dataIn, void *dataOut)
     {
       switch(lc.numRegStorage) {
         #if LIBRETT_USES_SYCL
-        #define CALL0(TYPE, NREG)                                       \
-        {auto event = plan.stream->submit([&](sycl::handler &cgh) {     \
+        #define CALL0(TYPE, TYPEOUT, NREG)                              \
+        {kernelEvent = stream->submit([&](sycl::handler &cgh) {         \
+          cgh.depends_on(depEvents);                                    \
           sycl::local_accessor<uint8_t, 1>                              \
             dpct_local_acc_ct1(sycl::range<1>(lc.shmemsize), cgh);      \
                                                                         \
@@ -1082,33 +1650,34 @@ bool librettKernel(librettPlan_t &plan, void *dataIn, void *dataOut)
           auto ts_volMbar_ct1 = ts.volMbar;                             \
           auto ts_sizeMmk_ct2 = ts.sizeMmk;                             \
           auto ts_sizeMbar_ct3 = ts.sizeMbar;                           \
-          auto plan_Mmk_ct4 = plan.Mmk;                                 \
-          auto plan_Mbar_ct5 = plan.Mbar;                               \
+          auto plan_Mmk_ct4 = planMmk;                                  \
+          auto plan_Mbar_ct5 = planMbar;                                \
           auto plan_Msh_ct6 = plan.Msh;                                 \
           auto dataIn_ct7 = (TYPE *)dataIn;                             \
-          auto dataOut_ct8 = (TYPE *)dataOut;                           \
+          auto dataOut_ct8 = (TYPEOUT *)dataOut;                        \
+          auto alpha_ct9 = hostScalar<TYPE>(alpha);                     \
+          auto beta_ct10 = hostScalar<TYPE>(beta);                      \
                                                                         \
           cgh.parallel_for(                                             \
             sycl::nd_range<3>(lc.numblock * lc.numthread, lc.numthread), \
             [=](sycl::nd_item<3> item) { \
-              transposePacked<TYPE, NREG>(                              \
+              transposePacked<TYPE, NREG, storeMode, IndexT, TYPEOUT>(          \
                 ts_volMmk_ct0, ts_volMbar_ct1, ts_sizeMmk_ct2, ts_sizeMbar_ct3, \
                 plan_Mmk_ct4, plan_Mbar_ct5, plan_Msh_ct6, dataIn_ct7,  \
-                dataOut_ct8, item, dpct_local_acc_ct1.get_pointer());   \
+                dataOut_ct8, alpha_ct9, beta_ct10,                      \
+                item, dpct_local_acc_ct1.get_pointer());                \
             });                                                         \
         });                                                             \
-          event.wait();                                                 \
         }
         #else // CUDA or HIP
-          #define CALL0(TYPE, NREG)                                                                \
-          transposePacked<TYPE, NREG> <<< lc.numblock, lc.numthread, lc.shmemsize, plan.stream >>> \
+          #define CALL0(TYPE, TYPEOUT, NREG)                                                       \
+          transposePacked<TYPE, NREG, storeMode, IndexT, TYPEOUT> <<< lc.numblock, lc.numthread, lc.shmemsize, stream >>> \
               (ts.volMmk, ts.volMbar, ts.sizeMmk, ts.sizeMbar,                                     \
-              plan.Mmk, plan.Mbar, plan.Msh, (TYPE *)dataIn, (TYPE *)dataOut)
+              planMmk, planMbar, plan.Msh, (TYPE *)dataIn, (TYPEOUT *)dataOut,                     \
+              hostScalar<TYPE>(alpha), hostScalar<TYPE>(beta))
         #endif // SYCL
 
-        #define CALL(ICASE) case ICASE: if (plan.sizeofType == 4) CALL0(float,  ICASE); \
-	                                if (plan.sizeofType == 8) CALL0(double, ICASE); \
-                                        if (plan.sizeofType == 16) CALL0(librett_complex,ICASE); break;
+        #define CALL(ICASE) case ICASE: CALL_TYPES(CALL0, ICASE); break;
         #include "calls.h"
         default:
         printf("librettKernel no template implemented for numRegStorage %d\n", lc.numRegStorage);
@@ -1124,8 +1693,9 @@ bool librettKernel(librettPlan_t &plan, void *dataIn, void *dataOut)
     {
       switch(lc.numRegStorage) {
         #if LIBRETT_USES_SYCL
-          #define CALL0(TYPE, NREG)                                                 \
-          plan.stream->submit([&](sycl::handler &cgh) {                             \
+          #define CALL0(TYPE, TYPEOUT, NREG)                                        \
+          kernelEvent = stream->submit([&](sycl::handler &cgh) {                    \
+            cgh.depends_on(depEvents);                                              \
             sycl::local_accessor<uint8_t, 1>                                        \
                 dpct_local_acc_ct1(sycl::range<1>(lc.shmemsize), cgh);              \
                                                                                     \
@@ -1134,34 +1704,35 @@ bool librettKernel(librettPlan_t &plan, void *dataIn, void *dataOut)
             auto ts_volMbar_ct2 = ts.volMbar;                                       \
             auto ts_sizeMmk_ct3 = ts.sizeMmk;                                       \
             auto ts_sizeMbar_ct4 = ts.sizeMbar;                                     \
-            auto plan_cuDimMm_ct5 = plan.cuDimMm;                                   \
-            auto plan_cuDimMk_ct6 = plan.cuDimMk;                                   \
-            auto plan_Mmk_ct7 = plan.Mmk;                                           \
-            auto plan_Mbar_ct8 = plan.Mbar;                                         \
+            auto plan_cuDimMm_ct5 = planCuDimMm;                                    \
+            auto plan_cuDimMk_ct6 = planCuDimMk;                                    \
+            auto plan_Mmk_ct7 = planMmk;                                            \
+            auto plan_Mbar_ct8 = planMbar;                                          \
             auto plan_Msh_ct9 = plan.Msh;                                           \
             auto dataIn_ct10 = (TYPE *)dataIn;                                      \
-            auto dataOut_ct11 = (TYPE *)dataOut;                                    \
+            auto dataOut_ct11 = (TYPEOUT *)dataOut;                                 \
+            auto alpha_ct12 = hostScalar<TYPE>(alpha);                              \
+            auto beta_ct13 = hostScalar<TYPE>(beta);                                \
                                                                                     \
             cgh.parallel_for(                                                       \
                 sycl::nd_range<3>(lc.numblock * lc.numthread, lc.numthread),        \
                 [=](sycl::nd_item<3> item) { \
-                  transposePackedSplit<TYPE, NREG>(                                 \
+                  transposePackedSplit<TYPE, NREG, storeMode, IndexT, TYPEOUT>(             \
                       ts_splitDim_ct0, ts_volMmkUnsplit_ct1, ts_volMbar_ct2,        \
                       ts_sizeMmk_ct3, ts_sizeMbar_ct4, plan_cuDimMm_ct5,            \
                       plan_cuDimMk_ct6, plan_Mmk_ct7, plan_Mbar_ct8, plan_Msh_ct9,  \
-                      dataIn_ct10, dataOut_ct11, item,                          \
+                      dataIn_ct10, dataOut_ct11, alpha_ct12, beta_ct13, item,       \
                       dpct_local_acc_ct1.get_pointer());                            \
                 });                                                                 \
-          }); plan.stream->wait();
+          });
         #else // CUDA or HIP
-          #define CALL0(TYPE, NREG)                                                                     \
-          transposePackedSplit<TYPE, NREG> <<< lc.numblock, lc.numthread, lc.shmemsize, plan.stream >>> \
+          #define CALL0(TYPE, TYPEOUT, NREG)                                                            \
+          transposePackedSplit<TYPE, NREG, storeMode, IndexT, TYPEOUT> <<< lc.numblock, lc.numthread, lc.shmemsize, stream >>> \
               (ts.splitDim, ts.volMmkUnsplit, ts. volMbar, ts.sizeMmk, ts.sizeMbar,                     \
-              plan.cuDimMm, plan.cuDimMk, plan.Mmk, plan.Mbar, plan.Msh, (TYPE *)dataIn, (TYPE *)dataOut)
+              planCuDimMm, planCuDimMk, planMmk, planMbar, plan.Msh, (TYPE *)dataIn, (TYPEOUT *)dataOut, \
+              hostScalar<TYPE>(alpha), hostScalar<TYPE>(beta))
         #endif
-        #define CALL(ICASE) case ICASE: if (plan.sizeofType == 4) CALL0(float,  ICASE); \
-	                                if (plan.sizeofType == 8) CALL0(double, ICASE); \
-                                        if (plan.sizeofType == 16) CALL0(librett_complex, ICASE); break;
+        #define CALL(ICASE) case ICASE: CALL_TYPES(CALL0, ICASE); break;
         #include "calls.h"
         default:
         printf("librettKernel no template implemented for numRegStorage %d\n", lc.numRegStorage);
@@ -1175,85 +1746,284 @@ bool librettKernel(librettPlan_t &plan, void *dataIn, void *dataOut)
 
     case Tiled:
     {
+      // Vector loads need aligned dataIn, otherwise scalar loads are used
+      const int vecWidth = isAligned(dataIn, lc.vecWidth*plan.sizeofType) ? lc.vecWidth : 1;
+      const int numMm = tiledNumMm(ts, vecWidth);
+      auto numblock = lc.numblock;
+      numblock_x = numMm*((ts.volMk - 1)/TILEDIM + 1);
       #if LIBRETT_USES_SYCL
-        #define CALL(TYPE)                                                        \
-        plan.stream->submit([&](sycl::handler &cgh) {                             \
+        #define CALL(TYPE, TYPEOUT, UNUSED)                                       \
+        dispatchVecWidth<TYPE, TYPEOUT, Tiled>(vecWidth, [&](auto vec) {                   \
+        dispatchNumMbar<storeMode, IndexT, std::is_same<TYPE, TYPEOUT>::value>(ts.sizeMbar, [&](auto nmbar) { \
+        kernelEvent = stream->submit([&](sycl::handler &cgh) {                    \
+          cgh.depends_on(depEvents);                                              \
                                                                                   \
-          auto ts_volMm_TILEDIM_ct0 = ((ts.volMm - 1) / TILEDIM + 1);             \
+          auto ts_volMm_TILEDIM_ct0 = numMm;                                      \
           auto ts_volMbar_ct1 = ts.volMbar;                                       \
           auto ts_sizeMbar_ct2 = ts.sizeMbar;                                     \
           auto plan_tiledVol_ct3 = plan.tiledVol;                                 \
-          auto plan_cuDimMk_ct4 = plan.cuDimMk;                                   \
-          auto plan_cuDimMm_ct5 = plan.cuDimMm;                                   \
-          auto plan_Mbar_ct6 = plan.Mbar;                                         \
+          auto plan_cuDimMk_ct4 = planCuDimMk;                                    \
+          auto plan_cuDimMm_ct5 = planCuDimMm;                                    \
+          auto plan_Mbar_ct6 = planMbar;                                          \
+          auto mbarParam_ct = mbarParam;                                          \
           auto dataIn_ct7 = (TYPE *)dataIn;                                       \
-          auto dataOut_ct8 = (TYPE *)dataOut;                                     \
+          auto dataOut_ct8 = (TYPEOUT *)dataOut;                                  \
+          auto alpha_ct9 = hostScalar<TYPE>(alpha);                               \
+          auto beta_ct10 = hostScalar<TYPE>(beta);                                \
                                                                                   \
           cgh.parallel_for(                                                       \
-              sycl::nd_range<3>(lc.numblock * lc.numthread, lc.numthread),        \
+              sycl::nd_range<3>(numblock * lc.numthread, lc.numthread),           \
               [=](sycl::nd_item<3> item) { \
-                transposeTiled<TYPE>(                                             \
+                transposeTiled<TYPE, storeMode, IndexT, decltype(vec)::value, decltype(nmbar)::value, TYPEOUT>( \
                     ts_volMm_TILEDIM_ct0, ts_volMbar_ct1, ts_sizeMbar_ct2,        \
                     plan_tiledVol_ct3, plan_cuDimMk_ct4, plan_cuDimMm_ct5, \
-                    plan_Mbar_ct6, dataIn_ct7, dataOut_ct8, item);      \
+                    plan_Mbar_ct6, mbarParam_ct, dataIn_ct7, dataOut_ct8, alpha_ct9, beta_ct10, item); \
               });                                                       \
-        }); plan.stream->wait();
+        }); }); })
       #else // CUDA or HIP
-        #define CALL(TYPE)                                                                                     \
-        transposeTiled<TYPE> <<< lc.numblock, lc.numthread, 0, plan.stream >>>                                 \
-            (((ts.volMm - 1)/TILEDIM + 1), ts.volMbar, ts.sizeMbar, plan.tiledVol, plan.cuDimMk, plan.cuDimMm, \
-            plan.Mbar, (TYPE *)dataIn, (TYPE *)dataOut)
+        #define CALL(TYPE, TYPEOUT, UNUSED)                                                                    \
+        dispatchVecWidth<TYPE, TYPEOUT, Tiled>(vecWidth, [&](auto vec) {                                             \
+        dispatchNumMbar<storeMode, IndexT, std::is_same<TYPE, TYPEOUT>::value>(ts.sizeMbar, [&](auto nmbar) { \
+        transposeTiled<TYPE, storeMode, IndexT, decltype(vec)::value, decltype(nmbar)::value, TYPEOUT>      \
+          <<< numblock, lc.numthread, 0, stream >>>                                                          \
+            (numMm, ts.volMbar, ts.sizeMbar, plan.tiledVol, planCuDimMk, planCuDimMm,                           \
+            planMbar, mbarParam, (TYPE *)dataIn, (TYPEOUT *)dataOut, hostScalar<TYPE>(alpha), hostScalar<TYPE>(beta)); }); })
       #endif
-      if (plan.sizeofType == 4) CALL(float);
-      if (plan.sizeofType == 8) CALL(double);
-      if (plan.sizeofType == 16) CALL(librett_complex);
+      CALL_TYPES(CALL, 0);
       #undef CALL
     }
     break;
 
     case TiledCopy:
     {
+      // Vector accesses need aligned dataIn and dataOut, otherwise scalar accesses are used.
+      // Converted vectors must also fit the output type
+      const int vecWidth = (isAligned(dataIn, lc.vecWidth*plan.sizeofType) &&
+        isAligned(dataOut, lc.vecWidth*plan.sizeofTypeOut) &&
+        vecWidthFits(TiledCopy, plan.sizeofTypeOut, lc.vecWidth)) ? lc.vecWidth : 1;
+      const int numMm = tiledNumMm(ts, vecWidth);
+      auto numblock = lc.numblock;
+      numblock_x = numMm*((ts.volMkBar - 1)/TILEDIM + 1);
       #if LIBRETT_USES_SYCL
-        #define CALL(TYPE)                                                           \
-        plan.stream->submit([&](sycl::handler &cgh) {                                \
-          auto ts_volMm_TILEDIM_ct0 = ((ts.volMm - 1) / TILEDIM + 1);                \
+        #define CALL(TYPE, TYPEOUT, UNUSED)                                       \
+        dispatchVecWidth<TYPE, TYPEOUT, TiledCopy>(vecWidth, [&](auto vec) {                  \
+        dispatchNumMbar<storeMode, IndexT, std::is_same<TYPE, TYPEOUT>::value>(ts.sizeMbar, [&](auto nmbar) { \
+        kernelEvent = stream->submit([&](sycl::handler &cgh) {                       \
+          cgh.depends_on(depEvents);                                                 \
+          auto ts_volMm_TILEDIM_ct0 = numMm;                                         \
           auto ts_volMbar_ct1 = ts.volMbar;                                          \
           auto ts_sizeMbar_ct2 = ts.sizeMbar;                                        \
-          auto plan_cuDimMk_ct3 = plan.cuDimMk;                                      \
-          auto plan_cuDimMm_ct4 = plan.cuDimMm;                                      \
+          auto plan_cuDimMk_ct3 = planCuDimMk;                                       \
+          auto plan_cuDimMm_ct4 = planCuDimMm;                                       \
           auto plan_tiledVol_ct5 = plan.tiledVol;                                    \
-          auto plan_Mbar_ct6 = plan.Mbar;                                            \
+          auto plan_Mbar_ct6 = planMbar;                                             \
+          auto mbarParam_ct = mbarParam;                                             \
           auto dataIn_ct7 = (TYPE *)dataIn;                                          \
-          auto dataOut_ct8 = (TYPE *)dataOut;                                        \
+          auto dataOut_ct8 = (TYPEOUT *)dataOut;                                     \
+          auto alpha_ct9 = hostScalar<TYPE>(alpha);                                  \
+          auto beta_ct10 = hostScalar<TYPE>(beta);                                   \
                                                                                      \
           cgh.parallel_for(                                                          \
-              sycl::nd_range<3>(lc.numblock * lc.numthread, lc.numthread),           \
+              sycl::nd_range<3>(numblock * lc.numthread, lc.numthread),              \
               [=](sycl::nd_item<3> item) {    \
-                transposeTiledCopy<TYPE>(                                            \
+                transposeTiledCopy<TYPE, storeMode, IndexT, decltype(vec)::value, decltype(nmbar)::value, TYPEOUT>( \
                     ts_volMm_TILEDIM_ct0, ts_volMbar_ct1, ts_sizeMbar_ct2,           \
                     plan_cuDimMk_ct3, plan_cuDimMm_ct4, plan_tiledVol_ct5,           \
-                    plan_Mbar_ct6, dataIn_ct7, dataOut_ct8, item);               \
+                    plan_Mbar_ct6, mbarParam_ct, dataIn_ct7, dataOut_ct8, alpha_ct9, beta_ct10, item); \
               });                                                                    \
-        }); plan.stream->wait();
+        }); }); })
       #else // CUDA or HIP
-        #define CALL(TYPE)                                                                                     \
-        transposeTiledCopy<TYPE> <<< lc.numblock, lc.numthread, 0, plan.stream >>>                             \
-            (((ts.volMm - 1)/TILEDIM + 1), ts.volMbar, ts.sizeMbar, plan.cuDimMk, plan.cuDimMm, plan.tiledVol, \
-            plan.Mbar, (TYPE *)dataIn, (TYPE *)dataOut)
+        #define CALL(TYPE, TYPEOUT, UNUSED)                                                                    \
+        dispatchVecWidth<TYPE, TYPEOUT, TiledCopy>(vecWidth, [&](auto vec) {                                         \
+        dispatchNumMbar<storeMode, IndexT, std::is_same<TYPE, TYPEOUT>::value>(ts.sizeMbar, [&](auto nmbar) { \
+        transposeTiledCopy<TYPE, storeMode, IndexT, decltype(vec)::value, decltype(nmbar)::value, TYPEOUT>  \
+          <<< numblock, lc.numthread, 0, stream >>>                                                          \
+            (numMm, ts.volMbar, ts.sizeMbar, planCuDimMk, planCuDimMm, plan.tiledVol,                           \
+            planMbar, mbarParam, (TYPE *)dataIn, (TYPEOUT *)dataOut, hostScalar<TYPE>(alpha), hostScalar<TYPE>(beta)); }); })
+      #endif
+      CALL_TYPES(CALL, 0);
+      #undef CALL
+    }
+    break;
+
+
+    case Grouped:
+    {
+      const int numGroup = plan.hostGroup.size();
+      #if LIBRETT_USES_SYCL
+        #define CALL(TYPE)                                                        \
+        kernelEvent = stream->submit([&](sycl::handler &cgh) {                    \
+          cgh.depends_on(depEvents);                                              \
+          auto numGroup_ct0 = numGroup;                                           \
+          auto plan_Group_ct1 = plan.Group;                                       \
+          auto plan_Mbar_ct2 = plan.Mbar;                                         \
+          auto dataIn_ct3 = (TYPE *)dataIn;                                       \
+          auto dataOut_ct4 = (TYPE *)dataOut;                                     \
+          auto alpha_ct5 = hostScalar<TYPE>(alpha);                               \
+          auto beta_ct6 = hostScalar<TYPE>(beta);                                 \
+                                                                                  \
+          cgh.parallel_for(                                                       \
+              sycl::nd_range<3>(lc.numblock * lc.numthread, lc.numthread),        \
+              [=](sycl::nd_item<3> item) {                                        \
+                transposeGrouped<TYPE, storeMode>(                                \
+                    numGroup_ct0, plan_Group_ct1, plan_Mbar_ct2, dataIn_ct3,      \
+                    dataOut_ct4, alpha_ct5, beta_ct6, item);                      \
+              });                                                                 \
+        });
+      #else // CUDA or HIP
+        #define CALL(TYPE)                                                                          \
+        transposeGrouped<TYPE, storeMode> <<< lc.numblock, lc.numthread, 0, stream >>>              \
+            (numGroup, plan.Group, plan.Mbar, (TYPE *)dataIn, (TYPE *)dataOut,                      \
+            hostScalar<TYPE>(alpha), hostScalar<TYPE>(beta))
       #endif
       if (plan.sizeofType == 4) CALL(float);
-      if (plan.sizeofType == 8) CALL(double);
+      if (plan.sizeofType == 8 && !complexFloat) CALL(double);
+      if constexpr (storeMode != StoreCopy) {
+        if (plan.sizeofType == 8 && complexFloat) CALL(librett_complex_float);
+      }
       if (plan.sizeofType == 16) CALL(librett_complex);
+      if (plan.sizeofType == 2) CALL(uint16_t);
+      if (plan.sizeofType == 1) CALL(uint8_t);
       #undef CALL
     }
     break;
 
   }
 
-#if LIBRETT_USES_CUDA
+#if LIBRETT_USES_SYCL
+  if (event != nullptr) *event = kernelEvent;
+#elif LIBRETT_USES_CUDA
   cudaCheck(cudaGetLastError());
 #elif LIBRETT_USES_HIP
   hipCheck(hipGetLastError());
 #endif
   return true;
 }
+
+bool librettKernel(librettPlan_t &plan, void *dataIn, void *dataOut, gpuStream_t stream,
+  const void* alpha, const void* beta, const librettScalarType scalarType
+#if LIBRETT_USES_SYCL
+  , const std::vector<sycl::event>& depEvents, sycl::event* event
+#endif
+  )
+{
+  // Plain copy unless scaling is requested. beta = 0 never reads dataOut
+  int storeMode = StoreCopy;
+  if (alpha != nullptr || beta != nullptr) {
+    // Type conversions are copied only
+    if (librettScalarSize(scalarType) != plan.sizeofType || plan.sizeofTypeOut != plan.sizeofType) return false;
+    if (!scalarEquals(beta, scalarType, 0.0)) {
+      storeMode = StoreAccumulate;
+    } else if (!scalarEquals(alpha, scalarType, 1.0)) {
+      storeMode = StoreScale;
+    }
+  }
+
+#if LIBRETT_USES_SYCL
+  #define CALL(MODE) \
+    if (plan.index64) return librettKernelStore<MODE, long long int>(plan, dataIn, dataOut, stream, alpha, beta, \
+      scalarType, depEvents, event); \
+    return librettKernelStore<MODE, int>(plan, dataIn, dataOut, stream, alpha, beta, scalarType, depEvents, event)
+#else
+  #define CALL(MODE) \
+    if (plan.index64) return librettKernelStore<MODE, long long int>(plan, dataIn, dataOut, stream, alpha, beta, \
+      scalarType); \
+    return librettKernelStore<MODE, int>(plan, dataIn, dataOut, stream, alpha, beta, scalarType)
+#endif
+  switch(storeMode) {
+    case StoreScale: CALL(StoreScale);
+    case StoreAccumulate: CALL(StoreAccumulate);
+    default: CALL(StoreCopy);
+  }
+  #undef CALL
+}
+#undef CALL_TYPES
+
+void librettInPlacePass(const int pass, const long long m, const long long n, const long long first,
+  const long long count, const size_t blockBytes, char* data, char* scratch, gpuStream_t stream) {
+
+  // Largest word that divides the blocks
+  size_t wordSize = 8;
+  while (blockBytes % wordSize != 0 || (uintptr_t)data % wordSize != 0) wordSize /= 2;
+  const long long numWord = blockBytes/wordSize;
+  const long long c = std::gcd(m, n);
+  const long long a = m/c;
+  const long long b = n/c;
+
+  const long long volume = ((pass == 1) ? count*n : m*count)*numWord;
+  const int numthread = 256;
+  const int numblock = (int)std::max<long long>(1, std::min<long long>((volume - 1)/numthread + 1, 65535));
+
+#if LIBRETT_USES_SYCL
+  #define CALL(TYPE)                                                          \
+  stream->submit([&](sycl::handler &cgh) {                                    \
+    auto data_ct0 = (TYPE *)data;                                             \
+    auto scratch_ct1 = (TYPE *)scratch;                                       \
+                                                                              \
+    cgh.parallel_for(                                                         \
+        sycl::nd_range<3>(sycl::range<3>(1, 1, numblock*numthread),           \
+                          sycl::range<3>(1, 1, numthread)),                   \
+        [=](sycl::nd_item<3> item) {                                          \
+          inPlaceGather<TYPE>(pass, m, n, a, b, first, count, numWord,        \
+              data_ct0, scratch_ct1, item);                                   \
+        });                                                                   \
+  });
+#else // CUDA or HIP
+  #define CALL(TYPE)                                                          \
+  inPlaceGather<TYPE> <<< numblock, numthread, 0, stream >>>                  \
+      (pass, m, n, a, b, first, count, numWord, (TYPE *)data, (TYPE *)scratch)
+#endif
+  if (wordSize == 8) CALL(uint64_t);
+  if (wordSize == 4) CALL(uint32_t);
+  if (wordSize == 2) CALL(uint16_t);
+  if (wordSize == 1) CALL(uint8_t);
+  #undef CALL
+
+#if LIBRETT_USES_SYCL
+  // Store must not start before the gather is done
+  if (!stream->is_in_order()) stream->ext_oneapi_submit_barrier();
+#endif
+
+  if (pass == 1) {
+    // Rows are contiguous
+    const size_t bytes = (size_t)count*n*blockBytes;
+#if LIBRETT_USES_SYCL
+    stream->memcpy(data + (size_t)first*n*blockBytes, scratch, bytes);
+#elif LIBRETT_USES_HIP
+    hipCheck(hipMemcpyAsync(data + (size_t)first*n*blockBytes, scratch, bytes, hipMemcpyDefault, stream));
+#elif LIBRETT_USES_CUDA
+    cudaCheck(cudaMemcpyAsync(data + (size_t)first*n*blockBytes, scratch, bytes, cudaMemcpyDefault, stream));
+#endif
+  } else {
+#if LIBRETT_USES_SYCL
+    #define CALL(TYPE)                                                        \
+    stream->submit([&](sycl::handler &cgh) {                                  \
+      auto scratch_ct0 = (TYPE *)scratch;                                     \
+      auto data_ct1 = (TYPE *)data;                                           \
+                                                                              \
+      cgh.parallel_for(                                                       \
+          sycl::nd_range<3>(sycl::range<3>(1, 1, numblock*numthread),         \
+                            sycl::range<3>(1, 1, numthread)),                 \
+          [=](sycl::nd_item<3> item) {                                        \
+            inPlaceStoreColumns<TYPE>(m, n, first, count, numWord,            \
+                scratch_ct0, data_ct1, item);                                 \
+          });                                                                 \
+    });
+#else // CUDA or HIP
+    #define CALL(TYPE)                                                        \
+    inPlaceStoreColumns<TYPE> <<< numblock, numthread, 0, stream >>>          \
+        (m, n, first, count, numWord, (TYPE *)scratch, (TYPE *)data)
+#endif
+    if (wordSize == 8) CALL(uint64_t);
+    if (wordSize == 4) CALL(uint32_t);
+    if (wordSize == 2) CALL(uint16_t);
+    if (wordSize == 1) CALL(uint8_t);
+    #undef CALL
+  }
+
+#if LIBRETT_USES_CUDA
+  cudaCheck(cudaGetLastError());
+#elif LIBRETT_USES_HIP
+  hipCheck(hipGetLastError());
+#endif
+}
@@ -27,7 +27,9 @@ SOFTWARE.
 
 #ifdef LIBRETT_USES_SYCL
   #include <sycl/sycl.hpp>
+  #include <vector>
 #endif
+#include "librett.h"
 #include "plan.h"
 #include "uniapi.h"
 
@@ -36,6 +38,23 @@ void librettKernelSetSharedMemConfig();
 int librettKernelLaunchConfiguration(const int sizeofType, const TensorSplit &ts,
              const int deviceID, const gpuDeviceProp_t &prop, LaunchConfig &lc);
 
-bool librettKernel(librettPlan_t& plan, void* dataIn, void* dataOut);
+// Returns size of the elements of type in bytes, 0 for unknown types
+size_t librettScalarSize(const librettScalarType type);
+
+// Launches the transpose of plan on stream, does not wait for it to finish.
+// If alpha and beta are given (host pointers to scalarType), dataOut = alpha*dataIn + beta*dataOut
+// SYCL: the launch depends on depEvents and its event is returned in event
+bool librettKernel(librettPlan_t& plan, void* dataIn, void* dataOut, gpuStream_t stream,
+  const void* alpha = nullptr, const void* beta = nullptr, const librettScalarType scalarType = LIBRETT_FLOAT
+#if LIBRETT_USES_SYCL
+  , const std::vector<sycl::event>& depEvents = {}, sycl::event* event = nullptr
+#endif
+  );
+
+// Launches pass (0, 1 or 2) of the in-place transpose of the row-major m x n matrix of
+// blocks of blockBytes bytes at data, on rows (pass 1) or columns first ... first+count-1.
+// scratch holds count rows or columns. See InPlace.h
+void librettInPlacePass(const int pass, const long long m, const long long n, const long long first,
+  const long long count, const size_t blockBytes, char* data, char* scratch, gpuStream_t stream);
 
 #endif // LIBRETTKERNEL_H
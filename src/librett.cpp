@@ -24,6 +24,8 @@ SOFTWARE.
 *******************************************************************************/
 
 #include <list>
+#include <memory>
+#include <string>
 #include <unordered_map>
 #include "GpuUtils.h"
 #include "GpuMem.hpp"
@@ -31,27 +33,673 @@ SOFTWARE.
 #include "kernel.h"
 #include "Timer.h"
 #include "librett.h"
+#include "PlanDatabase.h"
+#include "WorkloadTrace.h"
+#include "GpuModel.h"
+#include "MultiGpu.h"
+#include "InPlace.h"
+#include "Streaming.h"
 #include <atomic>
 #include <mutex>
+#include <thread>
 #include <cstdlib>
-// #include <chrono>
 
 // global Umpire allocator
 #ifdef LIBRETT_HAS_UMPIRE
 umpire::Allocator librett_umpire_allocator;
 #endif
 
-// Hash table to store the plans
-static std::unordered_map<librettHandle, librettPlan_t* > planStorage;
-static std::mutex planStorageMutex;
+//
+// Execution times of a handle, measured with events around its launches.
+// A launch is only timed when the previous timed launch of the handle has finished,
+// so timing never waits for the device. The lock is only held to record and read the events
+//
+class ExecStats {
+private:
+#if LIBRETT_USES_SYCL
+  sycl::event event;
+#else
+  gpuEvent_t startEvent = nullptr;
+  gpuEvent_t stopEvent = nullptr;
+#endif
+  // Timed launch that has not been added to the times yet
+  bool pending = false;
+  // Timed launch between start() and stop()
+  bool active = false;
+
+  std::mutex mtx;
+
+  // Adds the pending launch to the times, returns false if the launch has not finished
+  bool update() {
+    if (!pending) return true;
+    double time;
+#if LIBRETT_USES_SYCL
+    if (event.get_info<sycl::info::event::command_execution_status>() !=
+      sycl::info::event_command_status::complete) return false;
+    time = (event.get_profiling_info<sycl::info::event_profiling::command_end>() -
+      event.get_profiling_info<sycl::info::event_profiling::command_start>())*1.0e-6;
+#elif LIBRETT_USES_HIP
+    if (hipEventQuery(stopEvent) == hipErrorNotReady) return false;
+    float ms;
+    hipCheck(hipEventElapsedTime(&ms, startEvent, stopEvent));
+    time = ms;
+#elif LIBRETT_USES_CUDA
+    if (cudaEventQuery(stopEvent) == cudaErrorNotReady) return false;
+    float ms;
+    cudaCheck(cudaEventElapsedTime(&ms, startEvent, stopEvent));
+    time = ms;
+#endif
+    pending = false;
+    minTime = (numTimed == 0) ? time : std::min(minTime, time);
+    lastTime = time;
+    totalTime += time;
+    numTimed++;
+    return true;
+  }
+
+  // Number of timed launches and their times in milliseconds
+  int numTimed = 0;
+  double lastTime = 0.0;
+  double minTime = 0.0;
+  double totalTime = 0.0;
+
+public:
+  ExecStats() = default;
+  ExecStats(const ExecStats&) = delete;
+  ExecStats& operator=(const ExecStats&) = delete;
+
+  ~ExecStats() {
+    // Errors are ignored, the device may already be reset at exit
+#if LIBRETT_USES_HIP
+    if (startEvent != nullptr) (void)hipEventDestroy(startEvent);
+    if (stopEvent != nullptr) (void)hipEventDestroy(stopEvent);
+#elif LIBRETT_USES_CUDA
+    if (startEvent != nullptr) (void)cudaEventDestroy(startEvent);
+    if (stopEvent != nullptr) (void)cudaEventDestroy(stopEvent);
+#endif
+  }
+
+  // Starts timing a launch on stream, returns false if it can not be timed
+  bool start(gpuStream_t stream) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (active || !update()) return false;
+#if LIBRETT_USES_SYCL
+    // Kernel events only carry times on profiling queues
+    if (!stream->has_property<sycl::property::queue::enable_profiling>()) return false;
+#elif LIBRETT_USES_HIP
+    if (startEvent == nullptr) {
+      hipCheck(hipEventCreate(&startEvent));
+      hipCheck(hipEventCreate(&stopEvent));
+    }
+    hipCheck(hipEventRecord(startEvent, stream));
+#elif LIBRETT_USES_CUDA
+    if (startEvent == nullptr) {
+      cudaCheck(cudaEventCreate(&startEvent));
+      cudaCheck(cudaEventCreate(&stopEvent));
+    }
+    cudaCheck(cudaEventRecord(startEvent, stream));
+#endif
+    active = true;
+    return true;
+  }
+
+  // Stops timing the launch started with start(), ok = false if the launch failed
+#if LIBRETT_USES_SYCL
+  void stop(const bool ok, const sycl::event& kernelEvent) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (ok) event = kernelEvent;
+#else
+  void stop(const bool ok, gpuStream_t stream) {
+    std::lock_guard<std::mutex> lock(mtx);
+  #if LIBRETT_USES_HIP
+    if (ok) hipCheck(hipEventRecord(stopEvent, stream));
+  #elif LIBRETT_USES_CUDA
+    if (ok) cudaCheck(cudaEventRecord(stopEvent, stream));
+  #endif
+#endif
+    active = false;
+    pending = ok;
+  }
+
+  // Copies the times of the launches that have finished
+  void get(int& numTimed_out, double& lastTime_out, double& minTime_out, double& totalTime_out) {
+    std::lock_guard<std::mutex> lock(mtx);
+    update();
+    numTimed_out = numTimed;
+    lastTime_out = lastTime;
+    minTime_out = minTime;
+    totalTime_out = totalTime;
+  }
+};
+
+//
+// Storage of plans indexed by handle
+//
+// Lookups are lock free. Each slot counts the threads that are currently using
+// its plan and remove() waits for them to finish before handing the plan back.
+// Handles are never reused, so slots are allocated in chunks that are never freed.
+//
+class PlanStorage {
+private:
+
+  struct Slot {
+    std::atomic<librettPlan_t*> plan;
+    std::atomic<int> numUser;
+    // Plan has been launched on a stream other than its own
+    std::atomic<bool> otherStream;
+    // Execution times, created by the first timed launch
+    std::atomic<ExecStats*> stats;
+  };
+
+  // 2^16 chunks of 2^16 slots cover all handle values
+  static const int CHUNK_BITS = 16;
+  static const unsigned int CHUNK_SIZE = (1u << CHUNK_BITS);
+
+  std::atomic<Slot*> chunks[CHUNK_SIZE];
+
+  // Returns slot for handle, nullptr if the chunk does not exist and create = false
+  Slot* getSlot(const librettHandle handle, const bool create) {
+    std::atomic<Slot*>& chunk = chunks[handle >> CHUNK_BITS];
+    Slot* slots = chunk.load();
+    if (slots == nullptr && create) {
+      Slot* newSlots = new Slot[CHUNK_SIZE]();
+      if (chunk.compare_exchange_strong(slots, newSlots)) {
+        slots = newSlots;
+      } else {
+        // Another thread created the chunk
+        delete [] newSlots;
+      }
+    }
+    if (slots == nullptr) return nullptr;
+    return &slots[handle & (CHUNK_SIZE - 1)];
+  }
+
+public:
+
+  PlanStorage() {
+    for (unsigned int i=0;i < CHUNK_SIZE;i++) chunks[i] = nullptr;
+  }
+
+  // Returns true if handle is in use
+  bool exists(const librettHandle handle) {
+    Slot* slot = getSlot(handle, false);
+    return (slot != nullptr && slot->plan.load() != nullptr);
+  }
+
+  // Stores plan, returns false if handle is already in use
+  bool insert(const librettHandle handle, librettPlan_t* plan) {
+    Slot* slot = getSlot(handle, true);
+    librettPlan_t* expected = nullptr;
+    return slot->plan.compare_exchange_strong(expected, plan);
+  }
+
+  // Returns plan and marks it being used, nullptr if handle is not in use.
+  // Must be followed by release() when a plan was returned
+  librettPlan_t* acquire(const librettHandle handle) {
+    Slot* slot = getSlot(handle, false);
+    if (slot == nullptr) return nullptr;
+    slot->numUser++;
+    librettPlan_t* plan = slot->plan.load();
+    if (plan == nullptr) slot->numUser--;
+    return plan;
+  }
+
+  void release(const librettHandle handle) {
+    getSlot(handle, false)->numUser--;
+  }
+
+  // Marks plan of handle launched on a stream other than its own,
+  // must be called between acquire() and release()
+  void setOtherStream(const librettHandle handle) {
+    getSlot(handle, false)->otherStream.store(true);
+  }
+
+  // Returns execution times of handle, nullptr if they do not exist and create = false.
+  // Must be called between acquire() and release()
+  ExecStats* getStats(const librettHandle handle, const bool create) {
+    Slot* slot = getSlot(handle, false);
+    ExecStats* stats = slot->stats.load();
+    if (stats == nullptr && create) {
+      ExecStats* newStats = new ExecStats();
+      if (slot->stats.compare_exchange_strong(stats, newStats)) {
+        stats = newStats;
+      } else {
+        // Another thread created the times
+        delete newStats;
+      }
+    }
+    return stats;
+  }
+
+  // Removes and returns plan once no thread uses it, nullptr if handle is not in use
+  librettPlan_t* remove(const librettHandle handle) {
+    Slot* slot = getSlot(handle, false);
+    if (slot == nullptr) return nullptr;
+    librettPlan_t* plan = slot->plan.exchange(nullptr);
+    if (plan == nullptr) return nullptr;
+    while (slot->numUser.load() != 0) std::this_thread::yield();
+    delete slot->stats.exchange(nullptr);
+    // Buffers of the plan may be in use on other streams
+    if (slot->otherStream.load()) plan->orderedRelease = false;
+    return plan;
+  }
+
+};
+
+static PlanStorage planStorage;
 
 // Current handle
 static std::atomic<librettHandle> curHandle(0);
 
+// librettPlanMeasure budget, see librettSetMeasureBudget()
+static std::atomic<int> measureTopK(0);
+static std::atomic<int> measureNumRepeat(1);
+
+// librettPlan recounts memory transactions on the device, see librettSetDeviceScoring()
+static std::atomic<bool> deviceScoring(false);
+
+// Part of the plan cache key of heuristic plans, incremented when the heuristic
+// choices change, see invalidateHeuristicPlans()
+static std::atomic<int> heuristicGeneration(0);
+
+// librettExecute* times the launches, see librettSetTiming()
+static std::atomic<bool> timingEnabled(false);
+
+
+//
+// Plans that are built from other plans (multi-GPU, in-place, streaming).
+// They share the handle numbering with the other plans. Execution keeps
+// the plan alive while librettDestroy removes it
+//
+template <typename PlanT>
+class CompositePlans {
+private:
+  std::unordered_map<librettHandle, std::shared_ptr<PlanT>> plans;
+  std::mutex plansMutex;
+
+public:
+  // Returns false if handle is already in use
+  bool insert(const librettHandle handle, const std::shared_ptr<PlanT>& plan) {
+    std::lock_guard<std::mutex> lock(plansMutex);
+    return plans.insert({handle, plan}).second;
+  }
+
+  // Returns nullptr if handle is not in use
+  std::shared_ptr<PlanT> find(const librettHandle handle) {
+    std::lock_guard<std::mutex> lock(plansMutex);
+    auto it = plans.find(handle);
+    if (it == plans.end()) return nullptr;
+    return it->second;
+  }
+
+  // Removes plan, returns false if handle is not in use
+  bool remove(const librettHandle handle) {
+    // Plan is deleted after the lock is released, its destructor destroys the plans it uses
+    std::shared_ptr<PlanT> plan;
+    std::lock_guard<std::mutex> lock(plansMutex);
+    auto it = plans.find(handle);
+    if (it == plans.end()) return false;
+    plan = it->second;
+    plans.erase(it);
+    return true;
+  }
+};
+
+static CompositePlans<librettMultiGpuPlan_t> multiGpuPlans;
+static CompositePlans<librettInPlacePlan_t> inPlacePlans;
+static CompositePlans<librettStreamingPlan_t> streamingPlans;
+
 // Table of devices that have been initialized
 static std::unordered_map<int, gpuDeviceProp_t> deviceProps;
 static std::mutex devicePropsMutex;
 
+static void createEvent(gpuEvent_t& event) {
+#if LIBRETT_USES_HIP
+  hipCheck(hipEventCreateWithFlags(&event, hipEventDisableTiming));
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaEventCreateWithFlags(&event, cudaEventDisableTiming));
+#endif
+}
+
+static void destroyEvent(gpuEvent_t& event) {
+#if LIBRETT_USES_HIP
+  if (event != nullptr) hipCheck(hipEventDestroy(event));
+  event = nullptr;
+#elif LIBRETT_USES_CUDA
+  if (event != nullptr) cudaCheck(cudaEventDestroy(event));
+  event = nullptr;
+#endif
+}
+
+static void recordEvent(gpuEvent_t& event, gpuStream_t stream) {
+#if LIBRETT_USES_SYCL
+  event = stream->ext_oneapi_submit_barrier();
+#elif LIBRETT_USES_HIP
+  hipCheck(hipEventRecord(event, stream));
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaEventRecord(event, stream));
+#endif
+}
+
+static void streamWaitEvent(gpuStream_t stream, gpuEvent_t& event) {
+#if LIBRETT_USES_SYCL
+  stream->ext_oneapi_submit_barrier({event});
+#elif LIBRETT_USES_HIP
+  hipCheck(hipStreamWaitEvent(stream, event, 0));
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaStreamWaitEvent(stream, event, 0));
+#endif
+}
+
+// Makes the work queued on stream after this call wait for the upload of plan's buffers
+static void waitReady(librettPlan_t& plan, gpuStream_t stream) {
+#if !LIBRETT_USES_SYCL
+  if (plan.readyEvent == nullptr) return;
+#endif
+  streamWaitEvent(stream, plan.readyEvent);
+}
+
+//
+// Cache of activated plans
+//
+// Plans created for the same (device, dim, permutation, sizeofType) share the device
+// buffers (Mbar, Mmk, Msh) of a cached template plan. Templates are reference counted
+// and only templates without live handles are evicted, oldest first.
+//
+class PlanCache {
+private:
+
+  struct Entry {
+    // Activated plan that owns the device buffers
+    librettPlan_t* plan;
+    // Number of handles that share the device buffers
+    int refCount;
+    // Position in the list of keys
+    std::list<std::string>::iterator it;
+    // Streams of the released handles and events of their last work,
+    // the device buffers are released after it
+    std::vector<std::pair<gpuStream_t, gpuEvent_t>> useEvents;
+    // A handle was launched on streams that are not known, see PlanStorage::remove()
+    bool unordered = false;
+    // Chosen by librettPlanMeasure()
+    bool measured = false;
+  };
+
+  // Maximum number of templates that are kept when not in use
+  const size_t capacity;
+
+  // Double linked list of keys. Oldest is at the back
+  std::list<std::string> keys;
+
+  std::unordered_map<std::string, Entry> cache;
+
+  // Key of the template used by each handle
+  std::unordered_map<librettHandle, std::string> handleKeys;
+
+#if !LIBRETT_USES_SYCL
+  // Stream of each device that uploads and releases the templates
+  std::unordered_map<int, gpuStream_t> templateStreams;
+#endif
+
+  std::mutex cacheMutex;
+
+  // Returns copy of the template that shares the device buffers
+  librettPlan_t* share(librettHandle handle, const std::string& key, Entry& entry, gpuStream_t& stream) {
+    entry.refCount++;
+    keys.erase(entry.it);
+    keys.push_front(key);
+    entry.it = keys.begin();
+    handleKeys.insert({handle, key});
+    librettPlan_t* plan = new librettPlan_t();
+    *plan = *entry.plan;
+    plan->setStream(stream);
+    // The launches of the handle come after the upload of the buffers
+    waitReady(*plan, stream);
+    return plan;
+  }
+
+  // Deallocates template and its events. Called without holding cacheMutex
+  static void deleteTemplate(Entry& entry) {
+    librettPlan_t* plan = entry.plan;
+    gpuStream_t queue = plan->stream;
+    if (entry.unordered) {
+      // Buffers may still be in use on any stream of the device
+      plan->orderedRelease = false;
+#if LIBRETT_USES_SYCL
+      queue->wait();
+#endif
+    } else {
+      // Released on the template's stream after the last work of all handles
+      for (auto& use : entry.useEvents) streamWaitEvent(queue, use.second);
+    }
+    for (auto& use : entry.useEvents) destroyEvent(use.second);
+    destroyEvent(plan->readyEvent);
+    delete plan;
+#if LIBRETT_USES_SYCL
+    delete queue;
+#endif
+  }
+
+  // Removes template of cache iterator cit and moves it into retired
+  void retire(std::unordered_map<std::string, Entry>::iterator cit, std::vector<Entry>& retired) {
+    retired.push_back(cit->second);
+    keys.erase(cit->second.it);
+    cache.erase(cit);
+  }
+
+public:
+
+  // NOTE: Templates are not deallocated on destruction since the device runtime
+  // may already be shut down at program exit. Use clear() instead
+  PlanCache(const size_t capacity) : capacity(capacity) {}
+
+  //
+  // Deallocates all templates that are not in use
+  //
+  void clear() {
+    std::vector<Entry> retired;
+    {
+      std::lock_guard<std::mutex> lock(cacheMutex);
+      for (auto it=cache.begin();it != cache.end();) {
+        auto cit = it++;
+        if (cit->second.refCount == 0) retire(cit, retired);
+      }
+    }
+    for (auto& entry : retired) deleteTemplate(entry);
+  }
+
+  //
+  // Deallocates all heuristic templates that are not in use. Templates in use
+  // stay until evicted, new handles do not find them since the key changes
+  //
+  void clearHeuristic() {
+    std::vector<Entry> retired;
+    {
+      std::lock_guard<std::mutex> lock(cacheMutex);
+      for (auto it=cache.begin();it != cache.end();) {
+        auto cit = it++;
+        if (cit->second.refCount == 0 && !cit->second.measured) retire(cit, retired);
+      }
+    }
+    for (auto& entry : retired) deleteTemplate(entry);
+  }
+
+  //
+  // Returns new plan for handle if the template is found, otherwise returns nullptr
+  //
+  librettPlan_t* acquire(librettHandle handle, const std::string& key, gpuStream_t& stream) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = cache.find(key);
+    if (it == cache.end()) return nullptr;
+    return share(handle, key, it->second, stream);
+  }
+
+  //
+  // Stores plan as a template and returns new plan for handle.
+  // Takes ownership of plan and activates it
+  //
+  librettPlan_t* insert(librettHandle handle, const std::string& key, librettPlan_t* plan, const bool measured,
+    gpuStream_t& stream) {
+    // The buffers are uploaded on the template's stream and the handles' streams wait
+    // for the upload, no stream is synchronized with the host
+#if LIBRETT_USES_SYCL
+    // Template keeps its own queue so that the buffers can be deallocated
+    // after the user queue is gone
+    plan->stream = new sycl::queue(*stream);
+#else
+    {
+      std::lock_guard<std::mutex> lock(cacheMutex);
+      auto sit = templateStreams.find(plan->deviceID);
+      if (sit == templateStreams.end()) {
+        gpuStream_t templateStream;
+  #if LIBRETT_USES_HIP
+        hipCheck(hipStreamCreateWithFlags(&templateStream, hipStreamNonBlocking));
+  #elif LIBRETT_USES_CUDA
+        cudaCheck(cudaStreamCreateWithFlags(&templateStream, cudaStreamNonBlocking));
+  #endif
+        sit = templateStreams.insert({plan->deviceID, templateStream}).first;
+      }
+      plan->setStream(sit->second);
+    }
+#endif
+    plan->activate();
+    createEvent(plan->readyEvent);
+    recordEvent(plan->readyEvent, plan->stream);
+
+    std::vector<Entry> retired;
+    librettPlan_t* handlePlan;
+    {
+      std::lock_guard<std::mutex> lock(cacheMutex);
+      auto it = cache.find(key);
+      if (it != cache.end()) {
+        // Another thread got here first, use its template
+        Entry lost;
+        lost.plan = plan;
+        retired.push_back(lost);
+        handlePlan = share(handle, key, it->second, stream);
+      } else {
+        keys.push_front(key);
+        Entry entry;
+        entry.plan = plan;
+        entry.refCount = 0;
+        entry.it = keys.begin();
+        entry.measured = measured;
+        it = cache.insert({key, entry}).first;
+        handlePlan = share(handle, key, it->second, stream);
+
+        // Evict unused templates, oldest first
+        auto kit = keys.end();
+        while (cache.size() > capacity && kit != keys.begin()) {
+          kit--;
+          auto cit = cache.find(*kit);
+          if (cit->second.refCount == 0) {
+            // Erasing the key invalidates kit
+            kit = std::next(kit);
+            retire(cit, retired);
+          }
+        }
+      }
+    }
+    for (auto& entry : retired) deleteTemplate(entry);
+
+    return handlePlan;
+  }
+
+  //
+  // Releases the template used by handle. The template's buffers are released after
+  // the work currently queued on stream, or after all work on the device if
+  // ordered = false (the handle was launched on other streams)
+  // Returns true if handle was using a template, in which case the device buffers
+  // of the handle's plan must not be deallocated
+  //
+  bool release(librettHandle handle, gpuStream_t stream, const bool ordered) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto hit = handleKeys.find(handle);
+    if (hit == handleKeys.end()) return false;
+    auto it = cache.find(hit->second);
+    if (it != cache.end()) {
+      Entry& entry = it->second;
+      entry.refCount--;
+      if (!ordered) {
+        entry.unordered = true;
+      } else {
+#if !LIBRETT_USES_SYCL
+        // Events must be on the device of the stream
+        int curDevice;
+  #if LIBRETT_USES_HIP
+        hipCheck(hipGetDevice(&curDevice));
+        if (curDevice != entry.plan->deviceID) hipCheck(hipSetDevice(entry.plan->deviceID));
+  #elif LIBRETT_USES_CUDA
+        cudaCheck(cudaGetDevice(&curDevice));
+        if (curDevice != entry.plan->deviceID) cudaCheck(cudaSetDevice(entry.plan->deviceID));
+  #endif
+#endif
+        // One event per stream, recorded again by later handles
+        auto uit = entry.useEvents.begin();
+        while (uit != entry.useEvents.end() && uit->first != stream) uit++;
+        if (uit == entry.useEvents.end()) {
+          gpuEvent_t event;
+          createEvent(event);
+          uit = entry.useEvents.insert(uit, {stream, event});
+        }
+        recordEvent(uit->second, stream);
+#if LIBRETT_USES_HIP
+        if (curDevice != entry.plan->deviceID) hipCheck(hipSetDevice(curDevice));
+#elif LIBRETT_USES_CUDA
+        if (curDevice != entry.plan->deviceID) cudaCheck(cudaSetDevice(curDevice));
+#endif
+      }
+    }
+    handleKeys.erase(hit);
+    return true;
+  }
+
+};
+
+// Number of templates that are kept in the plan cache
+const int PLAN_CACHE_SIZE = 256;
+static PlanCache planCache(PLAN_CACHE_SIZE);
+
+//
+// Returns plan cache key
+//
+std::string planCacheKey(const int deviceID, gpuStream_t& stream, const int rank, const int* dim,
+  const int* permutation, const size_t sizeofType, const bool measured) {
+  std::string key;
+#if LIBRETT_USES_SYCL
+  // Device buffers can only be shared within the same context
+  key = std::to_string(std::hash<sycl::context>{}(stream->get_context())) + " "
+    + std::to_string(std::hash<sycl::device>{}(stream->get_device()));
+#else
+  key = std::to_string(deviceID);
+#endif
+  key += " " + std::to_string(sizeofType) + " " + std::to_string((int)measured);
+  if (!measured) key += " " + std::to_string(heuristicGeneration.load());
+  for (int i=0;i < rank;i++) key += " " + std::to_string(dim[i]);
+  for (int i=0;i < rank;i++) key += " " + std::to_string(permutation[i]);
+  return key;
+}
+
+//
+// Stores plan of handle. On failure deletes plan and releases its plan cache template
+//
+bool storePlan(const librettHandle handle, librettPlan_t* plan) {
+  if (planStorage.insert(handle, plan)) return true;
+  if (planCache.release(handle, plan->stream, true)) plan->nullDevicePointers();
+  delete plan;
+  return false;
+}
+
+//
+// Drops heuristic plans from the plan cache and, if deviceName is not empty,
+// heuristic plans of that device from the plan database
+//
+void invalidateHeuristicPlans(const std::string& deviceName) {
+  heuristicGeneration++;
+  planCache.clearHeuristic();
+  if (!deviceName.empty()) librettPlanDatabaseClearHeuristic(deviceName);
+}
+
 // Checks prepares device if it's not ready yet and returns device properties
 // Also sets shared memory configuration
 void getDeviceProp(int& deviceID, gpuStream_t& stream, gpuDeviceProp_t &prop) {
@@ -82,9 +730,36 @@ void getDeviceProp(int& deviceID, gpuStream_t& stream, gpuDeviceProp_t &prop) {
   }
 }
 
+//
+// Returns true if stream is being captured into a graph. Plan creation allocates
+// device memory and synchronizes the stream, which is not allowed during capture
+//
+static bool streamIsCapturing(gpuStream_t stream) {
+#if LIBRETT_USES_SYCL
+  return false;
+#elif LIBRETT_USES_HIP
+  hipStreamCaptureStatus status;
+  if (hipStreamIsCapturing(stream, &status) != hipSuccess) {
+    // Implicit capture of the null stream, clear the error
+    (void)hipGetLastError();
+    return true;
+  }
+  return (status != hipStreamCaptureStatusNone);
+#elif LIBRETT_USES_CUDA
+  cudaStreamCaptureStatus status;
+  if (cudaStreamIsCapturing(stream, &status) != cudaSuccess) {
+    // Implicit capture of the null stream, clear the error
+    (void)cudaGetLastError();
+    return true;
+  }
+  return (status != cudaStreamCaptureStatusNone);
+#endif
+}
+
 librettResult librettPlanCheckInput(int rank, int* dim, int* permutation, size_t sizeofType) {
   // Check sizeofType
-  if (sizeofType != 4 && sizeofType != 8 && sizeofType != 16) return LIBRETT_INVALID_PARAMETER;
+  if (sizeofType != 1 && sizeofType != 2 && sizeofType != 4 && sizeofType != 8 && sizeofType != 16)
+    return LIBRETT_INVALID_PARAMETER;
   // Check rank
   if (rank < 1) return LIBRETT_INVALID_PARAMETER;
   // Check dim[]
@@ -107,8 +782,14 @@ librettResult librettPlanCheckInput(int rank, int* dim, int* permutation, size_t
   return LIBRETT_SUCCESS;
 }
 
-librettResult librettPlan(librettHandle *handle, int rank, int *dim, int *permutation, size_t sizeofType,
-  gpuStream_t& stream) {
+//
+// Creates plan for librettPlan, librettPlanStrided and librettPlanConvert.
+// strideIn[i] and strideOut[i] are the strides of rank i in the input and in the output,
+// nullptr = packed tensors. Output elements have sizeofTypeOut bytes.
+// Strided and converting plans are not stored in the plan database
+//
+static librettResult createPlan(librettHandle *handle, int rank, int *dim, int *permutation, size_t sizeofType,
+  gpuStream_t& stream, const long long int* strideIn, const long long int* strideOut, const size_t sizeofTypeOut) {
 
 #if LIBRETT_USES_SYCL
   if(stream == nullptr) {
@@ -116,6 +797,8 @@ librettResult librettPlan(librettHandle *handle, int rank, int *dim, int *permut
   }
 #endif
 
+  if (streamIsCapturing(stream)) return LIBRETT_INVALID_PARAMETER;
+
 #ifdef ENABLE_NVTOOLS
   gpuRangeStart("init");
 #endif
@@ -129,58 +812,86 @@ librettResult librettPlan(librettHandle *handle, int rank, int *dim, int *permut
   curHandle++;
 
   // Check that the current handle is available (it better be!)
-  {
-    std::lock_guard<std::mutex> lock(planStorageMutex);
-    if (planStorage.count(*handle) != 0) return LIBRETT_INTERNAL_ERROR;
-  }
+  if (planStorage.exists(*handle)) return LIBRETT_INTERNAL_ERROR;
 
   // // Prepare device
   int deviceID;
   gpuDeviceProp_t prop;
   getDeviceProp(deviceID, stream, prop);
 
+  // Use activated plan from the plan cache
+  std::string cacheKey = planCacheKey(deviceID, stream, rank, dim, permutation, sizeofType, false);
+  const bool strided = (strideIn != nullptr);
+  if (strided) {
+    for (int i=0;i < rank;i++) cacheKey += " " + std::to_string(strideIn[i]);
+    for (int i=0;i < rank;i++) cacheKey += " " + std::to_string(strideOut[i]);
+  }
+  const bool converting = (sizeofTypeOut != sizeofType);
+  if (converting) cacheKey += " to " + std::to_string(sizeofTypeOut);
+  {
+    librettPlan_t* plan = planCache.acquire(*handle, cacheKey, stream);
+    if (plan != nullptr) {
+      if (!storePlan(*handle, plan)) return LIBRETT_INTERNAL_ERROR;
+#ifdef ENABLE_NVTOOLS
+      gpuRangeStop();
+#endif
+      return LIBRETT_SUCCESS;
+    }
+  }
+
   // Reduce ranks
   std::vector<int> redDim;
   std::vector<int> redPermutation;
-  reduceRanks(rank, dim, permutation, redDim, redPermutation);
+  std::vector<long long int> redStrideIn;
+  std::vector<long long int> redStrideOut;
+  if (strided) {
+    reduceRanks(rank, dim, permutation, strideIn, strideOut, redDim, redPermutation, redStrideIn, redStrideOut);
+  } else {
+    reduceRanks(rank, dim, permutation, redDim, redPermutation);
+  }
 
   // Create plans from reduced ranks
   std::list<librettPlan_t> plans;
-  // if (rank != redDim.size()) {
-  //   if (!createPlans(redDim.size(), redDim.data(), redPermutation.data(), sizeofType, prop, plans)) return LIBRETT_INTERNAL_ERROR;
-  // }
 
-  // // Create plans from non-reduced ranks
-  // if (!createPlans(rank, dim, permutation, sizeofType, prop, plans)) return LIBRETT_INTERNAL_ERROR;
+  // Look up the plan from the database
+  std::string deviceName = librettDeviceName(prop);
+  if (!strided && !converting) {
+    librettPlan_t dbPlan;
+    if (librettPlanDatabaseFind(deviceName, rank, dim, permutation, redDim.size(), redDim.data(),
+      redPermutation.data(), sizeofType, false, deviceID, prop, dbPlan)) plans.push_back(dbPlan);
+  }
+  const bool databaseHit = !plans.empty();
 
-#if 0
-  if (!librettKernelDatabase(deviceID, prop)) return LIBRETT_INTERNAL_ERROR;
-#endif
+  if (!databaseHit) {
 
 #ifdef ENABLE_NVTOOLS
-  gpuRangeStop();
-  gpuRangeStart("createPlans");
+    gpuRangeStop();
+    gpuRangeStart("createPlans");
 #endif
 
-  // std::chrono::high_resolution_clock::time_point plan_start;
-  // plan_start = std::chrono::high_resolution_clock::now();
-
-  if (!librettPlan_t::createPlans(rank, dim, permutation, redDim.size(), redDim.data(), redPermutation.data(),
-    sizeofType, deviceID, prop, plans)) return LIBRETT_INTERNAL_ERROR;
-
-  // std::chrono::high_resolution_clock::time_point plan_end;
-  // plan_end = std::chrono::high_resolution_clock::now();
-  // double plan_duration = std::chrono::duration_cast< std::chrono::duration<double> >(plan_end - plan_start).count();
-  // printf("createPlans took %lf ms\n", plan_duration*1000.0);
+    if (strided) {
+      // Strided plans have only the reduced ranks
+      if (!librettPlan_t::createPlans(redDim.size(), redDim.data(), redPermutation.data(), redDim.size(),
+        redDim.data(), redPermutation.data(), sizeofType, deviceID, prop, plans,
+        redStrideIn.data(), redStrideOut.data())) return LIBRETT_INTERNAL_ERROR;
+    } else {
+      if (!librettPlan_t::createPlans(rank, dim, permutation, redDim.size(), redDim.data(), redPermutation.data(),
+        sizeofType, deviceID, prop, plans)) return LIBRETT_INTERNAL_ERROR;
+    }
 
 #ifdef ENABLE_NVTOOLS
-  gpuRangeStop();
-  gpuRangeStart("countCycles");
+    gpuRangeStop();
+    gpuRangeStart("countCycles");
 #endif
 
-  // Count cycles
-  for (auto it=plans.begin();it != plans.end();it++) {
-    if (!it->countCycles(prop, 10)) return LIBRETT_INTERNAL_ERROR;
+    for (auto it=plans.begin();it != plans.end();it++) it->sizeofTypeOut = sizeofTypeOut;
+
+    // Count cycles
+    if (!librettPlan_t::countCyclesAll(plans, prop, 10)) return LIBRETT_INTERNAL_ERROR;
+    // Device scoring runs the plans on packed buffers of sizeofType elements
+    if (deviceScoring && !strided && !converting &&
+      !librettPlan_t::countCyclesDevice(plans, prop, stream)) return LIBRETT_INTERNAL_ERROR;
+
   }
 
 #ifdef ENABLE_NVTOOLS
@@ -192,7 +903,11 @@ librettResult librettPlan(librettHandle *handle, int rank, int *dim, int *permut
   std::list<librettPlan_t>::iterator bestPlan = choosePlanHeuristic(plans);
   if (bestPlan == plans.end()) return LIBRETT_INTERNAL_ERROR;
 
-  // bestPlan->print();
+  // Store the choice in the database
+  if (!databaseHit && !strided && !converting) {
+    librettPlanDatabaseInsert(deviceName, rank, dim, permutation, redDim.size(), redDim.data(),
+      redPermutation.data(), sizeofType, false, *bestPlan);
+  }
 
   // Create copy of the plan outside the list
   librettPlan_t* plan = new librettPlan_t();
@@ -201,18 +916,14 @@ librettResult librettPlan(librettHandle *handle, int rank, int *dim, int *permut
   // Set device pointers to NULL in the old copy of the plan so
   // that they won't be deallocated later when the object is destroyed
   bestPlan->nullDevicePointers();
+  plan->deviceID = deviceID;
 
-  // Set stream
-  plan->setStream(stream);
-
-  // Activate plan
-  plan->activate();
+  // Store and activate the plan in the plan cache,
+  // handle gets a copy that shares the device buffers
+  plan = planCache.insert(*handle, cacheKey, plan, false, stream);
 
   // Insert plan into storage
-  {
-    std::lock_guard<std::mutex> lock(planStorageMutex);
-    planStorage.insert( {*handle, plan} );
-  }
+  if (!storePlan(*handle, plan)) return LIBRETT_INTERNAL_ERROR;
 
 #ifdef ENABLE_NVTOOLS
   gpuRangeStop();
@@ -221,7 +932,75 @@ librettResult librettPlan(librettHandle *handle, int rank, int *dim, int *permut
   return LIBRETT_SUCCESS;
 }
 
-librettResult librettPlanMeasure(librettHandle *handle, int rank, int *dim, int *permutation, size_t sizeofType,
+//
+// Records plan handle in the workload trace
+//
+static void tracePlan(const librettHandle handle, int rank, int *dim, int *permutation, size_t sizeofType,
+  gpuStream_t& stream) {
+  int deviceID;
+  gpuDeviceProp_t prop;
+  getDeviceProp(deviceID, stream, prop);
+  librettTracePlan(handle, librettDeviceName(prop), rank, dim, permutation, sizeofType);
+}
+
+librettResult librettPlan(librettHandle *handle, int rank, int *dim, int *permutation, size_t sizeofType,
+  gpuStream_t& stream) {
+  librettResult result = createPlan(handle, rank, dim, permutation, sizeofType, stream, nullptr, nullptr, sizeofType);
+  if (result == LIBRETT_SUCCESS && librettTraceEnabled()) tracePlan(*handle, rank, dim, permutation, sizeofType, stream);
+  return result;
+}
+
+librettResult librettPlanStrided(librettHandle *handle, int rank, int *dim, int *permutation, size_t sizeofType,
+  size_t* inStride, size_t* outStride, gpuStream_t& stream) {
+
+  // Check that input parameters are valid
+  librettResult inpCheck = librettPlanCheckInput(rank, dim, permutation, sizeofType);
+  if (inpCheck != LIBRETT_SUCCESS) return inpCheck;
+  // Fastest ranks must be contiguous
+  if ((inStride != nullptr && inStride[0] != 1) || (outStride != nullptr && outStride[0] != 1))
+    return LIBRETT_INVALID_PARAMETER;
+
+  // Strides of input rank i in the input and in the output, packed if not given
+  std::vector<long long int> strideIn(rank);
+  std::vector<long long int> strideOut(rank);
+  bool packed = true;
+  long long int volIn = 1;
+  long long int volOut = 1;
+  for (int i=0;i < rank;i++) {
+    const int pi = permutation[i];
+    strideIn[i] = (inStride != nullptr) ? (long long int)inStride[i] : volIn;
+    strideOut[pi] = (outStride != nullptr) ? (long long int)outStride[i] : volOut;
+    if (strideIn[i] < 1 || strideOut[pi] < 1) return LIBRETT_INVALID_PARAMETER;
+    // Strides of ranks with dimension 1 are never used
+    if (dim[i] > 1 && strideIn[i] != volIn) packed = false;
+    if (dim[pi] > 1 && strideOut[pi] != volOut) packed = false;
+    volIn *= dim[i];
+    volOut *= dim[pi];
+  }
+  if (packed) return librettPlan(handle, rank, dim, permutation, sizeofType, stream);
+
+  return createPlan(handle, rank, dim, permutation, sizeofType, stream, strideIn.data(), strideOut.data(), sizeofType);
+}
+
+librettResult librettPlanConvert(librettHandle *handle, int rank, int *dim, int *permutation, size_t sizeofTypeIn,
+  size_t sizeofTypeOut, gpuStream_t& stream) {
+
+  // Check that input parameters are valid
+  librettResult inpCheck = librettPlanCheckInput(rank, dim, permutation, sizeofTypeIn);
+  if (inpCheck != LIBRETT_SUCCESS) return inpCheck;
+  if (sizeofTypeOut == sizeofTypeIn) return librettPlan(handle, rank, dim, permutation, sizeofTypeIn, stream);
+
+  // Supported conversions: double <-> float, float <-> half, float and double -> double complex
+  const bool supported =
+    (sizeofTypeIn == 8 && sizeofTypeOut == 4) || (sizeofTypeIn == 4 && sizeofTypeOut == 8) ||
+    (sizeofTypeIn == 4 && sizeofTypeOut == 2) || (sizeofTypeIn == 2 && sizeofTypeOut == 4) ||
+    (sizeofTypeIn == 4 && sizeofTypeOut == 16) || (sizeofTypeIn == 8 && sizeofTypeOut == 16);
+  if (!supported) return LIBRETT_INVALID_PARAMETER;
+
+  return createPlan(handle, rank, dim, permutation, sizeofTypeIn, stream, nullptr, nullptr, sizeofTypeOut);
+}
+
+static librettResult measurePlan(librettHandle *handle, int rank, int *dim, int *permutation, size_t sizeofType,
   gpuStream_t& stream, void* idata, void* odata)
 {
 #if LIBRETT_USES_SYCL
@@ -230,6 +1009,8 @@ librettResult librettPlanMeasure(librettHandle *handle, int rank, int *dim, int
   }
 #endif
 
+  if (streamIsCapturing(stream)) return LIBRETT_INVALID_PARAMETER;
+
   // Check that input parameters are valid
   librettResult inpCheck = librettPlanCheckInput(rank, dim, permutation, sizeofType);
   if (inpCheck != LIBRETT_SUCCESS) return inpCheck;
@@ -241,16 +1022,23 @@ librettResult librettPlanMeasure(librettHandle *handle, int rank, int *dim, int
   curHandle++;
 
   // Check that the current handle is available (it better be!)
-  {
-    std::lock_guard<std::mutex> lock(planStorageMutex);
-    if (planStorage.count(*handle) != 0) return LIBRETT_INTERNAL_ERROR;
-  }
+  if (planStorage.exists(*handle)) return LIBRETT_INTERNAL_ERROR;
 
   // // Prepare device
   int deviceID;
   gpuDeviceProp_t prop;
   getDeviceProp(deviceID, stream, prop);
 
+  // Use activated plan from the plan cache
+  std::string cacheKey = planCacheKey(deviceID, stream, rank, dim, permutation, sizeofType, true);
+  {
+    librettPlan_t* plan = planCache.acquire(*handle, cacheKey, stream);
+    if (plan != nullptr) {
+      if (!storePlan(*handle, plan)) return LIBRETT_INTERNAL_ERROR;
+      return LIBRETT_SUCCESS;
+    }
+  }
+
   // Reduce ranks
   std::vector<int> redDim;
   std::vector<int> redPermutation;
@@ -258,22 +1046,35 @@ librettResult librettPlanMeasure(librettHandle *handle, int rank, int *dim, int
 
   // Create plans from reduced ranks
   std::list<librettPlan_t> plans;
-#if 0
-  // if (rank != redDim.size()) {
-    if (!createPlans(redDim.size(), redDim.data(), redPermutation.data(), sizeofType, prop, plans)) return LIBRETT_INTERNAL_ERROR;
-  // }
 
-  // Create plans from non-reduced ranks
-  // if (!createPlans(rank, dim, permutation, sizeofType, prop, plans)) return LIBRETT_INTERNAL_ERROR;
-#else
-  if (!librettPlan_t::createPlans(rank, dim, permutation, redDim.size(), redDim.data(), redPermutation.data(),
-    sizeofType, deviceID, prop, plans)) return LIBRETT_INTERNAL_ERROR;
-#endif
+  // Look up a measured plan from the database
+  std::string deviceName = librettDeviceName(prop);
+  {
+    librettPlan_t dbPlan;
+    if (librettPlanDatabaseFind(deviceName, rank, dim, permutation, redDim.size(), redDim.data(),
+      redPermutation.data(), sizeofType, true, deviceID, prop, dbPlan)) plans.push_back(dbPlan);
+  }
+  const bool databaseHit = !plans.empty();
 
-  // // Count cycles
-  // for (auto it=plans.begin();it != plans.end();it++) {
-  //   if (!it->countCycles(prop, 10)) return LIBRETT_INTERNAL_ERROR;
-  // }
+  if (!databaseHit) {
+    if (!librettPlan_t::createPlans(rank, dim, permutation, redDim.size(), redDim.data(), redPermutation.data(),
+      sizeofType, deviceID, prop, plans)) return LIBRETT_INTERNAL_ERROR;
+  }
+
+  // Only time the topK candidates that the performance model ranks best
+  const int topK = measureTopK;
+  const int numRepeat = measureNumRepeat;
+  if (!databaseHit && topK > 0 && (int)plans.size() > topK) {
+    // Count cycles
+    if (!librettPlan_t::countCyclesAll(plans, prop, 10)) return LIBRETT_INTERNAL_ERROR;
+    plans.sort([](const librettPlan_t& lhs, const librettPlan_t& rhs) {
+      // Trivial method always wins
+      if (lhs.tensorSplit.method == Trivial || rhs.tensorSplit.method == Trivial)
+        return (lhs.tensorSplit.method == Trivial && rhs.tensorSplit.method != Trivial);
+      return (lhs.cycles < rhs.cycles);
+    });
+    plans.resize(topK);
+  }
 
   // // Count the number of elements
   size_t numBytes = sizeofType;
@@ -281,32 +1082,37 @@ librettResult librettPlanMeasure(librettHandle *handle, int rank, int *dim, int
 
   // Choose the plan
   double bestTime = 1.0e40;
-  auto bestPlan = plans.end();
+  auto bestPlan = databaseHit ? plans.begin() : plans.end();
   Timer timer;
-  std::vector<double> times;
-  for (auto it=plans.begin();it != plans.end();it++) {
+  for (auto it=plans.begin();it != plans.end() && !databaseHit;it++) {
     // Activate plan
     it->activate();
 
     // Clear output data to invalidate caches
     set_device_array<char>((char *)odata, -1, numBytes, stream);
 
+    // With numRepeat > 1, the first run warms up and the fastest of the
+    // numRepeat runs that follow counts
+    double curTime = 1.0e40;
+    for (int r=0;r < numRepeat + (numRepeat > 1);r++) {
 #if LIBRETT_USES_SYCL
-    stream->wait_and_throw();
+      stream->wait_and_throw();
 #elif LIBRETT_USES_HIP
-    hipCheck(hipStreamSynchronize(stream));
+      hipCheck(hipStreamSynchronize(stream));
 #elif LIBRETT_USES_CUDA
-    cudaCheck(cudaStreamSynchronize(stream));
+      cudaCheck(cudaStreamSynchronize(stream));
 #endif
 
-    timer.start();
-    // Execute plan
-    if (!librettKernel(*it, idata, odata)) return LIBRETT_INTERNAL_ERROR;
-    timer.stop();
-    double curTime = timer.seconds();
-    // it->print();
-    // printf("curTime %1.2lf\n", curTime*1000.0);
-    times.push_back(curTime);
+      timer.start();
+      // Execute plan
+      if (!librettKernel(*it, idata, odata, stream)) return LIBRETT_INTERNAL_ERROR;
+#if LIBRETT_USES_SYCL
+      // SYCL timer uses wall clock and launches are asynchronous
+      stream->wait_and_throw();
+#endif
+      timer.stop();
+      if (numRepeat == 1 || r > 0) curTime = std::min(curTime, timer.seconds());
+    }
     if (curTime < bestTime) {
       bestTime = curTime;
       bestPlan = it;
@@ -314,11 +1120,11 @@ librettResult librettPlanMeasure(librettHandle *handle, int rank, int *dim, int
   }
   if (bestPlan == plans.end()) return LIBRETT_INTERNAL_ERROR;
 
-  // bestPlan = plans.begin();
-
-  // printMatlab(prop, plans, times);
-  // findMispredictionBest(plans, times, bestPlan, bestTime);
-  // bestPlan->print();
+  // Store the measured choice in the database
+  if (!databaseHit) {
+    librettPlanDatabaseInsert(deviceName, rank, dim, permutation, redDim.size(), redDim.data(),
+      redPermutation.data(), sizeofType, true, *bestPlan);
+  }
 
   // Create copy of the plan outside the list
   librettPlan_t* plan = new librettPlan_t();
@@ -326,64 +1132,624 @@ librettResult librettPlanMeasure(librettHandle *handle, int rank, int *dim, int
   // Set device pointers to NULL in the old copy of the plan so
   // that they won't be deallocated later when the object is destroyed
   bestPlan->nullDevicePointers();
+  plan->deviceID = deviceID;
 
-  // Set stream
-  plan->setStream(stream);
+  // Store and activate the plan in the plan cache,
+  // handle gets a copy that shares the device buffers
+  plan = planCache.insert(*handle, cacheKey, plan, true, stream);
+
+  // Insert plan into storage
+  if (!storePlan(*handle, plan)) return LIBRETT_INTERNAL_ERROR;
+
+  return LIBRETT_SUCCESS;
+}
+
+librettResult librettPlanMeasure(librettHandle *handle, int rank, int *dim, int *permutation, size_t sizeofType,
+  gpuStream_t& stream, void* idata, void* odata) {
+  librettResult result = measurePlan(handle, rank, dim, permutation, sizeofType, stream, idata, odata);
+  if (result == LIBRETT_SUCCESS && librettTraceEnabled()) tracePlan(*handle, rank, dim, permutation, sizeofType, stream);
+  return result;
+}
 
-  // Activate plan
+librettResult librettSetMeasureBudget(int topK, int numRepeat) {
+  if (topK < 0 || numRepeat < 1) return LIBRETT_INVALID_PARAMETER;
+  measureTopK = topK;
+  measureNumRepeat = numRepeat;
+  return LIBRETT_SUCCESS;
+}
+
+librettResult librettSetDeviceScoring(bool enable) {
+  // Plans chosen with the other scoring are not reused
+  if (deviceScoring.exchange(enable) != enable) invalidateHeuristicPlans("");
+  return LIBRETT_SUCCESS;
+}
+
+librettResult librettSetTiming(bool enable) {
+  timingEnabled = enable;
+  return LIBRETT_SUCCESS;
+}
+
+librettResult librettPlanGetInfo(librettHandle handle, librettPlanInfo* info) {
+  if (info == nullptr) return LIBRETT_INVALID_PARAMETER;
+
+  // prevent deletion while in use
+  librettPlan_t* plan = planStorage.acquire(handle);
+  if (plan == nullptr) return LIBRETT_INVALID_PLAN;
+
+  const LaunchConfig& lc = plan->launchConfig;
+  info->method = methodName(plan->tensorSplit.method);
+  info->numthread[0] = lc.numthread_x;
+  info->numthread[1] = lc.numthread_y;
+  info->numthread[2] = lc.numthread_z;
+  info->numblock[0] = lc.numblock_x;
+  info->numblock[1] = lc.numblock_y;
+  info->numblock[2] = lc.numblock_z;
+  info->shmemsize = lc.shmemsize;
+  info->numRegStorage = lc.numRegStorage;
+  info->vecWidth = lc.vecWidth;
+  info->numActiveBlock = plan->numActiveBlock;
+  info->cycles = plan->cycles;
+  info->bytes = (size_t)plan->volume()*(plan->sizeofType + plan->sizeofTypeOut);
+
+  info->numTimed = 0;
+  info->lastTime = 0.0;
+  info->minTime = 0.0;
+  info->avgTime = 0.0;
+  info->bandwidth = 0.0;
+  ExecStats* stats = planStorage.getStats(handle, false);
+  if (stats != nullptr) {
+    double totalTime;
+    stats->get(info->numTimed, info->lastTime, info->minTime, totalTime);
+    if (info->numTimed > 0) {
+      info->avgTime = totalTime/info->numTimed;
+      if (info->minTime > 0.0) info->bandwidth = (double)info->bytes/(info->minTime*1.0e6);
+    }
+  }
+
+  planStorage.release(handle);
+  return LIBRETT_SUCCESS;
+}
+
+//
+// Reference transposes used by librettCalibrateModel, all about 2^23 elements
+//
+struct CalibrationProblem {
+  int rank;
+  int dim[6];
+  int permutation[6];
+};
+
+static const CalibrationProblem calibrationProblems[] = {
+  {2, {2048, 4096}, {1, 0}},
+  {3, {256, 256, 128}, {2, 1, 0}},
+  {3, {256, 256, 128}, {0, 2, 1}},
+  {3, {256, 256, 128}, {1, 0, 2}},
+  {4, {64, 64, 64, 32}, {3, 2, 1, 0}},
+  {4, {64, 64, 64, 32}, {0, 3, 2, 1}},
+  {4, {33, 65, 129, 30}, {3, 1, 0, 2}},
+  {6, {16, 16, 16, 16, 32, 4}, {5, 4, 3, 2, 1, 0}},
+  {6, {16, 16, 16, 16, 32, 4}, {1, 0, 3, 2, 5, 4}},
+  {6, {8, 16, 8, 16, 8, 64}, {2, 5, 0, 3, 1, 4}}
+};
+
+librettResult librettCalibrateModel(gpuStream_t& stream) {
+#if LIBRETT_USES_SYCL
+  if(stream == nullptr) {
+    throw std::runtime_error("[SYCL] pass a valid/non-nullptr SYCL queue to the plan constructor!");
+  }
+#endif
+
+  if (streamIsCapturing(stream)) return LIBRETT_INVALID_PARAMETER;
+
+  int deviceID;
+  gpuDeviceProp_t prop;
+  getDeviceProp(deviceID, stream, prop);
+
+  const int numProblem = sizeof(calibrationProblems)/sizeof(CalibrationProblem);
+  const size_t sizeofTypes[2] = {4, 8};
+  size_t maxVol = 0;
+  for (int p=0;p < numProblem;p++) {
+    size_t vol = 1;
+    for (int i=0;i < calibrationProblems[p].rank;i++) vol *= calibrationProblems[p].dim[i];
+    maxVol = std::max(maxVol, vol);
+  }
+
+  char* idata;
+  char* odata;
+  allocate_device<char>(&idata, maxVol*8, stream);
+  allocate_device<char>(&odata, maxVol*8, stream);
+  set_device_array<char>(idata, 0, maxVol*8, stream);
+
+  // Time every candidate plan of every reference problem
+  std::list<librettPlan_t> plans;
+  std::vector<double> times;
+  Timer timer;
+  bool ok = true;
+  for (int t=0;t < 2 && ok;t++) {
+    for (int p=0;p < numProblem && ok;p++) {
+      const CalibrationProblem& prob = calibrationProblems[p];
+      std::vector<int> redDim;
+      std::vector<int> redPermutation;
+      reduceRanks(prob.rank, prob.dim, prob.permutation, redDim, redPermutation);
+      std::list<librettPlan_t> probPlans;
+      if (!librettPlan_t::createPlans(prob.rank, prob.dim, prob.permutation, redDim.size(), redDim.data(),
+        redPermutation.data(), sizeofTypes[t], deviceID, prop, probPlans)) {
+        ok = false;
+        break;
+      }
+      for (auto it=probPlans.begin();it != probPlans.end();) {
+        if (!it->countCycles(prop, 10)) {
+          ok = false;
+          break;
+        }
+        // Trivial plans are not part of the model
+        if (it->tensorSplit.method == Trivial) {
+          it = probPlans.erase(it);
+          continue;
+        }
+        it->setStream(stream);
+        it->activate();
+        // Best of three runs after a warm up run
+        double bestTime = 1.0e40;
+        for (int r=0;r < 4 && ok;r++) {
+#if LIBRETT_USES_SYCL
+          stream->wait_and_throw();
+#elif LIBRETT_USES_HIP
+          hipCheck(hipStreamSynchronize(stream));
+#elif LIBRETT_USES_CUDA
+          cudaCheck(cudaStreamSynchronize(stream));
+#endif
+          timer.start();
+          if (!librettKernel(*it, idata, odata, stream)) ok = false;
+#if LIBRETT_USES_SYCL
+          stream->wait_and_throw();
+#endif
+          timer.stop();
+          if (r > 0) bestTime = std::min(bestTime, timer.seconds());
+        }
+        times.push_back(bestTime);
+        it++;
+      }
+      plans.splice(plans.end(), probPlans);
+    }
+  }
+
+  deallocate_device<char>(&idata, stream);
+  deallocate_device<char>(&odata, stream);
+  if (!ok) return LIBRETT_INTERNAL_ERROR;
+
+  // Fit, starting from the current parameters of the device
+  GpuModelProp modelProp(prop);
+  if (!fitGpuModelProp(prop, plans, times, modelProp)) return LIBRETT_INTERNAL_ERROR;
+
+  std::string deviceName = librettDeviceName(prop);
+  librettSetGpuModelProp(deviceName, modelProp);
+  // Heuristic choices were made with the old parameters
+  invalidateHeuristicPlans(deviceName);
+
+  return LIBRETT_SUCCESS;
+}
+
+librettResult librettPlanBatched(librettHandle *handle, int rank, int *dim, int *permutation, size_t sizeofType,
+  int batchCount, gpuStream_t& stream) {
+
+  if (batchCount < 1) return LIBRETT_INVALID_PARAMETER;
+  librettResult inpCheck = librettPlanCheckInput(rank, dim, permutation, sizeofType);
+  if (inpCheck != LIBRETT_SUCCESS) return inpCheck;
+
+  // Batch index is an extra outermost dimension that is not permuted.
+  // It ends up in Mbar (or is merged by reduceRanks) so that the whole
+  // batch runs in one launch
+  std::vector<int> batchDim(dim, dim + rank);
+  std::vector<int> batchPermutation(permutation, permutation + rank);
+  batchDim.push_back(batchCount);
+  batchPermutation.push_back(rank);
+
+  return librettPlan(handle, rank + 1, batchDim.data(), batchPermutation.data(), sizeofType, stream);
+}
+
+librettResult librettPlanGrouped(librettHandle *handle, int groupCount, int rank, int *dims, int *permutation,
+  size_t sizeofType, size_t* inOffsets, size_t* outOffsets, gpuStream_t& stream) {
+
+#if LIBRETT_USES_SYCL
+  if(stream == nullptr) {
+    throw std::runtime_error("[SYCL] pass a valid/non-nullptr SYCL queue to the plan constructor!");
+  }
+#endif
+
+  if (streamIsCapturing(stream)) return LIBRETT_INVALID_PARAMETER;
+
+  // Check that input parameters are valid
+  if (groupCount < 1 || dims == nullptr) return LIBRETT_INVALID_PARAMETER;
+  for (int g=0;g < groupCount;g++) {
+    librettResult inpCheck = librettPlanCheckInput(rank, dims + g*rank, permutation, sizeofType);
+    if (inpCheck != LIBRETT_SUCCESS) return inpCheck;
+  }
+
+  // Create new handle
+  *handle = curHandle;
+  curHandle++;
+
+  // Check that the current handle is available (it better be!)
+  if (planStorage.exists(*handle)) return LIBRETT_INTERNAL_ERROR;
+
+  int deviceID;
+  gpuDeviceProp_t prop;
+  getDeviceProp(deviceID, stream, prop);
+
+  // Grouped plans are not shared through the plan cache:
+  // the problem list makes each of them unique
+  librettPlan_t* plan = new librettPlan_t();
+  if (!plan->setupGrouped(groupCount, rank, dims, permutation, sizeofType, inOffsets, outOffsets)) {
+    delete plan;
+    return LIBRETT_INVALID_PARAMETER;
+  }
+  plan->deviceID = deviceID;
+  plan->setStream(stream);
   plan->activate();
 
   // Insert plan into storage
-  {
-    std::lock_guard<std::mutex> lock(planStorageMutex);
-    planStorage.insert( {*handle, plan} );
+  if (!storePlan(*handle, plan)) return LIBRETT_INTERNAL_ERROR;
+
+  return LIBRETT_SUCCESS;
+}
+
+librettResult librettPlanMultiGpu(librettHandle *handle, int rank, int *dim, int *permutation, size_t sizeofType,
+  int shardIn, int shardOut, int numDevice, int *devices, gpuStream_t *streams) {
+
+  // Check that input parameters are valid
+  librettResult inpCheck = librettPlanCheckInput(rank, dim, permutation, sizeofType);
+  if (inpCheck != LIBRETT_SUCCESS) return inpCheck;
+  if (numDevice < 1 || streams == nullptr) return LIBRETT_INVALID_PARAMETER;
+#if !LIBRETT_USES_SYCL
+  if (devices == nullptr) return LIBRETT_INVALID_PARAMETER;
+#endif
+  if (shardIn < 0 || shardIn >= rank || shardOut < 0 || shardOut >= rank) return LIBRETT_INVALID_PARAMETER;
+  // Every device gets at least one index of the sharded ranks
+  if (dim[shardIn] < numDevice || dim[shardOut] < numDevice) return LIBRETT_INVALID_PARAMETER;
+  for (int i=0;i < numDevice;i++) {
+#if LIBRETT_USES_SYCL
+    if (streams[i] == nullptr) {
+      throw std::runtime_error("[SYCL] pass valid/non-nullptr SYCL queues to the plan constructor!");
+    }
+#endif
+    if (streamIsCapturing(streams[i])) return LIBRETT_INVALID_PARAMETER;
   }
 
+  // Create new handle
+  *handle = curHandle;
+  curHandle++;
+
+  // Check that the current handle is available (it better be!)
+  if (planStorage.exists(*handle)) return LIBRETT_INTERNAL_ERROR;
+
+  std::shared_ptr<librettMultiGpuPlan_t> plan = std::make_shared<librettMultiGpuPlan_t>();
+  librettResult result = plan->setup(rank, dim, permutation, sizeofType, shardIn, shardOut,
+    numDevice, devices, streams);
+  if (result != LIBRETT_SUCCESS) return result;
+
+  if (!multiGpuPlans.insert(*handle, plan)) return LIBRETT_INTERNAL_ERROR;
+
   return LIBRETT_SUCCESS;
 }
 
-void librettDestroy_callback(gpuStream_t stream, gpuError_t status,
-  void *userData) {
-  librettPlan_t* plan = (librettPlan_t*) userData;
-  delete plan;
+librettResult librettExecuteMultiGpu(librettHandle handle, void **idata, void **odata)
+{
+  if (idata == nullptr || odata == nullptr) return LIBRETT_INVALID_PARAMETER;
+
+  std::shared_ptr<librettMultiGpuPlan_t> plan = multiGpuPlans.find(handle);
+  if (plan == nullptr) return LIBRETT_INVALID_PLAN;
+  return plan->execute(idata, odata);
 }
 
-librettResult librettDestroy(librettHandle handle) {
-  std::lock_guard<std::mutex> lock(planStorageMutex);
-  auto it = planStorage.find(handle);
-  if (it == planStorage.end()) return LIBRETT_INVALID_PLAN;
-#ifdef LIBRETT_HAS_UMPIRE
-  // get the pointer librettPlan_t
-  librettPlan_t* plan = it->second;
-  cudaStream_t stream = plan->stream;
-  // Delete entry from plan storage
-  planStorage.erase(it);
-  // register callback to deallocate plan
-  cudaStreamAddCallback(stream, librettDestroy_callback, plan, 0);
+librettResult librettPlanInPlace(librettHandle *handle, int rank, int *dim, int *permutation, size_t sizeofType,
+  gpuStream_t& stream, size_t scratchSize) {
+
+#if LIBRETT_USES_SYCL
+  if (stream == nullptr) {
+    throw std::runtime_error("[SYCL] pass a valid/non-nullptr SYCL queue to the plan constructor!");
+  }
+#endif
+
+  // Check that input parameters are valid
+  librettResult inpCheck = librettPlanCheckInput(rank, dim, permutation, sizeofType);
+  if (inpCheck != LIBRETT_SUCCESS) return inpCheck;
+  if (streamIsCapturing(stream)) return LIBRETT_INVALID_PARAMETER;
+
+  // Create new handle
+  *handle = curHandle;
+  curHandle++;
+
+  // Check that the current handle is available (it better be!)
+  if (planStorage.exists(*handle)) return LIBRETT_INTERNAL_ERROR;
+
+  std::shared_ptr<librettInPlacePlan_t> plan = std::make_shared<librettInPlacePlan_t>();
+  librettResult result = plan->setup(rank, dim, permutation, sizeofType, stream, scratchSize);
+  if (result != LIBRETT_SUCCESS) return result;
+
+  if (!inPlacePlans.insert(*handle, plan)) return LIBRETT_INTERNAL_ERROR;
+
+  return LIBRETT_SUCCESS;
+}
+
+librettResult librettExecuteInPlace(librettHandle handle, void *data)
+{
+  if (data == nullptr) return LIBRETT_INVALID_PARAMETER;
+
+  std::shared_ptr<librettInPlacePlan_t> plan = inPlacePlans.find(handle);
+  if (plan == nullptr) return LIBRETT_INVALID_PLAN;
+  return plan->execute(data);
+}
+
+librettResult librettPlanStreaming(librettHandle *handle, int rank, int *dim, int *permutation, size_t sizeofType,
+  int numStream, gpuStream_t *streams, size_t maxDeviceBytes) {
+
+  // Check that input parameters are valid
+  librettResult inpCheck = librettPlanCheckInput(rank, dim, permutation, sizeofType);
+  if (inpCheck != LIBRETT_SUCCESS) return inpCheck;
+  if (numStream < 1 || streams == nullptr) return LIBRETT_INVALID_PARAMETER;
+  for (int i=0;i < numStream;i++) {
+#if LIBRETT_USES_SYCL
+    if (streams[i] == nullptr) {
+      throw std::runtime_error("[SYCL] pass valid/non-nullptr SYCL queues to the plan constructor!");
+    }
+#endif
+    if (streamIsCapturing(streams[i])) return LIBRETT_INVALID_PARAMETER;
+  }
+
+  // Create new handle
+  *handle = curHandle;
+  curHandle++;
+
+  // Check that the current handle is available (it better be!)
+  if (planStorage.exists(*handle)) return LIBRETT_INTERNAL_ERROR;
+
+  std::shared_ptr<librettStreamingPlan_t> plan = std::make_shared<librettStreamingPlan_t>();
+  librettResult result = plan->setup(rank, dim, permutation, sizeofType, numStream, streams, maxDeviceBytes);
+  if (result != LIBRETT_SUCCESS) return result;
+
+  if (!streamingPlans.insert(*handle, plan)) return LIBRETT_INTERNAL_ERROR;
+
+  return LIBRETT_SUCCESS;
+}
+
+librettResult librettExecuteStreaming(librettHandle handle, const void *h_idata, void *h_odata)
+{
+  if (h_idata == nullptr || h_odata == nullptr || h_idata == h_odata) return LIBRETT_INVALID_PARAMETER;
+
+  std::shared_ptr<librettStreamingPlan_t> plan = streamingPlans.find(handle);
+  if (plan == nullptr) return LIBRETT_INVALID_PLAN;
+  return plan->execute(h_idata, h_odata);
+}
+
+#ifdef ENABLE_NVTOOLS
+//
+// Returns the profiler range name of launches of plan, tagged with method and shape
+//
+static std::string planRangeName(const librettPlan_t& plan) {
+  const TensorSplit& ts = plan.tensorSplit;
+  std::string name = std::string("librettExecute ") + methodName(ts.method);
+  if (ts.method == Grouped) {
+    name += " groups " + std::to_string(plan.hostGroup.size());
+  } else {
+    name += " Mm " + std::to_string(ts.volMm) + " Mk " + std::to_string(ts.volMk) +
+      " Mbar " + std::to_string(ts.volMbar);
+  }
+  name += " vol " + std::to_string(plan.volume()) + " " + std::to_string(plan.sizeofType) + "B";
+  return name;
+}
+#endif
+
+//
+// Launches plan of handle on stream. The launch is marked with a profiler range
+// (ENABLE_NVTOOLS) and timed when timing is enabled
+//
+static bool executePlan(const librettHandle handle, librettPlan_t& plan, void* idata, void* odata,
+  gpuStream_t stream, const void* alpha = nullptr, const void* beta = nullptr,
+  const librettScalarType scalarType = LIBRETT_FLOAT
+#if LIBRETT_USES_SYCL
+  , const std::vector<sycl::event>& depEvents = {}, sycl::event* event = nullptr
+#endif
+  ) {
+#ifdef ENABLE_NVTOOLS
+  gpuRangeStart(planRangeName(plan).c_str());
+#endif
+  if (librettTraceEnabled()) librettTraceExecute(handle);
+  bool ok;
+  if (!timingEnabled) {
+#if LIBRETT_USES_SYCL
+    ok = librettKernel(plan, idata, odata, stream, alpha, beta, scalarType, depEvents, event);
+#else
+    ok = librettKernel(plan, idata, odata, stream, alpha, beta, scalarType);
+#endif
+  } else {
+    ExecStats* stats = planStorage.getStats(handle, true);
+    const bool timed = stats->start(stream);
+#if LIBRETT_USES_SYCL
+    sycl::event kernelEvent;
+    ok = librettKernel(plan, idata, odata, stream, alpha, beta, scalarType, depEvents, &kernelEvent);
+    if (timed) stats->stop(ok, kernelEvent);
+    if (event != nullptr) *event = kernelEvent;
 #else
-  // Delete instance of librettPlan_t
-  delete it->second;
-  // Delete entry from plan storage
-  planStorage.erase(it);
+    ok = librettKernel(plan, idata, odata, stream, alpha, beta, scalarType);
+    if (timed) stats->stop(ok, stream);
 #endif
+  }
+#ifdef ENABLE_NVTOOLS
+  gpuRangeStop();
+#endif
+  return ok;
+}
+
+librettResult librettDestroy(librettHandle handle) {
+  // Delete entry from plan storage, waits for concurrent librettExecute calls on this handle
+  librettPlan_t* plan = planStorage.remove(handle);
+  if (plan == nullptr) {
+    // Composite plan, deleted here or by the last execution that still uses it
+    if (multiGpuPlans.remove(handle) || inPlacePlans.remove(handle) || streamingPlans.remove(handle)) {
+      return LIBRETT_SUCCESS;
+    }
+    return LIBRETT_INVALID_PLAN;
+  }
+  if (librettTraceEnabled()) librettTraceDestroy(handle);
+  // Device buffers shared with the cached template are not deallocated here
+  if (planCache.release(handle, plan->stream, plan->orderedRelease)) plan->nullDevicePointers();
+#if LIBRETT_USES_SYCL
+  // Launches on other queues are not ordered with the release, wait for the plan's queue
+  if (!plan->orderedRelease) plan->stream->wait();
+#endif
+  // Delete instance of librettPlan_t. The device buffers are released in order with
+  // the plan's stream, so launches that are still in flight keep working
+  delete plan;
   return LIBRETT_SUCCESS;
 }
 
 librettResult librettExecute(librettHandle handle, void *idata, void *odata)
 {
-  // prevent modification when find
-  std::lock_guard<std::mutex> lock(planStorageMutex);
-  auto it = planStorage.find(handle);
-  if (it == planStorage.end()) return LIBRETT_INVALID_PLAN;
+  if (idata == odata) return LIBRETT_INVALID_PARAMETER;
+
+  // prevent deletion while in use
+  librettPlan_t* plan = planStorage.acquire(handle);
+  if (plan == nullptr) return LIBRETT_INVALID_PLAN;
+
+  librettResult result = LIBRETT_SUCCESS;
+  if (!executePlan(handle, *plan, idata, odata, plan->stream)) result = LIBRETT_INTERNAL_ERROR;
+  planStorage.release(handle);
+  return result;
+}
+
+librettResult librettExecuteOnStream(librettHandle handle, void *idata, void *odata, gpuStream_t stream)
+{
+#if LIBRETT_USES_SYCL
+  if(stream == nullptr) {
+    throw std::runtime_error("[SYCL] pass a valid/non-nullptr SYCL queue to librettExecuteOnStream!");
+  }
+#endif
 
   if (idata == odata) return LIBRETT_INVALID_PARAMETER;
 
-  librettPlan_t& plan = *(it->second);
+  // prevent deletion while in use
+  librettPlan_t* plan = planStorage.acquire(handle);
+  if (plan == nullptr) return LIBRETT_INVALID_PLAN;
 
-  if (!librettKernel(plan, idata, odata)) return LIBRETT_INTERNAL_ERROR;
-  return LIBRETT_SUCCESS;
+  librettResult result = LIBRETT_SUCCESS;
+
+  // Stream must be on the device the plan was created for
+#if LIBRETT_USES_SYCL
+  if (stream->get_context() != plan->stream->get_context()) result = LIBRETT_INVALID_DEVICE;
+#else
+  // Runtimes without a stream device query check the current device instead
+  int deviceID;
+  #if LIBRETT_USES_HIP && defined(HIP_VERSION) && HIP_VERSION >= 50300000
+    hipCheck(hipStreamGetDevice(stream, &deviceID));
+  #elif LIBRETT_USES_HIP
+    hipCheck(hipGetDevice(&deviceID));
+  #elif LIBRETT_USES_CUDA && CUDART_VERSION >= 12080
+    cudaCheck(cudaStreamGetDevice(stream, &deviceID));
+  #elif LIBRETT_USES_CUDA
+    cudaCheck(cudaGetDevice(&deviceID));
+  #endif
+  if (deviceID != plan->deviceID) result = LIBRETT_INVALID_DEVICE;
+#endif
+
+  if (result == LIBRETT_SUCCESS && stream != plan->stream) {
+    planStorage.setOtherStream(handle);
+    waitReady(*plan, stream);
+  }
+  if (result == LIBRETT_SUCCESS && !executePlan(handle, *plan, idata, odata, stream)) result = LIBRETT_INTERNAL_ERROR;
+  planStorage.release(handle);
+  return result;
 }
 
+librettResult librettExecuteScaled(librettHandle handle, void *idata, void *odata, librettScalarType type,
+  const void *alpha, const void *beta)
+{
+  if (idata == odata) return LIBRETT_INVALID_PARAMETER;
+  if (alpha == nullptr || beta == nullptr) return LIBRETT_INVALID_PARAMETER;
+
+  // prevent deletion while in use
+  librettPlan_t* plan = planStorage.acquire(handle);
+  if (plan == nullptr) return LIBRETT_INVALID_PLAN;
+
+  librettResult result = LIBRETT_SUCCESS;
+  // Elements must be of type, type conversions can only be copied
+  if (librettScalarSize(type) != plan->sizeofType || plan->sizeofTypeOut != plan->sizeofType) {
+    result = LIBRETT_INVALID_PARAMETER;
+  } else if (!executePlan(handle, *plan, idata, odata, plan->stream, alpha, beta, type)) {
+    result = LIBRETT_INTERNAL_ERROR;
+  }
+  planStorage.release(handle);
+  return result;
+}
+
+#if LIBRETT_USES_SYCL
+librettResult librettExecuteAsync(librettHandle handle, void *idata, void *odata,
+  const std::vector<sycl::event>& depEvents, sycl::event *event)
+{
+  if (idata == odata) return LIBRETT_INVALID_PARAMETER;
+
+  // prevent deletion while in use
+  librettPlan_t* plan = planStorage.acquire(handle);
+  if (plan == nullptr) return LIBRETT_INVALID_PLAN;
+
+  librettResult result = LIBRETT_SUCCESS;
+  if (!executePlan(handle, *plan, idata, odata, plan->stream, nullptr, nullptr, LIBRETT_FLOAT, depEvents, event)) result = LIBRETT_INTERNAL_ERROR;
+  planStorage.release(handle);
+  return result;
+}
+#endif
+
+#if !LIBRETT_USES_SYCL
+librettResult librettAddGraphNode(librettHandle handle, void *idata, void *odata, librett_gpuGraph_t graph,
+  const librett_gpuGraphNode_t *dependencies, size_t numDependencies, librett_gpuGraphNode_t *node)
+{
+  if (idata == odata || node == nullptr) return LIBRETT_INVALID_PARAMETER;
+
+  // prevent deletion while in use
+  librettPlan_t* plan = planStorage.acquire(handle);
+  if (plan == nullptr) return LIBRETT_INVALID_PLAN;
+
+  // Capture the launch on a private stream and add the result as a child graph.
+  // This covers every method, including the memcpy of Trivial plans
+  librettResult result = LIBRETT_SUCCESS;
+  planStorage.setOtherStream(handle);
+  // The graph may be launched on any stream, the buffers must have been uploaded
+  if (plan->readyEvent != nullptr) {
+#if LIBRETT_USES_HIP
+    hipCheck(hipEventSynchronize(plan->readyEvent));
+#elif LIBRETT_USES_CUDA
+    cudaCheck(cudaEventSynchronize(plan->readyEvent));
+#endif
+  }
+  gpuStream_t captureStream;
+#if LIBRETT_USES_HIP
+  hipGraph_t childGraph;
+  hipCheck(hipStreamCreateWithFlags(&captureStream, hipStreamNonBlocking));
+  hipCheck(hipStreamBeginCapture(captureStream, hipStreamCaptureModeThreadLocal));
+  if (!librettKernel(*plan, idata, odata, captureStream)) result = LIBRETT_INTERNAL_ERROR;
+  hipCheck(hipStreamEndCapture(captureStream, &childGraph));
+  if (result == LIBRETT_SUCCESS) {
+    hipCheck(hipGraphAddChildGraphNode(node, graph, dependencies, numDependencies, childGraph));
+  }
+  hipCheck(hipGraphDestroy(childGraph));
+  hipCheck(hipStreamDestroy(captureStream));
+#elif LIBRETT_USES_CUDA
+  cudaGraph_t childGraph;
+  cudaCheck(cudaStreamCreateWithFlags(&captureStream, cudaStreamNonBlocking));
+  cudaCheck(cudaStreamBeginCapture(captureStream, cudaStreamCaptureModeThreadLocal));
+  if (!librettKernel(*plan, idata, odata, captureStream)) result = LIBRETT_INTERNAL_ERROR;
+  cudaCheck(cudaStreamEndCapture(captureStream, &childGraph));
+  if (result == LIBRETT_SUCCESS) {
+    cudaCheck(cudaGraphAddChildGraphNode(node, graph, dependencies, numDependencies, childGraph));
+  }
+  cudaCheck(cudaGraphDestroy(childGraph));
+  cudaCheck(cudaStreamDestroy(captureStream));
+#endif
+  planStorage.release(handle);
+  return result;
+}
+#endif
+
 void librettInitialize() {
 #ifdef LIBRETT_HAS_UMPIRE
   const char* alloc_env_var = std::getenv("LIBRETT_USES_THIS_UMPIRE_ALLOCATOR");
@@ -392,9 +1758,32 @@ void librettInitialize() {
   const char* alloc_cstr = alloc_env_var ? alloc_env_var : __LIBRETT_XSTRINGIZE(LIBRETT_USES_THIS_UMPIRE_ALLOCATOR);
   librett_umpire_allocator = umpire::ResourceManager::getInstance().getAllocator(alloc_cstr);
 #endif
+  // Load the persistent plan database
+  const char* database_env_var = std::getenv("LIBRETT_PLAN_DATABASE");
+  if (database_env_var != nullptr) {
+    librettPlanDatabaseLoad(database_env_var);
+  }
+  // Trace the workload
+  if (std::getenv("LIBRETT_TRACE") != nullptr) librettTraceEnable(true);
 }
 
 void librettFinalize() {
+  // Deallocate cached plans
+  planCache.clear();
+  // Deallocate the descriptor arena once no plans remain
+  DescriptorArena::instance().release();
+  // Save the persistent plan database
+  const char* database_env_var = std::getenv("LIBRETT_PLAN_DATABASE");
+  if (database_env_var != nullptr && librettPlanDatabaseEnabled()) {
+    if (!librettPlanDatabaseSave(database_env_var)) {
+      printf("librettFinalize: unable to write plan database %s\n", database_env_var);
+    }
+  }
+  // Append the workload trace
+  const char* trace_env_var = std::getenv("LIBRETT_TRACE");
+  if (trace_env_var != nullptr && !librettTraceSave(trace_env_var)) {
+    printf("librettFinalize: unable to write workload trace %s\n", trace_env_var);
+  }
 }
 
 #if LIBRETT_USES_SYCL
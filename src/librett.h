@@ -27,13 +27,18 @@ SOFTWARE.
 
 #ifdef LIBRETT_USES_SYCL
   #include <sycl/sycl.hpp>
+  #include <vector>
   using librett_gpuStream_t     = sycl::queue*;
 #elif LIBRETT_USES_HIP
   #include <hip/hip_runtime.h>
   using librett_gpuStream_t     = hipStream_t;
+  using librett_gpuGraph_t      = hipGraph_t;
+  using librett_gpuGraphNode_t  = hipGraphNode_t;
 #elif LIBRETT_USES_CUDA
   #include <cuda_runtime.h>
   using librett_gpuStream_t     = cudaStream_t;
+  using librett_gpuGraph_t      = cudaGraph_t;
+  using librett_gpuGraphNode_t  = cudaGraphNode_t;
 #endif
 
 // Handle type that is used to store and access librett plans
@@ -49,16 +54,35 @@ typedef enum librettResult_t {
   LIBRETT_UNDEFINED_ERROR,    // Undefined error
 } librettResult;
 
+// Element and scalar type of librettExecuteScaled
+typedef enum librettScalarType_t {
+  LIBRETT_FLOAT,              // float, sizeofType = 4
+  LIBRETT_DOUBLE,             // double, sizeofType = 8
+  LIBRETT_COMPLEX_FLOAT,      // float complex, sizeofType = 8
+  LIBRETT_COMPLEX_DOUBLE,     // double complex, sizeofType = 16
+} librettScalarType;
+
 // Initializes LIBRETT
 //
-// This is only needed for the Umpire allocator's lifetime management:
+// This is needed for the Umpire allocator's lifetime management and
+// for the persistent plan database:
 // - if LIBRETT_HAS_UMPIRE is defined, will grab Umpire's allocator;
-// - otherwise this is a no-op
+// - if environment variable LIBRETT_PLAN_DATABASE is set, plans and calibrated
+//   model parameters (see librettCalibrateModel) are loaded from that file and
+//   librettPlan/librettPlanMeasure skip plan enumeration on a hit;
+// - if environment variable LIBRETT_TRACE is set, librettPlan/librettPlanMeasure and
+//   execution calls are counted per shape and device
 void librettInitialize();
 
 // Finalizes LIBRETT
 //
-// This is currently a no-op
+// Deallocates the device buffers of cached plans that are no longer in use,
+// and the device buffer arena if no plans remain.
+// If environment variable LIBRETT_PLAN_DATABASE is set, writes the plan database
+// (including plans created and models calibrated during this run) to that file.
+// If environment variable LIBRETT_TRACE is set, appends the traced shapes to that file,
+// one "dim ... : permutation ... : sizeofType # device plans N executes M" line per shape.
+// librett_bench -tune replays the trace with librettPlanMeasure to build the plan database
 void librettFinalize();
 
 //
@@ -69,7 +93,7 @@ void librettFinalize();
 // rank              = Rank of the tensor
 // dim[rank]         = Dimensions of the tensor
 // permutation[rank] = Transpose permutation
-// sizeofType        = Size of the elements of the tensor in bytes (=4 or 8)
+// sizeofType        = Size of the elements of the tensor in bytes (=1, 2, 4, 8 or 16)
 // stream            = CUDA stream (0 if no stream is used)
 //
 // Returns
@@ -85,7 +109,7 @@ librettResult librettPlan(librettHandle* handle, int rank, int* dim, int* permut
 // rank              = Rank of the tensor
 // dim[rank]         = Dimensions of the tensor
 // permutation[rank] = Transpose permutation
-// sizeofType        = Size of the elements of the tensor in bytes (=4 or 8)
+// sizeofType        = Size of the elements of the tensor in bytes (=1, 2, 4, 8 or 16)
 // stream            = CUDA stream (0 if no stream is used)
 // idata             = Input data size product(dim)
 // odata             = Output data size product(dim)
@@ -96,9 +120,330 @@ librettResult librettPlan(librettHandle* handle, int rank, int* dim, int* permut
 librettResult librettPlanMeasure(librettHandle* handle, int rank, int* dim, int* permutation, size_t sizeofType,
                                  librett_gpuStream_t& stream, void* idata, void* odata);
 
+//
+// Set how much work librettPlanMeasure spends on timing
+//
+// Parameters
+// topK              = Number of candidate plans that are timed, the candidates are
+//                     ranked by the performance model first (0 = time all candidates)
+// numRepeat         = Number of timed runs per candidate, the fastest one counts.
+//                     For numRepeat > 1 an untimed warm up run comes first
+//
+// Default is topK = 0 and numRepeat = 1. The setting applies to all devices
+//
+// Returns
+// Success/unsuccess code
+//
+librettResult librettSetMeasureBudget(int topK, int numRepeat);
+
+//
+// Score librettPlan candidates with memory transaction counts from the device
+//
+// Parameters
+// enable            = true: after the host model, librettPlan counts the global memory
+//                     transactions of the 8 best candidates of the host model on the device
+//                     over the whole tensor (the host samples 10 positions) and chooses among
+//                     them with those counts. Launches go back to back with one synchronization
+//
+// Default is false. If any of these candidates uses vector accesses or positions that need
+// 64 bits, the device can not count it and all candidates are scored on the host.
+// Changing the setting drops the heuristic plans that are not in use from the plan cache
+//
+// Returns
+// Success/unsuccess code
+//
+librettResult librettSetDeviceScoring(bool enable);
+
+//
+// Time the executions of plans
+//
+// Parameters
+// enable            = true: librettExecute, librettExecuteOnStream, librettExecuteScaled and
+//                     librettExecuteAsync record events around the launches, the times are
+//                     returned by librettPlanGetInfo. A launch is only timed when the previous
+//                     timed launch of the same handle has finished, timing never waits for the device.
+//                     SYCL: only launches on queues with the enable_profiling property are timed
+//
+// Default is false
+//
+// Returns
+// Success/unsuccess code
+//
+librettResult librettSetTiming(bool enable);
+
+//
+// Plan information, see librettPlanGetInfo
+//
+typedef struct librettPlanInfo_t {
+  const char* method;   // Transposing method: Trivial, Packed, PackedSplit, Tiled, TiledCopy or Grouped
+  int numthread[3];     // Launch configuration (x, y, z)
+  int numblock[3];
+  size_t shmemsize;     // Shared memory per thread block in bytes
+  int numRegStorage;    // Packed and PackedSplit: elements stored in registers per thread
+  int vecWidth;         // Tiled and TiledCopy: elements per vector access
+  int numActiveBlock;   // Active thread blocks per multiprocessor
+  double cycles;        // Cycles predicted by the performance model
+  size_t bytes;         // Bytes read and written by one execution
+  // Timed executions, see librettSetTiming
+  int numTimed;         // Number of timed executions
+  double lastTime;      // Time of the last, the fastest and the average execution in milliseconds
+  double minTime;
+  double avgTime;
+  double bandwidth;     // Achieved bandwidth of the fastest execution in GB/s
+} librettPlanInfo;
+
+//
+// Get information about a plan
+//
+// Parameters
+// handle            = Handle to the LIBRETT plan
+// info              = Returned information
+//
+// Does not wait for the device, timed executions that have not finished are not included.
+// Plans of librettPlanMultiGpu, librettPlanInPlace and librettPlanStreaming are not supported
+//
+// Compile with ENABLE_NVTOOLS to mark every execution with an NVTX (CUDA) or ROCTX (HIP) range
+// named after the method and the shape of the plan
+//
+// Returns
+// Success/unsuccess code
+//
+librettResult librettPlanGetInfo(librettHandle handle, librettPlanInfo* info);
+
+//
+// Calibrate the performance model used by librettPlan
+//
+// Parameters
+// stream            = CUDA stream (0 if no stream is used)
+//
+// Runs every candidate plan of a fixed set of reference transposes on the device
+// of stream and fits the model parameters to the measured times. librettPlan uses
+// the fitted parameters for this device from then on, and heuristic plans are dropped
+// from the plan cache and, for this device, from the plan database. Needs about 130 MB
+// of device memory.
+//
+// Returns
+// Success/unsuccess code
+//
+librettResult librettCalibrateModel(librett_gpuStream_t& stream);
+
+//
+// Create plan for a batch of tensors that have the same shape and permutation
+//
+// Parameters
+// handle            = Returned handle to LIBRETT plan
+// rank              = Rank of one tensor in the batch
+// dim[rank]         = Dimensions of one tensor
+// permutation[rank] = Transpose permutation
+// sizeofType        = Size of the elements of the tensor in bytes (=1, 2, 4, 8 or 16)
+// batchCount        = Number of tensors in the batch
+// stream            = CUDA stream (0 if no stream is used)
+//
+// The tensors are stored back to back, tensor b starts at element b*product(dim)
+// of idata and odata. librettExecute* then transposes the whole batch in one launch
+//
+// Returns
+// Success/unsuccess code
+//
+librettResult librettPlanBatched(librettHandle* handle, int rank, int* dim, int* permutation, size_t sizeofType,
+                                 int batchCount, librett_gpuStream_t& stream);
+
+//
+// Create plan for a group of tensors that share the permutation but have different dimensions
+//
+// Parameters
+// handle                  = Returned handle to LIBRETT plan
+// groupCount              = Number of tensors in the group
+// rank                    = Rank of the tensors
+// dims[groupCount*rank]   = Dimensions, tensor g has dimensions dims[g*rank ... g*rank+rank-1]
+// permutation[rank]       = Transpose permutation
+// sizeofType              = Size of the elements of the tensor in bytes (=1, 2, 4, 8 or 16)
+// inOffsets[groupCount]   = Element offset of each tensor in idata, nullptr = tensors stored back to back
+// outOffsets[groupCount]  = Element offset of each tensor in odata, nullptr = tensors stored back to back
+// stream                  = CUDA stream (0 if no stream is used)
+//
+// librettExecute* then transposes all tensors of the group in one launch.
+// Each tensor must have fewer than 2^31 elements
+//
+// Returns
+// Success/unsuccess code
+//
+librettResult librettPlanGrouped(librettHandle* handle, int groupCount, int rank, int* dims, int* permutation,
+                                 size_t sizeofType, size_t* inOffsets, size_t* outOffsets,
+                                 librett_gpuStream_t& stream);
+
+//
+// Create plan for strided (sliced or padded) tensors
+//
+// Parameters
+// handle            = Returned handle to LIBRETT plan
+// rank              = Rank of the tensor
+// dim[rank]         = Dimensions of the tensor
+// permutation[rank] = Transpose permutation
+// sizeofType        = Size of the elements of the tensor in bytes (=1, 2, 4, 8 or 16)
+// inStride[rank]    = Stride of input rank i in elements, nullptr = packed input
+// outStride[rank]   = Stride of output rank i (dimension dim[permutation[i]]) in elements, nullptr = packed output
+// stream            = CUDA stream (0 if no stream is used)
+//
+// The fastest ranks must be contiguous (inStride[0] = outStride[0] = 1) and the
+// output elements must not overlap. Strided plans are not stored in the plan database
+// and librettSetDeviceScoring does not apply to them
+//
+// Returns
+// Success/unsuccess code
+//
+librettResult librettPlanStrided(librettHandle* handle, int rank, int* dim, int* permutation, size_t sizeofType,
+                                 size_t* inStride, size_t* outStride, librett_gpuStream_t& stream);
+
+//
+// Create plan that converts the element type during the transpose
+//
+// Parameters
+// handle            = Returned handle to LIBRETT plan
+// rank              = Rank of the tensor
+// dim[rank]         = Dimensions of the tensor
+// permutation[rank] = Transpose permutation
+// sizeofTypeIn      = Size of the input elements in bytes
+// sizeofTypeOut     = Size of the output elements in bytes
+// stream            = CUDA stream (0 if no stream is used)
+//
+// Supported conversions (sizeofTypeIn -> sizeofTypeOut):
+// double -> float (8 -> 4), float -> double (4 -> 8), float -> half (4 -> 2), half -> float (2 -> 4),
+// float -> double complex (4 -> 16) and double -> double complex (8 -> 16).
+// Real values become complex values with zero imaginary part.
+// The conversion is done in registers when the elements are stored, odata holds
+// sizeofTypeOut byte elements. Converting plans can not be used with librettExecuteScaled,
+// they are not stored in the plan database and librettSetDeviceScoring does not apply to them
+//
+// Returns
+// Success/unsuccess code
+//
+librettResult librettPlanConvert(librettHandle* handle, int rank, int* dim, int* permutation, size_t sizeofTypeIn,
+                                 size_t sizeofTypeOut, librett_gpuStream_t& stream);
+
+//
+// Create plan for a tensor that is sharded over several devices
+//
+// Parameters
+// handle              = Returned handle to LIBRETT plan
+// rank                = Rank of the tensor
+// dim[rank]           = Dimensions of the whole tensor
+// permutation[rank]   = Transpose permutation
+// sizeofType          = Size of the elements of the tensor in bytes (=1, 2, 4, 8 or 16)
+// shardIn             = Rank of the input that is split over the devices
+// shardOut            = Rank of the input that is split over the devices in the output
+// numDevice           = Number of shards
+// devices[numDevice]  = Device of each shard (not used with SYCL)
+// streams[numDevice]  = Stream of each shard, on devices[i]
+//
+// Dimension d = dim[shardIn] is split into blocks: shard i holds d/numDevice + (i < d % numDevice)
+// indices starting at i*(d/numDevice) + min(i, d % numDevice), stored as a tensor of its own
+// with dimension dim[shardIn] replaced by the block size. Output shards split dim[shardOut]
+// the same way. Both dimensions must be at least numDevice.
+//
+// When shardIn != shardOut, devices transpose their shards, exchange the parts with
+// peer-to-peer copies that overlap with the transposes, and transpose what they received.
+// This needs device buffers of the size of the input and output shards on each device.
+// With SYCL all queues must share one context.
+// The plan is destroyed with librettDestroy
+//
+// Returns
+// Success/unsuccess code
+//
+librettResult librettPlanMultiGpu(librettHandle* handle, int rank, int* dim, int* permutation, size_t sizeofType,
+                                  int shardIn, int shardOut, int numDevice, int* devices,
+                                  librett_gpuStream_t* streams);
+
+//
+// Create plan for an in-place transpose
+//
+// Parameters
+// handle            = Returned handle to LIBRETT plan
+// rank              = Rank of the tensor
+// dim[rank]         = Dimensions of the tensor
+// permutation[rank] = Transpose permutation
+// sizeofType        = Size of the elements of the tensor in bytes (=1, 2, 4, 8 or 16)
+// stream            = CUDA stream (0 if no stream is used)
+// scratchSize       = Size of the scratch buffer in bytes, 0 = 1/8 of the tensor
+//
+// The tensor is transposed with ordinary plans on slabs that fit into the scratch buffer
+// and, when the slowest input rank moves, with row and column permutations of a block
+// matrix, see InPlace.h. The scratch buffer is enlarged to hold one row and one column
+// of that matrix: up to vol/dim[slowest input rank] and dim[slowest input rank] times
+// the volume of the output ranks before it. In-place transposes read and write the
+// tensor about two to four times, in exchange for needing no second tensor.
+// The plan is executed with librettExecuteInPlace and destroyed with librettDestroy
+//
+// Returns
+// Success/unsuccess code
+//
+librettResult librettPlanInPlace(librettHandle* handle, int rank, int* dim, int* permutation, size_t sizeofType,
+                                 librett_gpuStream_t& stream, size_t scratchSize);
+
+//
+// Execute in-place plan
+//
+// Parameters
+// handle            = Returned handle to LIBRETT plan from librettPlanInPlace
+// data              = Input and output data size product(dim)
+//
+// Returns
+// Success/unsuccess code
+//
+librettResult librettExecuteInPlace(librettHandle handle, void* data);
+
+//
+// Create plan for a transpose of a tensor in host memory that does not fit on the device
+//
+// Parameters
+// handle            = Returned handle to LIBRETT plan
+// rank              = Rank of the tensor
+// dim[rank]         = Dimensions of the tensor
+// permutation[rank] = Transpose permutation
+// sizeofType        = Size of the elements of the tensor in bytes (=1, 2, 4, 8 or 16)
+// numStream         = Number of streams
+// streams[numStream] = CUDA streams, all on the current device
+// maxDeviceBytes    = Device memory the plan may use in bytes, 0 = half of the free memory
+//
+// The tensor is cut along one slow rank into chunks that are copied to the device,
+// transposed and copied back, cycling through the streams so that the copies of
+// one chunk overlap with the transpose of another. The chunks overlap only when
+// the host buffers are pinned (cudaMallocHost/cudaHostRegister, hipHostMalloc/hipHostRegister,
+// sycl::malloc_host). The plan is executed with librettExecuteStreaming and
+// destroyed with librettDestroy
+//
+// Returns
+// Success/unsuccess code
+//
+librettResult librettPlanStreaming(librettHandle* handle, int rank, int* dim, int* permutation, size_t sizeofType,
+                                   int numStream, librett_gpuStream_t* streams, size_t maxDeviceBytes);
+
+//
+// Execute streaming plan
+//
+// Parameters
+// handle            = Returned handle to LIBRETT plan from librettPlanStreaming
+// h_idata           = Input data in host memory size product(dim)
+// h_odata           = Output data in host memory size product(dim)
+//
+// The call returns once all chunks are queued, synchronize the streams before reading h_odata
+//
+// Returns
+// Success/unsuccess code
+//
+librettResult librettExecuteStreaming(librettHandle handle, const void* h_idata, void* h_odata);
+
 //
 // Destroy plan
 //
+// The device buffers of a plan come from a per-device arena, so creating and
+// destroying plans does not call cudaMalloc/cudaFree (hipMalloc/hipFree).
+// The buffers are reused once the launches queued on the plan's stream are done,
+// so a plan can be destroyed right after its launches have been enqueued, without
+// synchronizing the stream. If the plan was launched on other streams
+// (librettExecuteOnStream, librettAddGraphNode), the device is synchronized instead
+// (with SYCL, the plan's queue is waited for).
+//
 // Parameters
 // handle            = Handle to the LIBRETT plan
 //
@@ -120,4 +465,109 @@ librettResult librettDestroy(librettHandle handle);
 //
 librettResult librettExecute(librettHandle handle, void* idata, void* odata);
 
+//
+// Execute plan out-of-place on the given stream instead of the one the plan was created with
+//
+// Parameters
+// handle            = Returned handle to LIBRETT plan
+// idata             = Input data size product(dim)
+// odata             = Output data size product(dim)
+// stream            = CUDA stream, must be on the device the plan was created for.
+//                     CUDA before 12.8 and HIP before 5.3 check the current device instead
+//
+// Returns
+// Success/unsuccess code
+//
+librettResult librettExecuteOnStream(librettHandle handle, void* idata, void* odata, librett_gpuStream_t stream);
+
+//
+// Execute plan out-of-place and scale the result: odata = alpha*transpose(idata) + beta*odata
+//
+// Parameters
+// handle            = Returned handle to LIBRETT plan
+// idata             = Input data size product(dim)
+// odata             = Output data size product(dim)
+// type              = Type of the elements and of alpha and beta
+// alpha             = Host pointer to the scalar multiplying idata
+// beta              = Host pointer to the scalar multiplying odata. If *beta = 0, odata is not read
+//
+// The size of type must be sizeofType of the plan, otherwise LIBRETT_INVALID_PARAMETER is
+// returned. Integer and 1 and 2 byte types can not be scaled
+//
+// Returns
+// Success/unsuccess code
+//
+librettResult librettExecuteScaled(librettHandle handle, void* idata, void* odata, librettScalarType type,
+  const void* alpha, const void* beta);
+
+//
+// Execute multi-GPU plan
+//
+// Parameters
+// handle              = Returned handle to LIBRETT plan from librettPlanMultiGpu
+// idata[numDevice]    = Input shards, idata[i] on devices[i]
+// odata[numDevice]    = Output shards, odata[i] on devices[i]
+//
+// Work is enqueued on the streams of the plan and on internal copy streams.
+// Once the work on streams[i] is done, odata[i] is complete and all reads of idata are done
+//
+// Returns
+// Success/unsuccess code
+//
+librettResult librettExecuteMultiGpu(librettHandle handle, void** idata, void** odata);
+
+#ifdef LIBRETT_USES_SYCL
+//
+// Execute plan out-of-place after the given events, return the event of the launch
+//
+// Parameters
+// handle            = Returned handle to LIBRETT plan
+// idata             = Input data size product(dim)
+// odata             = Output data size product(dim)
+// depEvents         = Events the launch depends on, for example from an out-of-order queue
+// event             = Returned event of the launch, can be nullptr
+//
+// All librettExecute* functions submit the launch without waiting for it,
+// as with CUDA and HIP streams
+//
+// Returns
+// Success/unsuccess code
+//
+librettResult librettExecuteAsync(librettHandle handle, void* idata, void* odata,
+                                  const std::vector<sycl::event>& depEvents, sycl::event* event);
+#endif
+
+//
+// Graph capture
+//
+// librettExecute, librettExecuteOnStream and librettExecuteScaled only enqueue kernels
+// (and a device to device copy for Trivial plans) on the stream: they do not allocate,
+// synchronize or copy from the host, and can be captured into a CUDA/HIP graph.
+// Plan creation and librettDestroy are not capture-safe: create plans before the
+// capture starts and destroy them after the last replay has finished.
+// librettPlan* returns LIBRETT_INVALID_PARAMETER if the stream is being captured.
+//
+#ifndef LIBRETT_USES_SYCL
+//
+// Append the transpose of a plan to a graph as a child graph node
+//
+// Parameters
+// handle            = Returned handle to LIBRETT plan
+// idata             = Input data size product(dim)
+// odata             = Output data size product(dim)
+// graph             = Graph to add the node to
+// dependencies      = Nodes the new node depends on
+// numDependencies   = Number of dependencies
+// node              = Returned node
+//
+// The plan must not be destroyed while the graph can still be launched
+//
+// Returns
+// Success/unsuccess code
+//
+librettResult librettAddGraphNode(librettHandle handle, void* idata, void* odata, librett_gpuGraph_t graph,
+                                  const librett_gpuGraphNode_t* dependencies, size_t numDependencies,
+                                  librett_gpuGraphNode_t* node);
+#endif
+
 #endif // LIBRETT_H
@@ -26,36 +26,34 @@ SOFTWARE.
 #include <queue>
 #include <unordered_set>
 #include <cmath>
+#include <climits>
 #include <random>
+#include <atomic>
+#include <thread>
+#include <cstdlib>
 #include "GpuUtils.h"
 #include "GpuMem.hpp"
 #include "plan.h"
+#include "FastDiv.h"
 #include "kernel.h"
 #include "GpuModel.h"
+#include "GpuModelKernel.h"
 #include "uniapi.h"
 
-void printMethod(int method) {
+const char* methodName(const int method) {
   switch(method) {
-    case Trivial:
-    printf("Trivial");
-    break;
-    case Packed:
-    printf("Packed");
-    break;
-    case PackedSplit:
-    printf("PackedSplit");
-    break;
-    case Tiled:
-    printf("Tiled");
-    break;
-    case TiledCopy:
-    printf("TiledCopy");
-    break;
-    case Unknown:
-    printf("Unknown");
-    return;
-    break;
+    case Trivial: return "Trivial";
+    case Packed: return "Packed";
+    case PackedSplit: return "PackedSplit";
+    case Tiled: return "Tiled";
+    case TiledCopy: return "TiledCopy";
+    case Grouped: return "Grouped";
   };
+  return "Unknown";
+}
+
+void printMethod(int method) {
+  printf("%s", methodName(method));
 }
 
 //
@@ -69,7 +67,8 @@ void reduceRanks(const int rank, const int* dim, const int* permutation,
   int prev = -2;
   for (int i=0;i < rank;i++) {
     int cur = permutation[i];
-    if (cur == prev + 1)
+    // Combined dimension must fit into an int
+    if (cur == prev + 1 && (long long int)redDim.back()*dim[cur] <= INT_MAX)
     {
       // Skip over ranks that are in consequtive order and
       // combine dimensions
@@ -126,13 +125,58 @@ void reduceRanks(const int rank, const int* dim, const int* permutation,
 
 }
 
+//
+// Reduce ranks of strided tensors
+//
+void reduceRanks(const int rank, const int* dim, const int* permutation,
+  const long long int* strideIn, const long long int* strideOut,
+  std::vector<int>& redDim, std::vector<int>& redPermutation,
+  std::vector<long long int>& redStrideIn, std::vector<long long int>& redStrideOut) {
+
+  // First input rank and dimension of the combined ranks, in output order
+  std::vector<int> first;
+  std::vector<int> firstDim;
+  int prev = -2;
+  for (int i=0;i < rank;i++) {
+    int cur = permutation[i];
+    // Rank continues the previous one in the input and in the output
+    if (cur == prev + 1 && strideIn[cur] == strideIn[prev]*dim[prev] &&
+      strideOut[cur] == strideOut[prev]*dim[prev] && (long long int)firstDim.back()*dim[cur] <= INT_MAX)
+    {
+      firstDim.back() *= dim[cur];
+    } else {
+      first.push_back(cur);
+      firstDim.push_back(dim[cur]);
+    }
+    prev = cur;
+  }
+
+  // Combined ranks in input order
+  const int redRank = first.size();
+  std::vector<int> order(redRank);
+  for (int i=0;i < redRank;i++) order[i] = i;
+  std::sort(order.begin(), order.end(), [&](const int a, const int b) { return first[a] < first[b]; });
+
+  redDim.resize(redRank);
+  redPermutation.resize(redRank);
+  redStrideIn.resize(redRank);
+  redStrideOut.resize(redRank);
+  for (int i=0;i < redRank;i++) {
+    const int j = order[i];
+    redDim[i] = firstDim[j];
+    redStrideIn[i] = strideIn[first[j]];
+    redStrideOut[i] = strideOut[first[j]];
+    redPermutation[j] = i;
+  }
+}
+
 //
 // Stores tensor c object
 //
 class TensorC {
 private:
   const int rank;
-  int* c;
+  long long int* c;
   // map[i] tells where to find rank i in c[]
   int* map;
 public:
@@ -147,7 +191,7 @@ public:
     for (int i=0;i < n;i++) {
       map[rankInd[i]] = i;
     }
-    c = new int[n];
+    c = new long long int[n];
     c[0] = 1;
     for (int i=1;i < n;i++) {
       c[i] = c[i-1]*dim[rankInd[i-1]];
@@ -159,7 +203,7 @@ public:
     delete [] map;
   }
 
-  int get(const int i) {
+  long long int get(const int i) {
     int mapi;
     if (i < 0 || i >= rank || (mapi = map[i]) == -1) {
       printf("TensorC::get(), index out of range\n");
@@ -199,45 +243,54 @@ void TensorSplit::print() {
   if (method == PackedSplit) printf("numSplit %d splitRank %d\n", numSplit, splitRank);
 }
 
-void TensorSplit::update(const int sizeMm_in, const int sizeMk_in, const int rank,
+bool TensorSplit::update(const int sizeMm_in, const int sizeMk_in, const int rank,
   const int* dim, const int* permutation) {
 
   sizeMm = sizeMm_in;
   sizeMk = sizeMk_in;
 
+  // Volumes are computed in 64-bit and checked against INT_MAX at the end
   // First sizeMm are in Mm
-  volMm = 1;
+  long long int volMm64 = 1;
   for (int i=0;i < sizeMm;i++) {
-    volMm *= dim[i];
+    volMm64 *= dim[i];
   }
   // First sizeMk in permuted order are in Mk
-  volMk = 1;
+  long long int volMk64 = 1;
   for (int i=0;i < sizeMk;i++) {
-    volMk *= dim[permutation[i]];
+    volMk64 *= dim[permutation[i]];
   }
 
-  int vol = 1;
-  volMmk = 1;
+  long long int vol = 1;
+  long long int volMmk64 = 1;
   sizeMmk = 0;
-  volMkBar = 1;
+  long long int volMkBar64 = 1;
   sizeMkBar = 0;
   for (int i=0;i < rank;i++) {
     int pi = permutation[i];
     if (i < sizeMm) {
-      volMmk *= dim[i];
+      volMmk64 *= dim[i];
       sizeMmk++;
     }
     if (i < sizeMk && pi >= sizeMm) {
-      volMmk *= dim[pi];
+      volMmk64 *= dim[pi];
       sizeMmk++;
-      volMkBar *= dim[pi];
+      volMkBar64 *= dim[pi];
       sizeMkBar++;
     }
     vol *= dim[i];
   }
+  long long int volMbar64 = vol/volMmk64;
+
+  if (volMm64 > INT_MAX || volMk64 > INT_MAX || volMmk64 > INT_MAX ||
+    volMkBar64 > INT_MAX || volMbar64 > INT_MAX) return false;
 
+  volMm = volMm64;
+  volMk = volMk64;
+  volMmk = volMmk64;
+  volMkBar = volMkBar64;
   sizeMbar = rank - sizeMmk;
-  volMbar = vol/volMmk;
+  volMbar = volMbar64;
 
   if (splitRank >= 0) {
     splitDim = dim[splitRank];
@@ -278,6 +331,7 @@ void TensorSplit::update(const int sizeMm_in, const int sizeMk_in, const int ran
     }
   }
 
+  return true;
 }
 
 bool operator==(const TensorSplit& lhs, const TensorSplit& rhs) {
@@ -461,11 +515,7 @@ size_t TensorSplit::shmemAlloc(int sizeofType) const {
 
     case Tiled:
     {
-#ifdef LIBRETT_USES_HIP
-      vol = TILEDIM*TILEDIM*sizeofType;
-#else // CUDA and SYCL
-      vol = (TILEDIM+1)*TILEDIM*sizeofType;
-#endif
+      vol = (TILEDIM + tilePad(sizeofType))*TILEDIM*sizeofType;
     }
     break;
 
@@ -480,56 +530,90 @@ size_t TensorSplit::shmemAlloc(int sizeofType) const {
   return vol;
 }
 
+size_t TensorSplitHash::operator()(const TensorSplit& ts) const {
+  size_t h = std::hash<int>()(ts.method);
+  auto combine = [&h](const int val) { h ^= std::hash<int>()(val) + 0x9e3779b9 + (h << 6) + (h >> 2); };
+  if (ts.method == Trivial) return h;
+  if (ts.method == Tiled) {
+    combine(ts.volMm);
+    combine(ts.volMk);
+  } else if (ts.method == TiledCopy) {
+    combine(ts.volMm);
+    combine(ts.volMkBar);
+  } else if (ts.method == Packed || ts.method == PackedSplit) {
+    combine(ts.volMmkInCont);
+    combine(ts.volMmkOutCont);
+    combine(ts.volMmk);
+  } else {
+    combine(ts.volMm);
+    combine(ts.volMk);
+    combine(ts.volMmk);
+    combine(ts.numSplit);
+  }
+  combine(ts.volMbar);
+  return h;
+}
+
 //
-// Returns true if the plan with TensorSplit ts already exists
+// Sets up a plan with split ts at the end of plans, unless a plan with ts already exists.
+// The plan is set up in place so that its host buffers are not copied
 //
-bool planExists(TensorSplit& ts, std::list<librettPlan_t>& plans) {
-  for (auto it=plans.begin();it != plans.end();it++) {
-    if (it->tensorSplit == ts) return true;
+static bool addPlan(std::list<librettPlan_t>& plans, TensorSplitSet& splits, const int rank, const int *dim,
+  const int *permutation, const size_t sizeofType, const TensorSplit& ts, const LaunchConfig& lc,
+  const int numActiveBlock, const long long int* strideIn, const long long int* strideOut) {
+  if (!splits.insert(ts).second) return true;
+  plans.emplace_back();
+  if (!plans.back().setup(rank, dim, permutation, sizeofType, ts, lc, numActiveBlock, strideIn, strideOut)) {
+    plans.pop_back();
+    return false;
   }
-  return false;
+  return true;
 }
 
 bool librettPlan_t::createTrivialPlans(const int rank, const int *dim, const int *permutation,
-  const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t> &plans) {
+  const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t> &plans,
+  TensorSplitSet& splits, const long long int* strideIn, const long long int* strideOut) {
 
-  if (rank == 1) {
+  // Reduced rank is 1 unless combining the ranks would overflow an int
+  // Strided tensors are not copied in one piece
+  bool isIdentity = (strideIn == nullptr);
+  for (int i=0;i < rank;i++) {
+    if (permutation[i] != i) isIdentity = false;
+  }
+
+  if (isIdentity) {
     TensorSplit ts;
     ts.method = Trivial;
-    ts.update(1, 1, rank, dim, permutation);
+    if (!ts.update(1, 1, rank, dim, permutation)) return true;
     LaunchConfig lc;
     int numActiveBlock = librettKernelLaunchConfiguration(sizeofType, ts, deviceID, prop, lc);
-    if (numActiveBlock > 0 && !planExists(ts, plans)) {
-      librettPlan_t plan;
-      if (!plan.setup(rank, dim, permutation, sizeofType, ts, lc, numActiveBlock)) return false;
-      plans.push_back(plan);
-    }
+    if (numActiveBlock > 0 &&
+      !addPlan(plans, splits, rank, dim, permutation, sizeofType, ts, lc, numActiveBlock, strideIn, strideOut)) return false;
   }
 
   return true;
 }
 
 bool librettPlan_t::createTiledPlans(const int rank, const int *dim, const int *permutation,
-  const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t> &plans) {
+  const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t> &plans,
+  TensorSplitSet& splits, const long long int* strideIn, const long long int* strideOut) {
 
   if (permutation[0] != 0 && rank > 1) {
     TensorSplit ts;
     ts.method = Tiled;
-    ts.update(1, 1, rank, dim, permutation);
+    if (!ts.update(1, 1, rank, dim, permutation)) return true;
     LaunchConfig lc;
     int numActiveBlock = librettKernelLaunchConfiguration(sizeofType, ts, deviceID, prop, lc);
-    if (numActiveBlock > 0 && !planExists(ts, plans)) {
-      librettPlan_t plan;
-      if (!plan.setup(rank, dim, permutation, sizeofType, ts, lc, numActiveBlock)) return false;
-      plans.push_back(plan);
-    }
+    if (numActiveBlock > 0 &&
+      !addPlan(plans, splits, rank, dim, permutation, sizeofType, ts, lc, numActiveBlock, strideIn, strideOut)) return false;
   }
 
   return true;
 }
 
 bool librettPlan_t::createTiledCopyPlans(const int rank, const int *dim, const int *permutation,
-  const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t> &plans) {
+  const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t> &plans,
+  TensorSplitSet& splits, const long long int* strideIn, const long long int* strideOut) {
 
   // Count number of Mm and Mk which are the same
   int numMmMkSame = 0;
@@ -540,40 +624,39 @@ bool librettPlan_t::createTiledCopyPlans(const int rank, const int *dim, const i
     numMmMkSame = 1;
     TensorSplit ts;
     ts.method = TiledCopy;
+    bool fits;
     if (numMmMkSame < rank) {
-      ts.update(numMmMkSame, numMmMkSame + 1, rank, dim, permutation);
+      fits = ts.update(numMmMkSame, numMmMkSame + 1, rank, dim, permutation);
     } else {
-      ts.update(numMmMkSame - 1, numMmMkSame, rank, dim, permutation);
+      fits = ts.update(numMmMkSame - 1, numMmMkSame, rank, dim, permutation);
     }
+    if (!fits) return true;
     LaunchConfig lc;
     int numActiveBlock = librettKernelLaunchConfiguration(sizeofType, ts, deviceID, prop, lc);
-    if (numActiveBlock > 0 && !planExists(ts, plans)) {
-      librettPlan_t plan;
-      if (!plan.setup(rank, dim, permutation, sizeofType, ts, lc, numActiveBlock)) return false;
-      plans.push_back(plan);
-    }
+    if (numActiveBlock > 0 &&
+      !addPlan(plans, splits, rank, dim, permutation, sizeofType, ts, lc, numActiveBlock, strideIn, strideOut)) return false;
   }
 
   return true;
 }
 
 bool librettPlan_t::createPackedPlans(const int rank, const int *dim, const int *permutation,
-  const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t> &plans) {
+  const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t> &plans,
+  TensorSplitSet& splits, const long long int* strideIn, const long long int* strideOut) {
 
   LaunchConfig lc;
   for (int numMm=1;numMm < rank;numMm++) {
     for (int numMk=1;numMk < rank;numMk++) {
       TensorSplit ts;
       ts.method = Packed;
-      ts.update(numMm, numMk, rank, dim, permutation);
+      // Too large volumes do not fit on the device, break out of inner loop
+      if (!ts.update(numMm, numMk, rank, dim, permutation)) break;
+      // Existing splits fit on the device, skip their launch configuration
+      if (splits.count(ts) > 0) continue;
       int numActiveBlock = librettKernelLaunchConfiguration(sizeofType, ts, deviceID, prop, lc);
       // Does not fit on the device, break out of inner loop
       if (numActiveBlock == 0) break;
-      if (!planExists(ts, plans)) {
-        librettPlan_t plan;
-        if (!plan.setup(rank, dim, permutation, sizeofType, ts, lc, numActiveBlock)) return false;
-        plans.push_back(plan);
-      }
+      if (!addPlan(plans, splits, rank, dim, permutation, sizeofType, ts, lc, numActiveBlock, strideIn, strideOut)) return false;
     }
   }
 
@@ -581,14 +664,15 @@ bool librettPlan_t::createPackedPlans(const int rank, const int *dim, const int
 }
 
 bool librettPlan_t::createPackedSplitPlans(const int rank, const int *dim, const int *permutation,
-  const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t> &plans) {
+  const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t> &plans,
+  TensorSplitSet& splits, const long long int* strideIn, const long long int* strideOut) {
 
   LaunchConfig lc;
   for (int numMm=1;numMm < rank;numMm++) {
     for (int numMk=1;numMk < rank;numMk++) {
       TensorSplit ts;
       ts.method = Packed;
-      ts.update(numMm, numMk, rank, dim, permutation);
+      if (!ts.update(numMm, numMk, rank, dim, permutation)) break;
       // Amount of shared memory required
       size_t shmemsize = ts.shmemAlloc(sizeofType);
       /* DPCT1019:0: local_mem_size in SYCL is not a complete equivalent of sharedMemPerBlock in CUDA. */
@@ -664,29 +748,26 @@ bool librettPlan_t::createPackedSplitPlans(const int rank, const int *dim, const
         // Make sure splitDim*numSplit fits into an integer
         const unsigned long long int dim_cutoff = ((unsigned long long int)1 << 31);
         unsigned long long int dim0 = (unsigned long long int)ts.splitDim*(unsigned long long int)(ts.numSplit + 1);
-        if (!planExists(ts, plans) && dim0 < dim_cutoff) {
-          librettPlan_t plan;
-          if (!plan.setup(rank, dim, permutation, sizeofType, ts, lc0, numActiveBlock0)) return false;
-          plans.push_back(plan);
+        if (dim0 < dim_cutoff) {
+          if (!addPlan(plans, splits, rank, dim, permutation, sizeofType, ts, lc0, numActiveBlock0,
+            strideIn, strideOut)) return false;
         }
         if (bestNumSplit1 != bestNumSplit0) {
           ts.numSplit = bestNumSplit1;
           ts.update(numMm, numMk, rank, dim, permutation);
           unsigned long long int dim1 = (unsigned long long int)ts.splitDim*(unsigned long long int)(ts.numSplit + 1);
-          if (!planExists(ts, plans) && dim1 < dim_cutoff) {
-            librettPlan_t plan;
-            if (!plan.setup(rank, dim, permutation, sizeofType, ts, lc1, numActiveBlock1)) return false;
-            plans.push_back(plan);
+          if (dim1 < dim_cutoff) {
+            if (!addPlan(plans, splits, rank, dim, permutation, sizeofType, ts, lc1, numActiveBlock1,
+              strideIn, strideOut)) return false;
           }
         }
         if (bestNumSplit2 != bestNumSplit0 && bestNumSplit2 != bestNumSplit1) {
           ts.numSplit = bestNumSplit2;
           ts.update(numMm, numMk, rank, dim, permutation);
           unsigned long long int dim2 = (unsigned long long int)ts.splitDim*(unsigned long long int)(ts.numSplit + 1);
-          if (!planExists(ts, plans) && dim2 < dim_cutoff) {
-            librettPlan_t plan;
-            if (!plan.setup(rank, dim, permutation, sizeofType, ts, lc2, numActiveBlock2)) return false;
-            plans.push_back(plan);
+          if (dim2 < dim_cutoff) {
+            if (!addPlan(plans, splits, rank, dim, permutation, sizeofType, ts, lc2, numActiveBlock2,
+              strideIn, strideOut)) return false;
           }
         }
       }
@@ -701,20 +782,125 @@ bool librettPlan_t::createPackedSplitPlans(const int rank, const int *dim, const
 //
 bool librettPlan_t::createPlans(const int rank, const int *dim, const int *permutation,
   const int rankRed, const int *dimRed, const int *permutationRed,
-  const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t> &plans) {
-
+  const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t> &plans,
+  const long long int* strideIn, const long long int* strideOut) {
+
+  if (strideIn != nullptr && rank != rankRed) return false;
+  // Candidates whose split already has a plan are skipped,
+  // the original and the reduced ranks often give the same splits
+  TensorSplitSet splits;
+  for (auto it=plans.begin();it != plans.end();it++) splits.insert(it->tensorSplit);
   size_t size0 = plans.size();
   /* if (!createTiledCopyPlans(rank, dim, permutation, sizeofType, deviceID, prop, plans)) return false;*/
-  if (!createTrivialPlans(rankRed, dimRed, permutationRed, sizeofType, deviceID, prop, plans)) return false;
+  if (!createTrivialPlans(rankRed, dimRed, permutationRed, sizeofType, deviceID, prop, plans, splits, strideIn, strideOut)) return false;
   // If Trivial plan was created, that's the only one we need
   if (size0 != plans.size()) return true;
-  if (!createTiledCopyPlans(rankRed, dimRed, permutationRed, sizeofType, deviceID, prop, plans)) return false;
-  if (!createTiledPlans(rankRed, dimRed, permutationRed, sizeofType, deviceID, prop, plans)) return false;
-  if (!createPackedPlans(rank, dim, permutation, sizeofType, deviceID, prop, plans)) return false;
-  if (!createPackedSplitPlans(rank, dim, permutation, sizeofType, deviceID, prop, plans)) return false;
+  if (!createTiledCopyPlans(rankRed, dimRed, permutationRed, sizeofType, deviceID, prop, plans, splits, strideIn, strideOut)) return false;
+  if (!createTiledPlans(rankRed, dimRed, permutationRed, sizeofType, deviceID, prop, plans, splits, strideIn, strideOut)) return false;
+  if (!createPackedPlans(rank, dim, permutation, sizeofType, deviceID, prop, plans, splits, strideIn, strideOut)) return false;
+  if (!createPackedSplitPlans(rank, dim, permutation, sizeofType, deviceID, prop, plans, splits, strideIn, strideOut)) return false;
   if (rank != rankRed) {
-    if (!createPackedSplitPlans(rankRed, dimRed, permutationRed, sizeofType, deviceID, prop, plans)) return false;
+    if (!createPackedSplitPlans(rankRed, dimRed, permutationRed, sizeofType, deviceID, prop, plans, splits, strideIn, strideOut)) return false;
+  }
+  return true;
+}
+
+//
+// Number of elements per memory transaction (accWidth) and per L2 cache line (cacheWidth)
+//
+static void memoryWidths(const size_t sizeofType, int& accWidth, int& cacheWidth) {
+  // 128 bytes per transaction
+  accWidth = 128/sizeofType;
+  // L2 cache line width is 32 bytes
+#if LIBRETT_USES_HIP
+  cacheWidth = 64/sizeofType;  // AMD change
+#elif LIBRETT_USES_SYCL
+  #if LIBRETT_SUBGROUP_SIZE16
+  cacheWidth = 16/sizeofType;
+  #elif LIBRETT_SUBGROUP_SIZE32
+  cacheWidth = 32/sizeofType;
+  #elif LIBRETT_SUBGROUP_SIZE64
+  cacheWidth = 64/sizeofType;
+  #else
+  cacheWidth = 32/sizeofType;
+  #endif
+#elif LIBRETT_USES_CUDA
+  cacheWidth = 32/sizeofType;
+#endif
+}
+
+//
+// Count cycles of all plans. Plans are independent, so the result
+// does not depend on the number of threads
+//
+bool librettPlan_t::countCyclesAll(std::list<librettPlan_t>& plans, const gpuDeviceProp_t &prop,
+  const int numPosMbarSample) {
+
+  // Below about four plans per thread, thread start up costs more than it saves
+  const int minPlanPerThread = 4;
+  int numThread = std::thread::hardware_concurrency();
+  const char* num_threads_env_var = std::getenv("LIBRETT_NUM_THREADS");
+  if (num_threads_env_var != nullptr) numThread = std::atoi(num_threads_env_var);
+  numThread = std::min(numThread, ((int)plans.size() - 1)/minPlanPerThread + 1);
+
+  if (numThread <= 1) {
+    for (auto it=plans.begin();it != plans.end();it++) {
+      if (!it->countCycles(prop, numPosMbarSample)) return false;
+    }
+    return true;
+  }
+
+  std::vector<librettPlan_t*> planPtr;
+  for (auto it=plans.begin();it != plans.end();it++) planPtr.push_back(&(*it));
+
+  std::atomic<int> next(0);
+  std::atomic<bool> ok(true);
+  auto worker = [&]() {
+    for (int i=next++;i < (int)planPtr.size();i=next++) {
+      if (!planPtr[i]->countCycles(prop, numPosMbarSample)) ok = false;
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int i=1;i < numThread;i++) threads.emplace_back(worker);
+  worker();
+  for (auto& t : threads) t.join();
+
+  return ok;
+}
+
+//
+// Replaces the sampled global memory counters with full counts from the device
+// and re-evaluates the model. countCycles() must have been called first
+//
+// Number of candidates of the host model that countCyclesDevice() recounts
+static const int DEVICE_SCORING_NUM_CANDIDATE = 8;
+
+bool librettPlan_t::countCyclesDevice(std::list<librettPlan_t>& plans, const gpuDeviceProp_t &prop,
+  gpuStream_t& stream) {
+
+  if (plans.size() <= 1) return true;
+  // Trivial method always wins
+  for (auto it=plans.begin();it != plans.end();it++) {
+    if (it->tensorSplit.method == Trivial) return true;
+  }
+
+  // Keep the best candidates of the host model, device counts are only compared among them
+  plans.sort([](const librettPlan_t& lhs, const librettPlan_t& rhs) {return (lhs.cycles < rhs.cycles);});
+  while (plans.size() > DEVICE_SCORING_NUM_CANDIDATE) plans.pop_back();
+  // Device counts are not comparable to host counts, use host counts for all
+  for (auto it=plans.begin();it != plans.end();it++) {
+    if (!librettGpuModelKernelSupported(*it)) return true;
+  }
+
+  int accWidth, cacheWidth;
+  memoryWidths(plans.front().sizeofType, accWidth, cacheWidth);
+  if (!librettGpuModelKernelAll(plans, accWidth, cacheWidth, stream)) return false;
+
+  GpuModelProp modelProp(prop);
+  for (auto it=plans.begin();it != plans.end();it++) {
+    it->cycles = it->modelCycles(prop, modelProp);
   }
+
   return true;
 }
 
@@ -811,14 +997,21 @@ void printMatlab( const gpuDeviceProp_t &prop, std::list<librettPlan_t> &plans,
 }
 
 void LaunchConfig::print() {
-  printf("numthread %zu %zu %zu numblock %zu %zu %zu shmemsize %d numRegStorage %d\n",
+  printf("numthread %zu %zu %zu numblock %zu %zu %zu shmemsize %d numRegStorage %d vecWidth %d\n",
     numthread_x, numthread_y, numthread_z, numblock_x, numblock_y, numblock_z,
-    (int)shmemsize, numRegStorage);
+    (int)shmemsize, numRegStorage, vecWidth);
 }
 
 //
 // Output contents of the plan
 //
+long long int librettPlan_t::volume() const {
+  if (tensorSplit.method != Grouped) return (long long int)tensorSplit.volMmk*tensorSplit.volMbar;
+  long long int vol = 0;
+  for (const TensorGroup& grp : hostGroup) vol += (long long int)grp.tiledVolX*grp.tiledVolY*grp.volMbar;
+  return vol;
+}
+
 void librettPlan_t::print() {
   printf("method ");
   printMethod(tensorSplit.method);
@@ -829,22 +1022,60 @@ void librettPlan_t::print() {
 }
 
 
+//
+// Returns 32-bit TensorConvInOut, strides are truncated to int
+//
+static TensorConvInOut toTensorConvInOut(const TensorConvInOut64& a) {
+  TensorConvInOut b;
+  b.c_in   = a.c_in;
+  b.d_in   = a.d_in;
+  b.ct_in  = (int)a.ct_in;
+  b.c_out  = a.c_out;
+  b.d_out  = a.d_out;
+  b.ct_out = (int)a.ct_out;
+  b.c_in_div  = a.c_in_div;
+  b.d_in_div  = a.d_in_div;
+  b.c_out_div = a.c_out_div;
+  b.d_out_div = a.d_out_div;
+  return b;
+}
+
 //
 // Setup plan
 // NOTE: Expects that librettKernelLaunchConfiguration() has been called to setup
 // launchConfig_in and numActiveBlock_in
+// Strides of strided tensors go into ct_in, ct_out, cuDimMk and cuDimMm,
+// the fastest input and output ranks must have unit strides
 //
 bool librettPlan_t::setup(const int rank_in, const int* dim, const int* permutation,
   const size_t sizeofType_in, const TensorSplit& tensorSplit_in,
-  const LaunchConfig& launchConfig_in, const int numActiveBlock_in) {
+  const LaunchConfig& launchConfig_in, const int numActiveBlock_in,
+  const long long int* strideIn, const long long int* strideOut) {
 
   rank = rank_in;
   sizeofType = sizeofType_in;
+  sizeofTypeOut = sizeofType_in;
   tensorSplit = tensorSplit_in;
   numActiveBlock = numActiveBlock_in;
   launchConfig = launchConfig_in;
   if (numActiveBlock == 0) return false;
 
+  long long int vol = 1;
+  for (int i=0;i < rank;i++) {
+    vol *= dim[i];
+  }
+  index64 = (vol > INT_MAX);
+  if (strideIn != nullptr) {
+    // Largest positions in the input and in the output
+    long long int maxPosIn = 0;
+    long long int maxPosOut = 0;
+    for (int i=0;i < rank;i++) {
+      maxPosIn += (dim[i] - 1)*strideIn[i];
+      maxPosOut += (dim[i] - 1)*strideOut[i];
+    }
+    index64 = index64 || (maxPosIn >= INT_MAX) || (maxPosOut >= INT_MAX);
+  }
+
   std::vector<bool> isMm(rank, false);
   std::vector<bool> isMk(rank, false);
   for (int i=0;i < tensorSplit.sizeMm;i++) {
@@ -868,15 +1099,19 @@ bool librettPlan_t::setup(const int rank_in, const int* dim, const int* permutat
   // Build cO
   TensorC cO(rank, rank, permutation, dim);
 
+  // Strides of rank i in the input and in the output
+  auto ctIn = [&](const int i) { return (strideIn != nullptr) ? strideIn[i] : cI.get(i); };
+  auto ctOut = [&](const int i) { return (strideOut != nullptr) ? strideOut[i] : cO.get(i); };
+
   if (tensorSplit.method == Tiled) {
-    cuDimMk = cI.get(permutation[0]);
-    cuDimMm = cO.get(0);
+    cuDimMk = ctIn(permutation[0]);
+    cuDimMm = ctOut(0);
     tiledVol_x = dim[0];
     tiledVol_y = dim[permutation[0]];
   } else if (tensorSplit.method == TiledCopy) {
     int rankMk = permutation[tensorSplit.sizeMk - 1];
-    cuDimMk = cI.get(rankMk);
-    cuDimMm = cO.get(rankMk);
+    cuDimMk = ctIn(rankMk);
+    cuDimMm = ctOut(rankMk);
     tiledVol_x = tensorSplit.volMm;
     tiledVol_y = dim[rankMk];
   }
@@ -916,16 +1151,16 @@ bool librettPlan_t::setup(const int rank_in, const int* dim, const int* permutat
       }
     }
 
-    hostMbar.resize(tensorSplit.sizeMbar);
+    hostMbar64.resize(tensorSplit.sizeMbar);
     for (int i=0;i < tensorSplit.sizeMbar;i++) {
       int si = MbarI[i];
-      hostMbar[i].c_in  = cMbarI.get(si);
-      hostMbar[i].d_in  = dim[si];
-      hostMbar[i].ct_in = cI.get(si);
+      hostMbar64[i].c_in  = cMbarI.get(si);
+      hostMbar64[i].d_in  = dim[si];
+      hostMbar64[i].ct_in = ctIn(si);
       int sli = MbarO[i];
-      hostMbar[i].c_out  = cMbarI.get(sli);
-      hostMbar[i].d_out  = dim[sli];
-      hostMbar[i].ct_out = cO.get(sli);
+      hostMbar64[i].c_out  = cMbarI.get(sli);
+      hostMbar64[i].d_out  = dim[sli];
+      hostMbar64[i].ct_out = ctOut(sli);
     }
 
     delete [] MbarI;
@@ -956,8 +1191,8 @@ bool librettPlan_t::setup(const int rank_in, const int* dim, const int* permutat
     cuDimMk = 1;
     dimSplit[tensorSplit.splitRank]        = tensorSplit.splitDim/tensorSplit.numSplit;
     dimSplitPlusOne[tensorSplit.splitRank] = tensorSplit.splitDim/tensorSplit.numSplit + 1;
-    cuDimMm = cI.get(tensorSplit.splitRank);
-    cuDimMk = cO.get(tensorSplit.splitRank);
+    cuDimMm = ctIn(tensorSplit.splitRank);
+    cuDimMk = ctOut(tensorSplit.splitRank);
     // Build MmkI = {q_1, ..., q_a}
     std::vector<int> MmkI(tensorSplit.sizeMmk);
     int j = 0;
@@ -982,24 +1217,24 @@ bool librettPlan_t::setup(const int rank_in, const int* dim, const int* permutat
     TensorC cMmkOSplit(rank, tensorSplit.sizeMmk, MmkO.data(), dimSplit.data());
     TensorC cMmkOSplitPlusOne(rank, tensorSplit.sizeMmk, MmkO.data(), dimSplitPlusOne.data());
 
-    hostMmk.resize(tensorSplit.sizeMmk*2);
+    hostMmk64.resize(tensorSplit.sizeMmk*2);
     for (int i=0;i < tensorSplit.sizeMmk;i++) {
       // Minor reading position
       int qi = MmkI[i];
-      hostMmk[i].c_in                        = cMmkISplit.get(qi);
-      hostMmk[i].d_in                        = dimSplit[qi];
-      hostMmk[i].ct_in                       = cI.get(qi);
-      hostMmk[i + tensorSplit.sizeMmk].c_in  = cMmkISplitPlusOne.get(qi);
-      hostMmk[i + tensorSplit.sizeMmk].d_in  = dimSplitPlusOne[qi];
-      hostMmk[i + tensorSplit.sizeMmk].ct_in = cI.get(qi);
+      hostMmk64[i].c_in                        = cMmkISplit.get(qi);
+      hostMmk64[i].d_in                        = dimSplit[qi];
+      hostMmk64[i].ct_in                       = ctIn(qi);
+      hostMmk64[i + tensorSplit.sizeMmk].c_in  = cMmkISplitPlusOne.get(qi);
+      hostMmk64[i + tensorSplit.sizeMmk].d_in  = dimSplitPlusOne[qi];
+      hostMmk64[i + tensorSplit.sizeMmk].ct_in = ctIn(qi);
       // Minor writing position
       int qti = MmkO[i];
-      hostMmk[i].c_out                        = cMmkOSplit.get(qti);
-      hostMmk[i].d_out                        = dimSplit[qti];
-      hostMmk[i].ct_out                       = cO.get(qti);
-      hostMmk[i + tensorSplit.sizeMmk].c_out  = cMmkOSplitPlusOne.get(qti);
-      hostMmk[i + tensorSplit.sizeMmk].d_out  = dimSplitPlusOne[qti];
-      hostMmk[i + tensorSplit.sizeMmk].ct_out = cO.get(qti);
+      hostMmk64[i].c_out                        = cMmkOSplit.get(qti);
+      hostMmk64[i].d_out                        = dimSplit[qti];
+      hostMmk64[i].ct_out                       = ctOut(qti);
+      hostMmk64[i + tensorSplit.sizeMmk].c_out  = cMmkOSplitPlusOne.get(qti);
+      hostMmk64[i + tensorSplit.sizeMmk].d_out  = dimSplitPlusOne[qti];
+      hostMmk64[i + tensorSplit.sizeMmk].ct_out = ctOut(qti);
     }
 
     hostMsh.resize(tensorSplit.sizeMmk*2);
@@ -1038,18 +1273,18 @@ bool librettPlan_t::setup(const int rank_in, const int* dim, const int* permutat
     }
     TensorC cMmkO(rank, tensorSplit.sizeMmk, MmkO.data(), dim);
 
-    hostMmk.resize(tensorSplit.sizeMmk);
+    hostMmk64.resize(tensorSplit.sizeMmk);
     for (int i=0;i < tensorSplit.sizeMmk;i++) {
       // Minor reading position
       int qi = MmkI[i];
-      hostMmk[i].c_in  = cMmkI.get(qi);
-      hostMmk[i].d_in  = dim[qi];
-      hostMmk[i].ct_in = cI.get(qi);
+      hostMmk64[i].c_in  = cMmkI.get(qi);
+      hostMmk64[i].d_in  = dim[qi];
+      hostMmk64[i].ct_in = ctIn(qi);
       // Minor writing position
       int qti = MmkO[i];
-      hostMmk[i].c_out  = cMmkO.get(qti);
-      hostMmk[i].d_out  = dim[qti];
-      hostMmk[i].ct_out = cO.get(qti);
+      hostMmk64[i].c_out  = cMmkO.get(qti);
+      hostMmk64[i].d_out  = dim[qti];
+      hostMmk64[i].ct_out = ctOut(qti);
     }
 
     hostMsh.resize(tensorSplit.sizeMmk);
@@ -1062,35 +1297,158 @@ bool librettPlan_t::setup(const int rank_in, const int* dim, const int* permutat
     }
   }
 
+  // Vector accesses of Tiled (loads) and TiledCopy (loads and stores) need
+  // strides that are multiples of the vector width, packed tensors always have them
+  if (strideIn != nullptr && launchConfig.vecWidth > 1 &&
+    (tensorSplit.method == Tiled || tensorSplit.method == TiledCopy)) {
+    const int vecWidth = launchConfig.vecWidth;
+    const bool copy = (tensorSplit.method == TiledCopy);
+    bool fits = (cuDimMk % vecWidth == 0) && (!copy || cuDimMm % vecWidth == 0);
+    for (const auto& conv : hostMbar64) {
+      if (conv.ct_in % vecWidth != 0 || (copy && conv.ct_out % vecWidth != 0)) fits = false;
+    }
+    if (!fits) {
+      const int numMk = launchConfig.numblock_x/((tensorSplit.volMm - 1)/(TILEDIM*vecWidth) + 1);
+      launchConfig.vecWidth = 1;
+      launchConfig.numblock_x = ((tensorSplit.volMm - 1)/TILEDIM + 1)*numMk;
+    }
+  }
+
+  // Divisors of the kernel index computations are only known here
+  for (auto& conv : hostMbar64) setFastDiv(conv);
+  for (auto& conv : hostMmk64) setFastDiv(conv);
+
+  // 32-bit copies, strides wrap around for index64 plans
+  hostMbar.resize(hostMbar64.size());
+  for (size_t i=0;i < hostMbar64.size();i++) {
+    hostMbar[i] = toTensorConvInOut(hostMbar64[i]);
+  }
+  hostMmk.resize(hostMmk64.size());
+  for (size_t i=0;i < hostMmk64.size();i++) {
+    hostMmk[i] = toTensorConvInOut(hostMmk64[i]);
+  }
+
   return true;
 }
 
 // #define COUNTCYCLE_CHECK
 
+//
+// Sets up a grouped plan: numGroup tensors with the same permutation and
+// dimensions dims[g*rank ... (g+1)*rank-1]. Each tensor is reduced on its own
+// and transposed with TILEDIM x TILEDIM tiles of its fastest input rank and
+// fastest output rank, remaining ranks go to the packed Mbar buffer.
+// Returns false if a tensor or the grid does not fit into an int
+//
+bool librettPlan_t::setupGrouped(const int numGroup, const int rank_in, const int* dims, const int* permutation,
+  const size_t sizeofType_in, const size_t* inOffsets, const size_t* outOffsets) {
+
+  rank = rank_in;
+  sizeofType = sizeofType_in;
+  sizeofTypeOut = sizeofType_in;
+  tensorSplit = TensorSplit();
+  tensorSplit.method = Grouped;
+  index64 = false;
+  numActiveBlock = 1;
+  hostGroup.resize(numGroup);
+  hostMbar.clear();
+
+  long long int numBlock = 0;
+  long long int inOffset = 0;
+  long long int outOffset = 0;
+  for (int g=0;g < numGroup;g++) {
+    std::vector<int> redDim;
+    std::vector<int> redPermutation;
+    reduceRanks(rank, dims + g*rank, permutation, redDim, redPermutation);
+    const int redRank = redDim.size();
+
+    long long int vol = 1;
+    for (int i=0;i < redRank;i++) vol *= redDim[i];
+    if (vol > INT_MAX) return false;
+
+    std::vector<int> I(redRank);
+    for (int i=0;i < redRank;i++) I[i] = i;
+    TensorC cI(redRank, redRank, I.data(), redDim.data());
+    TensorC cO(redRank, redRank, redPermutation.data(), redDim.data());
+
+    // Tile is spanned by rank 0 and rankY
+    TensorGroup& grp = hostGroup[g];
+    grp.copy = (redPermutation[0] == 0);
+    const int rankY = (redRank == 1) ? -1 : (grp.copy ? 1 : redPermutation[0]);
+    grp.tiledVolX = redDim[0];
+    grp.tiledVolY = (rankY == -1) ? 1 : redDim[rankY];
+    grp.cuDimMk = (rankY == -1) ? 0 : (int)cI.get(rankY);
+    if (grp.copy) {
+      grp.cuDimMm = (rankY == -1) ? 0 : (int)cO.get(rankY);
+    } else {
+      grp.cuDimMm = (int)cO.get(0);
+    }
+    grp.numMm = (grp.tiledVolX - 1)/TILEDIM + 1;
+    grp.numTile = grp.numMm*((grp.tiledVolY - 1)/TILEDIM + 1);
+
+    // Mbar = ranks other than 0 and rankY, in input and in output order
+    std::vector<int> MbarI;
+    std::vector<int> MbarO;
+    for (int i=0;i < redRank;i++) {
+      if (i != 0 && i != rankY) MbarI.push_back(i);
+      int pi = redPermutation[i];
+      if (pi != 0 && pi != rankY) MbarO.push_back(pi);
+    }
+    grp.sizeMbar = MbarI.size();
+    grp.volMbar = vol/((long long int)grp.tiledVolX*grp.tiledVolY);
+    grp.mbarOffset = hostMbar.size();
+    if (grp.sizeMbar > 0) {
+      TensorC cMbarI(redRank, grp.sizeMbar, MbarI.data(), redDim.data());
+      for (int i=0;i < grp.sizeMbar;i++) {
+        TensorConvInOut Mbar;
+        int si = MbarI[i];
+        Mbar.c_in  = cMbarI.get(si);
+        Mbar.d_in  = redDim[si];
+        Mbar.ct_in = cI.get(si);
+        int sli = MbarO[i];
+        Mbar.c_out  = cMbarI.get(sli);
+        Mbar.d_out  = redDim[sli];
+        Mbar.ct_out = cO.get(sli);
+        setFastDiv(Mbar);
+        hostMbar.push_back(Mbar);
+      }
+    }
+
+    grp.blockStart = numBlock;
+    numBlock += (long long int)grp.numTile*grp.volMbar;
+
+    // Tensors are stored back to back unless offsets are given
+    grp.inOffset = (inOffsets != nullptr) ? inOffsets[g] : inOffset;
+    grp.outOffset = (outOffsets != nullptr) ? outOffsets[g] : outOffset;
+    inOffset += vol;
+    outOffset += vol;
+  }
+  // Total number of threads must fit into an int
+  if (numBlock*TILEDIM*TILEROWS > INT_MAX) return false;
+
+  tensorSplit.sizeMbar = hostMbar.size();
+  tensorSplit.volMbar = numBlock;
+
+  launchConfig.numthread_x = TILEDIM;
+  launchConfig.numthread_y = TILEROWS;
+  launchConfig.numthread_z = 1;
+  launchConfig.numblock_x = numBlock;
+  launchConfig.numblock_y = 1;
+  launchConfig.numblock_z = 1;
+  launchConfig.shmemsize = 0;
+  launchConfig.numRegStorage = 0;
+
+  return true;
+}
+
 //
 // Count the number of cycles using the MWP-CWP model
 //
 bool librettPlan_t::countCycles( const gpuDeviceProp_t &prop, const int numPosMbarSample) {
 
-  // Number of elements that are loaded per memory transaction:
-  // 128 bytes per transaction
-  const int accWidth = 128/sizeofType;
-  // L2 cache line width is 32 bytes
-#if LIBRETT_USES_HIP
-  const int cacheWidth = 64/sizeofType;  // AMD change
-#elif LIBRETT_USES_SYCL
-  #if LIBRETT_SUBGROUP_SIZE16
-  const int cacheWidth = 16/sizeofType;
-  #elif LIBRETT_SUBGROUP_SIZE32
-  const int cacheWidth = 32/sizeofType;
-  #elif LIBRETT_SUBGROUP_SIZE64
-  const int cacheWidth = 64/sizeofType;
-  #else
-  const int cacheWidth = 32/sizeofType;
-  #endif
-#elif LIBRETT_USES_CUDA
-  const int cacheWidth = 32/sizeofType;
-#endif
+  // Number of elements that are loaded per memory transaction and per cache line
+  int accWidth, cacheWidth;
+  memoryWidths(sizeofType, accWidth, cacheWidth);
 
   if (tensorSplit.method == Tiled) {
     // Global memory
@@ -1098,12 +1456,12 @@ bool librettPlan_t::countCycles( const gpuDeviceProp_t &prop, const int numPosMb
     gpuRangeStart("countTiledGlTransactions");
 #endif
     countTiledGlTransactions(false, numPosMbarSample, tensorSplit.volMm, tensorSplit.volMk, tensorSplit.volMbar,
-      cuDimMk, cuDimMm, accWidth, cacheWidth, hostMbar, tensorSplit.sizeMbar,
+      (int)cuDimMk, (int)cuDimMm, accWidth, cacheWidth, launchConfig.vecWidth, hostMbar, tensorSplit.sizeMbar,
       num_iter, mlp, gld_tran, gst_tran, gld_req, gst_req, cl_full_l2, cl_part_l2);
 #ifdef ENABLE_NVTOOLS
     gpuRangeStop();
 #endif
-    // Shared memory
+    // Shared memory, transposeTiled stores vector elements in separate tile parts without bank conflicts
     sld_tran = 1;
     sst_tran = 1;
     sld_req = 1;
@@ -1114,7 +1472,7 @@ bool librettPlan_t::countCycles( const gpuDeviceProp_t &prop, const int numPosMb
     gpuRangeStart("countTiledGlTransactions (copy)");
 #endif
     countTiledGlTransactions(true, numPosMbarSample, tensorSplit.volMm, tensorSplit.volMkBar, tensorSplit.volMbar,
-      cuDimMk, cuDimMm, accWidth, cacheWidth, hostMbar, tensorSplit.sizeMbar,
+      (int)cuDimMk, (int)cuDimMm, accWidth, cacheWidth, launchConfig.vecWidth, hostMbar, tensorSplit.sizeMbar,
       num_iter, mlp, gld_tran, gst_tran, gld_req, gst_req, cl_full_l2, cl_part_l2);
 #ifdef ENABLE_NVTOOLS
     gpuRangeStop();
@@ -1252,8 +1610,8 @@ bool librettPlan_t::countCycles( const gpuDeviceProp_t &prop, const int numPosMb
         int isplit  = pos[ipos + i] % tensorSplit.numSplit;
         int p0 = isplit*tensorSplit.splitDim/tensorSplit.numSplit;
         computePos(posMbar, posMbar, hostMbar.data(), tensorSplit.sizeMbar, &posMbarIn[i], &posMbarOut[i]);
-        posMbarIn[i] += p0*cuDimMm;
-        posMbarOut[i] += p0*cuDimMk;
+        posMbarIn[i] += p0*(int)cuDimMm;
+        posMbarOut[i] += p0*(int)cuDimMk;
       }
       for (int i=numPos;i < INT_VECTOR_LEN;i++) {
         posMbarIn[i]  = posMbarIn[numPos - 1];
@@ -1317,8 +1675,8 @@ bool librettPlan_t::countCycles( const gpuDeviceProp_t &prop, const int numPosMb
         int isplit  = pos[ipos + i] % tensorSplit.numSplit;
         int p0 = isplit*tensorSplit.splitDim/tensorSplit.numSplit;
         computePos(posMbar, posMbar, hostMbar.data(), tensorSplit.sizeMbar, &posMbarIn[i], &posMbarOut[i]);
-        posMbarIn[i] += p0*cuDimMm;
-        posMbarOut[i] += p0*cuDimMk;
+        posMbarIn[i] += p0*(int)cuDimMm;
+        posMbarOut[i] += p0*(int)cuDimMk;
       }
       for (int i=numPos;i < INT_VECTOR_LEN;i++) {
         posMbarIn[i]  = posMbarIn[numPos - 1];
@@ -1604,7 +1962,7 @@ bool librettPlan_t::countCycles( const gpuDeviceProp_t &prop, const int numPosMb
     gpuRangeStop();
 #endif
   } else if (tensorSplit.method == Trivial) {
-    size_t vol = tensorSplit.volMmk*tensorSplit.volMbar;
+    size_t vol = (size_t)tensorSplit.volMmk*tensorSplit.volMbar;
     // Global memory
     gld_req = (vol - 1) / gpuWarpSize + 1;
     gst_req = gld_req;
@@ -1624,22 +1982,33 @@ bool librettPlan_t::countCycles( const gpuDeviceProp_t &prop, const int numPosMb
     return false;
   }
 
+  // Converting plans store sizeofTypeOut bytes per element
+  if (sizeofTypeOut != sizeofType && gst_tran > 0) {
+    gst_tran = (int)(((long long int)gst_tran*sizeofTypeOut - 1)/sizeofType + 1);
+  }
+
+  cycles = modelCycles(prop, GpuModelProp(prop));
+
+  return true;
+}
+
+double librettPlan_t::modelCycles(const gpuDeviceProp_t &prop, const GpuModelProp &modelProp) const {
   int numthread = launchConfig.numthread_x*launchConfig.numthread_y*launchConfig.numthread_z;
   // double cl_val = (double)cl_part/(double)std::max(1, cl_full + cl_part);
 
   if (tensorSplit.method == Packed || tensorSplit.method == PackedSplit) {
-    cycles = cyclesPacked(tensorSplit.method == PackedSplit, sizeofType, prop, numthread,
+    return cyclesPacked(tensorSplit.method == PackedSplit, sizeofType, prop, modelProp, numthread,
       numActiveBlock, launchConfig.numRegStorage,
       gld_req, gst_req, gld_tran, gst_tran, sld_req, sst_req, sld_tran, sst_tran,
       num_iter, cl_full_l2, cl_part_l2);
   } else if (tensorSplit.method == Tiled || tensorSplit.method == TiledCopy) {
-    cycles = cyclesTiled(tensorSplit.method == TiledCopy, sizeofType, prop, numthread,
+    return cyclesTiled(tensorSplit.method == TiledCopy, sizeofType, prop, modelProp, numthread,
       numActiveBlock, mlp, gld_req, gst_req, gld_tran, gst_tran,
       sld_req, sst_req, sld_tran, sst_tran,
       num_iter, cl_full_l2, cl_part_l2);
   }
 
-  return true;
+  return 0.0;
 }
 
 //
@@ -1650,24 +2019,37 @@ void librettPlan_t::activate() {
   gpuStream_t queue = this->getStream();
 
   if (tensorSplit.sizeMbar > 0) {
-    if (Mbar == nullptr) {
-      allocate_device<TensorConvInOut>(&Mbar, tensorSplit.sizeMbar, queue);
+    if (index64 && Mbar64 == nullptr) {
+      allocate_descriptor<TensorConvInOut64>(&Mbar64, tensorSplit.sizeMbar, queue);
+      copy_HtoD<TensorConvInOut64>(hostMbar64.data(), Mbar64, tensorSplit.sizeMbar, queue);
+    }
+    if (!index64 && Mbar == nullptr) {
+      allocate_descriptor<TensorConvInOut>(&Mbar, tensorSplit.sizeMbar, queue);
       copy_HtoD<TensorConvInOut>(hostMbar.data(), Mbar, tensorSplit.sizeMbar, queue);
     }
   }
 
   if (tensorSplit.method == Packed || tensorSplit.method == PackedSplit) {
     int MmkSize = (tensorSplit.method == Packed) ? tensorSplit.sizeMmk : tensorSplit.sizeMmk*2;
-    if (Mmk == nullptr) {
-      allocate_device<TensorConvInOut>(&Mmk, MmkSize, queue);
+    if (index64 && Mmk64 == nullptr) {
+      allocate_descriptor<TensorConvInOut64>(&Mmk64, MmkSize, queue);
+      copy_HtoD<TensorConvInOut64>(hostMmk64.data(), Mmk64, MmkSize, queue);
+    }
+    if (!index64 && Mmk == nullptr) {
+      allocate_descriptor<TensorConvInOut>(&Mmk, MmkSize, queue);
       copy_HtoD<TensorConvInOut>(hostMmk.data(), Mmk, MmkSize, queue);
     }
     if (Msh == nullptr) {
-      allocate_device<TensorConv>(&Msh, MmkSize, queue);
+      allocate_descriptor<TensorConv>(&Msh, MmkSize, queue);
       copy_HtoD<TensorConv>(hostMsh.data(), Msh, MmkSize, queue);
     }
   }
 
+  if (tensorSplit.method == Grouped && Group == nullptr) {
+    allocate_descriptor<TensorGroup>(&Group, hostGroup.size(), queue);
+    copy_HtoD<TensorGroup>(hostGroup.data(), Group, hostGroup.size(), queue);
+  }
+
 #ifdef LIBRETT_USES_SYCL
   if(!stream->is_in_order())
     stream->wait();
@@ -1684,22 +2066,35 @@ void librettPlan_t::nullDevicePointers() {
   Msh = nullptr;
   Mk = nullptr;
   Mm = nullptr;
+  Mbar64 = nullptr;
+  Mmk64 = nullptr;
+  Group = nullptr;
 }
 
 librettPlan_t::librettPlan_t() {
   deviceID = 0;
   stream = nullptr;
   numActiveBlock = 0;
+  sizeofType = 0;
+  sizeofTypeOut = 0;
+  index64 = false;
+  orderedRelease = true;
+#if !LIBRETT_USES_SYCL
+  readyEvent = nullptr;
+#endif
   nullDevicePointers();
 }
 
 librettPlan_t::~librettPlan_t() {
   // Deallocate device buffers
-  if (Mbar != nullptr) deallocate_device<TensorConvInOut>(&Mbar, this->getStream());
-  if (Mmk != nullptr) deallocate_device<TensorConvInOut>(&Mmk, this->getStream());
-  if (Msh != nullptr) deallocate_device<TensorConv>(&Msh, this->getStream());
-  if (Mk != nullptr) deallocate_device<TensorConv>(&Mk, this->getStream());
-  if (Mm != nullptr) deallocate_device<TensorConv>(&Mm, this->getStream());
+  if (Mbar != nullptr) deallocate_descriptor<TensorConvInOut>(&Mbar, this->getStream(), orderedRelease);
+  if (Mmk != nullptr) deallocate_descriptor<TensorConvInOut>(&Mmk, this->getStream(), orderedRelease);
+  if (Msh != nullptr) deallocate_descriptor<TensorConv>(&Msh, this->getStream(), orderedRelease);
+  if (Mk != nullptr) deallocate_descriptor<TensorConv>(&Mk, this->getStream(), orderedRelease);
+  if (Mm != nullptr) deallocate_descriptor<TensorConv>(&Mm, this->getStream(), orderedRelease);
+  if (Mbar64 != nullptr) deallocate_descriptor<TensorConvInOut64>(&Mbar64, this->getStream(), orderedRelease);
+  if (Mmk64 != nullptr) deallocate_descriptor<TensorConvInOut64>(&Mmk64, this->getStream(), orderedRelease);
+  if (Group != nullptr) deallocate_descriptor<TensorGroup>(&Group, this->getStream(), orderedRelease);
 }
 
 void librettPlan_t::setStream(gpuStream_t& stream_in)
@@ -30,6 +30,7 @@ All rights reserved.
 
 #include <list>
 #include <vector>
+#include <unordered_set>
 #include "Types.h"
 #include "uniapi.h"
 
@@ -50,11 +51,34 @@ All rights reserved.
 #endif
 const int TILEROWS = 8;
 
+// Padding of shared memory tile rows in elements. Rows are kept an odd number of
+// 4-byte banks apart, types smaller than 4 bytes are padded by a full bank
+constexpr int tilePad(const size_t sizeofType) {
+#if LIBRETT_USES_HIP || LIBRETT_SUBGROUP_SIZE64
+  return (sizeofType < 4) ? (int)(4/sizeofType) : 0;
+#else
+  return (sizeofType < 4) ? (int)(4/sizeofType) : 1;
+#endif
+}
+
 // Transposing methods
 enum {Unknown, Trivial, Packed, PackedSplit,
-  Tiled, TiledCopy,
+  Tiled, TiledCopy, Grouped,
   NumTransposeMethods};
 
+// Returns the name of transposing method
+const char* methodName(const int method);
+
+// Largest number of elements a thread of the Tiled and TiledCopy kernels loads with one access
+const int MAX_VEC_WIDTH = 4;
+
+// Returns true if Tiled or TiledCopy kernel can use vector accesses of vecWidth elements:
+// vector is at most 16 bytes and the shared memory tile of Tiled fits in 48KB
+constexpr bool vecWidthFits(const int method, const size_t sizeofType, const int vecWidth) {
+  return (vecWidth*sizeofType <= 16) &&
+    (method != Tiled || TILEDIM*(TILEDIM*vecWidth + tilePad(sizeofType))*sizeofType <= 48*1024);
+}
+
 // Tells how tensor is split into Mm and Mk and what method is used
 // NOTE: sizeMm and sizeMk fully define the split
 class TensorSplit {
@@ -102,7 +126,8 @@ public:
 
   void print();
 
-  void update(const int sizeMm_in, const int sizeMk_in, const int rank,
+  // Returns false if one of the volumes does not fit into an int
+  bool update(const int sizeMm_in, const int sizeMk_in, const int rank,
     const int* dim, const int* permutation);
 
   // Number of elements in shared memory space
@@ -117,6 +142,17 @@ public:
 
 };
 
+// Splits that define the same plan
+bool operator==(const TensorSplit& lhs, const TensorSplit& rhs);
+
+// Hash of the fields that operator== compares
+struct TensorSplitHash {
+  size_t operator()(const TensorSplit& ts) const;
+};
+
+// Splits of the candidate plans, used to skip duplicates during plan creation
+typedef std::unordered_set<TensorSplit, TensorSplitHash> TensorSplitSet;
+
 class LaunchConfig {
 public:
   // Kernel launch configuration
@@ -132,9 +168,16 @@ public:
   // For the Packed method, number of registers to use for storage
   int numRegStorage;
 
+  // For the Tiled and TiledCopy methods, number of consecutive elements
+  // each thread loads with one vector access (1, 2 or 4)
+  int vecWidth = 1;
+
   void print();
 };
 
+// Parameters of the performance model, see GpuModel.h
+struct GpuModelProp;
+
 // Class that stores the plan data
 class librettPlan_t {
 public:
@@ -153,13 +196,20 @@ public:
   // Size of the tensor elements in bytes
   size_t sizeofType;
 
+  // Size of the output elements in bytes. When it differs from sizeofType, the
+  // kernels convert the elements on the store path (see librettPlanConvert())
+  size_t sizeofTypeOut;
+
   TensorSplit tensorSplit;
 
   // Number of active thread blocks
   int numActiveBlock;
 
-  int cuDimMk;
-  int cuDimMm;
+  // Tensor has more than 2^31 elements, kernels use 64-bit positions
+  bool index64;
+
+  long long int cuDimMk;
+  long long int cuDimMm;
 
   int2_t tiledVol;
 
@@ -176,9 +226,15 @@ public:
   //--------------
   // Host buffers
   //--------------
+  // NOTE: For index64 plans the strides in hostMbar and hostMmk wrap around,
+  //       they are only used by the performance model
   std::vector<TensorConvInOut> hostMbar;
   std::vector<TensorConvInOut> hostMmk;
   std::vector<TensorConv> hostMsh;
+  std::vector<TensorConvInOut64> hostMbar64;
+  std::vector<TensorConvInOut64> hostMmk64;
+  // For Grouped plans, hostMbar holds the Mbar entries of all problems
+  std::vector<TensorGroup> hostGroup;
 
   //----------------
   // Device buffers
@@ -192,6 +248,21 @@ public:
   // sizeMmk
   TensorConv* Msh;
 
+  // Mbar and Mmk for index64 plans
+  TensorConvInOut64* Mbar64;
+  TensorConvInOut64* Mmk64;
+
+  // For Grouped plans
+  TensorGroup* Group;
+
+  // Device buffers are released in order with stream, see DescriptorArena::deallocate().
+  // Set to false when the buffers may be in use on other streams
+  bool orderedRelease;
+
+  // Upload of the device buffers of plans that share them with a plan cache template,
+  // owned by the template. Launches on other streams wait for it
+  gpuEvent_t readyEvent;
+
   // For TiledSingleInRank
   TensorConv* Mk;
 
@@ -203,33 +274,59 @@ public:
   void print();
   gpuStream_t getStream() { return stream; };
   void setStream(gpuStream_t& stream_in);
+  // Number of elements the plan transposes
+  long long int volume() const;
   bool countCycles(const gpuDeviceProp_t &prop, const int numPosMbarSample=0);
+  // Evaluates the performance model from the counters set by countCycles()
+  double modelCycles(const gpuDeviceProp_t &prop, const GpuModelProp &modelProp) const;
   void activate();
   void nullDevicePointers();
 
+  // strideIn[i] and strideOut[i] are the strides of rank i in the input and in the output,
+  // nullptr = packed tensors. Strided plans must be created from reduced ranks (rank = redRank)
   static bool createPlans(const int rank, const int* dim, const int* permutation,
     const int redRank, const int* redDim, const int* redPermutation, const size_t sizeofType,
-    const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t>& plans);
+    const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t>& plans,
+    const long long int* strideIn = nullptr, const long long int* strideOut = nullptr);
+
+  // Calls countCycles() for all plans using host threads.
+  // Number of threads is limited by environment variable LIBRETT_NUM_THREADS
+  static bool countCyclesAll(std::list<librettPlan_t>& plans, const gpuDeviceProp_t &prop,
+    const int numPosMbarSample=0);
+
+  // Recounts global memory transactions on the device (see librettSetDeviceScoring).
+  // Only the best candidates of the host model are kept in plans
+  static bool countCyclesDevice(std::list<librettPlan_t>& plans, const gpuDeviceProp_t &prop,
+    gpuStream_t& stream);
+
+  bool setup(const int rank_in, const int* dim, const int* permutation,
+    const size_t sizeofType_in, const TensorSplit& tensorSplit_in,
+    const LaunchConfig& launchConfig_in, const int numActiveBlock_in,
+    const long long int* strideIn = nullptr, const long long int* strideOut = nullptr);
+
+  bool setupGrouped(const int numGroup, const int rank_in, const int* dims, const int* permutation,
+    const size_t sizeofType_in, const size_t* inOffsets, const size_t* outOffsets);
 
 private:
   static bool createTrivialPlans(const int rank, const int* dim, const int* permutation,
-    const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t>& plans);
+    const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t>& plans,
+    TensorSplitSet& splits, const long long int* strideIn, const long long int* strideOut);
 
   static bool createTiledPlans(const int rank, const int* dim, const int* permutation,
-    const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t>& plans);
+    const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t>& plans,
+    TensorSplitSet& splits, const long long int* strideIn, const long long int* strideOut);
 
   static bool createTiledCopyPlans(const int rank, const int* dim, const int* permutation,
-    const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t>& plans);
+    const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t>& plans,
+    TensorSplitSet& splits, const long long int* strideIn, const long long int* strideOut);
 
   static bool createPackedPlans(const int rank, const int* dim, const int* permutation,
-    const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t>& plans);
+    const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t>& plans,
+    TensorSplitSet& splits, const long long int* strideIn, const long long int* strideOut);
 
   static bool createPackedSplitPlans(const int rank, const int* dim, const int* permutation,
-    const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t>& plans);
-
-  bool setup(const int rank_in, const int* dim, const int* permutation,
-    const size_t sizeofType_in, const TensorSplit& tensorSplit_in,
-    const LaunchConfig& launchConfig_in, const int numActiveBlock_in);
+    const size_t sizeofType, const int deviceID, const gpuDeviceProp_t &prop, std::list<librettPlan_t>& plans,
+    TensorSplitSet& splits, const long long int* strideIn, const long long int* strideOut);
 
 };
 
@@ -238,6 +335,13 @@ void printMatlab(const gpuDeviceProp_t &prop, std::list<librettPlan_t>& plans, s
 void reduceRanks(const int rank, const int* dim, const int* permutation,
   std::vector<int>& redDim, std::vector<int>& redPermutation);
 
+// Same for strided tensors, ranks are only combined when their strides are consecutive too.
+// strideIn[i] and strideOut[i] are the strides of rank i in the input and in the output
+void reduceRanks(const int rank, const int* dim, const int* permutation,
+  const long long int* strideIn, const long long int* strideOut,
+  std::vector<int>& redDim, std::vector<int>& redPermutation,
+  std::vector<long long int>& redStrideIn, std::vector<long long int>& redStrideOut);
+
 std::list<librettPlan_t>::iterator choosePlanHeuristic(std::list<librettPlan_t>& plans);
 
 #endif // LIBRETTPLAN_H
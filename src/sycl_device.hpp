@@ -3,6 +3,7 @@
 #include <cstring>
 #include <map>
 #include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -34,6 +35,9 @@ namespace Librett {
     int get_max_work_group_size() const { return _max_work_group_size; }
     int get_min_sub_group_size() const { return _warpSize; }
     size_t get_local_mem_size() const { return _local_mem_size; }
+    // Global memory bandwidth in GB/s
+    double get_mem_bandwidth() const { return _mem_bandwidth; }
+    std::string get_name() const { return _name; }
     // set interface
     void set_major_version(int major) { _major = major; }
     void set_max_clock_frequency(int frequency) { _clockRate = frequency; }
@@ -50,6 +54,8 @@ namespace Librett {
     void set_local_mem_size(size_t local_mem_size) {
       _local_mem_size = local_mem_size;
     }
+    void set_mem_bandwidth(double mem_bandwidth) { _mem_bandwidth = mem_bandwidth; }
+    void set_name(const std::string& name) { _name = name; }
   private:
     int _warpSize;
     int _clockRate;
@@ -57,6 +63,8 @@ namespace Librett {
     int _max_compute_units;
     int _max_work_group_size;
     size_t _local_mem_size;
+    double _mem_bandwidth;
+    std::string _name;
   };
 
 /// Util function to get number of GPU devices (default: explicit scaling)
@@ -93,6 +101,21 @@ namespace Librett {
 
     prop->set_local_mem_size( dev.get_info<sycl::info::device::local_mem_size>() );
 
+    prop->set_name( dev.get_info<sycl::info::device::name>() );
+
+    // Level Zero reports the memory clock as the effective data rate (MHz),
+    // so bandwidth is clock*busWidth without the DDR factor.
+    // When the Intel device info extension is not available, assume 1 TB/s
+    double mem_bandwidth = 1000.0;
+#if defined(SYCL_EXT_INTEL_DEVICE_INFO) && SYCL_EXT_INTEL_DEVICE_INFO >= 6
+    if (dev.has(sycl::aspect::ext_intel_memory_clock_rate) && dev.has(sycl::aspect::ext_intel_memory_bus_width)) {
+      double memClockRate = (double)dev.get_info<sycl::ext::intel::info::device::memory_clock_rate>();
+      double memBusWidth = (double)dev.get_info<sycl::ext::intel::info::device::memory_bus_width>();
+      if (memClockRate > 0.0 && memBusWidth > 0.0) mem_bandwidth = memClockRate*(memBusWidth/8.0)/1.0e3;
+    }
+#endif
+    prop->set_mem_bandwidth(mem_bandwidth);
+
     int major;
     // Version string has the following format:
     // a. OpenCL<space><major.minor><space><vendor-specific-information>
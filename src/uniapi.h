@@ -30,15 +30,23 @@ SOFTWARE.
   #include "sycl_device.hpp"
   #include <complex>
   typedef std::complex<double> librett_complex;
+  typedef std::complex<float> librett_complex_float;
+  typedef sycl::half librett_half;
 #elif LIBRETT_USES_HIP
   #include <hip/hip_runtime.h>
   #include <hip/hip_complex.h>
+  #include <hip/hip_fp16.h>
   typedef hipDoubleComplex librett_complex;
+  typedef hipFloatComplex librett_complex_float;
+  typedef __half librett_half;
 #elif LIBRETT_USES_CUDA
   #include <cuda.h>
   #include <cuda_runtime.h>
   #include <cuComplex.h>
+  #include <cuda_fp16.h>
   typedef cuDoubleComplex librett_complex;
+  typedef cuFloatComplex librett_complex_float;
+  typedef __half librett_half;
 #endif
 
 #if !defined(LIBRETT_USES_SYCL) && !defined(LIBRETT_USES_HIP)
@@ -123,6 +131,7 @@ extern SYCL_EXTERNAL sycl::vec<unsigned, 4> ballot(sycl::sub_group, bool);
   using gpuStream_t     = sycl::queue*;
   using gpuDeviceProp_t = Librett::DeviceProp_t;
   using gpuError_t      = int;
+  using gpuEvent_t      = sycl::event;
 #elif LIBRETT_USES_HIP
   using int2_t          = int2;
   using int4_t          = int4;
@@ -130,6 +139,7 @@ extern SYCL_EXTERNAL sycl::vec<unsigned, 4> ballot(sycl::sub_group, bool);
   using gpuStream_t     = hipStream_t;
   using gpuDeviceProp_t = hipDeviceProp_t;
   using gpuError_t      = hipError_t;
+  using gpuEvent_t      = hipEvent_t;
 #elif LIBRETT_USES_CUDA
   using int2_t          = int2;
   using int4_t          = int4;
@@ -137,6 +147,7 @@ extern SYCL_EXTERNAL sycl::vec<unsigned, 4> ballot(sycl::sub_group, bool);
   using gpuStream_t     = cudaStream_t;
   using gpuDeviceProp_t = cudaDeviceProp;
   using gpuError_t      = cudaError_t;
+  using gpuEvent_t      = cudaEvent_t;
 #endif
 
 // Functions
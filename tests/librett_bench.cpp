@@ -30,6 +30,11 @@ SOFTWARE.
 #include <cmath>
 #include <cctype>
 #include <random>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <cstdlib>         // std::getenv
 #include "librett.h"
 #include "GpuUtils.h"
 #include "GpuMem.hpp"
@@ -61,6 +66,45 @@ template <typename T> bool bench7(gpuStream_t& gpuStream);
 template <typename T> bool bench_input(std::vector<int>& dim, std::vector<int>& permutation, gpuStream_t& gpuStream);
 template <typename T> bool bench_memcpy(int numElem, gpuStream_t& gpuStream);
 
+//
+// Shape of the benchmark suite (-shapes)
+//
+struct BenchShape {
+  std::vector<int> dim;
+  std::vector<int> permutation;
+  int elemsize;
+};
+
+//
+// Result of one shape of the benchmark suite, times in milliseconds, bandwidths in GB/s
+//
+struct BenchResult {
+  BenchShape shape;
+  size_t vol;
+  bool ok;
+  // librettPlan
+  std::string method;
+  double planTime;
+  double execTime;
+  double execMedian;
+  double bandwidth;
+  // librettPlanMeasure
+  std::string measureMethod;
+  double measurePlanTime;
+  double measureExecTime;
+  double measureBandwidth;
+  // memcpyFloat of the same number of bytes
+  double memcpyBandwidth;
+};
+
+bool readShapes(const char* filename, int elemsize, std::vector<BenchShape>& shapes);
+bool bench_suite(std::vector<BenchShape>& shapes, int warmup, int repeat, bool measure,
+  const char* jsonFile, const char* csvFile, gpuStream_t& gpuStream);
+template <typename T> bool bench_shape(BenchShape& shape, int warmup, int repeat, bool measure,
+  BenchResult& result, gpuStream_t& gpuStream);
+bool bench_tune(std::vector<BenchShape>& shapes, gpuStream_t& gpuStream);
+template <typename T> bool tune_shape(BenchShape& shape, gpuStream_t& gpuStream);
+
 bool isTrivial(std::vector<int>& permutation);
 void getRandomDim(double vol, std::vector<int>& dim);
 template <typename T> bool bench_tensor(std::vector<int>& dim, std::vector<int>& permutation, gpuStream_t& q);
@@ -78,8 +122,18 @@ int main(int argc, char *argv[])
   use_librettPlanMeasure = false;
   use_plantimer = false;
   int elemsize = 8;
+  bool calibrate = false;
+  int measureTopK = 0;
+  int measureNumRepeat = 1;
   std::vector<int> dimIn;
   std::vector<int> permutationIn;
+  const char* shapeFile = NULL;
+  const char* jsonFile = NULL;
+  const char* csvFile = NULL;
+  int warmup = 1;
+  int repeat = 5;
+  bool suiteMeasure = true;
+  bool tune = false;
   if (argc >= 2) {
     int i = 1;
     while (i < argc) {
@@ -92,6 +146,13 @@ int main(int argc, char *argv[])
       } else if (strcmp(argv[i], "-measure") == 0) {
         use_librettPlanMeasure = true;
         i++;
+      } else if (strcmp(argv[i], "-budget") == 0 && i + 2 < argc) {
+        sscanf(argv[i+1], "%d", &measureTopK);
+        sscanf(argv[i+2], "%d", &measureNumRepeat);
+        i += 3;
+      } else if (strcmp(argv[i], "-calibrate") == 0) {
+        calibrate = true;
+        i++;
       } else if (strcmp(argv[i], "-seed") == 0) {
         sscanf(argv[i+1], "%u", &seed);
         i += 2;
@@ -101,6 +162,27 @@ int main(int argc, char *argv[])
       } else if (strcmp(argv[i], "-elemsize") == 0) {
         sscanf(argv[i+1], "%u", &elemsize);
         i += 2;
+      } else if (strcmp(argv[i], "-shapes") == 0 && i + 1 < argc) {
+        shapeFile = argv[i+1];
+        i += 2;
+      } else if (strcmp(argv[i], "-warmup") == 0 && i + 1 < argc) {
+        sscanf(argv[i+1], "%d", &warmup);
+        i += 2;
+      } else if (strcmp(argv[i], "-repeat") == 0 && i + 1 < argc) {
+        sscanf(argv[i+1], "%d", &repeat);
+        i += 2;
+      } else if (strcmp(argv[i], "-tune") == 0) {
+        tune = true;
+        i++;
+      } else if (strcmp(argv[i], "-nomeasure") == 0) {
+        suiteMeasure = false;
+        i++;
+      } else if (strcmp(argv[i], "-json") == 0 && i + 1 < argc) {
+        jsonFile = argv[i+1];
+        i += 2;
+      } else if (strcmp(argv[i], "-csv") == 0 && i + 1 < argc) {
+        csvFile = argv[i+1];
+        i += 2;
       } else if (strcmp(argv[i], "-dim") == 0) {
         i++;
         while (i < argc && isdigit(*argv[i])) {
@@ -128,17 +210,38 @@ int main(int argc, char *argv[])
     arg_ok = false;
   }
 
+  if (measureTopK < 0 || measureNumRepeat < 1) {
+    arg_ok = false;
+  }
+
+  if (warmup < 0 || repeat < 1) {
+    arg_ok = false;
+  }
+
   if (!arg_ok) {
     printf("librett_bench [options]\n");
     printf("Options:\n");
     printf("-device [int]    : GPU ID (default is 0)\n");
     printf("-measure         : use librettPlanMeasure (default is librettPlan)\n");
+    printf("-budget [int] [int] : with -measure, time only the top K candidates with N repeats (default is 0 1 = all, once)\n");
     printf("-plantimer       : planning is timed (default is no)\n");
+    printf("-calibrate       : calibrate the librettPlan performance model first (default is no)\n");
     printf("-seed [int]      : seed value for random number generator (default is system timer)\n");
     printf("-elemsize [int]  : size of elements in bytes, 4 or 8. (default is 8)\n");
     printf("-dim ...         : space-separated list of dimensions\n");
     printf("-permutation ... : space-separated list of permutations\n");
     printf("-bench benchID   : benchmark to run\n");
+    printf("Benchmark suite:\n");
+    printf("-shapes [file]   : run the shapes of file, one per line: dim ... : permutation ... [: elemsize]\n");
+    printf("                   with elemsize 4 or 8 (default is -elemsize), # starts a comment\n");
+    printf("-warmup [int]    : untimed executions per plan (default is 1)\n");
+    printf("-repeat [int]    : timed executions per plan (default is 5)\n");
+    printf("-nomeasure       : time librettPlan only (default is librettPlan and librettPlanMeasure)\n");
+    printf("-json [file]     : write results in JSON\n");
+    printf("-csv [file]      : write results in CSV\n");
+    printf("-tune            : with -shapes, choose the plans of the shapes with librettPlanMeasure (see -budget)\n");
+    printf("                   and save them into the plan database file LIBRETT_PLAN_DATABASE.\n");
+    printf("                   The shape file can be a workload trace written with LIBRETT_TRACE\n");
     return 1;
   }
 
@@ -172,6 +275,14 @@ int main(int argc, char *argv[])
   //printDeviceInfo();
   printf("CPU using vector type %s of length %d\n", INT_VECTOR_TYPE, INT_VECTOR_LEN);
 
+  // With LIBRETT_PLAN_DATABASE set, the calibration is saved at librettFinalize()
+  librettInitialize();
+  librettCheck(librettSetMeasureBudget(measureTopK, measureNumRepeat));
+  if (calibrate) {
+    librettCheck(librettCalibrateModel(gpuStream));
+    printf("librettPlan performance model calibrated\n");
+  }
+
   timer = new librettTimer(elemsize);
 
   dataSize = (elemsize == 4) ? 420*MILLION : 530*MILLION;
@@ -213,6 +324,17 @@ int main(int argc, char *argv[])
     goto fail;
   }
 
+  if (shapeFile != NULL) {
+    std::vector<BenchShape> shapes;
+    if (!readShapes(shapeFile, elemsize, shapes)) goto fail;
+    if (tune) {
+      if (bench_tune(shapes, gpuStream)) goto benchOK;
+      goto fail;
+    }
+    if (bench_suite(shapes, warmup, repeat, suiteMeasure, jsonFile, csvFile, gpuStream)) goto benchOK;
+    goto fail;
+  }
+
   if (benchID == 3) {
     if (elemsize == 4) {
       printf("bench 3 not implemented for elemsize = 4\n");
@@ -379,6 +501,8 @@ end:
 
   delete timer;
 
+  librettFinalize();
+
 #ifdef LIBRETT_USES_SYCL
   gpuStream->wait_and_throw();
 #elif LIBRETT_USES_HIP
@@ -849,6 +973,9 @@ bool bench_tensor(std::vector<int> &dim, std::vector<int> &permutation, gpuStrea
 
     timer->start(dim, permutation);
     librettCheck(librettExecute(plan, dataIn, dataOut));
+#if LIBRETT_USES_SYCL
+    q->wait_and_throw();
+#endif
     timer->stop();
 
     printf("wall time %lf ms %lf GB/s\n", timer->seconds()*1000.0, timer->GBs());
@@ -946,6 +1073,323 @@ template <typename T> bool bench_memcpy(int numElem, gpuStream_t& gpuStr)
   return true;
 }
 
+//######################################################################################
+// Benchmark suite
+//######################################################################################
+
+//
+// Reads shapes from file, one per line: dim ... : permutation ... [: elemsize]
+// Shapes with elemsize other than 4 or 8 (e.g. from a workload trace) are skipped.
+// Returns false if the file can not be read or has an invalid line
+//
+bool readShapes(const char* filename, int elemsize, std::vector<BenchShape>& shapes) {
+  std::ifstream file(filename);
+  if (!file.is_open()) {
+    printf("readShapes: unable to read %s\n", filename);
+    return false;
+  }
+  std::string line;
+  int lineNum = 0;
+  while (std::getline(file, line)) {
+    lineNum++;
+    line = line.substr(0, line.find('#'));
+    std::vector< std::vector<int> > fields(1);
+    std::istringstream iss(line);
+    std::string token;
+    while (iss >> token) {
+      if (token == ":") {
+        fields.push_back(std::vector<int>());
+      } else {
+        fields.back().push_back(atoi(token.c_str()));
+      }
+    }
+    if (fields.size() == 1 && fields[0].empty()) continue;
+
+    BenchShape shape;
+    bool ok = (fields.size() == 2 || fields.size() == 3);
+    if (ok) {
+      shape.dim = fields[0];
+      shape.permutation = fields[1];
+      shape.elemsize = (fields.size() == 3 && fields[2].size() == 1) ? fields[2][0] : elemsize;
+      ok = (!shape.dim.empty() && shape.dim.size() == shape.permutation.size() &&
+        (fields.size() == 2 || fields[2].size() == 1));
+    }
+    if (!ok) {
+      printf("readShapes: invalid line %d in %s\n", lineNum, filename);
+      return false;
+    }
+    if (shape.elemsize != 4 && shape.elemsize != 8) {
+      printf("readShapes: skipping line %d in %s, elemsize %d is not supported\n", lineNum, filename, shape.elemsize);
+      continue;
+    }
+    shapes.push_back(shape);
+  }
+  return true;
+}
+
+//
+// Runs func warmup times and then repeat times, returns the times of the repeats in milliseconds
+//
+template <typename Func>
+std::vector<double> timeRuns(int warmup, int repeat, gpuStream_t& q, Func&& func) {
+  for (int i=0;i < warmup;i++) func();
+#if LIBRETT_USES_SYCL
+  q->wait_and_throw();
+#elif LIBRETT_USES_HIP
+  hipCheck(hipStreamSynchronize(q));
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaStreamSynchronize(q));
+#endif
+  Timer timer;
+  std::vector<double> times;
+  for (int i=0;i < repeat;i++) {
+    timer.start();
+    func();
+#if LIBRETT_USES_SYCL
+    q->wait_and_throw();
+#endif
+    timer.stop();
+    times.push_back(timer.seconds()*1000.0);
+  }
+  return times;
+}
+
+double getMedian(std::vector<double> v) {
+  std::sort(v.begin(), v.end());
+  const size_t n = v.size();
+  return (n % 2 == 1) ? v[n/2] : 0.5*(v[n/2 - 1] + v[n/2]);
+}
+
+double elapsedMs(std::chrono::high_resolution_clock::time_point start) {
+  std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration_cast< std::chrono::duration<double> >(end - start).count()*1000.0;
+}
+
+//
+// Benchmarks one shape with librettPlan, librettPlanMeasure (if measure = true) and memcpyFloat
+//
+template <typename T>
+bool bench_shape(BenchShape& shape, int warmup, int repeat, bool measure, BenchResult& result, gpuStream_t& q) {
+  const int rank = shape.dim.size();
+  size_t vol = 1;
+  for (int i=0;i < rank;i++) vol *= shape.dim[i];
+  result.shape = shape;
+  result.vol = vol;
+  result.ok = false;
+  if (vol*sizeof(T) > dataSize*sizeof(float)) {
+    printf("bench_shape: %zu elements exceed the data size\n", vol);
+    return false;
+  }
+  // Read and written bytes
+  const double bytes = 2.0*vol*sizeof(T);
+
+  librettHandle plan;
+  librettPlanInfo info;
+  std::chrono::high_resolution_clock::time_point plan_start = std::chrono::high_resolution_clock::now();
+  librettCheck(librettPlan(&plan, rank, shape.dim.data(), shape.permutation.data(), sizeof(T), q));
+  result.planTime = elapsedMs(plan_start);
+  librettCheck(librettPlanGetInfo(plan, &info));
+  result.method = info.method;
+  set_device_array<T>((T *)dataOut, -1, vol, q);
+  std::vector<double> times = timeRuns(warmup, repeat, q, [&]() {
+    librettCheck(librettExecute(plan, dataIn, dataOut)); });
+  librettCheck(librettDestroy(plan));
+  result.ok = tester->checkTranspose<T>(rank, shape.dim.data(), shape.permutation.data(), (T *)dataOut);
+  result.execTime = *std::min_element(times.begin(), times.end());
+  result.execMedian = getMedian(times);
+  result.bandwidth = bytes/(result.execTime*1.0e6);
+
+  result.measureMethod = "";
+  result.measurePlanTime = 0.0;
+  result.measureExecTime = 0.0;
+  result.measureBandwidth = 0.0;
+  if (measure) {
+    plan_start = std::chrono::high_resolution_clock::now();
+    librettCheck(librettPlanMeasure(&plan, rank, shape.dim.data(), shape.permutation.data(), sizeof(T), q,
+      dataIn, dataOut));
+    result.measurePlanTime = elapsedMs(plan_start);
+    librettCheck(librettPlanGetInfo(plan, &info));
+    result.measureMethod = info.method;
+    times = timeRuns(warmup, repeat, q, [&]() {
+      librettCheck(librettExecute(plan, dataIn, dataOut)); });
+    librettCheck(librettDestroy(plan));
+    result.ok = result.ok &&
+      tester->checkTranspose<T>(rank, shape.dim.data(), shape.permutation.data(), (T *)dataOut);
+    result.measureExecTime = *std::min_element(times.begin(), times.end());
+    result.measureBandwidth = bytes/(result.measureExecTime*1.0e6);
+  }
+
+  const int numFloat = vol*sizeof(T)/sizeof(float);
+  times = timeRuns(warmup, repeat, q, [&]() {
+    memcpyFloat(numFloat, (float *)dataIn, (float *)dataOut, q); });
+  result.memcpyBandwidth = bytes/(*std::min_element(times.begin(), times.end())*1.0e6);
+
+  return result.ok;
+}
+
+std::string benchDeviceName(gpuStream_t& q) {
+#if LIBRETT_USES_SYCL
+  return q->get_device().get_info<sycl::info::device::name>();
+#elif LIBRETT_USES_HIP
+  int deviceID;
+  hipCheck(hipGetDevice(&deviceID));
+  hipDeviceProp_t prop;
+  hipCheck(hipGetDeviceProperties(&prop, deviceID));
+  return prop.name;
+#elif LIBRETT_USES_CUDA
+  int deviceID;
+  cudaCheck(cudaGetDevice(&deviceID));
+  cudaDeviceProp prop;
+  cudaCheck(cudaGetDeviceProperties(&prop, deviceID));
+  return prop.name;
+#endif
+}
+
+std::string vecString(const std::vector<int>& vec, const char* sep) {
+  std::string str;
+  for (size_t i=0;i < vec.size();i++) str += (i == 0 ? "" : sep) + std::to_string(vec[i]);
+  return str;
+}
+
+std::string jsonString(const std::string& str) {
+  std::string res = "\"";
+  for (char c : str) {
+    if (c == '"' || c == '\\') res += '\\';
+    res += c;
+  }
+  return res + "\"";
+}
+
+bool writeJson(const char* filename, const std::string& device, int warmup, int repeat,
+  std::vector<BenchResult>& results) {
+  FILE* fp = fopen(filename, "w");
+  if (fp == NULL) return false;
+  fprintf(fp, "{\n  \"device\": %s,\n  \"warmup\": %d,\n  \"repeat\": %d,\n  \"results\": [",
+    jsonString(device).c_str(), warmup, repeat);
+  for (size_t i=0;i < results.size();i++) {
+    BenchResult& r = results[i];
+    fprintf(fp, "%s\n    {\"dim\": [%s], \"permutation\": [%s], \"elemsize\": %d, \"vol\": %zu, \"ok\": %s,\n",
+      (i == 0) ? "" : ",", vecString(r.shape.dim, ", ").c_str(), vecString(r.shape.permutation, ", ").c_str(),
+      r.shape.elemsize, r.vol, r.ok ? "true" : "false");
+    fprintf(fp, "     \"plan\": {\"method\": %s, \"plan_ms\": %.6f, \"exec_ms\": %.6f, \"exec_median_ms\": %.6f, \"GBs\": %.3f},\n",
+      jsonString(r.method).c_str(), r.planTime, r.execTime, r.execMedian, r.bandwidth);
+    if (!r.measureMethod.empty()) {
+      fprintf(fp, "     \"measure\": {\"method\": %s, \"plan_ms\": %.6f, \"exec_ms\": %.6f, \"GBs\": %.3f},\n",
+        jsonString(r.measureMethod).c_str(), r.measurePlanTime, r.measureExecTime, r.measureBandwidth);
+    }
+    fprintf(fp, "     \"memcpy_GBs\": %.3f}", r.memcpyBandwidth);
+  }
+  fprintf(fp, "\n  ]\n}\n");
+  fclose(fp);
+  return true;
+}
+
+bool writeCsv(const char* filename, const std::string& device, std::vector<BenchResult>& results) {
+  FILE* fp = fopen(filename, "w");
+  if (fp == NULL) return false;
+  fprintf(fp, "device,dim,permutation,elemsize,vol,ok,method,plan_ms,exec_ms,exec_median_ms,GBs,"
+    "measure_method,measure_plan_ms,measure_exec_ms,measure_GBs,memcpy_GBs\n");
+  for (BenchResult& r : results) {
+    fprintf(fp, "\"%s\",%s,%s,%d,%zu,%d,%s,%.6f,%.6f,%.6f,%.3f,%s,%.6f,%.6f,%.3f,%.3f\n", device.c_str(),
+      vecString(r.shape.dim, " ").c_str(), vecString(r.shape.permutation, " ").c_str(), r.shape.elemsize, r.vol,
+      (int)r.ok, r.method.c_str(), r.planTime, r.execTime, r.execMedian, r.bandwidth, r.measureMethod.c_str(),
+      r.measurePlanTime, r.measureExecTime, r.measureBandwidth, r.memcpyBandwidth);
+  }
+  fclose(fp);
+  return true;
+}
+
+//
+// Runs the benchmark suite, writes results into jsonFile and csvFile if given
+//
+bool bench_suite(std::vector<BenchShape>& shapes, int warmup, int repeat, bool measure,
+  const char* jsonFile, const char* csvFile, gpuStream_t& gpuStream) {
+  std::string device = benchDeviceName(gpuStream);
+  printf("device %s warmup %d repeat %d\n", device.c_str(), warmup, repeat);
+  printf("dim | permutation | elemsize | method plan_ms exec_ms GBs | measure method plan_ms exec_ms GBs | memcpy GBs\n");
+
+  bool all_ok = true;
+  std::vector<BenchResult> results(shapes.size());
+  for (size_t i=0;i < shapes.size();i++) {
+    BenchShape& shape = shapes[i];
+    BenchResult& r = results[i];
+    bool ok = (shape.elemsize == 4) ? bench_shape<int>(shape, warmup, repeat, measure, r, gpuStream) :
+      bench_shape<long long int>(shape, warmup, repeat, measure, r, gpuStream);
+    printf("%s | %s | %d | %s %.3f %.3f %.2f | %s %.3f %.3f %.2f | %.2f%s\n",
+      vecString(shape.dim, " ").c_str(), vecString(shape.permutation, " ").c_str(), shape.elemsize,
+      r.method.c_str(), r.planTime, r.execTime, r.bandwidth,
+      measure ? r.measureMethod.c_str() : "-", r.measurePlanTime, r.measureExecTime, r.measureBandwidth,
+      r.memcpyBandwidth, ok ? "" : " FAILED");
+    all_ok = all_ok && ok;
+  }
+
+  if (jsonFile != NULL && !writeJson(jsonFile, device, warmup, repeat, results)) {
+    printf("bench_suite: unable to write %s\n", jsonFile);
+    all_ok = false;
+  }
+  if (csvFile != NULL && !writeCsv(csvFile, device, results)) {
+    printf("bench_suite: unable to write %s\n", csvFile);
+    all_ok = false;
+  }
+  return all_ok;
+}
+
+//
+// Tunes one shape with librettPlanMeasure.
+// The measured plan is stored in the plan database
+//
+template <typename T>
+bool tune_shape(BenchShape& shape, gpuStream_t& q) {
+  const int rank = shape.dim.size();
+  size_t vol = 1;
+  for (int i=0;i < rank;i++) vol *= shape.dim[i];
+  if (vol*sizeof(T) > dataSize*sizeof(float)) {
+    printf("tune_shape: %zu elements exceed the data size\n", vol);
+    return false;
+  }
+
+  librettHandle plan;
+  std::chrono::high_resolution_clock::time_point plan_start = std::chrono::high_resolution_clock::now();
+  librettCheck(librettPlanMeasure(&plan, rank, shape.dim.data(), shape.permutation.data(), sizeof(T), q,
+    dataIn, dataOut));
+  const double planTime = elapsedMs(plan_start);
+  librettPlanInfo info;
+  librettCheck(librettPlanGetInfo(plan, &info));
+  set_device_array<T>((T *)dataOut, -1, vol, q);
+  librettCheck(librettExecute(plan, dataIn, dataOut));
+  librettCheck(librettDestroy(plan));
+  bool ok = tester->checkTranspose<T>(rank, shape.dim.data(), shape.permutation.data(), (T *)dataOut);
+  printf("%s | %s | %zu | %s %.3f ms%s\n", vecString(shape.dim, " ").c_str(),
+    vecString(shape.permutation, " ").c_str(), sizeof(T), info.method, planTime, ok ? "" : " FAILED");
+  return ok;
+}
+
+//
+// Chooses the plans of shapes with librettPlanMeasure, each distinct shape once.
+// The plans are saved into the plan database at librettFinalize()
+//
+bool bench_tune(std::vector<BenchShape>& shapes, gpuStream_t& gpuStream) {
+  const char* database = std::getenv("LIBRETT_PLAN_DATABASE");
+  if (database == NULL) {
+    printf("bench_tune: set LIBRETT_PLAN_DATABASE to save the tuned plans\n");
+    return false;
+  }
+  printf("tuning %zu shapes into %s\n", shapes.size(), database);
+  printf("dim | permutation | elemsize | method plan_ms\n");
+
+  bool all_ok = true;
+  std::set<std::string> tuned;
+  for (BenchShape& shape : shapes) {
+    std::string key = vecString(shape.dim, " ") + ":" + vecString(shape.permutation, " ") + ":" +
+      std::to_string(shape.elemsize);
+    if (!tuned.insert(key).second) continue;
+    bool ok = (shape.elemsize == 4) ? tune_shape<int>(shape, gpuStream) :
+      tune_shape<long long int>(shape, gpuStream);
+    all_ok = all_ok && ok;
+  }
+  return all_ok;
+}
+
 // #ifdef LIBRETT_USES_SYCL
 // void printDeviceInfo() {
 //   int deviceID;
@@ -30,13 +30,18 @@ All rights reserved.
 #include <ctime>           // std::time
 #include <cstring>         // strcmp
 #include <cmath>
+#include <cstdint>         // uint8_t, uint16_t
+#include <cstdio>          // std::remove
 #include "librett.h"
 #include "GpuUtils.h"
 #include "GpuMem.hpp"
 #include "TensorTester.h"
 #include "Timer.h"
 #include "GpuModel.h"      // testCounters
+#include "FastDiv.h"       // makeFastDiv, fastDivide, fastDivMod
 #include "GpuUtils.h"
+#include "PlanDatabase.h"  // librettPlanDatabaseLoad, librettPlanDatabaseSave
+#include "WorkloadTrace.h" // librettTraceEnable, librettTraceSave
 
 #ifdef LIBRETT_USES_SYCL
 auto sycl_asynchandler = [] (sycl::exception_list exceptions) {
@@ -68,6 +73,32 @@ bool test2(gpuStream_t&);
 bool test3(gpuStream_t&);
 bool test4();
 bool test5();
+bool test6(gpuStream_t&);
+bool test7(gpuStream_t&);
+bool test8(gpuStream_t&);
+bool test9();
+bool test10(gpuStream_t&);
+bool test11(gpuStream_t&);
+bool test12(gpuStream_t&);
+bool test13(gpuStream_t&);
+bool test14(gpuStream_t&);
+bool test15(gpuStream_t&);
+bool test16(gpuStream_t&);
+bool test17(gpuStream_t&);
+bool test18(gpuStream_t&);
+bool test19(gpuStream_t&);
+bool test20(gpuStream_t&);
+bool test21(gpuStream_t&);
+bool test22(gpuStream_t&);
+bool test23(gpuStream_t&);
+bool test24(gpuStream_t&);
+bool test25(gpuStream_t&);
+bool test26(gpuStream_t&);
+bool test27(gpuStream_t&);
+bool test28(gpuStream_t&);
+bool test29(gpuStream_t&);
+bool test30(gpuStream_t&);
+bool test31(gpuStream_t&);
 template <typename T> bool test_tensor(std::vector<int>& dim, std::vector<int>& permutation, gpuStream_t& stream);
 void printVec(std::vector<int>& vec);
 
@@ -132,6 +163,35 @@ int main(int argc, char *argv[])
   if(passed){passed = test5(); if(!passed) printf("Test 5 failed\n");}
 #endif
 #endif
+  if(passed){passed = test6(gpumasterstream); if(!passed) printf("Test 6 failed\n");}
+  if(passed){passed = test7(gpumasterstream); if(!passed) printf("Test 7 failed\n");}
+  if(passed){passed = test8(gpumasterstream); if(!passed) printf("Test 8 failed\n");}
+  if(passed){passed = test9(); if(!passed) printf("Test 9 failed\n");}
+  if(passed){passed = test10(gpumasterstream); if(!passed) printf("Test 10 failed\n");}
+  if(passed){passed = test11(gpumasterstream); if(!passed) printf("Test 11 failed\n");}
+#ifndef LIBRETT_USES_SYCL
+  if(passed){passed = test12(gpumasterstream); if(!passed) printf("Test 12 failed\n");}
+#else
+  if(passed){passed = test13(gpumasterstream); if(!passed) printf("Test 13 failed\n");}
+#endif
+  if(passed){passed = test14(gpumasterstream); if(!passed) printf("Test 14 failed\n");}
+  if(passed){passed = test15(gpumasterstream); if(!passed) printf("Test 15 failed\n");}
+  if(passed){passed = test16(gpumasterstream); if(!passed) printf("Test 16 failed\n");}
+  if(passed){passed = test17(gpumasterstream); if(!passed) printf("Test 17 failed\n");}
+  if(passed){passed = test18(gpumasterstream); if(!passed) printf("Test 18 failed\n");}
+  if(passed){passed = test19(gpumasterstream); if(!passed) printf("Test 19 failed\n");}
+  if(passed){passed = test20(gpumasterstream); if(!passed) printf("Test 20 failed\n");}
+  if(passed){passed = test21(gpumasterstream); if(!passed) printf("Test 21 failed\n");}
+  if(passed){passed = test22(gpumasterstream); if(!passed) printf("Test 22 failed\n");}
+  if(passed){passed = test23(gpumasterstream); if(!passed) printf("Test 23 failed\n");}
+  if(passed){passed = test24(gpumasterstream); if(!passed) printf("Test 24 failed\n");}
+  if(passed){passed = test25(gpumasterstream); if(!passed) printf("Test 25 failed\n");}
+  if(passed){passed = test26(gpumasterstream); if(!passed) printf("Test 26 failed\n");}
+  if(passed){passed = test27(gpumasterstream); if(!passed) printf("Test 27 failed\n");}
+  if(passed){passed = test28(gpumasterstream); if(!passed) printf("Test 28 failed\n");}
+  if(passed){passed = test29(gpumasterstream); if(!passed) printf("Test 29 failed\n");}
+  if(passed){passed = test30(gpumasterstream); if(!passed) printf("Test 30 failed\n");}
+  if(passed){passed = test31(gpumasterstream); if(!passed) printf("Test 31 failed\n");}
 
   if(passed){
     std::vector<int> worstDim;
@@ -510,6 +570,1282 @@ bool test5() {
   return true;
 }
 
+//
+// Test 6: Persistent plan database
+//
+bool test6(gpuStream_t& master_gpustream) {
+  const char* filename = "librett_test_plans.db";
+  std::remove(filename);
+
+  // Missing file enables an empty database
+  librettPlanDatabaseLoad(filename);
+
+  std::vector<int> dim = {24, 32, 16, 36};
+  std::vector<int> permutation = {3, 1, 0, 2};
+  // First call creates and stores the plan, second call uses the stored plan
+  for (int i=0;i < 2;i++) {
+    if (!test_tensor<long long int>(dim, permutation, master_gpustream)) return false;
+    if (!test_tensor<int>(dim, permutation, master_gpustream)) return false;
+  }
+
+  if (!librettPlanDatabaseSave(filename)) return false;
+
+  // One record for each element size
+  FILE* file = fopen(filename, "r");
+  if (file == nullptr) return false;
+  char line[1024];
+  int numRecord = 0;
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    if (line[0] != '#' && strncmp(line, "model ", 6) != 0) numRecord++;
+  }
+  fclose(file);
+  if (numRecord < 2) {
+    printf("test6 database file has %d records\n", numRecord);
+    return false;
+  }
+
+  if (!librettPlanDatabaseLoad(filename)) return false;
+  if (!test_tensor<long long int>(dim, permutation, master_gpustream)) return false;
+
+  // Loaded record gives the launch configuration of the created plan
+  int deviceID = 0;
+  gpuDeviceProp_t prop;
+#if LIBRETT_USES_SYCL
+  Librett::syclGetDeviceProperties(&prop, master_gpustream);
+#elif LIBRETT_USES_HIP
+  hipCheck(hipGetDevice(&deviceID));
+  hipCheck(hipGetDeviceProperties(&prop, deviceID));
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaGetDevice(&deviceID));
+  cudaCheck(cudaGetDeviceProperties(&prop, deviceID));
+#endif
+  std::vector<int> redDim;
+  std::vector<int> redPermutation;
+  reduceRanks(dim.size(), dim.data(), permutation.data(), redDim, redPermutation);
+  librettPlan_t dbPlan;
+  if (!librettPlanDatabaseFind(librettDeviceName(prop), dim.size(), dim.data(), permutation.data(), redDim.size(),
+    redDim.data(), redPermutation.data(), sizeof(long long int), false, deviceID, prop, dbPlan)) {
+    printf("test6 plan not found in the loaded database\n");
+    return false;
+  }
+  librettHandle plan;
+  librettCheck(librettPlan(&plan, dim.size(), dim.data(), permutation.data(), sizeof(long long int), master_gpustream));
+  librettPlanInfo info;
+  librettCheck(librettPlanGetInfo(plan, &info));
+  librettCheck(librettDestroy(plan));
+  const LaunchConfig& lc = dbPlan.launchConfig;
+  if (info.numthread[0] != (int)lc.numthread_x || info.numthread[1] != (int)lc.numthread_y ||
+    info.numthread[2] != (int)lc.numthread_z || info.numblock[0] != (int)lc.numblock_x ||
+    info.numblock[1] != (int)lc.numblock_y || info.numblock[2] != (int)lc.numblock_z ||
+    info.shmemsize != lc.shmemsize || info.numRegStorage != lc.numRegStorage ||
+    info.vecWidth != lc.vecWidth || info.numActiveBlock != dbPlan.numActiveBlock) {
+    printf("test6 database plan differs from the created plan\n");
+    return false;
+  }
+
+  std::remove(filename);
+  return true;
+}
+
+//
+// Test 7: one plan executed on several streams
+//
+bool test7(gpuStream_t& master_gpustream)
+{
+  std::vector<int> dim = {24, 32, 16, 36, 43};
+  std::vector<int> permutation = {4, 1, 3, 2, 0};
+
+  const int numStream = 4;
+  gpuStream_t streams[numStream];
+  for (int i=0;i < numStream;i++) {
+#if LIBRETT_USES_SYCL
+    streams[i] = new sycl::queue(master_gpustream->get_context(), master_gpustream->get_device(),
+      sycl_asynchandler, sycl::property_list{sycl::property::queue::in_order{}});
+#elif LIBRETT_USES_HIP
+    hipCheck(hipStreamCreate(&streams[i]));
+#elif LIBRETT_USES_CUDA
+    cudaCheck(cudaStreamCreate(&streams[i]));
+#endif
+  }
+
+  librettHandle plan;
+  librettCheck(librettPlan(&plan, dim.size(), dim.data(), permutation.data(), sizeof(double), master_gpustream));
+  gpuDeviceSynchronize(master_gpustream);
+
+  for (int i=0;i < numStream;i++) {
+    librettCheck(librettExecuteOnStream(plan, dataIn, dataOut, streams[i]));
+  }
+
+#if LIBRETT_USES_SYCL
+  for (int i=0;i < numStream;i++) {
+    streams[i]->wait_and_throw();
+  }
+#elif LIBRETT_USES_HIP
+  hipCheck(hipDeviceSynchronize());
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaDeviceSynchronize());
+#endif
+
+  bool run_ok = tester->checkTranspose(dim.size(), dim.data(), permutation.data(), (long long int *)dataOut);
+
+  librettCheck(librettDestroy(plan));
+
+  for (int i=0;i < numStream;i++) {
+#if LIBRETT_USES_SYCL
+    delete streams[i];
+#elif LIBRETT_USES_HIP
+    hipCheck(hipStreamDestroy(streams[i]));
+#elif LIBRETT_USES_CUDA
+    cudaCheck(cudaStreamDestroy(streams[i]));
+#endif
+  }
+
+  return run_ok;
+}
+
+//
+// Checks librettExecuteScaled of plan with vol 8 byte elements scaled as float complex
+//
+bool checkScaledComplexFloat(librettHandle plan, const int vol, gpuStream_t& master_gpustream)
+{
+  // 8 byte elements scaled as float complex: odata = (1+2i)*transpose(idata) + (0.5-1i)*odata
+  std::vector<float> hInC(2*vol), hOut0C(2*vol), hRefC(2*vol), hResC(2*vol);
+  for (int i=0;i < 2*vol;i++) {
+    hInC[i] = (float)(i % 17) - 8.0f;
+    hOut0C[i] = 0.25f*(float)(i % 13);
+  }
+  float* dInC = (float *)dataIn;
+  float* dOutC = (float *)dataOut;
+  copy_HtoD_sync<float>(hInC.data(), dInC, 2*vol, master_gpustream);
+  librettCheck(librettExecute(plan, dInC, dOutC));
+  copy_DtoH_sync<float>(dOutC, hRefC.data(), 2*vol, master_gpustream);
+  float alphaC[2] = {1.0f, 2.0f};
+  float betaC[2] = {0.5f, -1.0f};
+  copy_HtoD_sync<float>(hOut0C.data(), dOutC, 2*vol, master_gpustream);
+  librettCheck(librettExecuteScaled(plan, dInC, dOutC, LIBRETT_COMPLEX_FLOAT, alphaC, betaC));
+  copy_DtoH_sync<float>(dOutC, hResC.data(), 2*vol, master_gpustream);
+  for (int i=0;i < vol;i++) {
+    const float xr = hRefC[2*i], xi = hRefC[2*i + 1];
+    const float yr = hOut0C[2*i], yi = hOut0C[2*i + 1];
+    const float re = alphaC[0]*xr - alphaC[1]*xi + betaC[0]*yr - betaC[1]*yi;
+    const float im = alphaC[0]*xi + alphaC[1]*xr + betaC[0]*yi + betaC[1]*yr;
+    if (std::abs(hResC[2*i] - re) > 1.0e-4f || std::abs(hResC[2*i + 1] - im) > 1.0e-4f) {
+      printf("test8 float complex error at %d: %f %f %f %f\n", i, hResC[2*i], hResC[2*i + 1], re, im);
+      return false;
+    }
+  }
+  return true;
+}
+
+//
+// Test 8: librettExecuteScaled against librettExecute
+//
+bool test8(gpuStream_t& master_gpustream)
+{
+  std::vector<int> dim = {6, 5, 4, 3};
+  // Tiled/Packed transpose and the Trivial copy
+  std::vector< std::vector<int> > permutations = {{2, 0, 3, 1}, {0, 1, 2, 3}};
+
+  int vol = 1;
+  for (size_t r=0;r < dim.size();r++) vol *= dim[r];
+
+  double* dIn  = (double *)dataIn;
+  double* dOut = (double *)dataOut;
+  std::vector<double> hIn(vol), hOut0(vol), hRef(vol), hRes(vol);
+  for (int i=0;i < vol;i++) {
+    hIn[i] = (double)(i + 1);
+    hOut0[i] = 0.5*(double)i;
+  }
+
+  bool run_ok = true;
+  for (auto& permutation : permutations) {
+    librettHandle plan;
+    librettCheck(librettPlan(&plan, dim.size(), dim.data(), permutation.data(), sizeof(double), master_gpustream));
+
+    copy_HtoD_sync<double>(hIn.data(), dIn, vol, master_gpustream);
+    librettCheck(librettExecute(plan, dIn, dOut));
+    copy_DtoH_sync<double>(dOut, hRef.data(), vol, master_gpustream);
+
+    // odata = 2*transpose(idata) - odata
+    double alpha = 2.0;
+    double beta = -1.0;
+    copy_HtoD_sync<double>(hOut0.data(), dOut, vol, master_gpustream);
+    librettCheck(librettExecuteScaled(plan, dIn, dOut, LIBRETT_DOUBLE, &alpha, &beta));
+    copy_DtoH_sync<double>(dOut, hRes.data(), vol, master_gpustream);
+    for (int i=0;i < vol;i++) {
+      if (hRes[i] != alpha*hRef[i] + beta*hOut0[i]) {
+        printf("test8 accumulate error at %d: %lf %lf\n", i, hRes[i], alpha*hRef[i] + beta*hOut0[i]);
+        run_ok = false;
+        break;
+      }
+    }
+
+    // odata = 3*transpose(idata)
+    alpha = 3.0;
+    beta = 0.0;
+    copy_HtoD_sync<double>(hOut0.data(), dOut, vol, master_gpustream);
+    librettCheck(librettExecuteScaled(plan, dIn, dOut, LIBRETT_DOUBLE, &alpha, &beta));
+    copy_DtoH_sync<double>(dOut, hRes.data(), vol, master_gpustream);
+    for (int i=0;i < vol;i++) {
+      if (hRes[i] != alpha*hRef[i]) {
+        printf("test8 scale error at %d: %lf %lf\n", i, hRes[i], alpha*hRef[i]);
+        run_ok = false;
+        break;
+      }
+    }
+
+    run_ok = run_ok && checkScaledComplexFloat(plan, vol, master_gpustream);
+
+    // The scalar type must match the element size of the plan
+    if (librettExecuteScaled(plan, dIn, dOut, LIBRETT_FLOAT, &alpha, &beta) != LIBRETT_INVALID_PARAMETER ||
+      librettExecuteScaled(plan, dIn, dOut, LIBRETT_COMPLEX_DOUBLE, &alpha, &beta) != LIBRETT_INVALID_PARAMETER) {
+      printf("test8 librettExecuteScaled accepted a scalar type of the wrong size\n");
+      run_ok = false;
+    }
+
+    librettCheck(librettDestroy(plan));
+    if (!run_ok) break;
+  }
+
+  // Grouped plans scale float complex elements too
+  if (run_ok) {
+    const int groupCount = 2;
+    std::vector<int> dims = {3, 4, 5, 6, 2, 7};
+    std::vector<int> permutation = {2, 0, 1};
+    librettHandle plan;
+    librettCheck(librettPlanGrouped(&plan, groupCount, 3, dims.data(), permutation.data(), 8,
+      nullptr, nullptr, master_gpustream));
+    run_ok = checkScaledComplexFloat(plan, 3*4*5 + 6*2*7, master_gpustream);
+    librettCheck(librettDestroy(plan));
+  }
+
+  // Restore the check pattern used by the other tests
+  tester->setTensorCheckPattern((unsigned int *)dataIn, dataSize*2);
+
+  return run_ok;
+}
+
+//
+// Test plan setup helpers for shapes with more than 2^31 elements
+//
+bool test9()
+{
+  // Ranks are not merged when the product does not fit into an int
+  {
+    std::vector<int> dim = {65536, 65536, 2};
+    std::vector<int> permutation = {0, 1, 2};
+    std::vector<int> redDim;
+    std::vector<int> redPermutation;
+    reduceRanks(dim.size(), dim.data(), permutation.data(), redDim, redPermutation);
+    long long int vol = 1;
+    for (auto d : redDim) {
+      vol *= d;
+      if (d < 1) return false;
+    }
+    if (vol != 65536LL*65536LL*2LL || redDim.size() < 2) {
+      printf("test9 reduceRanks merged past INT_MAX\n");
+      return false;
+    }
+  }
+
+  // Splits with a sub-volume that does not fit into an int are rejected
+  {
+    std::vector<int> dim = {65536, 2, 65536};
+    std::vector<int> permutation = {2, 1, 0};
+    TensorSplit ts;
+    ts.method = Tiled;
+    if (ts.update(1, 1, dim.size(), dim.data(), permutation.data())) {
+      printf("test9 TensorSplit::update accepted overflowing volMmk\n");
+      return false;
+    }
+    // Total volume is above 2^31 but the sub-volumes fit
+    std::vector<int> dim2 = {32768, 2, 32768, 2};
+    std::vector<int> permutation2 = {2, 1, 0, 3};
+    if (!ts.update(1, 1, dim2.size(), dim2.data(), permutation2.data())) {
+      printf("test9 TensorSplit::update rejected valid split\n");
+      return false;
+    }
+  }
+
+  return true;
+}
+
+//
+// Test 10: batch of same-shape tensors in one plan
+//
+bool test10(gpuStream_t& master_gpustream)
+{
+  std::vector<int> dim = {7, 12, 5};
+  std::vector<int> permutation = {2, 0, 1};
+  const int batchCount = 100;
+
+  librettHandle plan;
+  librettCheck(librettPlanBatched(&plan, dim.size(), dim.data(), permutation.data(), sizeof(long long int),
+    batchCount, master_gpustream));
+  librettCheck(librettExecute(plan, dataIn, dataOut));
+  gpuDeviceSynchronize(master_gpustream);
+  librettCheck(librettDestroy(plan));
+
+  // Batch is the outermost, non-permuted dimension
+  std::vector<int> batchDim(dim);
+  std::vector<int> batchPermutation(permutation);
+  batchDim.push_back(batchCount);
+  batchPermutation.push_back(dim.size());
+  return tester->checkTranspose(batchDim.size(), batchDim.data(), batchPermutation.data(), (long long int *)dataOut);
+}
+
+//
+// Test 11: group of tensors with different shapes in one plan
+//
+bool test11(gpuStream_t& master_gpustream)
+{
+  const int rank = 3;
+  const int groupCount = 4;
+  std::vector<int> dims = {5, 7, 3,  40, 2, 9,  33, 1, 65,  1, 1, 17};
+  // Tiled transpose and the copy of the fastest rank
+  std::vector< std::vector<int> > permutations = {{2, 0, 1}, {0, 2, 1}};
+
+  int vol = 0;
+  for (int g=0;g < groupCount;g++) vol += dims[g*rank]*dims[g*rank + 1]*dims[g*rank + 2];
+
+  double* dIn  = (double *)dataIn;
+  double* dOut = (double *)dataOut;
+  std::vector<double> hIn(vol), hRef(vol), hRes(vol);
+  for (int i=0;i < vol;i++) hIn[i] = (double)(i + 1);
+  copy_HtoD_sync<double>(hIn.data(), dIn, vol, master_gpustream);
+
+  bool run_ok = true;
+  for (auto& permutation : permutations) {
+    // Reference on the host, tensors are stored back to back
+    int offset = 0;
+    for (int g=0;g < groupCount;g++) {
+      const int* dim = &dims[g*rank];
+      int strideOut[rank];
+      strideOut[permutation[0]] = 1;
+      for (int i=1;i < rank;i++) strideOut[permutation[i]] = strideOut[permutation[i-1]]*dim[permutation[i-1]];
+      for (int k=0;k < dim[2];k++)
+        for (int j=0;j < dim[1];j++)
+          for (int i=0;i < dim[0];i++) {
+            hRef[offset + i*strideOut[0] + j*strideOut[1] + k*strideOut[2]] = hIn[offset + i + dim[0]*(j + dim[1]*k)];
+          }
+      offset += dim[0]*dim[1]*dim[2];
+    }
+
+    librettHandle plan;
+    librettCheck(librettPlanGrouped(&plan, groupCount, rank, dims.data(), permutation.data(), sizeof(double),
+      nullptr, nullptr, master_gpustream));
+    librettCheck(librettExecute(plan, dIn, dOut));
+    copy_DtoH_sync<double>(dOut, hRes.data(), vol, master_gpustream);
+    librettCheck(librettDestroy(plan));
+
+    for (int i=0;i < vol;i++) {
+      if (hRes[i] != hRef[i]) {
+        printf("test11 error at %d: %lf %lf\n", i, hRes[i], hRef[i]);
+        run_ok = false;
+        break;
+      }
+    }
+    if (!run_ok) break;
+  }
+
+  // Restore the check pattern used by the other tests
+  tester->setTensorCheckPattern((unsigned int *)dataIn, dataSize*2);
+
+  return run_ok;
+}
+
+#ifndef LIBRETT_USES_SYCL
+//
+// Test 12: plan added to a graph and replayed
+//
+bool test12(gpuStream_t& master_gpustream)
+{
+  std::vector<int> dim = {24, 32, 16, 36};
+  std::vector<int> permutation = {3, 1, 0, 2};
+
+  librettHandle plan;
+  librettCheck(librettPlan(&plan, dim.size(), dim.data(), permutation.data(), sizeof(long long int), master_gpustream));
+
+#if LIBRETT_USES_HIP
+  hipGraph_t graph;
+  hipGraphExec_t graphExec;
+  hipGraphNode_t node;
+  hipCheck(hipGraphCreate(&graph, 0));
+  librettCheck(librettAddGraphNode(plan, dataIn, dataOut, graph, nullptr, 0, &node));
+  hipCheck(hipGraphInstantiate(&graphExec, graph, nullptr, nullptr, 0));
+  for (int i=0;i < 3;i++) hipCheck(hipGraphLaunch(graphExec, master_gpustream));
+  hipCheck(hipStreamSynchronize(master_gpustream));
+  hipCheck(hipGraphExecDestroy(graphExec));
+  hipCheck(hipGraphDestroy(graph));
+#elif LIBRETT_USES_CUDA
+  cudaGraph_t graph;
+  cudaGraphExec_t graphExec;
+  cudaGraphNode_t node;
+  cudaCheck(cudaGraphCreate(&graph, 0));
+  librettCheck(librettAddGraphNode(plan, dataIn, dataOut, graph, nullptr, 0, &node));
+  cudaCheck(cudaGraphInstantiateWithFlags(&graphExec, graph, 0));
+  for (int i=0;i < 3;i++) cudaCheck(cudaGraphLaunch(graphExec, master_gpustream));
+  cudaCheck(cudaStreamSynchronize(master_gpustream));
+  cudaCheck(cudaGraphExecDestroy(graphExec));
+  cudaCheck(cudaGraphDestroy(graph));
+#endif
+
+  librettCheck(librettDestroy(plan));
+
+  return tester->checkTranspose(dim.size(), dim.data(), permutation.data(), (long long int *)dataOut);
+}
+#endif
+
+#ifdef LIBRETT_USES_SYCL
+//
+// Test 13: SYCL launches chained with events
+//
+bool test13(gpuStream_t& master_gpustream)
+{
+  std::vector<int> dim = {24, 32, 16, 36};
+  std::vector<int> permutation = {3, 1, 0, 2};
+
+  librettHandle plan;
+  librettCheck(librettPlan(&plan, dim.size(), dim.data(), permutation.data(), sizeof(long long int), master_gpustream));
+
+  sycl::event clearEvent = master_gpustream->memset(dataOut, 0, dataSize*sizeof(long long int));
+  sycl::event event;
+  librettCheck(librettExecuteAsync(plan, dataIn, dataOut, {clearEvent}, &event));
+  event.wait_and_throw();
+
+  bool run_ok = tester->checkTranspose(dim.size(), dim.data(), permutation.data(), (long long int *)dataOut);
+  librettCheck(librettDestroy(plan));
+  return run_ok;
+}
+#endif
+
+//
+// Test 14: calibrated model is used by librettPlan
+//
+bool test14(gpuStream_t& master_gpustream)
+{
+  librettCheck(librettCalibrateModel(master_gpustream));
+
+  auto modelProps = librettGetGpuModelProps();
+  if (modelProps.empty()) {
+    printf("test14 no calibrated model parameters\n");
+    return false;
+  }
+  for (auto& it : modelProps) {
+    const GpuModelProp& p = it.second;
+    if (!(p.base_dep_delay > 0.0 && p.base_mem_latency > 0.0 && p.sh_mem_latency > 0.0 &&
+      p.iter_cycles > 0.0 && p.fac > 0.0 && p.hitrate > 0.0 && p.hitrate < 1.0)) {
+      printf("test14 invalid model parameters for %s\n", it.first.c_str());
+      return false;
+    }
+  }
+
+  std::vector<int> dim = {31, 64, 17, 40};
+  std::vector<int> permutation = {2, 3, 0, 1};
+  return test_tensor<double>(dim, permutation, master_gpustream);
+}
+
+//
+// Test 15: librettPlanMeasure with a limited budget
+//
+bool test15(gpuStream_t& master_gpustream)
+{
+  if (librettSetMeasureBudget(-1, 1) != LIBRETT_INVALID_PARAMETER ||
+    librettSetMeasureBudget(2, 0) != LIBRETT_INVALID_PARAMETER) {
+    printf("test15 invalid budget accepted\n");
+    return false;
+  }
+
+  librettCheck(librettSetMeasureBudget(3, 4));
+  std::vector<int> dim = {45, 23, 67, 12};
+  std::vector<int> permutation = {1, 3, 0, 2};
+  librettHandle plan;
+  librettCheck(librettPlanMeasure(&plan, dim.size(), dim.data(), permutation.data(), sizeof(long long int),
+    master_gpustream, dataIn, dataOut));
+  librettCheck(librettExecute(plan, dataIn, dataOut));
+  gpuDeviceSynchronize(master_gpustream);
+  librettCheck(librettDestroy(plan));
+  librettCheck(librettSetMeasureBudget(0, 1));
+
+  return tester->checkTranspose(dim.size(), dim.data(), permutation.data(), (long long int *)dataOut);
+}
+
+//
+// Test 16: cycle counts do not depend on the number of host threads
+//
+bool test16(gpuStream_t& master_gpustream)
+{
+  int deviceID = 0;
+  gpuDeviceProp_t prop;
+#if LIBRETT_USES_SYCL
+  Librett::syclGetDeviceProperties(&prop, master_gpustream);
+#elif LIBRETT_USES_HIP
+  hipCheck(hipGetDevice(&deviceID));
+  hipCheck(hipGetDeviceProperties(&prop, deviceID));
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaGetDevice(&deviceID));
+  cudaCheck(cudaGetDeviceProperties(&prop, deviceID));
+#endif
+
+  std::vector<int> dim = {5, 12, 7, 9, 11, 6, 4};
+  std::vector<int> permutation = {6, 2, 4, 0, 5, 1, 3};
+  std::vector<int> redDim;
+  std::vector<int> redPermutation;
+  reduceRanks(dim.size(), dim.data(), permutation.data(), redDim, redPermutation);
+  std::list<librettPlan_t> plans;
+  if (!librettPlan_t::createPlans(dim.size(), dim.data(), permutation.data(), redDim.size(), redDim.data(),
+    redPermutation.data(), sizeof(double), deviceID, prop, plans)) return false;
+  std::list<librettPlan_t> plansSerial(plans);
+
+  setenv("LIBRETT_NUM_THREADS", "1", 1);
+  bool ok = librettPlan_t::countCyclesAll(plansSerial, prop, 10);
+  setenv("LIBRETT_NUM_THREADS", "8", 1);
+  ok = ok && librettPlan_t::countCyclesAll(plans, prop, 10);
+  unsetenv("LIBRETT_NUM_THREADS");
+  if (!ok) return false;
+  for (auto it=plans.begin(), its=plansSerial.begin();it != plans.end();it++,its++) {
+    if (it->cycles != its->cycles) {
+      printf("test16 cycles differ between serial and threaded countCycles\n");
+      return false;
+    }
+  }
+
+  return test_tensor<double>(dim, permutation, master_gpustream);
+}
+
+//
+// Test 17: librettPlan with candidates scored on the device
+//
+bool test17(gpuStream_t& master_gpustream)
+{
+  librettCheck(librettSetDeviceScoring(true));
+  bool run_ok = true;
+  {
+    std::vector<int> dim = {29, 13, 44, 7, 21};
+    std::vector<int> permutation = {4, 1, 3, 0, 2};
+    run_ok = run_ok && test_tensor<double>(dim, permutation, master_gpustream);
+  }
+  {
+    std::vector<int> dim = {512, 3, 1031};
+    std::vector<int> permutation = {2, 1, 0};
+    run_ok = run_ok && test_tensor<float>(dim, permutation, master_gpustream);
+  }
+  librettCheck(librettSetDeviceScoring(false));
+  return run_ok;
+}
+
+//
+// Test 18: 1 and 2 byte element types
+//
+template <typename T>
+bool test18_type(gpuStream_t& master_gpustream)
+{
+  const int rank = 3;
+  std::vector<int> dim = {67, 45, 33};
+  // Tiled, copy of the fastest rank and Packed transposes
+  std::vector< std::vector<int> > permutations = {{1, 0, 2}, {0, 2, 1}, {2, 1, 0}, {2, 0, 1}};
+
+  const int vol = dim[0]*dim[1]*dim[2];
+  T* dIn  = (T *)dataIn;
+  T* dOut = (T *)dataOut;
+  std::vector<T> hIn(vol), hRef(vol), hRes(vol);
+  for (int i=0;i < vol;i++) hIn[i] = (T)(i*7 + 1);
+  copy_HtoD_sync<T>(hIn.data(), dIn, vol, master_gpustream);
+
+  bool run_ok = true;
+  for (auto& permutation : permutations) {
+    int strideOut[rank];
+    strideOut[permutation[0]] = 1;
+    for (int i=1;i < rank;i++) strideOut[permutation[i]] = strideOut[permutation[i-1]]*dim[permutation[i-1]];
+    for (int k=0;k < dim[2];k++)
+      for (int j=0;j < dim[1];j++)
+        for (int i=0;i < dim[0];i++) {
+          hRef[i*strideOut[0] + j*strideOut[1] + k*strideOut[2]] = hIn[i + dim[0]*(j + dim[1]*k)];
+        }
+
+    librettHandle plan;
+    librettCheck(librettPlan(&plan, rank, dim.data(), permutation.data(), sizeof(T), master_gpustream));
+    librettCheck(librettExecute(plan, dIn, dOut));
+    copy_DtoH_sync<T>(dOut, hRes.data(), vol, master_gpustream);
+    // Scaling is not supported for these types
+    float alpha = 1.0f;
+    float beta = 0.0f;
+    if (librettExecuteScaled(plan, dIn, dOut, LIBRETT_FLOAT, &alpha, &beta) != LIBRETT_INVALID_PARAMETER) {
+      printf("test18 librettExecuteScaled accepted sizeofType %d\n", (int)sizeof(T));
+      run_ok = false;
+    }
+    librettCheck(librettDestroy(plan));
+
+    for (int i=0;i < vol;i++) {
+      if (hRes[i] != hRef[i]) {
+        printf("test18 error with sizeofType %d at %d: %d %d\n", (int)sizeof(T), i, (int)hRes[i], (int)hRef[i]);
+        run_ok = false;
+        break;
+      }
+    }
+    if (!run_ok) break;
+  }
+
+  return run_ok;
+}
+
+bool test18(gpuStream_t& master_gpustream)
+{
+  bool run_ok = test18_type<uint16_t>(master_gpustream) && test18_type<uint8_t>(master_gpustream);
+
+  // Restore the check pattern used by the other tests
+  tester->setTensorCheckPattern((unsigned int *)dataIn, dataSize*2);
+
+  return run_ok;
+}
+
+//
+// Test 19: vector accesses of Tiled and TiledCopy, scaled and with unaligned data
+//
+bool test19(gpuStream_t& master_gpustream)
+{
+  // Tiled and TiledCopy with the lead dimension a multiple of the vector width
+  std::vector< std::vector<int> > dims = {{256, 300}, {256, 40, 50}};
+  std::vector< std::vector<int> > permutations = {{1, 0}, {0, 2, 1}};
+
+  bool run_ok = true;
+  for (size_t t=0;t < dims.size() && run_ok;t++) {
+    std::vector<int>& dim = dims[t];
+    std::vector<int>& permutation = permutations[t];
+    const int rank = dim.size();
+    int vol = 1;
+    for (int i=0;i < rank;i++) vol *= dim[i];
+
+    std::vector<float> hIn(vol), hRef(vol), hRes(vol);
+    for (int i=0;i < vol;i++) hIn[i] = (float)(i % 1000 + 1);
+    std::vector<int> strideIn(rank), strideOut(rank);
+    strideIn[0] = 1;
+    for (int i=1;i < rank;i++) strideIn[i] = strideIn[i-1]*dim[i-1];
+    strideOut[permutation[0]] = 1;
+    for (int i=1;i < rank;i++) strideOut[permutation[i]] = strideOut[permutation[i-1]]*dim[permutation[i-1]];
+    for (int i=0;i < vol;i++) {
+      int posOut = 0;
+      for (int r=0;r < rank;r++) posOut += ((i/strideIn[r]) % dim[r])*strideOut[r];
+      hRef[posOut] = hIn[i];
+    }
+
+    librettHandle plan;
+    librettCheck(librettPlan(&plan, rank, dim.data(), permutation.data(), sizeof(float), master_gpustream));
+    // Offset 1 makes the data unaligned for vector accesses
+    for (int offset=0;offset <= 1 && run_ok;offset++) {
+      float* dIn  = (float *)dataIn + offset;
+      float* dOut = (float *)dataOut + offset;
+      copy_HtoD_sync<float>(hIn.data(), dIn, vol, master_gpustream);
+      for (int scaled=0;scaled <= 1 && run_ok;scaled++) {
+        float alpha = 2.0f;
+        float beta = 0.0f;
+        if (scaled) {
+          librettCheck(librettExecuteScaled(plan, dIn, dOut, LIBRETT_FLOAT, &alpha, &beta));
+        } else {
+          librettCheck(librettExecute(plan, dIn, dOut));
+        }
+        copy_DtoH_sync<float>(dOut, hRes.data(), vol, master_gpustream);
+        const float fac = scaled ? alpha : 1.0f;
+        for (int i=0;i < vol;i++) {
+          if (hRes[i] != fac*hRef[i]) {
+            printf("test19 error at %d (offset %d scaled %d): %f %f\n", i, offset, scaled, hRes[i], fac*hRef[i]);
+            run_ok = false;
+            break;
+          }
+        }
+      }
+    }
+    librettCheck(librettDestroy(plan));
+  }
+
+  // Restore the check pattern used by the other tests
+  tester->setTensorCheckPattern((unsigned int *)dataIn, dataSize*2);
+
+  return run_ok;
+}
+
+//
+// Test 20: Tiled and TiledCopy with 0 to 5 Mbar ranks, around the kernels specialized on sizeMbar
+//
+bool test20(gpuStream_t& master_gpustream)
+{
+  bool run_ok = true;
+  for (int rank=2;rank <= 7 && run_ok;rank++) {
+    // Mm and Mk are 33 and 45 wide, the other ranks go to Mbar
+    std::vector<int> dim(rank, 3);
+    dim[0] = 33;
+    dim[1] = 45;
+    // Tiled: swap the two first ranks, reverse the rest
+    std::vector<int> permutation(rank);
+    permutation[0] = 1;
+    permutation[1] = 0;
+    for (int i=2;i < rank;i++) permutation[i] = rank + 1 - i;
+    run_ok = run_ok && test_tensor<float>(dim, permutation, master_gpustream);
+    // TiledCopy: keep the first rank
+    if (rank >= 3) {
+      for (int i=1;i < rank;i++) permutation[i] = rank - i;
+      permutation[0] = 0;
+      run_ok = run_ok && test_tensor<double>(dim, permutation, master_gpustream);
+    }
+  }
+  return run_ok;
+}
+
+//
+// Test 21: fast divisors against integer division, and Mbar ranks with large odd dimensions
+//
+bool test21(gpuStream_t& master_gpustream)
+{
+  std::vector<int> divisors = {1, 2, 3, 5, 7, 31, 32, 33, 641, 1000, 65535, 65536, 65537,
+    1000003, (1 << 30) - 1, 1 << 30, (1 << 30) + 1, 2147483647};
+  std::vector<int> numerators = {0, 1, 2, 3, 31, 32, 33, 65535, 65536, 1000002, 1000003,
+    (1 << 30), 2147483646, 2147483647};
+  for (int i=0;i < 1000;i++) {
+    numerators.push_back((int)(2147483647.0*((double)rand())/((double)RAND_MAX)));
+  }
+  for (int c : divisors) {
+    FastDiv cdiv = makeFastDiv(c);
+    FastDiv ddiv = makeFastDiv(7);
+    for (int n : numerators) {
+      if (fastDivide(n, cdiv) != n/c || fastDivMod(n, cdiv, ddiv, 7) != (n/c) % 7) {
+        printf("test21 fastDivide %d / %d failed\n", n, c);
+        return false;
+      }
+    }
+  }
+
+  std::vector<int> dim = {5, 7, 1031, 3, 97};
+  std::vector<int> permutation = {4, 2, 0, 3, 1};
+  if (!test_tensor<float>(dim, permutation, master_gpustream)) return false;
+  permutation = {0, 3, 1, 4, 2};
+  if (!test_tensor<double>(dim, permutation, master_gpustream)) return false;
+
+  return true;
+}
+
+//
+// Test 22: multi-GPU plan with all shards on the current device
+//
+bool test22(gpuStream_t& master_gpustream)
+{
+  int deviceID = 0;
+#if LIBRETT_USES_HIP
+  hipCheck(hipGetDevice(&deviceID));
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaGetDevice(&deviceID));
+#endif
+  const int numDevice = 3;
+  std::vector<int> devices(numDevice, deviceID);
+  std::vector<gpuStream_t> streams(numDevice, master_gpustream);
+
+  // Exchange with chunks, exchange without step 1, local transposes only
+  std::vector< std::vector<int> > dims = {{6, 5, 7, 9}, {6, 5, 7, 9}, {6, 5, 7, 9}, {10, 4, 11}};
+  std::vector< std::vector<int> > permutations = {{3, 1, 0, 2}, {1, 0, 3, 2}, {1, 0, 2, 3}, {2, 0, 1}};
+
+  int* dIn  = (int *)dataIn;
+  int* dOut = (int *)dataOut;
+  bool run_ok = true;
+  for (size_t t=0;t < dims.size() && run_ok;t++) {
+    std::vector<int>& dim = dims[t];
+    std::vector<int>& permutation = permutations[t];
+    const int rank = dim.size();
+    int vol = 1;
+    for (int i=0;i < rank;i++) vol *= dim[i];
+
+    // Slowest input and output ranks are sharded,
+    // so the shards are consecutive parts of the whole tensors
+    const int shardIn = rank - 1;
+    const int shardOut = permutation[rank - 1];
+    std::vector<void*> idata(numDevice), odata(numDevice);
+    for (int i=0;i < numDevice;i++) {
+      const int d = dim[shardIn];
+      idata[i] = dIn + (i*(d/numDevice) + std::min(i, d % numDevice))*(vol/d);
+      const int e = dim[shardOut];
+      odata[i] = dOut + (i*(e/numDevice) + std::min(i, e % numDevice))*(vol/e);
+    }
+
+    std::vector<int> hIn(vol), hRef(vol), hRes(vol);
+    for (int i=0;i < vol;i++) hIn[i] = i + 1;
+    std::vector<int> strideOut(rank);
+    strideOut[permutation[0]] = 1;
+    for (int i=1;i < rank;i++) strideOut[permutation[i]] = strideOut[permutation[i-1]]*dim[permutation[i-1]];
+    for (int i=0;i < vol;i++) {
+      int pos = 0;
+      for (int j=0, r=i;j < rank;r /= dim[j], j++) pos += (r % dim[j])*strideOut[j];
+      hRef[pos] = hIn[i];
+    }
+    copy_HtoD_sync<int>(hIn.data(), dIn, vol, master_gpustream);
+
+    librettHandle plan;
+    librettCheck(librettPlanMultiGpu(&plan, rank, dim.data(), permutation.data(), sizeof(int),
+      shardIn, shardOut, numDevice, devices.data(), streams.data()));
+    librettCheck(librettExecuteMultiGpu(plan, idata.data(), odata.data()));
+    copy_DtoH_sync<int>(dOut, hRes.data(), vol, master_gpustream);
+    librettCheck(librettDestroy(plan));
+
+    for (int i=0;i < vol;i++) {
+      if (hRes[i] != hRef[i]) {
+        printf("test22 error at %d: %d %d\n", i, hRes[i], hRef[i]);
+        run_ok = false;
+        break;
+      }
+    }
+  }
+
+  // Restore the check pattern used by the other tests
+  tester->setTensorCheckPattern((unsigned int *)dataIn, dataSize*2);
+
+  return run_ok;
+}
+
+//
+// Test 23: plans destroyed right after their launches, without synchronizing the stream
+//
+bool test23(gpuStream_t& master_gpustream)
+{
+  std::vector< std::vector<int> > dims = {{24, 32, 16, 36}, {300, 7, 2, 11}, {5, 7, 9, 11, 13}, {2, 2, 2, 2, 2, 2, 2, 2}};
+  std::vector< std::vector<int> > permutations = {{3, 1, 0, 2}, {1, 3, 0, 2}, {4, 0, 3, 1, 2}, {7, 6, 5, 4, 3, 2, 1, 0}};
+
+  // Buffers of destroyed plans are reused by the next plans while the launches may still run
+  for (int repeat=0;repeat < 4;repeat++) {
+    for (size_t t=0;t < dims.size();t++) {
+      librettHandle plan;
+      librettCheck(librettPlan(&plan, dims[t].size(), dims[t].data(), permutations[t].data(), sizeof(int), master_gpustream));
+      librettCheck(librettExecute(plan, dataIn, dataOut));
+      librettCheck(librettDestroy(plan));
+    }
+  }
+
+  const size_t t = dims.size() - 1;
+  return tester->checkTranspose(dims[t].size(), dims[t].data(), permutations[t].data(), (int *)dataOut);
+}
+
+//
+// Test 24: in-place transposes
+//
+bool test24(gpuStream_t& master_gpustream)
+{
+  // 2D, slabs only, slabs and shuffle, recursion with the smallest scratch buffer
+  std::vector< std::vector<int> > dims = {{1000, 37}, {24, 32, 16, 36}, {24, 32, 16, 36}, {5, 7, 9, 11, 13}, {64, 3, 50, 2}};
+  std::vector< std::vector<int> > permutations = {{1, 0}, {1, 0, 2, 3}, {3, 1, 0, 2}, {4, 0, 3, 1, 2}, {2, 3, 0, 1}};
+  std::vector<size_t> scratchSizes = {0, 0, 0, 1, 4096};
+
+  for (size_t t=0;t < dims.size();t++) {
+    std::vector<int>& dim = dims[t];
+    std::vector<int>& permutation = permutations[t];
+    unsigned int vol = 1;
+    for (int d : dim) vol *= d;
+    tester->setTensorCheckPattern((unsigned int *)dataOut, vol);
+
+    librettHandle plan;
+    librettCheck(librettPlanInPlace(&plan, dim.size(), dim.data(), permutation.data(), sizeof(int),
+      master_gpustream, scratchSizes[t]));
+    librettCheck(librettExecuteInPlace(plan, dataOut));
+    librettCheck(librettDestroy(plan));
+    if (!tester->checkTranspose(dim.size(), dim.data(), permutation.data(), (int *)dataOut)) return false;
+  }
+
+  return true;
+}
+
+//
+// Test 25: streaming transposes of host tensors
+//
+bool test25(gpuStream_t& master_gpustream)
+{
+  const int numStream = 3;
+  std::vector<gpuStream_t> streams(numStream, master_gpustream);
+
+  // Chunks along the slowest output rank with a partial last chunk, along the slowest input rank,
+  // one slice per chunk
+  std::vector< std::vector<int> > dims = {{6, 5, 7, 9}, {6, 5, 7, 9}, {10, 4, 11}};
+  std::vector< std::vector<int> > permutations = {{3, 1, 0, 2}, {1, 0, 3, 2}, {2, 0, 1}};
+
+  for (size_t t=0;t < dims.size();t++) {
+    std::vector<int>& dim = dims[t];
+    std::vector<int>& permutation = permutations[t];
+    const int rank = dim.size();
+    int vol = 1;
+    for (int i=0;i < rank;i++) vol *= dim[i];
+
+    std::vector<int> hIn(vol), hRef(vol), hRes(vol, 0);
+    for (int i=0;i < vol;i++) hIn[i] = i + 1;
+    std::vector<int> strideOut(rank);
+    strideOut[permutation[0]] = 1;
+    for (int i=1;i < rank;i++) strideOut[permutation[i]] = strideOut[permutation[i-1]]*dim[permutation[i-1]];
+    for (int i=0;i < vol;i++) {
+      int pos = 0;
+      for (int j=0, r=i;j < rank;r /= dim[j], j++) pos += (r % dim[j])*strideOut[j];
+      hRef[pos] = hIn[i];
+    }
+
+    // Device memory for two tensors, so that the tensor is split into several chunks
+    librettHandle plan;
+    librettCheck(librettPlanStreaming(&plan, rank, dim.data(), permutation.data(), sizeof(int),
+      numStream, streams.data(), 2*vol*sizeof(int)));
+    librettCheck(librettExecuteStreaming(plan, hIn.data(), hRes.data()));
+#if LIBRETT_USES_SYCL
+    master_gpustream->wait();
+#elif LIBRETT_USES_HIP
+    hipCheck(hipStreamSynchronize(master_gpustream));
+#elif LIBRETT_USES_CUDA
+    cudaCheck(cudaStreamSynchronize(master_gpustream));
+#endif
+    librettCheck(librettDestroy(plan));
+
+    for (int i=0;i < vol;i++) {
+      if (hRes[i] != hRef[i]) {
+        printf("test25 error at %d: %d %d\n", i, hRes[i], hRef[i]);
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+//
+// Test 26: strided (sliced and padded) tensors
+//
+bool test26(gpuStream_t& master_gpustream)
+{
+  // Sliced input, padded output, strided copy, padding that rules out vector loads.
+  // Empty stride vector = packed tensor
+  std::vector< std::vector<int> > dims = {{21, 17, 9}, {64, 30, 7, 5}, {100, 40}, {256, 48, 3}};
+  std::vector< std::vector<int> > permutations = {{2, 0, 1}, {1, 0, 3, 2}, {0, 1}, {1, 0, 2}};
+  std::vector< std::vector<size_t> > inStrides = {{1, 32, 32*20}, {}, {1, 128}, {1, 258, 258*48}};
+  std::vector< std::vector<size_t> > outStrides = {{}, {1, 32, 32*65, 32*65*6}, {1, 104}, {1, 50, 50*256}};
+
+  int* dIn  = (int *)dataIn;
+  int* dOut = (int *)dataOut;
+  bool run_ok = true;
+  for (size_t t=0;t < dims.size() && run_ok;t++) {
+    std::vector<int>& dim = dims[t];
+    std::vector<int>& permutation = permutations[t];
+    const int rank = dim.size();
+    int vol = 1;
+    for (int i=0;i < rank;i++) vol *= dim[i];
+
+    // Strides of input rank i in the input and in the output
+    std::vector<size_t> strideIn(rank), strideOut(rank);
+    size_t volIn = 1, volOut = 1;
+    for (int i=0;i < rank;i++) {
+      strideIn[i] = inStrides[t].empty() ? volIn : inStrides[t][i];
+      strideOut[permutation[i]] = outStrides[t].empty() ? volOut : outStrides[t][i];
+      volIn *= dim[i];
+      volOut *= dim[permutation[i]];
+    }
+    size_t extIn = 1, extOut = 1;
+    for (int i=0;i < rank;i++) {
+      extIn += (dim[i] - 1)*strideIn[i];
+      extOut += (dim[i] - 1)*strideOut[i];
+    }
+
+    std::vector<int> hIn(extIn), hRef(extOut, 0), hRes(extOut);
+    for (size_t i=0;i < extIn;i++) hIn[i] = i + 1;
+    for (int i=0;i < vol;i++) {
+      size_t posIn = 0, posOut = 0;
+      for (int j=0, r=i;j < rank;r /= dim[j], j++) {
+        posIn += (r % dim[j])*strideIn[j];
+        posOut += (r % dim[j])*strideOut[j];
+      }
+      hRef[posOut] = hIn[posIn];
+    }
+    copy_HtoD_sync<int>(hIn.data(), dIn, extIn, master_gpustream);
+    copy_HtoD_sync<int>(std::vector<int>(extOut, 0).data(), dOut, extOut, master_gpustream);
+
+    librettHandle plan;
+    librettCheck(librettPlanStrided(&plan, rank, dim.data(), permutation.data(), sizeof(int),
+      inStrides[t].empty() ? nullptr : inStrides[t].data(),
+      outStrides[t].empty() ? nullptr : outStrides[t].data(), master_gpustream));
+    librettCheck(librettExecute(plan, dIn, dOut));
+    copy_DtoH_sync<int>(dOut, hRes.data(), extOut, master_gpustream);
+    librettCheck(librettDestroy(plan));
+
+    // Padding of the output is left untouched
+    for (size_t i=0;i < extOut;i++) {
+      if (hRes[i] != hRef[i]) {
+        printf("test26 error at %zu: %d %d\n", i, hRes[i], hRef[i]);
+        run_ok = false;
+        break;
+      }
+    }
+  }
+
+  // Restore the check pattern used by the other tests
+  tester->setTensorCheckPattern((unsigned int *)dataIn, dataSize*2);
+
+  return run_ok;
+}
+
+//
+// Test 27: type conversion during the transpose
+//
+template <typename TIn, typename TOut>
+bool test27_type(gpuStream_t& master_gpustream)
+{
+  const int rank = 3;
+  // Odd leading dimension (scalar accesses) and a multiple of the vector widths
+  std::vector< std::vector<int> > dims = {{67, 45, 33}, {128, 40, 33}};
+  // Trivial, Tiled, copy of the fastest rank and Packed transposes
+  std::vector< std::vector<int> > permutations = {{0, 1, 2}, {1, 0, 2}, {0, 2, 1}, {2, 1, 0}, {2, 0, 1}};
+
+  TIn* dIn  = (TIn *)dataIn;
+  TOut* dOut = (TOut *)dataOut;
+  bool run_ok = true;
+  for (auto& dim : dims) {
+    const int vol = dim[0]*dim[1]*dim[2];
+    std::vector<TIn> hIn(vol);
+    std::vector<TOut> hRef(vol), hRes(vol);
+    // Values are exact in both types
+    for (int i=0;i < vol;i++) hIn[i] = (TIn)(i*7 + 1) + (TIn)0.5;
+    copy_HtoD_sync<TIn>(hIn.data(), dIn, vol, master_gpustream);
+
+    for (auto& permutation : permutations) {
+      int strideOut[rank];
+      strideOut[permutation[0]] = 1;
+      for (int i=1;i < rank;i++) strideOut[permutation[i]] = strideOut[permutation[i-1]]*dim[permutation[i-1]];
+      for (int k=0;k < dim[2];k++)
+        for (int j=0;j < dim[1];j++)
+          for (int i=0;i < dim[0];i++) {
+            hRef[i*strideOut[0] + j*strideOut[1] + k*strideOut[2]] = (TOut)hIn[i + dim[0]*(j + dim[1]*k)];
+          }
+
+      librettHandle plan;
+      librettCheck(librettPlanConvert(&plan, rank, dim.data(), permutation.data(), sizeof(TIn), sizeof(TOut),
+        master_gpustream));
+      librettCheck(librettExecute(plan, dIn, dOut));
+      copy_DtoH_sync<TOut>(dOut, hRes.data(), vol, master_gpustream);
+      // Converting plans only copy
+      TIn alpha = 2;
+      TIn beta = 0;
+      const librettScalarType type = (sizeof(TIn) == 8) ? LIBRETT_DOUBLE : LIBRETT_FLOAT;
+      if (librettExecuteScaled(plan, dIn, dOut, type, &alpha, &beta) != LIBRETT_INVALID_PARAMETER) {
+        printf("test27 librettExecuteScaled accepted a converting plan\n");
+        run_ok = false;
+      }
+      librettCheck(librettDestroy(plan));
+
+      for (int i=0;i < vol;i++) {
+        if (hRes[i] != hRef[i]) {
+          printf("test27 error with sizeofType %d -> %d at %d: %f %f\n", (int)sizeof(TIn), (int)sizeof(TOut), i,
+            (double)hRes[i], (double)hRef[i]);
+          run_ok = false;
+          break;
+        }
+      }
+      if (!run_ok) break;
+    }
+    if (!run_ok) break;
+  }
+
+  return run_ok;
+}
+
+bool test27(gpuStream_t& master_gpustream)
+{
+  bool run_ok = test27_type<float, double>(master_gpustream) && test27_type<double, float>(master_gpustream);
+
+  // Unsupported conversion
+  int dim[2] = {10, 20};
+  int permutation[2] = {1, 0};
+  librettHandle plan;
+  if (librettPlanConvert(&plan, 2, dim, permutation, 4, 1, master_gpustream) != LIBRETT_INVALID_PARAMETER) {
+    printf("test27 librettPlanConvert accepted 4 -> 1 byte conversion\n");
+    run_ok = false;
+  }
+
+  // Restore the check pattern used by the other tests
+  tester->setTensorCheckPattern((unsigned int *)dataIn, dataSize*2);
+
+  return run_ok;
+}
+
+//
+// Test 28: plan information and execution timing
+//
+bool test28(gpuStream_t& master_gpustream)
+{
+  std::vector<int> dim = {200, 300, 50};
+  std::vector<int> permutation = {2, 0, 1};
+  const size_t vol = (size_t)dim[0]*dim[1]*dim[2];
+
+  bool run_ok = true;
+  librettHandle plan;
+  librettCheck(librettPlan(&plan, 3, dim.data(), permutation.data(), sizeof(double), master_gpustream));
+  librettCheck(librettSetTiming(true));
+  const int numExecute = 3;
+  for (int i=0;i < numExecute;i++) librettCheck(librettExecute(plan, dataIn, dataOut));
+  // librettPlanGetInfo only reports executions that have finished
+#if LIBRETT_USES_SYCL
+  master_gpustream->wait_and_throw();
+#elif LIBRETT_USES_HIP
+  hipCheck(hipStreamSynchronize(master_gpustream));
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaStreamSynchronize(master_gpustream));
+#endif
+
+  librettPlanInfo info;
+  librettCheck(librettPlanGetInfo(plan, &info));
+  librettCheck(librettSetTiming(false));
+  printf("test28 method %s numTimed %d minTime %f ms bandwidth %f GB/s\n", info.method, info.numTimed,
+    info.minTime, info.bandwidth);
+  if (info.bytes != vol*2*sizeof(double)) {
+    printf("test28 bytes %zu, expected %zu\n", info.bytes, vol*2*sizeof(double));
+    run_ok = false;
+  }
+  if (info.numthread[0] < 1 || info.numblock[0] < 1) {
+    printf("test28 invalid launch configuration\n");
+    run_ok = false;
+  }
+  // The first execution is always timed (SYCL: only on profiling queues)
+#if !LIBRETT_USES_SYCL
+  if (info.numTimed < 1 || info.numTimed > numExecute || info.minTime <= 0.0 || info.bandwidth <= 0.0) {
+    printf("test28 invalid timing\n");
+    run_ok = false;
+  }
+#endif
+  librettCheck(librettDestroy(plan));
+
+  if (librettPlanGetInfo(plan, &info) != LIBRETT_INVALID_PLAN) {
+    printf("test28 librettPlanGetInfo accepted destroyed plan\n");
+    run_ok = false;
+  }
+
+  return run_ok;
+}
+
+//
+// Test 29: workload trace
+//
+bool test29(gpuStream_t& master_gpustream)
+{
+  const char* filename = "librett_test_trace.txt";
+  std::remove(filename);
+
+  std::vector<int> dim = {24, 32, 16, 36};
+  std::vector<int> permutation = {3, 1, 0, 2};
+
+  librettTraceEnable(true);
+  librettHandle plan;
+  const int numExecute = 3;
+  for (int i=0;i < 2;i++) {
+    librettCheck(librettPlan(&plan, 4, dim.data(), permutation.data(), sizeof(double), master_gpustream));
+    for (int j=0;j < numExecute;j++) librettCheck(librettExecute(plan, dataIn, dataOut));
+    librettCheck(librettDestroy(plan));
+  }
+  librettTraceEnable(false);
+  // Untraced calls are not counted
+  librettCheck(librettPlan(&plan, 4, dim.data(), permutation.data(), sizeof(double), master_gpustream));
+  librettCheck(librettExecute(plan, dataIn, dataOut));
+  librettCheck(librettDestroy(plan));
+  if (!librettTraceSave(filename)) return false;
+
+  bool run_ok = false;
+  FILE* fp = fopen(filename, "r");
+  if (fp == NULL) return false;
+  char line[1024];
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    printf("test29 %s", line);
+    long long int numPlan = 0;
+    long long int numExecutes = 0;
+    const char* counts = strstr(line, " plans ");
+    if (strncmp(line, "24 32 16 36 : 3 1 0 2 : 8 # ", 28) == 0 && counts != NULL &&
+      sscanf(counts, " plans %lld executes %lld", &numPlan, &numExecutes) == 2) {
+      run_ok = (numPlan == 2 && numExecutes == 2*numExecute);
+    }
+  }
+  fclose(fp);
+
+  std::remove(filename);
+  return run_ok;
+}
+
+//
+// Test 30: plan creation of a high rank tensor has no duplicate candidates
+//
+bool test30(gpuStream_t& master_gpustream)
+{
+  int deviceID = 0;
+  gpuDeviceProp_t prop;
+#if LIBRETT_USES_SYCL
+  Librett::syclGetDeviceProperties(&prop, master_gpustream);
+#elif LIBRETT_USES_HIP
+  hipCheck(hipGetDevice(&deviceID));
+  hipCheck(hipGetDeviceProperties(&prop, deviceID));
+#elif LIBRETT_USES_CUDA
+  cudaCheck(cudaGetDevice(&deviceID));
+  cudaCheck(cudaGetDeviceProperties(&prop, deviceID));
+#endif
+
+  // Ranks 4 and 5 are combined by the rank reduction
+  std::vector<int> dim = {4, 3, 5, 2, 6, 3, 4, 2, 3, 5};
+  std::vector<int> permutation = {9, 2, 7, 4, 5, 0, 8, 1, 3, 6};
+  std::vector<int> redDim;
+  std::vector<int> redPermutation;
+  reduceRanks(dim.size(), dim.data(), permutation.data(), redDim, redPermutation);
+  std::list<librettPlan_t> plans;
+  if (!librettPlan_t::createPlans(dim.size(), dim.data(), permutation.data(), redDim.size(), redDim.data(),
+    redPermutation.data(), sizeof(double), deviceID, prop, plans)) return false;
+  printf("test30 rank %zu reduced rank %zu plans %zu\n", dim.size(), redDim.size(), plans.size());
+  if (plans.empty()) return false;
+  for (auto it=plans.begin();it != plans.end();it++) {
+    for (auto jt=std::next(it);jt != plans.end();jt++) {
+      if (it->tensorSplit == jt->tensorSplit) {
+        printf("test30 duplicate plan\n");
+        return false;
+      }
+    }
+  }
+
+  return test_tensor<double>(dim, permutation, master_gpustream);
+}
+
+//
+// Test 31: plans of the same tensor share the plan cache template
+//
+bool test31(gpuStream_t& master_gpustream)
+{
+  std::vector<int> dim = {31, 17, 24, 9};
+  std::vector<int> permutation = {2, 0, 3, 1};
+  int rank = dim.size();
+  int vol = 1;
+  for (int r=0;r < rank;r++) vol *= dim[r];
+
+  librettHandle plan1, plan2, planFloat;
+  librettCheck(librettPlan(&plan1, rank, dim.data(), permutation.data(), sizeof(double), master_gpustream));
+  librettCheck(librettPlan(&plan2, rank, dim.data(), permutation.data(), sizeof(double), master_gpustream));
+  // Different type must not use the template of the double plans
+  librettCheck(librettPlan(&planFloat, rank, dim.data(), permutation.data(), sizeof(float), master_gpustream));
+
+  // Second plan keeps working after the first one is destroyed
+  librettCheck(librettDestroy(plan1));
+  set_device_array<double>((double *)dataOut, -1, vol, master_gpustream);
+  librettCheck(librettExecute(plan2, dataIn, dataOut));
+#if LIBRETT_USES_SYCL
+  master_gpustream->wait_and_throw();
+#endif
+  librettCheck(librettDestroy(plan2));
+  if (!tester->checkTranspose<double>(rank, dim.data(), permutation.data(), (double *)dataOut)) {
+    printf("test31 shared plan failed\n");
+    librettCheck(librettDestroy(planFloat));
+    return false;
+  }
+
+  set_device_array<float>((float *)dataOut, -1, vol, master_gpustream);
+  librettCheck(librettExecute(planFloat, dataIn, dataOut));
+#if LIBRETT_USES_SYCL
+  master_gpustream->wait_and_throw();
+#endif
+  librettCheck(librettDestroy(planFloat));
+  if (!tester->checkTranspose<float>(rank, dim.data(), permutation.data(), (float *)dataOut)) {
+    printf("test31 float plan failed\n");
+    return false;
+  }
+
+  return true;
+}
+
 template <typename T>
 bool test_tensor(std::vector<int> &dim, std::vector<int> &permutation, gpuStream_t& gpustream)
 {
@@ -554,8 +1890,10 @@ bool test_tensor(std::vector<int> &dim, std::vector<int> &permutation, gpuStream
 
   if (vol > 1000000) timer->start(dim, permutation);
   librettCheck(librettExecute(plan, dataIn, dataOut));
+#if LIBRETT_USES_SYCL
+  gpustream->wait_and_throw();
+#endif
   if (vol > 1000000) timer->stop();
-  //q.wait();
 
   librettCheck(librettDestroy(plan));
 